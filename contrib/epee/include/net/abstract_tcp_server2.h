@@ -61,6 +61,8 @@
 #define WAZN_DEFAULT_LOG_CATEGORY "net"
 
 #define ABSTRACT_SERVER_SEND_QUE_MAX_COUNT 1000
+#define ABSTRACT_SERVER_SEND_GATHER_MAX_COUNT 64
+#define ABSTRACT_SERVER_SEND_GATHER_MAX_BYTES (1024 * 1024)
 
 namespace epee
 {
@@ -157,6 +159,9 @@ namespace net_utils
     /// Handle completion of a write operation.
     void handle_write(const boost::system::error_code& e, size_t cb);
 
+    /// Start one gathered write over the head of the send queue; m_send_que_lock must be held.
+    void start_write();
+
     /// reset connection timeout timer and callback
     void reset_timer(boost::posix_time::milliseconds ms, bool add);
     boost::posix_time::milliseconds get_default_timeout();
@@ -233,6 +238,11 @@ namespace net_utils
 	const std::string port_ipv6 = "", const std::string address_ipv6 = "::", bool use_ipv6 = false, bool require_ipv4 = true,
 	ssl_options_t ssl_options = ssl_support_t::e_ssl_support_autodetect);
 
+    /// Pin every connection to one of `count` io_services, each run by its own thread.
+    /// The shared io_service keeps the acceptors, idle handlers and async_call work.
+    /// Zero (the default) runs connections on the shared io_service. Call before init_server.
+    void set_io_shards(size_t count);
+
     /// Run the server's io_service loop.
     bool run_server(size_t threads_count, bool wait = true, const boost::thread::attributes& attrs = boost::thread::attributes());
 
@@ -248,7 +258,7 @@ namespace net_utils
 
     void set_threads_prefix(const std::string& prefix_name);
 
-    bool deinit_server(){return true;}
+    bool deinit_server(){stop_io_shards(); return true;}
 
     size_t get_threads_count(){return m_threads_count;}
 
@@ -347,7 +357,12 @@ namespace net_utils
 
   private:
     /// Run the server's io_service loop.
-    bool worker_thread();
+    bool worker_thread(boost::asio::io_service& io_service);
+    /// io_service for the next new connection (round robin over the shards)
+    boost::asio::io_service& next_connection_io_service();
+    bool is_multithreaded() const { return 1 < m_threads_count || !m_shards.empty(); }
+    /// stop the shard io_services and join their threads, so the shards can be run or changed again
+    void stop_io_shards();
     /// Handle completion of an asynchronous accept operation.
     void handle_accept_ipv4(const boost::system::error_code& e);
     void handle_accept_ipv6(const boost::system::error_code& e);
@@ -369,6 +384,9 @@ namespace net_utils
     };
     std::unique_ptr<worker> m_io_service_local_instance;
     boost::asio::io_service& io_service_;    
+    std::vector<std::unique_ptr<worker>> m_shards;
+    std::vector<boost::shared_ptr<boost::thread> > m_shard_threads;
+    std::atomic<size_t> m_next_shard;
 
     /// Acceptor used to listen for incoming connections.
     boost::asio::ip::tcp::acceptor acceptor_;
@@ -347,32 +347,21 @@ PRAGMA_WARNING_DISABLE_VS(4355)
         context.m_current_speed_down = current_speed_down;
         context.m_max_speed_down = std::max(context.m_max_speed_down, current_speed_down);
 
-    {
-			CRITICAL_REGION_LOCAL(	epee::net_utils::network_throttle_manager::network_throttle_manager::m_lock_get_global_throttle_in );
-			epee::net_utils::network_throttle_manager::network_throttle_manager::get_global_throttle_in().handle_trafic_exact(bytes_transferred);
-		}
+		// lock-free, like the token bucket below
+		epee::net_utils::network_throttle_manager::network_throttle_manager::get_global_throttle_in().handle_trafic_exact(bytes_transferred);
 
-		double delay=0; // will be calculated - how much we should sleep to obey speed limit etc
+		if (speed_limit_is_enabled()) {
+			// lock-free token bucket, gives the whole delay at once
+			const double delay = epee::net_utils::network_throttle_manager::get_global_throttle_in().consume( bytes_transferred );
 
+			if (m_was_shutdown)
+				return;
 
-		if (speed_limit_is_enabled()) {
-			do // keep sleeping if we should sleep
-			{
-				{ //_scope_dbg1("CRITICAL_REGION_LOCAL");
-					CRITICAL_REGION_LOCAL(	epee::net_utils::network_throttle_manager::m_lock_get_global_throttle_in );
-					delay = epee::net_utils::network_throttle_manager::get_global_throttle_in().get_sleep_time_after_tick( bytes_transferred );
-				}
-
-				if (m_was_shutdown)
-					return;
-
-				delay *= 0.5;
-				long int ms = (long int)(delay * 100);
-				if (ms > 0) {
-					reset_timer(boost::posix_time::milliseconds(ms + 1), true);
-					boost::this_thread::sleep_for(boost::chrono::milliseconds(ms));
-				}
-			} while(delay > 0);
+			long int ms = (long int)(delay * 1000);
+			if (ms > 0) {
+				reset_timer(boost::posix_time::milliseconds(ms + 1), true);
+				boost::this_thread::sleep_for(boost::chrono::milliseconds(ms));
+			}
 		} // any form of sleeping
 
       //_info("[sock " << socket().native_handle() << "] RECV " << bytes_transferred);
@@ -673,39 +662,23 @@ PRAGMA_WARNING_DISABLE_VS(4355)
     }
 
     m_send_que.push_back(std::move(chunk));
+    record_send_que_depth(m_send_que.size());
 
-    if(m_send_que.size() > 1)
+    if(m_send_que_inflight)
     { // active operation should be in progress, nothing to do, just wait last operation callback
+        // the chunk will go out with the next gathered write from handle_write
         auto size_now = m_send_que.back().size();
         MDEBUG("do_send_chunk() NOW just queues: packet="<<size_now<<" B, is added to queue-size="<<m_send_que.size());
-        //do_send_handler_delayed( ptr , size_now ); // (((H))) // empty function
 
       LOG_TRACE_CC(context, "[sock " << socket().native_handle() << "] Async send requested " << m_send_que.front().size());
     }
     else
     { // no active operation
-
-        if(m_send_que.size()!=1)
-        {
-            _erro("Looks like no active operations, but send que size != 1!!");
-            return false;
-        }
-
-        auto size_now = m_send_que.front().size();
-        MDEBUG("do_send_chunk() NOW SENSD: packet="<<size_now<<" B");
         if (speed_limit_is_enabled())
 			do_send_handler_write( m_send_que.back().data(), m_send_que.back().size() ); // (((H)))
 
-        CHECK_AND_ASSERT_MES( size_now == m_send_que.front().size(), false, "Unexpected queue size");
         reset_timer(get_default_timeout(), false);
-            async_write(boost::asio::buffer(m_send_que.front().data(), size_now ) ,
-                                 strand_.wrap(
-                                 std::bind(&connection<t_protocol_handler>::handle_write, self, std::placeholders::_1, std::placeholders::_2)
-                                 )
-                                 );
-        //_dbg3("(chunk): " << size_now);
-        //logger_handle_net_write(size_now);
-        //_info("[sock " << socket().native_handle() << "] Async send requested " << m_send_que.front().size());
+        start_write();
     }
 
     //do_send_handler_stop( ptr , cb ); // empty function
@@ -887,7 +860,11 @@ PRAGMA_WARNING_DISABLE_VS(4355)
       return;
     }
 
-    m_send_que.pop_front();
+    // async_write completes only once every buffer of the gathered write went out
+    CHECK_AND_ASSERT_MES(m_send_que_inflight <= m_send_que.size(), void(), "Unexpected queue size");
+    record_write(cb);
+    m_send_que.erase(m_send_que.begin(), m_send_que.begin() + m_send_que_inflight);
+    m_send_que_inflight = 0;
     if(m_send_que.empty())
     {
       if(boost::interprocess::ipcdetail::atomic_read32(&m_want_close_connection))
@@ -898,17 +875,9 @@ PRAGMA_WARNING_DISABLE_VS(4355)
     {
       //have more data to send
 		reset_timer(get_default_timeout(), false);
-		auto size_now = m_send_que.front().size();
-		MDEBUG("handle_write() NOW SENDS: packet="<<size_now<<" B" <<", from  queue size="<<m_send_que.size());
 		if (speed_limit_is_enabled())
 			do_send_handler_write_from_queue(e, m_send_que.front().size() , m_send_que.size()); // (((H)))
-		CHECK_AND_ASSERT_MES( size_now == m_send_que.front().size(), void(), "Unexpected queue size");
-		  async_write(boost::asio::buffer(m_send_que.front().data(), size_now) ,
-           strand_.wrap(
-            std::bind(&connection<t_protocol_handler>::handle_write, connection<t_protocol_handler>::shared_from_this(), std::placeholders::_1, std::placeholders::_2)
-			  )
-          );
-      //_dbg3("(normal)" << size_now);
+		start_write();
     }
     CRITICAL_REGION_END();
 
@@ -918,6 +887,32 @@ PRAGMA_WARNING_DISABLE_VS(4355)
     }
     CATCH_ENTRY_L0("connection<t_protocol_handler>::handle_write", void());
   }
+  //---------------------------------------------------------------------------------
+  template<class t_protocol_handler>
+  void connection<t_protocol_handler>::start_write()
+  {
+    // Coalesce the queued slices into a single scatter/gather write, so a burst
+    // of small messages costs one writev instead of one syscall and one strand
+    // round trip each. The slices stay owned by m_send_que until handle_write.
+    m_send_buffers.clear();
+    size_t bytes = 0;
+    for (const byte_slice& slice : m_send_que)
+    {
+      if (m_send_buffers.size() >= ABSTRACT_SERVER_SEND_GATHER_MAX_COUNT)
+        break;
+      if (!m_send_buffers.empty() && bytes + slice.size() > ABSTRACT_SERVER_SEND_GATHER_MAX_BYTES)
+        break;
+      m_send_buffers.emplace_back(slice.data(), slice.size());
+      bytes += slice.size();
+    }
+    m_send_que_inflight = m_send_buffers.size();
+    MDEBUG("start_write() NOW SENDS: " << m_send_que_inflight << " packets, " << bytes << " B, from queue size=" << m_send_que.size());
+    async_write(m_send_buffers,
+      strand_.wrap(
+        std::bind(&connection<t_protocol_handler>::handle_write, connection<t_protocol_handler>::shared_from_this(), std::placeholders::_1, std::placeholders::_2)
+      )
+    );
+  }
 
   //---------------------------------------------------------------------------------
   template<class t_protocol_handler>
@@ -942,6 +937,7 @@ PRAGMA_WARNING_DISABLE_VS(4355)
     m_state(std::make_shared<typename connection<t_protocol_handler>::shared_state>()),
     m_io_service_local_instance(new worker()),
     io_service_(m_io_service_local_instance->io_service),
+    m_next_shard(0),
     acceptor_(io_service_),
     acceptor_ipv6(io_service_),
     default_remote(),
@@ -960,6 +956,7 @@ PRAGMA_WARNING_DISABLE_VS(4355)
   boosted_tcp_server<t_protocol_handler>::boosted_tcp_server(boost::asio::io_service& extarnal_io_service, t_connection_type connection_type) :
     m_state(std::make_shared<typename connection<t_protocol_handler>::shared_state>()),
     io_service_(extarnal_io_service),
+    m_next_shard(0),
     acceptor_(io_service_),
     acceptor_ipv6(io_service_),
     default_remote(),
@@ -1022,7 +1019,7 @@ PRAGMA_WARNING_DISABLE_VS(4355)
       boost::asio::ip::tcp::endpoint binded_endpoint = acceptor_.local_endpoint();
       m_port = binded_endpoint.port();
       MDEBUG("start accept (IPv4)");
-      new_connection_.reset(new connection<t_protocol_handler>(io_service_, m_state, m_connection_type, m_state->ssl_options().support));
+      new_connection_.reset(new connection<t_protocol_handler>(next_connection_io_service(), m_state, m_connection_type, m_state->ssl_options().support));
       acceptor_.async_accept(new_connection_->socket(),
 	boost::bind(&boosted_tcp_server<t_protocol_handler>::handle_accept_ipv4, this,
 	boost::asio::placeholders::error));
@@ -1059,7 +1056,7 @@ PRAGMA_WARNING_DISABLE_VS(4355)
         boost::asio::ip::tcp::endpoint binded_endpoint = acceptor_ipv6.local_endpoint();
         m_port_ipv6 = binded_endpoint.port();
         MDEBUG("start accept (IPv6)");
-        new_connection_ipv6.reset(new connection<t_protocol_handler>(io_service_, m_state, m_connection_type, m_state->ssl_options().support));
+        new_connection_ipv6.reset(new connection<t_protocol_handler>(next_connection_io_service(), m_state, m_connection_type, m_state->ssl_options().support));
         acceptor_ipv6.async_accept(new_connection_ipv6->socket(),
             boost::bind(&boosted_tcp_server<t_protocol_handler>::handle_accept_ipv6, this,
               boost::asio::placeholders::error));
@@ -1117,7 +1114,7 @@ DISABLE_GCC_WARNING(maybe-uninitialized)
 POP_WARNINGS
   //---------------------------------------------------------------------------------
   template<class t_protocol_handler>
-  bool boosted_tcp_server<t_protocol_handler>::worker_thread()
+  bool boosted_tcp_server<t_protocol_handler>::worker_thread(boost::asio::io_service& io_service)
   {
     TRY_ENTRY();
     uint32_t local_thr_index = boost::interprocess::ipcdetail::atomic_inc32(&m_thread_index);
@@ -1129,7 +1126,7 @@ POP_WARNINGS
     {
       try
       {
-        io_service_.run();
+        io_service.run();
         return true;
       }
       catch(const std::exception& ex)
@@ -1147,6 +1144,57 @@ POP_WARNINGS
   }
   //---------------------------------------------------------------------------------
   template<class t_protocol_handler>
+  void boosted_tcp_server<t_protocol_handler>::set_io_shards(size_t count)
+  {
+    CHECK_AND_ASSERT_THROW_MES(m_shard_threads.empty(), "Cannot change io shards of a running server");
+    m_shards.clear();
+    for (size_t i = 0; i < count; ++i)
+      m_shards.emplace_back(new worker());
+    MINFO("Using " << count << " io shards for " << m_thread_name_prefix << " connections");
+  }
+  //---------------------------------------------------------------------------------
+  template<class t_protocol_handler>
+  boost::asio::io_service& boosted_tcp_server<t_protocol_handler>::next_connection_io_service()
+  {
+    if (m_shards.empty())
+      return io_service_;
+    size_t shard = m_next_shard++ % m_shards.size();
+    // connect() waits for the connection's io_service, so never hand out the shard the caller runs on
+    CRITICAL_REGION_LOCAL(m_threads_lock);
+    if (shard < m_shard_threads.size() && m_shard_threads[shard]->get_id() == boost::this_thread::get_id())
+    {
+      if (m_shards.size() == 1)
+        return io_service_;
+      shard = (shard + 1) % m_shards.size();
+    }
+    return m_shards[shard]->io_service;
+  }
+  //---------------------------------------------------------------------------------
+  template<class t_protocol_handler>
+  void boosted_tcp_server<t_protocol_handler>::stop_io_shards()
+  {
+    TRY_ENTRY();
+    std::vector<boost::shared_ptr<boost::thread> > shard_threads;
+    {
+      // join outside the lock, the shard threads take it too
+      CRITICAL_REGION_LOCAL(m_threads_lock);
+      shard_threads.swap(m_shard_threads);
+    }
+    for (auto &shard: m_shards)
+      shard->io_service.stop();
+    for (auto &thp: shard_threads)
+    {
+      if (thp->get_id() == boost::this_thread::get_id())
+        thp->detach();
+      else if (thp->joinable())
+        thp->join();
+    }
+    for (auto &shard: m_shards)
+      shard->io_service.reset();
+    CATCH_ENTRY_L0("boosted_tcp_server<t_protocol_handler>::stop_io_shards", void());
+  }
+  //---------------------------------------------------------------------------------
+  template<class t_protocol_handler>
   void boosted_tcp_server<t_protocol_handler>::set_threads_prefix(const std::string& prefix_name)
   {
     m_thread_name_prefix = prefix_name;
@@ -1178,10 +1226,18 @@ POP_WARNINGS
       for (std::size_t i = 0; i < threads_count; ++i)
       {
         boost::shared_ptr<boost::thread> thread(new boost::thread(
-          attrs, boost::bind(&boosted_tcp_server<t_protocol_handler>::worker_thread, this)));
+          attrs, boost::bind(&boosted_tcp_server<t_protocol_handler>::worker_thread, this, boost::ref(io_service_))));
           _note("Run server thread name: " << m_thread_name_prefix);
         m_threads.push_back(thread);
       }
+      // one thread per shard, started once: they outlive restarts of the shared io_service
+      for (std::size_t i = m_shard_threads.size(); i < m_shards.size(); ++i)
+      {
+        boost::shared_ptr<boost::thread> thread(new boost::thread(
+          attrs, boost::bind(&boosted_tcp_server<t_protocol_handler>::worker_thread, this, boost::ref(m_shards[i]->io_service))));
+          _note("Run server shard thread name: " << m_thread_name_prefix);
+        m_shard_threads.push_back(thread);
+      }
       CRITICAL_REGION_END();
       // Wait for all threads in the pool to exit.
       if (wait)
@@ -1207,6 +1263,7 @@ POP_WARNINGS
         if(!this->init_server(m_port, m_address, m_port_ipv6, m_address_ipv6, m_use_ipv6, m_require_ipv4))
         {
           _dbg1("Reiniting service failed, exit.");
+          stop_io_shards();
           return false;
         }else
         {
@@ -1214,6 +1271,7 @@ POP_WARNINGS
         }
       }
     }
+    stop_io_shards();
     return true;
     CATCH_ENTRY_L0("boosted_tcp_server<t_protocol_handler>::run_server", false);
   }
@@ -1228,6 +1286,11 @@ POP_WARNINGS
       if(thp->get_id() == boost::this_thread::get_id())
         return true;
     }
+    BOOST_FOREACH(boost::shared_ptr<boost::thread>& thp,  m_shard_threads)
+    {
+      if(thp->get_id() == boost::this_thread::get_id())
+        return true;
+    }
     if(m_threads_count == 1 && boost::this_thread::get_id() == m_main_thread_id)
       return true;
     return false;
@@ -1247,6 +1310,14 @@ POP_WARNINGS
         m_threads[i]->interrupt();
       }
     }
+    for (std::size_t i = 0; i < m_shard_threads.size(); ++i)
+    {
+      if(m_shard_threads[i]->joinable() && !m_shard_threads[i]->try_join_for(ms))
+      {
+        _dbg1("Interrupting shard thread " << m_shard_threads[i]->native_handle());
+        m_shard_threads[i]->interrupt();
+      }
+    }
     return true;
     CATCH_ENTRY_L0("boosted_tcp_server<t_protocol_handler>::timed_wait_server_stop", false);
   }
@@ -1266,6 +1337,8 @@ POP_WARNINGS
     connections_.clear();
     connections_mutex.unlock();
     io_service_.stop();
+    for (auto &shard: m_shards)
+      shard->io_service.stop();
     CATCH_ENTRY_L0("boosted_tcp_server<t_protocol_handler>::send_stop_signal()", void());
   }
   //---------------------------------------------------------------------------------
@@ -1312,7 +1385,7 @@ POP_WARNINGS
         (*current_new_connection)->setRpcStation(); // hopefully this is not needed actually
       }
       connection_ptr conn(std::move((*current_new_connection)));
-      (*current_new_connection).reset(new connection<t_protocol_handler>(io_service_, m_state, m_connection_type, conn->get_ssl_support()));
+      (*current_new_connection).reset(new connection<t_protocol_handler>(next_connection_io_service(), m_state, m_connection_type, conn->get_ssl_support()));
       current_acceptor->async_accept((*current_new_connection)->socket(),
           boost::bind(accept_function_pointer, this,
             boost::asio::placeholders::error));
@@ -1322,9 +1395,9 @@ POP_WARNINGS
 
       bool res;
       if (default_remote.get_type_id() == net_utils::address_type::invalid)
-        res = conn->start(true, 1 < m_threads_count);
+        res = conn->start(true, is_multithreaded());
       else
-        res = conn->start(true, 1 < m_threads_count, default_remote);
+        res = conn->start(true, is_multithreaded(), default_remote);
       if (!res)
       {
         conn->cancel();
@@ -1347,7 +1420,7 @@ POP_WARNINGS
     assert(m_state != nullptr); // always set in constructor
     _erro("Some problems at accept: " << e.message() << ", connections_count = " << m_state->sock_count);
     misc_utils::sleep_no_w(100);
-    (*current_new_connection).reset(new connection<t_protocol_handler>(io_service_, m_state, m_connection_type, (*current_new_connection)->get_ssl_support()));
+    (*current_new_connection).reset(new connection<t_protocol_handler>(next_connection_io_service(), m_state, m_connection_type, (*current_new_connection)->get_ssl_support()));
     current_acceptor->async_accept((*current_new_connection)->socket(),
         boost::bind(accept_function_pointer, this,
           boost::asio::placeholders::error));
@@ -1359,7 +1432,7 @@ POP_WARNINGS
     if(std::addressof(get_io_service()) == std::addressof(GET_IO_SERVICE(sock)))
     {
       connection_ptr conn(new connection<t_protocol_handler>(std::move(sock), m_state, m_connection_type, ssl_support));
-      if(conn->start(false, 1 < m_threads_count, std::move(real_remote)))
+      if(conn->start(false, is_multithreaded(), std::move(real_remote)))
       {
         conn->get_context(out);
         conn->save_dbg_log();
@@ -1476,7 +1549,7 @@ POP_WARNINGS
   {
     TRY_ENTRY();
 
-    connection_ptr new_connection_l(new connection<t_protocol_handler>(io_service_, m_state, m_connection_type, ssl_support) );
+    connection_ptr new_connection_l(new connection<t_protocol_handler>(next_connection_io_service(), m_state, m_connection_type, ssl_support) );
     connections_mutex.lock();
     connections_.insert(new_connection_l);
     MDEBUG("connections_ size now " << connections_.size());
@@ -1578,7 +1651,7 @@ POP_WARNINGS
     connections_mutex.lock();
     connections_.erase(new_connection_l);
     connections_mutex.unlock();
-    bool r = new_connection_l->start(false, 1 < m_threads_count);
+    bool r = new_connection_l->start(false, is_multithreaded());
     if (r)
     {
       new_connection_l->get_context(conn_context);
@@ -1601,7 +1674,7 @@ POP_WARNINGS
   bool boosted_tcp_server<t_protocol_handler>::connect_async(const std::string& adr, const std::string& port, uint32_t conn_timeout, const t_callback &cb, const std::string& bind_ip, epee::net_utils::ssl_support_t ssl_support)
   {
     TRY_ENTRY();
-    connection_ptr new_connection_l(new connection<t_protocol_handler>(io_service_, m_state, m_connection_type, ssl_support) );
+    connection_ptr new_connection_l(new connection<t_protocol_handler>(next_connection_io_service(), m_state, m_connection_type, ssl_support) );
     connections_mutex.lock();
     connections_.insert(new_connection_l);
     MDEBUG("connections_ size now " << connections_.size());
@@ -1679,7 +1752,7 @@ POP_WARNINGS
       }
     }
 
-    boost::shared_ptr<boost::asio::deadline_timer> sh_deadline(new boost::asio::deadline_timer(io_service_));
+    boost::shared_ptr<boost::asio::deadline_timer> sh_deadline(new boost::asio::deadline_timer(GET_IO_SERVICE(sock_)));
     //start deadline
     sh_deadline->expires_from_now(boost::posix_time::milliseconds(conn_timeout));
     sh_deadline->async_wait([=](const boost::system::error_code& error)
@@ -1710,7 +1783,7 @@ POP_WARNINGS
             connections_mutex.lock();
             connections_.erase(new_connection_l);
             connections_mutex.unlock();
-            bool r = new_connection_l->start(false, 1 < m_threads_count);
+            bool r = new_connection_l->start(false, is_multithreaded());
             if (r)
             {
               new_connection_l->get_context(conn_context);
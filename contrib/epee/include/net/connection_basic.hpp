@@ -42,9 +42,11 @@
 #define INCLUDED_p2p_connection_basic_hpp
 
 
+#include <algorithm>
 #include <string>
 #include <atomic>
 #include <memory>
+#include <vector>
 
 #include <boost/asio.hpp>
 #include <boost/asio/ssl.hpp>
@@ -110,6 +112,14 @@ class connection_basic { // not-templated base class for rapid developmet of som
     std::atomic<bool> m_was_shutdown;
     critical_section m_send_que_lock;
     std::deque<byte_slice> m_send_que;
+    /// Number of slices at the head of m_send_que covered by the write in progress (0 when idle).
+    size_t m_send_que_inflight;
+    /// Buffer sequence handed to the write in progress, reused between writes.
+    std::vector<boost::asio::const_buffer> m_send_buffers;
+    // send statistics, updated under m_send_que_lock
+    uint64_t m_send_write_count;
+    uint64_t m_send_write_bytes;
+    size_t m_send_que_peak;
     volatile bool m_is_multithreaded;
     /// Strand to ensure the connection's handlers are not called concurrently.
     boost::asio::io_service::strand strand_;
@@ -170,6 +180,8 @@ class connection_basic { // not-templated base class for rapid developmet of som
 		void do_send_handler_write_from_queue(const boost::system::error_code& e, size_t cb , int q_len); // from handle_write, sending next part
 
 		void logger_handle_net_write(size_t size); // network data written
+		void record_send_que_depth(size_t depth) { m_send_que_peak = std::max(m_send_que_peak, depth); }
+		void record_write(size_t bytes) { ++m_send_write_count; m_send_write_bytes += bytes; }
 		void logger_handle_net_read(size_t size); // network data read
 
 		// config for rate limit
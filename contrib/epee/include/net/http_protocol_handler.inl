@@ -40,6 +40,7 @@
 #define HTTP_MAX_URI_LEN		 9000 
 #define HTTP_MAX_HEADER_LEN		 100000
 #define HTTP_MAX_STARTING_NEWLINES       8
+#define HTTP_MAX_COPIED_BODY_SIZE        16384 // larger bodies are sent as their own slice
 
 namespace epee
 {
@@ -593,10 +594,17 @@ namespace net_utils
 
 		LOG_PRINT_L3("HTTP_RESPONSE_HEAD: << \r\n" << response_data);
 
-		if ((response.m_body.size() && (query_info.m_http_method != http::http_method_head)) || (query_info.m_http_method == http::http_method_options))
+		bool send_body = (response.m_body.size() && (query_info.m_http_method != http::http_method_head)) || (query_info.m_http_method == http::http_method_options);
+		if (send_body && response.m_body.size() <= HTTP_MAX_COPIED_BODY_SIZE)
+		{
 			response_data += response.m_body;
+			send_body = false;
+		}
 
 		m_psnd_hndlr->do_send(byte_slice{std::move(response_data)});
+		// large bodies (eg, get_blocks.bin) are handed over as is rather than copied after the header
+		if (send_body)
+			m_psnd_hndlr->do_send(byte_slice{std::move(response.m_body)});
 		m_psnd_hndlr->send_done();
 		return res;
 	}
@@ -30,6 +30,7 @@
 #include <boost/unordered_map.hpp>
 #include <boost/interprocess/detail/atomic.hpp>
 #include <boost/smart_ptr/make_shared.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 
 #include <atomic>
 #include <deque>
@@ -167,6 +168,8 @@ public:
 
   net_utils::buffer m_cache_in_buffer;
   stream_state m_state;
+  boost::posix_time::ptime m_message_started; // first byte of the message being received
+  boost::posix_time::ptime m_fragments_started; // first byte of the first fragment of a fragmented message
 
   int32_t m_oponent_protocol_ver;
   bool m_connection_initialized;
@@ -415,6 +418,10 @@ public:
       return false;
     }
 
+    const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+    if(m_state == stream_state_head && m_cache_in_buffer.size() == 0)
+      m_message_started = now;
+
     m_cache_in_buffer.append((const char*)ptr, cb);
 
     bool is_continue = true;
@@ -444,6 +451,9 @@ public:
           std::string temp{};
           epee::span<const uint8_t> buff_to_invoke = m_cache_in_buffer.carve((std::string::size_type)m_current_head.m_cb);
           m_state = stream_state_head;
+          m_connection_context.m_message_recv_start = m_message_started;
+          m_connection_context.m_message_recv_end = now;
+          m_message_started = now; // whatever is left in the buffer came with this read
 
           // abstract_tcp_server2.h manages max bandwidth for a p2p link
           if (!(m_current_head.m_flags & (LEVIN_PACKET_REQUEST | LEVIN_PACKET_RESPONSE)))
@@ -454,7 +464,10 @@ public:
               break; // noise message, skip to next message
 
             if (m_current_head.m_flags & LEVIN_PACKET_BEGIN)
+            {
               m_fragment_buffer.clear();
+              m_fragments_started = m_connection_context.m_message_recv_start;
+            }
 
             m_fragment_buffer.append(reinterpret_cast<const char*>(buff_to_invoke.data()), buff_to_invoke.size());
             if (!(m_current_head.m_flags & LEVIN_PACKET_END))
@@ -468,6 +481,7 @@ public:
 
             temp = std::move(m_fragment_buffer);
             m_fragment_buffer.clear();
+            m_connection_context.m_message_recv_start = m_fragments_started;
             std::memcpy(std::addressof(m_current_head), std::addressof(temp[0]), sizeof(bucket_head2));
             const size_t max_bytes = m_connection_context.get_max_bytes(m_current_head.m_command);
             if(m_current_head.m_cb > std::min<size_t>(max_packet_size, max_bytes))
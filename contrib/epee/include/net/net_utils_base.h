@@ -32,6 +32,7 @@
 #include <boost/uuid/uuid.hpp>
 #include <boost/asio/io_service.hpp>
 #include <boost/asio/ip/address_v6.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 #include <typeinfo>
 #include <type_traits>
 #include "byte_slice.h"
@@ -373,6 +374,8 @@ namespace net_utils
     double m_current_speed_up;
     double m_max_speed_down;
     double m_max_speed_up;
+    boost::posix_time::ptime m_message_recv_start; // first and last byte of the last message received
+    boost::posix_time::ptime m_message_recv_end;
 
     connection_context_base(boost::uuids::uuid connection_id,
                             const network_address &remote_address, bool is_income, bool ssl,
@@ -36,7 +36,8 @@
 #ifndef INCLUDED_throttle_detail_hpp
 #define INCLUDED_throttle_detail_hpp
 
-#include <boost/circular_buffer.hpp>
+#include <atomic>
+#include <memory>
 #include "network_throttle.hpp"
 
 namespace epee
@@ -44,15 +45,29 @@ namespace epee
 namespace net_utils
 {
 
+/***
+ * Lock-free token bucket, one token per byte, holding at most one second of tokens.
+ * Callers may take the bucket into debt, and are told how long to wait for it to be
+ * paid back, so every packet costs O(1) and no caller has to poll.
+*/
+class token_bucket {
+	public:
+		token_bucket();
+		void set_rate(uint64_t bytes_per_second); ///< 0 for no limit
+		uint64_t get_rate() const;
+		network_time_seconds consume(size_t bytes); ///< take bytes, and get the time to wait before using them
+		network_time_seconds consume(size_t bytes, uint64_t now_us); ///< ditto, at the given steady clock time
 
-class network_throttle : public i_network_throttle {
 	private:
-		struct packet_info {
-			size_t m_size; // octets sent. Summary for given small-window (e.g. for all packaged in 1 second)
-			packet_info();
-		};
+		void refill(uint64_t now_us);
 
+		std::atomic<uint64_t> m_rate; // bytes per second
+		std::atomic<int64_t> m_tokens; // negative when in debt
+		std::atomic<uint64_t> m_last_refill; // microseconds, only advanced by the time worth of tokens added
+};
 
+class network_throttle : public i_network_throttle {
+	private:
 		network_speed_bps m_target_speed;
 		size_t m_network_add_cost; // estimated add cost of headers 
 		size_t m_network_minimal_segment; // estimated minimal cost of sending 1 byte to round up to
@@ -62,12 +77,11 @@ class network_throttle : public i_network_throttle {
 		network_time_seconds m_slot_size; // the size of one slot. TODO: now hardcoded for 1 second e.g. in time_to_slot()
 		// TODO for big window size, for performance better the substract on change of m_last_sample_time instead of recalculating average of eg >100 elements
 
-		boost::circular_buffer< packet_info > m_history; // the history of bw usage
-		network_time_seconds m_last_sample_time; // time of last history[0] - so we know when to rotate the buffer
+		token_bucket m_bucket; // decides the delays; the history is kept for the stats
+		std::unique_ptr<std::atomic<uint64_t>[]> m_history; // the history of bw usage, one slot per second: the second in the high bits, octets in the low ones
 		network_time_seconds m_start_time; // when we were created
-		bool m_any_packet_yet; // did we yet got any packet to count
-		uint64_t m_total_packets;
-		uint64_t m_total_bytes;
+		std::atomic<uint64_t> m_total_packets;
+		std::atomic<uint64_t> m_total_bytes;
 
 		std::string m_name; // my name for debug and logs
 		std::string m_nameshort; // my name for debug and logs (used in log file name)
@@ -81,16 +95,17 @@ class network_throttle : public i_network_throttle {
 		virtual network_speed_kbps get_target_speed();
 
 		// add information about events:
-		virtual void handle_trafic_exact(size_t packet_size); ///< count the new traffic/packet; the size is exact considering all network costs
-		virtual void handle_trafic_tcp(size_t packet_size); ///< count the new traffic/packet; the size is as TCP, we will consider MTU etc
+		virtual void handle_trafic_exact(size_t packet_size); ///< lock-free: count the new traffic/packet; the size is exact considering all network costs
+		virtual void handle_trafic_tcp(size_t packet_size); ///< lock-free: count the new traffic/packet; the size is as TCP, we will consider MTU etc
 
-		virtual void tick(); ///< poke and update timers/history (recalculates, moves the history if needed, checks the real clock etc)
+		virtual void tick(); ///< nothing to do, history slots are recycled as traffic is counted
 
 		virtual double get_time_seconds() const ; ///< timer that we use, time in seconds, monotionic
 
 		// time calculations:
 		virtual void calculate_times(size_t packet_size, calculate_times_struct &cts, bool dbg, double force_window) const; ///< MAIN LOGIC (see base class for info)
 
+		virtual network_time_seconds consume(size_t packet_size); ///< lock-free: take packet_size from the budget, and get how long to wait before it fits the target speed
 		virtual network_time_seconds get_sleep_time_after_tick(size_t packet_size); ///< increase the timer if needed, and get the package size
 		virtual network_time_seconds get_sleep_time(size_t packet_size) const; ///< gets the Delay (recommended Delay time) from calc. (not safe: only if time didnt change?) TODO
 
@@ -101,6 +116,7 @@ class network_throttle : public i_network_throttle {
 
 	private:
 		virtual network_time_seconds time_to_slot(network_time_seconds t) const { return std::floor( t ); } // convert exact time eg 13.7 to rounded time for slot number in history 13
+		size_t get_history_bytes(uint64_t slot, size_t slots) const; // octets counted in the given number of slots up to this one
         virtual void _handle_trafic_exact(size_t packet_size, size_t orginal_size);
         virtual void logger_handle_net(const std::string &filename, double time, size_t size);
 };
@@ -111,7 +111,7 @@ class network_throttle_manager {
     static boost::mutex m_lock_get_global_throttle_inreq;
     static boost::mutex m_lock_get_global_throttle_out;
 
-		friend class connection_basic; // FRIEND - to directly access global throttle-s. !! REMEMBER TO USE LOCKS!
+		friend class connection_basic; // FRIEND - to directly access global throttle-s. !! REMEMBER TO USE LOCKS! (except for counting traffic and consume, which are lock-free)
 		friend class connection_basic_pimpl; // ditto
 
 	public:
@@ -131,8 +131,8 @@ class i_network_throttle {
 		virtual void set_target_speed( network_speed_kbps target )=0;
 		virtual network_speed_kbps get_target_speed()=0;
 
-		virtual void handle_trafic_exact(size_t packet_size) =0; // count the new traffic/packet; the size is exact considering all network costs
-		virtual void handle_trafic_tcp(size_t packet_size) =0; // count the new traffic/packet; the size is as TCP, we will consider MTU etc
+		virtual void handle_trafic_exact(size_t packet_size) =0; // lock-free: count the new traffic/packet; the size is exact considering all network costs
+		virtual void handle_trafic_tcp(size_t packet_size) =0; // lock-free: count the new traffic/packet; the size is as TCP, we will consider MTU etc
 		virtual void tick() =0; // poke and update timers/history
 		
 		// time calculations:
@@ -144,6 +144,7 @@ class i_network_throttle {
 
 		virtual network_time_seconds get_sleep_time(size_t packet_size) const =0; // gets the D (recommended Delay time) from calc
 		virtual network_time_seconds get_sleep_time_after_tick(size_t packet_size) =0; // ditto, but first tick the timer
+		virtual network_time_seconds consume(size_t packet_size) =0; // lock-free: take from the budget, and get the D to wait before it fits the target speed
 
 		virtual size_t get_recommended_size_of_planned_transport() const =0; // what should be the recommended limit of data size that we can transport over current network_throttle in near future
 
@@ -48,13 +48,14 @@ namespace misc_utils
     // 8: whitespace
     // 16: allowed in float but doesn't necessarily mean it's a float
     // 32: \ and " (end of verbatim string)
+    // 64: escaped when writing a string
     static const constexpr uint8_t lut[256]={
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 8, 8, 8, 8, 8, 0, 0, // 16
+      0, 0, 0, 0, 0, 0, 0, 0, 64, 72, 72, 72, 72, 72, 0, 0, // 16
       0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 32
-      8, 0, 32, 0, 0, 0, 0, 0, 0, 0, 0, 16, 0, 16, 18, 0, // 48
+      8, 0, 96, 0, 0, 0, 0, 0, 0, 0, 0, 16, 0, 16, 18, 64, // 48
       17, 17, 17, 17, 17, 17, 17, 17, 17, 17, 0, 0, 0, 0, 0, 0, // 64
       0, 4, 4, 4, 4, 22, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, // 80
-      4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 0, 32, 0, 0, 0, // 96
+      4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 0, 96, 0, 0, 0, // 96
       0, 4, 4, 4, 4, 22, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, // 112
       4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 0, 0, 0, 0, 0, // 128
       0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
@@ -97,16 +98,14 @@ namespace misc_utils
       return lut[(uint8_t)c] & 1;
     }
 
-    inline std::string transform_to_escape_sequence(const std::string& src)
+    //! Appends src to res, escaped as for a JSON string
+    inline void append_escape_sequence(std::string& res, const std::string& src)
     {
-      static const char escaped[] = "\b\f\n\r\t\v\"\\/";
-      std::string::const_iterator it = std::find_first_of(src.begin(), src.end(), escaped, escaped + sizeof(escaped));
+      std::string::const_iterator it = std::find_if(src.begin(), src.end(), [](char c) { return lut[(uint8_t)c] & 64; });
+      res.append(src.begin(), it);
       if (it == src.end())
-        return src;
+        return;
 
-      std::string res;
-      res.reserve(2 * src.size());
-      res.assign(src.begin(), it);
       for(; it!=src.end(); ++it)
       {
         switch(*it)
@@ -135,6 +134,12 @@ namespace misc_utils
           res.push_back(*it);
         }
       }
+    }
+
+    inline std::string transform_to_escape_sequence(const std::string& src)
+    {
+      std::string res;
+      append_escape_sequence(res, src);
       return res;
     }
     /*
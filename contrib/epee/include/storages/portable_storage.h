@@ -145,14 +145,20 @@ namespace epee
     bool portable_storage::store_to_binary(binarybuffer& target)
     {
       TRY_ENTRY();
-      std::stringstream ss;
       storage_block_header sbh = AUTO_VAL_INIT(sbh);
       sbh.m_signature_a = SWAP32LE(PORTABLE_STORAGE_SIGNATUREA);
       sbh.m_signature_b = SWAP32LE(PORTABLE_STORAGE_SIGNATUREB);
       sbh.m_ver = PORTABLE_STORAGE_FORMAT_VER;
+
+      // size first, so large payloads (blocks, txes) are written once, in place
+      size_counting_stream counter;
+      pack_entry_to_buff(counter, m_root);
+      target.clear();
+      target.reserve(sizeof(storage_block_header) + counter.size);
+
+      string_append_stream ss{target};
       ss.write((const char*)&sbh, sizeof(storage_block_header));
       pack_entry_to_buff(ss, m_root);
-      target = ss.str();
       return true;
       CATCH_ENTRY("portable_storage::store_to_binary", false)
     }
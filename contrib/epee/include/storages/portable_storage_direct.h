@@ -0,0 +1,1179 @@
+// Copyright (c) 2019-2021 WAZN Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <sstream>
+#include <type_traits>
+#include <vector>
+
+#include "portable_storage.h"
+
+namespace epee
+{
+  namespace serialization
+  {
+    template<class t_type> struct binary_type_code;
+    template<> struct binary_type_code<int64_t>     { static constexpr uint8_t value = SERIALIZE_TYPE_INT64; };
+    template<> struct binary_type_code<int32_t>     { static constexpr uint8_t value = SERIALIZE_TYPE_INT32; };
+    template<> struct binary_type_code<int16_t>     { static constexpr uint8_t value = SERIALIZE_TYPE_INT16; };
+    template<> struct binary_type_code<int8_t>      { static constexpr uint8_t value = SERIALIZE_TYPE_INT8; };
+    template<> struct binary_type_code<uint64_t>    { static constexpr uint8_t value = SERIALIZE_TYPE_UINT64; };
+    template<> struct binary_type_code<uint32_t>    { static constexpr uint8_t value = SERIALIZE_TYPE_UINT32; };
+    template<> struct binary_type_code<uint16_t>    { static constexpr uint8_t value = SERIALIZE_TYPE_UINT16; };
+    template<> struct binary_type_code<uint8_t>     { static constexpr uint8_t value = SERIALIZE_TYPE_UINT8; };
+    template<> struct binary_type_code<double>      { static constexpr uint8_t value = SERIALIZE_TYPE_DUOBLE; };
+    template<> struct binary_type_code<bool>        { static constexpr uint8_t value = SERIALIZE_TYPE_BOOL; };
+    template<> struct binary_type_code<std::string> { static constexpr uint8_t value = SERIALIZE_TYPE_STRING; };
+
+    //! Size of a fixed width value on the wire, 0 for strings, objects and arrays
+    inline size_t binary_pod_size(uint8_t type)
+    {
+      switch (type)
+      {
+      case SERIALIZE_TYPE_INT64: case SERIALIZE_TYPE_UINT64: case SERIALIZE_TYPE_DUOBLE: return 8;
+      case SERIALIZE_TYPE_INT32: case SERIALIZE_TYPE_UINT32: return 4;
+      case SERIALIZE_TYPE_INT16: case SERIALIZE_TYPE_UINT16: return 2;
+      case SERIALIZE_TYPE_INT8: case SERIALIZE_TYPE_UINT8: case SERIALIZE_TYPE_BOOL: return 1;
+      default: return 0;
+      }
+    }
+
+    inline int binary_name_compare(const char* a, size_t a_size, const char* b, size_t b_size)
+    {
+      const int r = std::memcmp(a, b, std::min(a_size, b_size));
+      if (r)
+        return r;
+      return a_size < b_size ? -1 : a_size > b_size ? 1 : 0;
+    }
+
+    struct binary_writer_section;
+    struct binary_writer_array;
+
+    struct binary_writer_field
+    {
+      enum kind_t { value, string, section, array };
+
+      size_t name_offset;
+      size_t name_size;
+      kind_t kind;
+      size_t offset; //!< whole entry in the data buffer, type byte included, or index of the string
+      size_t size;
+      binary_writer_section* child;
+      binary_writer_array* arr;
+    };
+
+    struct binary_writer_section
+    {
+      std::vector<binary_writer_field> fields;
+    };
+
+    struct binary_writer_array
+    {
+      uint8_t type;
+      size_t count;
+      size_t offset; //!< packed elements in the data buffer, for arrays of fixed width values
+      size_t size;
+      std::vector<std::string> strings;
+      std::vector<binary_writer_section*> sections;
+    };
+
+    /************************************************************************/
+    /* Stores a KV_SERIALIZE_MAP struct straight into the binary format.    */
+    /* Fixed width values are encoded as they are set and strings are moved */
+    /* in as is, sections only keep the order of their fields so they can   */
+    /* be emitted sorted by name, which gives the exact bytes               */
+    /* portable_storage::store_to_binary would.                             */
+    /************************************************************************/
+    class binary_writer
+    {
+    public:
+      typedef binary_writer_section* hsection;
+      typedef binary_writer_array* harray;
+      typedef storage_entry meta_entry;
+
+      binary_writer();
+
+      hsection open_section(const char* section_name, hsection hparent_section, bool create_if_notexist = false);
+      template<class t_value>
+      bool set_value(const char* value_name, t_value&& target, hsection hparent_section);
+      template<class t_value>
+      harray insert_first_value(const char* value_name, t_value&& target, hsection hparent_section);
+      template<class t_value>
+      bool insert_next_value(harray hval_array, t_value&& target);
+      harray insert_first_section(const char* section_name, hsection& hinserted_childsection, hsection hparent_section);
+      bool insert_next_section(harray hsec_array, hsection& hinserted_childsection);
+
+      bool store_to_binary(binarybuffer& target);
+
+    private:
+      typedef binary_writer_field field;
+
+      field* find_field(hsection psection, const char* name, size_t name_size);
+      field* insert_field(const char* name, hsection psection);
+      hsection new_section();
+      harray new_array(uint8_t type);
+      template<class t_value>
+      void assign(field& f, const t_value& v);
+      void assign(field& f, std::string&& v);
+      void assign(field& f, const std::string& v) { assign(f, std::string(v)); }
+      void assign(field& f, storage_entry&& v);
+      template<class t_value>
+      void append(binary_writer_array& arr, const t_value& v);
+      void append(binary_writer_array& arr, std::string&& v) { arr.strings.push_back(std::move(v)); }
+      void append(binary_writer_array& arr, const std::string& v) { arr.strings.push_back(v); }
+      template<class t_stream>
+      void pack_section(t_stream& strm, const binary_writer_section& sec) const;
+
+      std::deque<binary_writer_section> m_sections;
+      std::deque<binary_writer_array> m_arrays;
+      std::deque<std::string> m_strings;
+      std::string m_names;
+      std::string m_data;
+    };
+
+    inline binary_writer::binary_writer()
+    {
+      new_section();
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    inline binary_writer::hsection binary_writer::new_section()
+    {
+      m_sections.emplace_back();
+      return &m_sections.back();
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    inline binary_writer::harray binary_writer::new_array(uint8_t type)
+    {
+      m_arrays.emplace_back();
+      binary_writer_array& arr = m_arrays.back();
+      arr.type = type | SERIALIZE_FLAG_ARRAY;
+      arr.count = 0;
+      arr.offset = m_data.size();
+      arr.size = 0;
+      return &arr;
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    inline binary_writer::field* binary_writer::find_field(hsection psection, const char* name, size_t name_size)
+    {
+      for (field& f: psection->fields)
+        if (f.name_size == name_size && !std::memcmp(m_names.data() + f.name_offset, name, name_size))
+          return &f;
+      return nullptr;
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    inline binary_writer::field* binary_writer::insert_field(const char* name, hsection psection)
+    {
+      CHECK_AND_ASSERT(name, nullptr);
+      const size_t name_size = std::strlen(name);
+      CHECK_AND_ASSERT(name_size, nullptr);
+      if (!psection)
+        psection = &m_sections.front();
+      field* f = find_field(psection, name, name_size);
+      if (!f)
+      {
+        psection->fields.push_back(field{m_names.size(), name_size, field::value, 0, 0, nullptr, nullptr});
+        m_names.append(name, name_size);
+        f = &psection->fields.back();
+      }
+      return f;
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    template<class t_value>
+    void binary_writer::assign(field& f, const t_value& v)
+    {
+      f.kind = field::value;
+      f.offset = m_data.size();
+      m_data.push_back((char)binary_type_code<t_value>::value);
+      const t_value v0 = CONVERT_POD(v);
+      m_data.append((const char*)&v0, sizeof(v0));
+      f.size = m_data.size() - f.offset;
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    inline void binary_writer::assign(field& f, std::string&& v)
+    {
+      f.kind = field::string;
+      f.offset = m_strings.size();
+      m_strings.push_back(std::move(v));
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    inline void binary_writer::assign(field& f, storage_entry&& v)
+    {
+      f.kind = field::value;
+      f.offset = m_data.size();
+      string_append_stream ss{m_data};
+      pack_entry_to_buff(ss, v);
+      f.size = m_data.size() - f.offset;
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    template<class t_value>
+    void binary_writer::append(binary_writer_array& arr, const t_value& v)
+    {
+      // elements are expected back to back, move them to the end if something got written in between
+      if (arr.offset + arr.size != m_data.size())
+      {
+        const std::string elements = m_data.substr(arr.offset, arr.size);
+        arr.offset = m_data.size();
+        m_data += elements;
+      }
+      const t_value v0 = CONVERT_POD(v);
+      m_data.append((const char*)&v0, sizeof(v0));
+      arr.size = m_data.size() - arr.offset;
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    inline binary_writer::hsection binary_writer::open_section(const char* section_name, hsection hparent_section, bool create_if_notexist)
+    {
+      TRY_ENTRY();
+      if (!hparent_section)
+        hparent_section = &m_sections.front();
+      field* f = find_field(hparent_section, section_name, std::strlen(section_name));
+      if (f && f->kind == field::section)
+        return f->child;
+      if (!create_if_notexist)
+        return nullptr;
+      f = insert_field(section_name, hparent_section);
+      if (!f)
+        return nullptr;
+      f->kind = field::section;
+      f->child = new_section();
+      return f->child;
+      CATCH_ENTRY("binary_writer::open_section", nullptr);
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    template<class t_value>
+    bool binary_writer::set_value(const char* value_name, t_value&& v, hsection hparent_section)
+    {
+      TRY_ENTRY();
+      field* f = insert_field(value_name, hparent_section);
+      if (!f)
+        return false;
+      assign(*f, std::forward<t_value>(v));
+      return true;
+      CATCH_ENTRY("binary_writer::set_value", false);
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    template<class t_value>
+    binary_writer::harray binary_writer::insert_first_value(const char* value_name, t_value&& target, hsection hparent_section)
+    {
+      using t_real_value = typename std::decay<t_value>::type;
+      TRY_ENTRY();
+      field* f = insert_field(value_name, hparent_section);
+      if (!f)
+        return nullptr;
+      f->kind = field::array;
+      f->arr = new_array(binary_type_code<t_real_value>::value);
+      if (!insert_next_value(f->arr, std::forward<t_value>(target)))
+        return nullptr;
+      return f->arr;
+      CATCH_ENTRY("binary_writer::insert_first_value", nullptr);
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    template<class t_value>
+    bool binary_writer::insert_next_value(harray hval_array, t_value&& target)
+    {
+      using t_real_value = typename std::decay<t_value>::type;
+      TRY_ENTRY();
+      CHECK_AND_ASSERT(hval_array, false);
+      const uint8_t type = binary_type_code<t_real_value>::value | SERIALIZE_FLAG_ARRAY;
+      CHECK_AND_ASSERT_MES(hval_array->type == type, false, "unexpected type in insert_next_value: " << typeid(t_real_value).name());
+      append(*hval_array, std::forward<t_value>(target));
+      ++hval_array->count;
+      return true;
+      CATCH_ENTRY("binary_writer::insert_next_value", false);
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    inline binary_writer::harray binary_writer::insert_first_section(const char* section_name, hsection& hinserted_childsection, hsection hparent_section)
+    {
+      TRY_ENTRY();
+      field* f = insert_field(section_name, hparent_section);
+      if (!f)
+        return nullptr;
+      f->kind = field::array;
+      f->arr = new_array(SERIALIZE_TYPE_OBJECT);
+      if (!insert_next_section(f->arr, hinserted_childsection))
+        return nullptr;
+      return f->arr;
+      CATCH_ENTRY("binary_writer::insert_first_section", nullptr);
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    inline bool binary_writer::insert_next_section(harray hsec_array, hsection& hinserted_childsection)
+    {
+      TRY_ENTRY();
+      CHECK_AND_ASSERT(hsec_array, false);
+      CHECK_AND_ASSERT_MES(hsec_array->type == (SERIALIZE_TYPE_OBJECT | SERIALIZE_FLAG_ARRAY), false, "unexpected type(not 'section') in insert_next_section");
+      hinserted_childsection = new_section();
+      hsec_array->sections.push_back(hinserted_childsection);
+      ++hsec_array->count;
+      return true;
+      CATCH_ENTRY("binary_writer::insert_next_section", false);
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    template<class t_stream>
+    void binary_writer::pack_section(t_stream& strm, const binary_writer_section& sec) const
+    {
+      pack_varint(strm, sec.fields.size());
+      for (const field& f: sec.fields)
+      {
+        CHECK_AND_ASSERT_THROW_MES(f.name_size < std::numeric_limits<uint8_t>::max(), "storage_entry_name is too long: " << f.name_size);
+        const uint8_t len = static_cast<uint8_t>(f.name_size);
+        strm.write((const char*)&len, sizeof(len));
+        strm.write(m_names.data() + f.name_offset, f.name_size);
+        switch (f.kind)
+        {
+        case field::value:
+          strm.write(m_data.data() + f.offset, f.size);
+          break;
+        case field::string:
+        {
+          const uint8_t type = SERIALIZE_TYPE_STRING;
+          strm.write((const char*)&type, 1);
+          put_string(strm, m_strings[f.offset]);
+          break;
+        }
+        case field::section:
+        {
+          const uint8_t type = SERIALIZE_TYPE_OBJECT;
+          strm.write((const char*)&type, 1);
+          pack_section(strm, *f.child);
+          break;
+        }
+        case field::array:
+          strm.write((const char*)&f.arr->type, 1);
+          pack_varint(strm, f.arr->count);
+          if (f.arr->type == (SERIALIZE_TYPE_OBJECT | SERIALIZE_FLAG_ARRAY))
+          {
+            for (const binary_writer_section* s: f.arr->sections)
+              pack_section(strm, *s);
+          }
+          else if (f.arr->type == (SERIALIZE_TYPE_STRING | SERIALIZE_FLAG_ARRAY))
+          {
+            for (const std::string& s: f.arr->strings)
+              put_string(strm, s);
+          }
+          else
+            strm.write(m_data.data() + f.arr->offset, f.arr->size);
+          break;
+        }
+      }
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    inline bool binary_writer::store_to_binary(binarybuffer& target)
+    {
+      TRY_ENTRY();
+      // portable_storage keeps its fields in a map, so they go out sorted by name
+      for (binary_writer_section& sec: m_sections)
+      {
+        std::sort(sec.fields.begin(), sec.fields.end(), [this](const field& a, const field& b) {
+          return binary_name_compare(m_names.data() + a.name_offset, a.name_size, m_names.data() + b.name_offset, b.name_size) < 0;
+        });
+      }
+
+      const uint32_t signature_a = SWAP32LE(PORTABLE_STORAGE_SIGNATUREA);
+      const uint32_t signature_b = SWAP32LE(PORTABLE_STORAGE_SIGNATUREB);
+      const uint8_t ver = PORTABLE_STORAGE_FORMAT_VER;
+
+      size_counting_stream counter;
+      pack_section(counter, m_sections.front());
+      target.clear();
+      target.reserve(sizeof(signature_a) + sizeof(signature_b) + sizeof(ver) + counter.size);
+
+      string_append_stream ss{target};
+      ss.write((const char*)&signature_a, sizeof(signature_a));
+      ss.write((const char*)&signature_b, sizeof(signature_b));
+      ss.write((const char*)&ver, sizeof(ver));
+      pack_section(ss, m_sections.front());
+      return true;
+      CATCH_ENTRY("binary_writer::store_to_binary", false);
+    }
+
+    struct binary_reader_field
+    {
+      const char* name;
+      uint8_t name_size;
+      uint8_t type;          //!< with SERIALIZE_FLAG_ARRAY for arrays, also when stored as SERIALIZE_TYPE_ARRAY
+      const uint8_t* entry;  //!< the entry as stored, from its first type byte
+      const uint8_t* value;  //!< the value, past its type byte(s)
+    };
+
+    struct binary_reader_section
+    {
+      std::vector<binary_reader_field> fields;
+      bool sorted;
+    };
+
+    struct binary_reader_array
+    {
+      uint8_t type;
+      size_t remaining;
+      const uint8_t* ptr;
+    };
+
+    /************************************************************************/
+    /* Loads a KV_SERIALIZE_MAP struct straight from the binary format.     */
+    /* The whole blob is validated up front against the same rules and      */
+    /* limits as throwable_buffer_reader, then sections are only indexed    */
+    /* (name to offset) when opened and values are decoded into the struct  */
+    /* members as they are asked for.                                       */
+    /************************************************************************/
+    class binary_reader
+    {
+    public:
+      typedef binary_reader_section* hsection;
+      typedef binary_reader_array* harray;
+      typedef storage_entry meta_entry;
+
+      bool load_from_binary(const epee::span<const uint8_t> source, const portable_storage::limits_t *limits = NULL);
+      bool load_from_binary(const std::string& source, const portable_storage::limits_t *limits = NULL) { return load_from_binary(epee::strspan<uint8_t>(source), limits); }
+
+      hsection open_section(const char* section_name, hsection hparent_section, bool create_if_notexist = false);
+      template<class t_value>
+      bool get_value(const char* value_name, t_value& val, hsection hparent_section);
+      bool get_value(const char* value_name, storage_entry& val, hsection hparent_section);
+      template<class t_value>
+      harray get_first_value(const char* value_name, t_value& target, hsection hparent_section);
+      template<class t_value>
+      bool get_next_value(harray hval_array, t_value& target);
+      harray get_first_section(const char* section_name, hsection& h_child_section, hsection hparent_section);
+      bool get_next_section(harray hsec_array, hsection& h_child_section);
+
+      // read only, these only let hand written maps with a store branch compile
+      template<class t_value>
+      harray insert_first_value(const char* value_name, t_value&& target, hsection hparent_section) { return nullptr; }
+      template<class t_value>
+      bool insert_next_value(harray hval_array, t_value&& target) { return false; }
+
+    private:
+      typedef binary_reader_field field;
+
+      static size_t read_varint(const uint8_t*& p);
+      template<class t_pod_type>
+      static t_pod_type read_pod(const uint8_t*& p);
+      template<class t_value>
+      static void read_string(const uint8_t* p, size_t len, t_value& target) { convert_t(std::string((const char*)p, len), target); }
+      static void read_string(const uint8_t* p, size_t len, std::string& target) { target.assign((const char*)p, len); }
+      template<class t_value>
+      static void read_value(uint8_t type, const uint8_t*& p, t_value& target);
+      static const uint8_t* skip_section(const uint8_t* p);
+      static const uint8_t* skip_value(uint8_t type, const uint8_t* p);
+
+      hsection index_section(const uint8_t* p, const uint8_t** end);
+      const field* find_field(hsection psection, const char* name) const;
+
+      void check_depth(size_t depth) const;
+      void take(size_t count);
+      size_t take_varint();
+      void validate_string();
+      void validate_section(size_t depth);
+      void validate_entry(size_t depth);
+      void validate_array(size_t depth, uint8_t type);
+
+      std::deque<binary_reader_section> m_sections;
+      std::deque<binary_reader_array> m_arrays;
+      const uint8_t* m_end;
+
+      // validation state
+      const uint8_t* m_ptr;
+      size_t m_objects;
+      size_t m_fields;
+      size_t m_strings;
+      size_t m_max_objects;
+      size_t m_max_fields;
+      size_t m_max_strings;
+      std::vector<std::pair<const uint8_t*, uint8_t>> m_names;
+    };
+
+    inline size_t binary_reader::read_varint(const uint8_t*& p)
+    {
+      switch (*p & PORTABLE_RAW_SIZE_MARK_MASK)
+      {
+      case PORTABLE_RAW_SIZE_MARK_BYTE: return read_pod<uint8_t>(p) >> 2;
+      case PORTABLE_RAW_SIZE_MARK_WORD: return read_pod<uint16_t>(p) >> 2;
+      case PORTABLE_RAW_SIZE_MARK_DWORD: return read_pod<uint32_t>(p) >> 2;
+      default: return read_pod<uint64_t>(p) >> 2;
+      }
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    template<class t_pod_type>
+    t_pod_type binary_reader::read_pod(const uint8_t*& p)
+    {
+      t_pod_type v;
+      std::memcpy(&v, p, sizeof(v));
+      p += sizeof(v);
+      return CONVERT_POD(v);
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    template<class t_value>
+    void binary_reader::read_value(uint8_t type, const uint8_t*& p, t_value& target)
+    {
+      switch (type)
+      {
+      case SERIALIZE_TYPE_INT64:  convert_t(read_pod<int64_t>(p), target); break;
+      case SERIALIZE_TYPE_INT32:  convert_t(read_pod<int32_t>(p), target); break;
+      case SERIALIZE_TYPE_INT16:  convert_t(read_pod<int16_t>(p), target); break;
+      case SERIALIZE_TYPE_INT8:   convert_t(read_pod<int8_t>(p), target); break;
+      case SERIALIZE_TYPE_UINT64: convert_t(read_pod<uint64_t>(p), target); break;
+      case SERIALIZE_TYPE_UINT32: convert_t(read_pod<uint32_t>(p), target); break;
+      case SERIALIZE_TYPE_UINT16: convert_t(read_pod<uint16_t>(p), target); break;
+      case SERIALIZE_TYPE_UINT8:  convert_t(read_pod<uint8_t>(p), target); break;
+      case SERIALIZE_TYPE_DUOBLE: convert_t(read_pod<double>(p), target); break;
+      case SERIALIZE_TYPE_BOOL:   convert_t(read_pod<bool>(p), target); break;
+      case SERIALIZE_TYPE_STRING:
+      {
+        const size_t len = read_varint(p);
+        read_string(p, len, target);
+        p += len;
+        break;
+      }
+      case SERIALIZE_TYPE_OBJECT: convert_t(section(), target); break;
+      default:                    convert_t(array_entry(), target); break;
+      }
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    inline const uint8_t* binary_reader::skip_section(const uint8_t* p)
+    {
+      size_t count = read_varint(p);
+      while (count--)
+      {
+        p += 1 + *p;
+        uint8_t type = *p++;
+        if (type == SERIALIZE_TYPE_ARRAY)
+          type = *p++;
+        p = skip_value(type, p);
+      }
+      return p;
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    inline const uint8_t* binary_reader::skip_value(uint8_t type, const uint8_t* p)
+    {
+      if (type & SERIALIZE_FLAG_ARRAY)
+      {
+        type &= ~SERIALIZE_FLAG_ARRAY;
+        size_t count = read_varint(p);
+        if (const size_t size = binary_pod_size(type))
+          return p + count * size;
+        while (count--)
+          p = skip_value(type, p);
+        return p;
+      }
+      switch (type)
+      {
+      case SERIALIZE_TYPE_STRING:
+      {
+        const size_t len = read_varint(p);
+        return p + len;
+      }
+      case SERIALIZE_TYPE_OBJECT:
+        return skip_section(p);
+      default:
+        return p + binary_pod_size(type);
+      }
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    inline binary_reader::hsection binary_reader::index_section(const uint8_t* p, const uint8_t** end)
+    {
+      m_sections.emplace_back();
+      binary_reader_section& sec = m_sections.back();
+      sec.sorted = true;
+      size_t count = read_varint(p);
+      sec.fields.reserve(count);
+      while (count--)
+      {
+        field f;
+        f.name_size = *p++;
+        f.name = (const char*)p;
+        p += f.name_size;
+        f.entry = p;
+        f.type = *p++;
+        if (f.type == SERIALIZE_TYPE_ARRAY)
+          f.type = *p++;
+        f.value = p;
+        if (!sec.fields.empty() && binary_name_compare(sec.fields.back().name, sec.fields.back().name_size, f.name, f.name_size) >= 0)
+          sec.sorted = false;
+        sec.fields.push_back(f);
+        p = skip_value(f.type, p);
+      }
+      if (end)
+        *end = p;
+      return &sec;
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    inline const binary_reader::field* binary_reader::find_field(hsection psection, const char* name) const
+    {
+      if (!psection)
+        psection = const_cast<hsection>(&m_sections.front());
+      const size_t name_size = std::strlen(name);
+      if (psection->sorted)
+      {
+        const auto it = std::lower_bound(psection->fields.begin(), psection->fields.end(), name, [name_size](const field& f, const char* n) {
+          return binary_name_compare(f.name, f.name_size, n, name_size) < 0;
+        });
+        if (it != psection->fields.end() && !binary_name_compare(it->name, it->name_size, name, name_size))
+          return &*it;
+        return nullptr;
+      }
+      for (const field& f: psection->fields)
+        if (!binary_name_compare(f.name, f.name_size, name, name_size))
+          return &f;
+      return nullptr;
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    // The depth checks mirror the nesting of throwable_buffer_reader calls, each of which counts against
+    // EPEE_PORTABLE_STORAGE_RECURSION_LIMIT_INTERNAL, so exactly the same blobs get rejected
+    inline void binary_reader::check_depth(size_t depth) const
+    {
+      CHECK_AND_ASSERT_THROW_MES(depth < EPEE_PORTABLE_STORAGE_RECURSION_LIMIT_INTERNAL, "Wrong blob data in portable storage: recursion limitation (" << EPEE_PORTABLE_STORAGE_RECURSION_LIMIT_INTERNAL << ") exceeded");
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    inline void binary_reader::take(size_t count)
+    {
+      const size_t remaining = m_end - m_ptr;
+      CHECK_AND_ASSERT_THROW_MES(remaining >= count, " attempt to read " << count << " bytes from buffer with " << remaining << " bytes remained");
+      m_ptr += count;
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    inline size_t binary_reader::take_varint()
+    {
+      CHECK_AND_ASSERT_THROW_MES(m_ptr < m_end, "empty buff, expected place for varint");
+      const uint8_t* p = m_ptr;
+      take(size_t(1) << (*p & PORTABLE_RAW_SIZE_MARK_MASK));
+      return read_varint(p);
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    inline void binary_reader::validate_string()
+    {
+      const size_t len = take_varint();
+      CHECK_AND_ASSERT_THROW_MES(len < MAX_STRING_LEN_POSSIBLE, "to big string len value in storage: " << len);
+      CHECK_AND_ASSERT_THROW_MES(size_t(m_end - m_ptr) >= len, "string len count value " << len << " goes out of remain storage len " << size_t(m_end - m_ptr));
+      m_ptr += len;
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    // depth is that of the matching throwable_buffer_reader::read(section&) frame
+    inline void binary_reader::validate_section(size_t depth)
+    {
+      check_depth(depth + 4);
+      size_t count = take_varint();
+      CHECK_AND_ASSERT_THROW_MES(count <= m_max_fields - m_fields, "Too many object fields");
+      m_fields += count;
+      const size_t names_start = m_names.size();
+      bool sorted = true;
+      while (count--)
+      {
+        const uint8_t* name = m_ptr;
+        take(1);
+        const uint8_t name_size = *name++;
+        CHECK_AND_ASSERT_THROW_MES(name_size > 0, "Section name is missing");
+        take(name_size);
+        if (sorted && m_names.size() > names_start)
+        {
+          const auto& last = m_names.back();
+          sorted = binary_name_compare((const char*)last.first, last.second, (const char*)name, name_size) < 0;
+        }
+        m_names.emplace_back(name, name_size);
+        validate_entry(depth);
+      }
+      if (!sorted)
+      {
+        const auto less = [](const std::pair<const uint8_t*, uint8_t>& a, const std::pair<const uint8_t*, uint8_t>& b) {
+          return binary_name_compare((const char*)a.first, a.second, (const char*)b.first, b.second) < 0;
+        };
+        std::sort(m_names.begin() + names_start, m_names.end(), less);
+        for (size_t i = names_start + 1; i < m_names.size(); ++i)
+          CHECK_AND_ASSERT_THROW_MES(less(m_names[i - 1], m_names[i]), "duplicate key: " << std::string((const char*)m_names[i].first, m_names[i].second));
+      }
+      m_names.resize(names_start);
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    inline void binary_reader::validate_entry(size_t depth)
+    {
+      const uint8_t* type = m_ptr;
+      take(1);
+      if (*type & SERIALIZE_FLAG_ARRAY)
+        return validate_array(depth + 2, *type);
+      switch (*type)
+      {
+      case SERIALIZE_TYPE_STRING:
+        check_depth(depth + 8);
+        CHECK_AND_ASSERT_THROW_MES(m_strings + 1 <= m_max_strings, "Too many strings");
+        ++m_strings;
+        validate_string();
+        return;
+      case SERIALIZE_TYPE_OBJECT:
+        CHECK_AND_ASSERT_THROW_MES(m_objects < m_max_objects, "Too many objects");
+        ++m_objects;
+        return validate_section(depth + 3);
+      case SERIALIZE_TYPE_ARRAY:
+      {
+        const uint8_t* array_type = m_ptr;
+        take(1);
+        CHECK_AND_ASSERT_THROW_MES(*array_type & SERIALIZE_FLAG_ARRAY, "wrong type sequenses");
+        return validate_array(depth + 3, *array_type);
+      }
+      default:
+        const size_t size = binary_pod_size(*type);
+        CHECK_AND_ASSERT_THROW_MES(size, "unknown entry_type code = " << (unsigned)*type);
+        take(size);
+        return;
+      }
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    // depth is that of the matching throwable_buffer_reader::load_storage_array_entry frame
+    inline void binary_reader::validate_array(size_t depth, uint8_t type)
+    {
+      type &= ~SERIALIZE_FLAG_ARRAY;
+      size_t min_bytes = binary_pod_size(type);
+      if (type == SERIALIZE_TYPE_STRING)
+        min_bytes = 2;
+      else if (type == SERIALIZE_TYPE_OBJECT || type == SERIALIZE_TYPE_ARRAY)
+        min_bytes = 1;
+      CHECK_AND_ASSERT_THROW_MES(min_bytes, "unknown entry_type code = " << (unsigned)type);
+
+      const size_t read_ae = depth + 1;
+      check_depth(read_ae + 4);
+      size_t size = take_varint();
+      CHECK_AND_ASSERT_THROW_MES(size <= size_t(m_end - m_ptr) / min_bytes, "Size sanity check failed");
+      if (type == SERIALIZE_TYPE_OBJECT)
+      {
+        CHECK_AND_ASSERT_THROW_MES(size <= m_max_objects - m_objects, "Too many objects");
+        m_objects += size;
+      }
+      else if (type == SERIALIZE_TYPE_STRING)
+      {
+        CHECK_AND_ASSERT_THROW_MES(size <= m_max_strings - m_strings, "Too many strings");
+        m_strings += size;
+      }
+      if (!size)
+        return;
+
+      switch (type)
+      {
+      case SERIALIZE_TYPE_STRING:
+        check_depth(read_ae + 6);
+        while (size--)
+          validate_string();
+        return;
+      case SERIALIZE_TYPE_OBJECT:
+        while (size--)
+          validate_section(read_ae + 2);
+        return;
+      case SERIALIZE_TYPE_ARRAY:
+        check_depth(read_ae + 2);
+        CHECK_AND_ASSERT_THROW_MES(false, "Reading array entry is not supported");
+      default:
+        check_depth(read_ae + 3);
+        take(size * min_bytes);
+        return;
+      }
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    inline bool binary_reader::load_from_binary(const epee::span<const uint8_t> source, const portable_storage::limits_t *limits)
+    {
+      m_sections.clear();
+      m_arrays.clear();
+      const size_t header_size = 2 * sizeof(uint32_t) + sizeof(uint8_t);
+      if (source.size() < header_size)
+      {
+        LOG_ERROR("binary_reader: wrong binary format, packet size = " << source.size() << " less than expected header size=" << header_size);
+        return false;
+      }
+      const uint8_t* p = source.data();
+      const uint32_t signature_a = read_pod<uint32_t>(p);
+      const uint32_t signature_b = read_pod<uint32_t>(p);
+      if (signature_a != PORTABLE_STORAGE_SIGNATUREA || signature_b != PORTABLE_STORAGE_SIGNATUREB)
+      {
+        LOG_ERROR("binary_reader: wrong binary format - signature mismatch");
+        return false;
+      }
+      if (*p != PORTABLE_STORAGE_FORMAT_VER)
+      {
+        LOG_ERROR("binary_reader: wrong binary format - unknown format ver = " << (unsigned)*p);
+        return false;
+      }
+      ++p;
+      TRY_ENTRY();
+      CHECK_AND_ASSERT_THROW_MES(p != source.data() + source.size(), "binary_reader: empty storage");
+      m_ptr = p;
+      m_end = source.data() + source.size();
+      m_objects = 0;
+      m_fields = 0;
+      m_strings = 0;
+      m_max_objects = limits ? limits->n_objects : std::numeric_limits<size_t>::max();
+      m_max_fields = limits ? limits->n_fields : std::numeric_limits<size_t>::max();
+      m_max_strings = limits ? limits->n_strings : std::numeric_limits<size_t>::max();
+      m_names.clear();
+      validate_section(1);
+      index_section(p, nullptr);
+      return true;
+      CATCH_ENTRY("binary_reader::load_from_binary", false);
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    inline binary_reader::hsection binary_reader::open_section(const char* section_name, hsection hparent_section, bool create_if_notexist)
+    {
+      TRY_ENTRY();
+      const field* f = find_field(hparent_section, section_name);
+      if (!f || f->type != SERIALIZE_TYPE_OBJECT)
+        return nullptr;
+      return index_section(f->value, nullptr);
+      CATCH_ENTRY("binary_reader::open_section", nullptr);
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    template<class t_value>
+    bool binary_reader::get_value(const char* value_name, t_value& val, hsection hparent_section)
+    {
+      const field* f = find_field(hparent_section, value_name);
+      if (!f)
+        return false;
+      const uint8_t* p = f->value;
+      read_value(f->type, p, val);
+      return true;
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    inline bool binary_reader::get_value(const char* value_name, storage_entry& val, hsection hparent_section)
+    {
+      const field* f = find_field(hparent_section, value_name);
+      if (!f)
+        return false;
+      throwable_buffer_reader buf_reader(f->entry, m_end - f->entry);
+      val = buf_reader.load_storage_entry();
+      return true;
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    template<class t_value>
+    binary_reader::harray binary_reader::get_first_value(const char* value_name, t_value& target, hsection hparent_section)
+    {
+      const field* f = find_field(hparent_section, value_name);
+      if (!f || !(f->type & SERIALIZE_FLAG_ARRAY))
+        return nullptr;
+      const uint8_t* p = f->value;
+      m_arrays.emplace_back();
+      binary_reader_array& arr = m_arrays.back();
+      arr.type = f->type & ~SERIALIZE_FLAG_ARRAY;
+      arr.remaining = read_varint(p);
+      arr.ptr = p;
+      if (!get_next_value(&arr, target))
+        return nullptr;
+      return &arr;
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    template<class t_value>
+    bool binary_reader::get_next_value(harray hval_array, t_value& target)
+    {
+      CHECK_AND_ASSERT(hval_array, false);
+      if (!hval_array->remaining)
+        return false;
+      --hval_array->remaining;
+      read_value(hval_array->type, hval_array->ptr, target);
+      return true;
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    inline binary_reader::harray binary_reader::get_first_section(const char* section_name, hsection& h_child_section, hsection hparent_section)
+    {
+      TRY_ENTRY();
+      const field* f = find_field(hparent_section, section_name);
+      if (!f || f->type != (SERIALIZE_TYPE_OBJECT | SERIALIZE_FLAG_ARRAY))
+        return nullptr;
+      const uint8_t* p = f->value;
+      m_arrays.emplace_back();
+      binary_reader_array& arr = m_arrays.back();
+      arr.type = SERIALIZE_TYPE_OBJECT;
+      arr.remaining = read_varint(p);
+      arr.ptr = p;
+      if (!get_next_section(&arr, h_child_section))
+        return nullptr;
+      return &arr;
+      CATCH_ENTRY("binary_reader::get_first_section", nullptr);
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    inline bool binary_reader::get_next_section(harray hsec_array, hsection& h_child_section)
+    {
+      TRY_ENTRY();
+      CHECK_AND_ASSERT(hsec_array, false);
+      if (hsec_array->type != SERIALIZE_TYPE_OBJECT || !hsec_array->remaining)
+        return false;
+      --hsec_array->remaining;
+      h_child_section = index_section(hsec_array->ptr, &hsec_array->ptr);
+      return true;
+      CATCH_ENTRY("binary_reader::get_next_section", false);
+    }
+
+    struct json_writer_frame
+    {
+      size_t level;  //!< position on the writer's stack, -1 once closed
+      size_t indent;
+      size_t count;  //!< entries written so far
+      bool array;
+      uint8_t type;  //!< element type, for arrays
+    };
+
+    //! Formats numbers like the std::stringstream behind portable_storage::dump_as_json
+    struct json_append_stream
+    {
+      std::string& buffer;
+
+      json_append_stream& operator<<(const char* v) { buffer += v; return *this; }
+      json_append_stream& operator<<(const std::string& v) { buffer += v; return *this; }
+      template<class t_value>
+      typename std::enable_if<std::is_integral<t_value>::value, json_append_stream&>::type operator<<(const t_value& v)
+      {
+        buffer += std::to_string(v);
+        return *this;
+      }
+      template<class t_value>
+      typename std::enable_if<!std::is_integral<t_value>::value, json_append_stream&>::type operator<<(const t_value& v)
+      {
+        std::stringstream ss;
+        ss << v;
+        buffer += ss.str();
+        return *this;
+      }
+    };
+
+    /************************************************************************/
+    /* Stores a KV_SERIALIZE_MAP struct straight into JSON text.            */
+    /* KV serialization is depth first, so writing to a section or array    */
+    /* closes everything opened after it and nothing but a small frame per  */
+    /* section is kept. Layout and escaping are those of dump_as_json, but  */
+    /* keys come out in declaration order rather than sorted.               */
+    /************************************************************************/
+    class json_writer
+    {
+    public:
+      typedef json_writer_frame* hsection;
+      typedef json_writer_frame* harray;
+      typedef storage_entry meta_entry;
+
+      //! Appends to target, which has to outlive the writer
+      json_writer(std::string& target, size_t indent = 0, bool insert_newlines = true);
+
+      hsection open_section(const char* section_name, hsection hparent_section, bool create_if_notexist = false);
+      template<class t_value>
+      bool set_value(const char* value_name, t_value&& target, hsection hparent_section);
+      template<class t_value>
+      harray insert_first_value(const char* value_name, t_value&& target, hsection hparent_section);
+      template<class t_value>
+      bool insert_next_value(harray hval_array, t_value&& target);
+      harray insert_first_section(const char* section_name, hsection& hinserted_childsection, hsection hparent_section);
+      bool insert_next_section(harray hsec_array, hsection& hinserted_childsection);
+
+      //! Closes whatever is still open, the target holds the whole document afterwards
+      bool finish();
+
+    private:
+      json_writer_frame* push(bool array, size_t indent, uint8_t type);
+      void close_back();
+      bool unwind_to(json_writer_frame* frame);
+      bool begin_field(const char* name, hsection& hparent_section);
+      bool begin_element(harray hval_array, uint8_t type);
+      template<class t_value>
+      void put_value(const t_value& v, size_t indent);
+      void put_value(const std::string& v, size_t indent);
+
+      std::string& m_target;
+      const bool m_insert_newlines;
+      std::deque<json_writer_frame> m_frames; //!< never reused, so stale handles are caught
+      std::vector<json_writer_frame*> m_open;
+    };
+
+    inline json_writer::json_writer(std::string& target, size_t indent, bool insert_newlines):
+      m_target(target), m_insert_newlines(insert_newlines)
+    {
+      m_target += '{';
+      if (m_insert_newlines)
+        m_target += "\r\n";
+      push(false, indent, SERIALIZE_TYPE_OBJECT);
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    inline json_writer_frame* json_writer::push(bool array, size_t indent, uint8_t type)
+    {
+      m_frames.push_back(json_writer_frame{m_open.size(), indent, 0, array, type});
+      m_open.push_back(&m_frames.back());
+      return m_open.back();
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    inline void json_writer::close_back()
+    {
+      json_writer_frame& frame = *m_open.back();
+      if (frame.array)
+      {
+        m_target += ']';
+      }
+      else
+      {
+        if (frame.count && m_insert_newlines)
+          m_target += "\r\n";
+        m_target.append(frame.indent * 2, ' ');
+        m_target += '}';
+      }
+      frame.level = -1;
+      m_open.pop_back();
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    inline bool json_writer::unwind_to(json_writer_frame* frame)
+    {
+      CHECK_AND_ASSERT_MES(frame && frame->level < m_open.size() && m_open[frame->level] == frame, false,
+        "json_writer: section or array is already closed");
+      while (m_open.back() != frame)
+        close_back();
+      return true;
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    inline bool json_writer::begin_field(const char* name, hsection& hparent_section)
+    {
+      CHECK_AND_ASSERT(name, false);
+      if (!hparent_section)
+        hparent_section = &m_frames.front();
+      CHECK_AND_ASSERT(!hparent_section->array, false);
+      if (!unwind_to(hparent_section))
+        return false;
+      if (hparent_section->count++)
+      {
+        m_target += ',';
+        if (m_insert_newlines)
+          m_target += "\r\n";
+      }
+      m_target.append((hparent_section->indent + 1) * 2, ' ');
+      m_target += '"';
+      misc_utils::parse::append_escape_sequence(m_target, name);
+      m_target += "\": ";
+      return true;
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    inline bool json_writer::begin_element(harray hval_array, uint8_t type)
+    {
+      CHECK_AND_ASSERT(hval_array && hval_array->array, false);
+      CHECK_AND_ASSERT_MES(hval_array->type == type, false, "json_writer: unexpected array element type");
+      if (!unwind_to(hval_array))
+        return false;
+      if (hval_array->count++)
+        m_target += ',';
+      return true;
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    template<class t_value>
+    void json_writer::put_value(const t_value& v, size_t indent)
+    {
+      json_append_stream ss{m_target};
+      dump_as_json(ss, v, indent, m_insert_newlines);
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    inline void json_writer::put_value(const std::string& v, size_t indent)
+    {
+      m_target += '"';
+      misc_utils::parse::append_escape_sequence(m_target, v);
+      m_target += '"';
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    inline json_writer::hsection json_writer::open_section(const char* section_name, hsection hparent_section, bool create_if_notexist)
+    {
+      TRY_ENTRY();
+      // earlier sections are gone by now, only new ones can be handed out
+      if (!create_if_notexist || !begin_field(section_name, hparent_section))
+        return nullptr;
+      m_target += '{';
+      if (m_insert_newlines)
+        m_target += "\r\n";
+      return push(false, hparent_section->indent + 1, SERIALIZE_TYPE_OBJECT);
+      CATCH_ENTRY("json_writer::open_section", nullptr);
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    template<class t_value>
+    bool json_writer::set_value(const char* value_name, t_value&& v, hsection hparent_section)
+    {
+      TRY_ENTRY();
+      if (!begin_field(value_name, hparent_section))
+        return false;
+      put_value(v, hparent_section->indent + 1);
+      return true;
+      CATCH_ENTRY("json_writer::set_value", false);
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    template<class t_value>
+    json_writer::harray json_writer::insert_first_value(const char* value_name, t_value&& target, hsection hparent_section)
+    {
+      using t_real_value = typename std::decay<t_value>::type;
+      TRY_ENTRY();
+      if (!begin_field(value_name, hparent_section))
+        return nullptr;
+      m_target += '[';
+      harray hval_array = push(true, hparent_section->indent + 1, binary_type_code<t_real_value>::value);
+      if (!insert_next_value(hval_array, std::forward<t_value>(target)))
+        return nullptr;
+      return hval_array;
+      CATCH_ENTRY("json_writer::insert_first_value", nullptr);
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    template<class t_value>
+    bool json_writer::insert_next_value(harray hval_array, t_value&& target)
+    {
+      using t_real_value = typename std::decay<t_value>::type;
+      TRY_ENTRY();
+      if (!begin_element(hval_array, binary_type_code<t_real_value>::value))
+        return false;
+      put_value(target, hval_array->indent);
+      return true;
+      CATCH_ENTRY("json_writer::insert_next_value", false);
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    inline json_writer::harray json_writer::insert_first_section(const char* section_name, hsection& hinserted_childsection, hsection hparent_section)
+    {
+      TRY_ENTRY();
+      if (!begin_field(section_name, hparent_section))
+        return nullptr;
+      m_target += '[';
+      harray hsec_array = push(true, hparent_section->indent + 1, SERIALIZE_TYPE_OBJECT);
+      if (!insert_next_section(hsec_array, hinserted_childsection))
+        return nullptr;
+      return hsec_array;
+      CATCH_ENTRY("json_writer::insert_first_section", nullptr);
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    inline bool json_writer::insert_next_section(harray hsec_array, hsection& hinserted_childsection)
+    {
+      TRY_ENTRY();
+      if (!begin_element(hsec_array, SERIALIZE_TYPE_OBJECT))
+        return false;
+      m_target += '{';
+      if (m_insert_newlines)
+        m_target += "\r\n";
+      hinserted_childsection = push(false, hsec_array->indent, SERIALIZE_TYPE_OBJECT);
+      return true;
+      CATCH_ENTRY("json_writer::insert_next_section", false);
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    inline bool json_writer::finish()
+    {
+      TRY_ENTRY();
+      while (!m_open.empty())
+        close_back();
+      return true;
+      CATCH_ENTRY("json_writer::finish", false);
+    }
+  }
+}
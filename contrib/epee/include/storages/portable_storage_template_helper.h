@@ -30,6 +30,7 @@
 
 #include "parserse_base_utils.h"
 #include "portable_storage.h"
+#include "portable_storage_direct.h"
 #include "file_io_utils.h"
 
 namespace epee
@@ -61,10 +62,10 @@ namespace epee
     template<class t_struct>
     bool store_t_to_json(t_struct& str_in, std::string& json_buff, size_t indent = 0, bool insert_newlines = true)
     {
-      portable_storage ps;
-      str_in.store(ps);
-      ps.dump_as_json(json_buff, indent, insert_newlines);
-      return true;
+      json_buff.clear();
+      json_writer writer(json_buff, indent, insert_newlines);
+      str_in.store(writer);
+      return writer.finish();
     }
     //-----------------------------------------------------------------------------------------------------------
     template<class t_struct>
@@ -86,12 +87,12 @@ namespace epee
     template<class t_struct>
     bool load_t_from_binary(t_struct& out, const epee::span<const uint8_t> binary_buff, const epee::serialization::portable_storage::limits_t *limits = NULL)
     {
-      portable_storage ps;
-      bool rs = ps.load_from_binary(binary_buff, limits);
+      binary_reader reader;
+      bool rs = reader.load_from_binary(binary_buff, limits);
       if(!rs)
         return false;
 
-      return out.load(ps);
+      return out.load(reader);
     }
     //-----------------------------------------------------------------------------------------------------------
     template<class t_struct>
@@ -113,9 +114,9 @@ namespace epee
     template<class t_struct>
     bool store_t_to_binary(t_struct& str_in, std::string& binary_buff, size_t indent = 0)
     {
-      portable_storage ps;
-      str_in.store(ps);
-      return ps.store_to_binary(binary_buff);
+      binary_writer writer;
+      str_in.store(writer);
+      return writer.store_to_binary(binary_buff);
     }
     //-----------------------------------------------------------------------------------------------------------
     template<class t_struct>
@@ -84,6 +84,20 @@ namespace epee
       return true;
     }
 
+    //! Stream that only counts what is written, to size the target before packing into it
+    struct size_counting_stream
+    {
+      size_t size = 0;
+      void write(const char*, size_t length) { size += length; }
+    };
+
+    //! Stream appending straight to a string, without the copy out of a stringstream
+    struct string_append_stream
+    {
+      std::string& target;
+      void write(const char* data, size_t length) { target.append(data, length); }
+    };
+
     template<class t_stream>
     struct array_entry_store_visitor: public boost::static_visitor<bool>
     {
@@ -137,6 +137,10 @@ connection_basic::connection_basic(boost::asio::ip::tcp::socket&& sock, std::sha
 	socket_(GET_IO_SERVICE(sock), get_context(m_state.get())),
 	m_want_close_connection(false),
 	m_was_shutdown(false),
+	m_send_que_inflight(0),
+	m_send_write_count(0),
+	m_send_write_bytes(0),
+	m_send_que_peak(0),
 	m_is_multithreaded(false),
 	m_ssl_support(ssl_support)
 {
@@ -162,6 +166,10 @@ connection_basic::connection_basic(boost::asio::io_service &io_service, std::sha
 	socket_(io_service, get_context(m_state.get())),
 	m_want_close_connection(false),
 	m_was_shutdown(false),
+	m_send_que_inflight(0),
+	m_send_write_count(0),
+	m_send_write_bytes(0),
+	m_send_que_peak(0),
 	m_is_multithreaded(false),
 	m_ssl_support(ssl_support)
 {
@@ -183,6 +191,9 @@ connection_basic::~connection_basic() noexcept(false) {
 	std::string remote_addr_str = "?";
 	try { boost::system::error_code e; remote_addr_str = socket().remote_endpoint(e).address().to_string(); } catch(...){} ;
 	_note("Destructing connection #"<<mI->m_peer_number << " to " << remote_addr_str);
+	if (m_send_write_count)
+		MDEBUG("Connection #" << mI->m_peer_number << " send stats: " << m_send_write_count << " writes, "
+		  << m_send_write_bytes / m_send_write_count << " B/write average, peak queue depth " << m_send_que_peak);
 }
 
 void connection_basic::set_rate_up_limit(uint64_t limit) {
@@ -236,33 +247,21 @@ int connection_basic::get_tos_flag() {
 }
 
 void connection_basic::sleep_before_packet(size_t packet_size, int phase,  int q_len) {
-	double delay=0; // will be calculated
-	do
-	{ // rate limiting
-		if (m_was_shutdown) {
-			_dbg2("m_was_shutdown - so abort sleep");
-			return;
-		}
-
-		{
-			CRITICAL_REGION_LOCAL(	network_throttle_manager::m_lock_get_global_throttle_out );
-			delay = network_throttle_manager::get_global_throttle_out().get_sleep_time_after_tick( packet_size );
-		}
-
-		delay *= 0.50;
-		if (delay > 0) {
-            long int ms = (long int)(delay * 1000);
-			MTRACE("Sleeping in " << __FUNCTION__ << " for " << ms << " ms before packet_size="<<packet_size); // debug sleep
-			boost::this_thread::sleep(boost::posix_time::milliseconds( ms ) );
-		}
-	} while(delay > 0);
-
-// XXX LATER XXX
-	{
-	  CRITICAL_REGION_LOCAL(	network_throttle_manager::m_lock_get_global_throttle_out );
-		network_throttle_manager::get_global_throttle_out().handle_trafic_exact( packet_size ); // increase counter - global
+	if (m_was_shutdown) {
+		_dbg2("m_was_shutdown - so abort sleep");
+		return;
+	}
+
+	// rate limiting: the token bucket gives the whole delay at once, without taking the lock
+	const double delay = network_throttle_manager::get_global_throttle_out().consume( packet_size );
+	if (delay > 0) {
+		long int ms = (long int)(delay * 1000);
+		MTRACE("Sleeping in " << __FUNCTION__ << " for " << ms << " ms before packet_size="<<packet_size); // debug sleep
+		boost::this_thread::sleep(boost::posix_time::milliseconds( ms ) );
 	}
 
+	network_throttle_manager::get_global_throttle_out().handle_trafic_exact( packet_size ); // increase counter - global, lock-free
+
 }
 
 void connection_basic::do_send_handler_write(const void* ptr , size_t cb ) {
@@ -64,6 +64,10 @@
 #undef WAZN_DEFAULT_LOG_CATEGORY
 #define WAZN_DEFAULT_LOG_CATEGORY "net.throttle"
 
+// a history slot keeps the second it counts in its high bits and the octets in the low ones,
+// so a packet is counted with one compare and swap, and a stale slot is recycled the same way
+#define THROTTLE_HISTORY_BYTES_BITS 36
+
 // ################################################################################################
 // ################################################################################################
 // the "header part". Not separeted out for .hpp because point of this modification is
@@ -113,30 +117,89 @@ namespace net_utils
 {
 
 // ================================================================================================
-// network_throttle
+// token_bucket
 // ================================================================================================
 
-network_throttle::~network_throttle() { }
+static uint64_t get_steady_time_us()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
-network_throttle::packet_info::packet_info()
-	: m_size(0)
+token_bucket::token_bucket()
+	: m_rate(0), m_tokens(0), m_last_refill(get_steady_time_us())
 {
 }
 
+void token_bucket::set_rate(uint64_t bytes_per_second)
+{
+	m_rate = bytes_per_second;
+	m_tokens = bytes_per_second; // start with a full second of burst
+	m_last_refill = get_steady_time_us();
+}
+
+uint64_t token_bucket::get_rate() const
+{
+	return m_rate;
+}
+
+void token_bucket::refill(uint64_t now_us)
+{
+	const uint64_t rate = m_rate;
+	uint64_t last = m_last_refill;
+	while (now_us > last)
+	{
+		const uint64_t elapsed = std::min<uint64_t>(now_us - last, 60000000); // bounded for overflow, the bucket itself caps at one second
+		const uint64_t tokens = rate * elapsed / 1000000;
+		if (tokens == 0)
+			return; // keep the fraction for later, instead of losing it
+		const uint64_t next = now_us - elapsed == last ? last + tokens * 1000000 / rate : now_us;
+		if (m_last_refill.compare_exchange_weak(last, next))
+		{
+			int64_t current = m_tokens;
+			while (!m_tokens.compare_exchange_weak(current, std::min<int64_t>(rate, current + tokens)))
+				;
+			return;
+		}
+	}
+}
+
+network_time_seconds token_bucket::consume(size_t bytes)
+{
+	return consume(bytes, get_steady_time_us());
+}
+
+network_time_seconds token_bucket::consume(size_t bytes, uint64_t now_us)
+{
+	const uint64_t rate = m_rate;
+	if (rate == 0)
+		return 0;
+	refill(now_us);
+	const int64_t left = m_tokens.fetch_sub(bytes) - int64_t(bytes);
+	return left >= 0 ? 0 : -left / double(rate);
+}
+
+// ================================================================================================
+// network_throttle
+// ================================================================================================
+
+static constexpr uint64_t history_bytes_mask = (uint64_t(1) << THROTTLE_HISTORY_BYTES_BITS) - 1;
+
+network_throttle::~network_throttle() { }
+
 network_throttle::network_throttle(const std::string &nameshort, const std::string &name, int window_size)
     : m_window_size( (window_size==-1) ? 10 : window_size  ),
-	  m_history( m_window_size ), m_nameshort(nameshort)
+	  m_history( new std::atomic<uint64_t>[m_window_size] ), m_nameshort(nameshort)
 {
 	set_name(name);
 	m_network_add_cost = 128;
 	m_network_minimal_segment = 256;
 	m_network_max_segment = 1024*1024;
-	m_start_time = 0;
-	m_any_packet_yet = false;
+	m_start_time = get_time_seconds();
 	m_slot_size = 1.0; // hard coded in few places
 	m_target_speed = 16 * 1024; // other defaults are probably defined in the command-line parsing code when this class is used e.g. as main global throttle
-	m_last_sample_time = 0;
-	m_history.resize(m_window_size);
+	m_bucket.set_rate(m_target_speed);
+	for (size_t i = 0; i < m_window_size; ++i)
+		m_history[i] = 0;
 	m_total_packets = 0;
 	m_total_bytes = 0;
 }
@@ -149,6 +212,7 @@ void network_throttle::set_name(const std::string &name)
 void network_throttle::set_target_speed( network_speed_kbps target )
 {
     m_target_speed = target * 1024;
+	m_bucket.set_rate(m_target_speed);
 	MINFO("Setting LIMIT: " << target << " kbps");
 }
 
@@ -159,28 +223,21 @@ network_speed_kbps network_throttle::get_target_speed()
 
 void network_throttle::tick()
 {
-	double time_now = get_time_seconds();
-	if (!m_any_packet_yet) m_start_time = time_now; // starting now
-
-	network_time_seconds current_sample_time_slot = time_to_slot( time_now ); // T=13.7 --> 13  (for 1-second smallwindow)
-	network_time_seconds last_sample_time_slot = time_to_slot( m_last_sample_time );
+	// the history is not rotated any more: each slot knows its second, and stale ones are
+	// recycled when counted into, or skipped when read
+}
 
-	// moving to next position, and filling gaps
-	// !! during this loop the m_last_sample_time and last_sample_time_slot mean the variable moved in +1
-	// TODO optimize when moving few slots at once
-	while ( (!m_any_packet_yet) || (last_sample_time_slot < current_sample_time_slot))
+size_t network_throttle::get_history_bytes(uint64_t slot, size_t slots) const
+{
+	size_t bytes = 0;
+	for (size_t i = 0; i < std::min<size_t>(slots, m_window_size) && i <= slot; ++i)
 	{
-		_dbg3("Moving counter buffer by 1 second " << last_sample_time_slot << " < " << current_sample_time_slot << " (last time " << m_last_sample_time<<")");
-		// rotate buffer
-		m_history.push_front(packet_info());
-		if (! m_any_packet_yet)
-		{
-			m_last_sample_time = time_now;
-		}
-		m_last_sample_time += 1;	last_sample_time_slot = time_to_slot( m_last_sample_time ); // increase and recalculate time, time slot
-		m_any_packet_yet=true;
+		const uint64_t sample_slot = slot - i;
+		const uint64_t sample = m_history[sample_slot % m_window_size];
+		if ((sample & ~history_bytes_mask) == (sample_slot << THROTTLE_HISTORY_BYTES_BITS))
+			bytes += sample & history_bytes_mask;
 	}
-	m_last_sample_time = time_now; // the real exact last time
+	return bytes;
 }
 
 void network_throttle::handle_trafic_exact(size_t packet_size)
@@ -190,15 +247,24 @@ void network_throttle::handle_trafic_exact(size_t packet_size)
 
 void network_throttle::_handle_trafic_exact(size_t packet_size, size_t orginal_size)
 {
-	tick();
-
-	calculate_times_struct cts ;  calculate_times(packet_size, cts , false, -1);
-	calculate_times_struct cts2;  calculate_times(packet_size, cts2, false, 5);
-	m_history.front().m_size += packet_size;
+	const uint64_t slot = time_to_slot( get_time_seconds() ); // T=13.7 --> 13  (for 1-second smallwindow)
+	const uint64_t tag = slot << THROTTLE_HISTORY_BYTES_BITS;
+	std::atomic<uint64_t> &sample = m_history[slot % m_window_size];
+	uint64_t current = sample, next;
+	do
+	{
+		const uint64_t bytes = (current & ~history_bytes_mask) == tag ? (current & history_bytes_mask) + packet_size : packet_size;
+		next = tag | std::min<uint64_t>(bytes, history_bytes_mask);
+	} while (!sample.compare_exchange_weak(current, next));
 	m_total_packets++;
 	m_total_bytes += packet_size;
 
-	std::ostringstream oss; oss << "["; 	for (auto sample: m_history) oss << sample.m_size << " ";	 oss << "]" << std::ends;
+	if (!ELPP->vRegistry()->allowed(el::Level::Trace, WAZN_DEFAULT_LOG_CATEGORY))
+		return; // everything below is only for the log, and is done for every packet
+
+	calculate_times_struct cts ;  calculate_times(packet_size, cts , false, -1);
+	calculate_times_struct cts2;  calculate_times(packet_size, cts2, false, 5);
+	std::ostringstream oss; oss << "["; 	for (size_t i = 0; i < m_window_size; ++i) oss << get_history_bytes(slot - i, 1) << " ";	 oss << "]" << std::ends;
 	std::string history_str = oss.str();
 
 	MTRACE("Throttle " << m_name << ": packet of ~"<<packet_size<<"b " << " (from "<<orginal_size<<" b)"
@@ -216,8 +282,11 @@ void network_throttle::handle_trafic_tcp(size_t packet_size)
 	_handle_trafic_exact( all_size , packet_size );
 }
 
+network_time_seconds network_throttle::consume(size_t packet_size) {
+	return m_bucket.consume(packet_size);
+}
+
 network_time_seconds network_throttle::get_sleep_time_after_tick(size_t packet_size) {
-	tick();
 	return get_sleep_time(packet_size);
 }
 
@@ -252,22 +321,23 @@ void network_throttle::calculate_times(size_t packet_size, calculate_times_struc
 		((force_window>0) ? force_window : m_window_size)
 	);
 
-	if (!m_any_packet_yet) {
+	if (m_total_packets == 0) {
 		cts.window=0; cts.average=0; cts.delay=0;
 		cts.recomendetDataSize = m_network_minimal_segment; // should be overrided by caller anyway
 		return ; // no packet yet, I can not decide about sleep time
 	}
 
+	const network_time_seconds time_now = get_time_seconds();
 	network_time_seconds window_len = (the_window_size-1) * m_slot_size ; // -1 since current slot is not finished
-	window_len += (m_last_sample_time - time_to_slot(m_last_sample_time));  // add the time for current slot e.g. 13.7-13 = 0.7
+	window_len += (time_now - time_to_slot(time_now));  // add the time for current slot e.g. 13.7-13 = 0.7
 
-	auto time_passed = get_time_seconds() - m_start_time;
+	auto time_passed = time_now - m_start_time;
 	cts.window = std::max( std::min( window_len , time_passed ) , m_slot_size )  ; // window length resulting from size of history but limited by how long ago history was started,
 	// also at least slot size (e.g. 1 second) to not be ridiculous
 	// window_len e.g. 5.7 because takes into account current slot time
 
-	size_t Epast = 0; // summ of traffic till now
-	for (auto sample : m_history) Epast += sample.m_size;
+	const uint64_t slot = time_to_slot(time_now);
+	const size_t Epast = get_history_bytes(slot, m_window_size); // summ of traffic till now
 
 	const size_t E = Epast;
 	const size_t Enow = Epast + packet_size ; // including the data we're about to send now
@@ -291,7 +361,7 @@ void network_throttle::calculate_times(size_t packet_size, calculate_times_struc
     }
 
 	if (dbg) {
-		std::ostringstream oss; oss << "["; 	for (auto sample: m_history) oss << sample.m_size << " ";	 oss << "]" << std::ends;
+		std::ostringstream oss; oss << "["; 	for (size_t i = 0; i < m_window_size; ++i) oss << get_history_bytes(slot - i, 1) << " ";	 oss << "]" << std::ends;
 		std::string history_str = oss.str();
 		MTRACE((cts.delay > 0 ? "SLEEP" : "")
 			<< "dbg " << m_name << ": "
@@ -303,7 +373,7 @@ void network_throttle::calculate_times(size_t packet_size, calculate_times_struc
             << "M=" << std::setw(8) << M <<" W="<< std::setw(8) << cts.window << " "
             << "R=" << std::setw(8) << cts.recomendetDataSize << " Wgood" << std::setw(8) << Wgood << " "
 			<< "History: " << std::setw(8) << history_str << " "
-			<< "m_last_sample_time=" << std::setw(8) << m_last_sample_time
+			<< "time_now=" << std::setw(8) << time_now
 		);
 
 	}
@@ -343,18 +413,12 @@ size_t network_throttle::get_recommended_size_of_planned_transport() const {
 }
 
 double network_throttle::get_current_speed() const {
-	unsigned int bytes_transferred = 0;
-	if (m_history.size() == 0 || m_slot_size == 0)
+	if (m_window_size < 2 || m_slot_size == 0)
 		return 0;
 
-	auto it = m_history.begin();
-	while (it < m_history.end() - 1)
-	{
-		bytes_transferred += it->m_size;
-		it ++;
-	}
-
-	return bytes_transferred / ((m_history.size() - 1) * m_slot_size);
+	// the oldest slot is left out, the current one is not finished yet
+	const size_t bytes_transferred = get_history_bytes(time_to_slot(get_time_seconds()), m_window_size - 1);
+	return bytes_transferred / ((m_window_size - 1) * m_slot_size);
 }
 
 void network_throttle::get_stats(uint64_t &total_packets, uint64_t &total_bytes) const {
@@ -1845,6 +1845,26 @@ public:
    */
   virtual uint64_t get_database_size() const = 0;
 
+  /**
+   * @brief get how long the oldest open read snapshot has been held
+   *
+   * Long-lived read snapshots keep old pages from being reused, so this
+   * is a useful health metric for readers that do not take the
+   * blockchain lock. Snapshots pinned by db_rtxn_guard are included.
+   *
+   * @return the age in milliseconds, or 0 if not tracked
+   */
+  virtual uint64_t get_read_txn_max_age() const { return 0; }
+
+  /**
+   * @brief get the time spent resizing the database
+   *
+   * Readers and writers are held back while the map is resized.
+   *
+   * @return the total time in milliseconds since startup, or 0 if not tracked
+   */
+  virtual uint64_t get_resize_time() const { return 0; }
+
   // TODO: this should perhaps be (or call) a series of functions which
   // progressively update through version updates
   /**
@@ -0,0 +1,94 @@
+// Copyright (c) 2019-2021 WAZN Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include <cstring>
+
+#include "key_image_filter.h"
+
+// under 0.5% false positives at capacity
+#define BITS_PER_KEY_IMAGE 12
+#define BITS_PER_LOOKUP 6
+
+namespace
+{
+  // splitmix64 finalizer, key images are points rather than uniform
+  // hashes, so don't use their bytes directly as bit positions
+  inline uint64_t mix(uint64_t x)
+  {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x;
+  }
+}
+
+namespace cryptonote
+{
+
+key_image_filter::key_image_filter(uint64_t capacity):
+  m_capacity(capacity),
+  m_size(0)
+{
+  m_num_blocks = (capacity * BITS_PER_KEY_IMAGE + sizeof(block_t) * 8 - 1) / (sizeof(block_t) * 8);
+  if (m_num_blocks == 0)
+    m_num_blocks = 1;
+  m_blocks.reset(new block_t[m_num_blocks]());
+}
+
+const key_image_filter::block_t &key_image_filter::locate(const crypto::key_image &ki, uint64_t &bits) const
+{
+  uint64_t w[4];
+  static_assert(sizeof(w) == sizeof(ki), "Unexpected key image size");
+  memcpy(w, &ki, sizeof(w));
+  bits = mix(w[1] ^ w[3]);
+  return m_blocks[mix(w[0] ^ w[2]) % m_num_blocks];
+}
+
+void key_image_filter::insert(const crypto::key_image &ki)
+{
+  uint64_t bits;
+  block_t &block = const_cast<block_t&>(locate(ki, bits));
+  for (int i = 0; i < BITS_PER_LOOKUP; ++i, bits >>= 9)
+    block.words[(bits >> 6) & 7].fetch_or(1ull << (bits & 63), std::memory_order_release);
+  ++m_size;
+}
+
+bool key_image_filter::may_contain(const crypto::key_image &ki) const
+{
+  uint64_t bits;
+  const block_t &block = locate(ki, bits);
+  for (int i = 0; i < BITS_PER_LOOKUP; ++i, bits >>= 9)
+    if (!(block.words[(bits >> 6) & 7].load(std::memory_order_acquire) & (1ull << (bits & 63))))
+      return false;
+  return true;
+}
+
+}
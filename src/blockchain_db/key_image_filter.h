@@ -0,0 +1,87 @@
+// Copyright (c) 2019-2021 WAZN Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include "crypto/crypto.h"
+
+namespace cryptonote
+{
+  /**
+   * @brief in-memory approximate set of spent key images
+   *
+   * A blocked Bloom filter: every key image maps to one 64 byte block and
+   * sets a handful of bits inside it, so a lookup touches a single cache
+   * line.  may_contain() never returns false for an inserted key image,
+   * which lets callers skip the database on a negative answer and only
+   * confirm positives there.
+   *
+   * Bits are never cleared, so removals are handled by leaving the key
+   * image in the filter; the only cost is an extra database lookup until
+   * the filter is rebuilt.  insert() may run concurrently with
+   * may_contain(), but only one thread may insert at a time.
+   */
+  class key_image_filter
+  {
+  public:
+    static constexpr uint64_t MIN_CAPACITY = 1 << 20;
+
+    /**
+     * @brief creates an empty filter sized for the given number of key images
+     *
+     * @param capacity the number of insertions before full() returns true
+     */
+    explicit key_image_filter(uint64_t capacity);
+
+    void insert(const crypto::key_image &ki);
+    bool may_contain(const crypto::key_image &ki) const;
+
+    uint64_t capacity() const { return m_capacity; }
+    uint64_t size() const { return m_size; }
+    bool full() const { return m_size >= m_capacity; }
+    size_t memory_usage() const { return m_num_blocks * sizeof(block_t); }
+
+  private:
+    struct block_t
+    {
+      std::atomic<uint64_t> words[8];
+    };
+
+    const block_t &locate(const crypto::key_image &ki, uint64_t &bits) const;
+
+    uint64_t m_capacity;
+    uint64_t m_size;
+    uint64_t m_num_blocks;
+    std::unique_ptr<block_t[]> m_blocks;
+  };
+}
@@ -30,6 +30,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
 #include <fcntl.h>
 #endif
 
@@ -40,6 +41,7 @@
 #include <boost/circular_buffer.hpp>
 #include <memory>  // std::unique_ptr
 #include <cstring>  // memcpy
+#include <numeric>  // std::iota
 
 #include "string_tools.h"
 #include "file_io_utils.h"
@@ -361,9 +363,16 @@ typedef struct outtx {
 
 std::atomic<uint64_t> mdb_txn_safe::num_active_txns{0};
 std::atomic_flag mdb_txn_safe::creation_gate = ATOMIC_FLAG_INIT;
+uint64_t mdb_txn_safe::gate_closed_at = 0;
+std::atomic<uint64_t> mdb_txn_safe::gate_closed_time{0};
 
 mdb_threadinfo::~mdb_threadinfo()
 {
+  if (m_ti_registry)
+  {
+    boost::lock_guard<boost::mutex> lock(m_ti_registry->m_lock);
+    m_ti_registry->m_threads.erase(this);
+  }
   MDB_cursor **cur = &m_ti_rcursors.m_txc_blocks;
   unsigned i;
   for (i=0; i<sizeof(mdb_txn_cursors)/sizeof(MDB_cursor *); i++)
@@ -456,6 +465,7 @@ uint64_t mdb_txn_safe::num_active_tx() const
 void mdb_txn_safe::prevent_new_txns()
 {
   while (creation_gate.test_and_set());
+  gate_closed_at = epee::misc_utils::get_tick_count();
 }
 
 void mdb_txn_safe::wait_no_active_txns()
@@ -463,9 +473,12 @@ void mdb_txn_safe::wait_no_active_txns()
   while (num_active_txns > 0);
 }
 
-void mdb_txn_safe::allow_new_txns()
+uint64_t mdb_txn_safe::allow_new_txns()
 {
+  const uint64_t closed_for = epee::misc_utils::get_tick_count() - gate_closed_at;
+  gate_closed_time += closed_for;
   creation_gate.clear();
+  return closed_for;
 }
 
 void lmdb_resized(MDB_env *env)
@@ -482,15 +495,14 @@ void lmdb_resized(MDB_env *env)
   mdb_txn_safe::wait_no_active_txns();
 
   int result = mdb_env_set_mapsize(env, 0);
+  const uint64_t stall = mdb_txn_safe::allow_new_txns();
   if (result)
     throw0(DB_ERROR(lmdb_error("Failed to set new mapsize: ", result).c_str()));
 
   mdb_env_info(env, &mei);
   uint64_t new_mapsize = mei.me_mapsize;
 
-  MGINFO("LMDB Mapsize increased." << "  Old: " << old / (1024 * 1024) << "MiB" << ", New: " << new_mapsize / (1024 * 1024) << "MiB");
-
-  mdb_txn_safe::allow_new_txns();
+  MGINFO("LMDB Mapsize increased." << "  Old: " << old / (1024 * 1024) << "MiB" << ", New: " << new_mapsize / (1024 * 1024) << "MiB" << ", txns held back for " << stall << " ms");
 }
 
 inline int lmdb_txn_begin(MDB_env *env, MDB_txn *parent, unsigned int flags, MDB_txn **txn)
@@ -562,8 +574,11 @@ void BlockchainLMDB::do_resize(uint64_t increase_size)
 
   new_mapsize += (new_mapsize % mst.ms_psize);
 
-  mdb_txn_safe::prevent_new_txns();
+  // grow the reservation at once, if the disk got room for it
+  if (m_reserve_mapsize)
+    new_mapsize = std::max(new_mapsize, get_reserved_mapsize());
 
+  // checked before closing the gate, which would otherwise stay closed
   if (m_write_txn != nullptr)
   {
     if (m_batch_active)
@@ -576,15 +591,83 @@ void BlockchainLMDB::do_resize(uint64_t increase_size)
     }
   }
 
+  mdb_txn_safe::prevent_new_txns();
+
   mdb_txn_safe::wait_no_active_txns();
 
   int result = mdb_env_set_mapsize(m_env, new_mapsize);
+  const uint64_t stall = mdb_txn_safe::allow_new_txns();
   if (result)
     throw0(DB_ERROR(lmdb_error("Failed to set new mapsize: ", result).c_str()));
 
-  MGINFO("LMDB Mapsize increased." << "  Old: " << mei.me_mapsize / (1024 * 1024) << "MiB" << ", New: " << new_mapsize / (1024 * 1024) << "MiB");
+  MGINFO("LMDB Mapsize increased." << "  Old: " << mei.me_mapsize / (1024 * 1024) << "MiB" << ", New: " << new_mapsize / (1024 * 1024) << "MiB" << ", txns held back for " << stall << " ms");
+}
 
-  mdb_txn_safe::allow_new_txns();
+// LMDB only grows the file as pages get written (short of MDB_WRITEMAP), so
+// on 64-bit systems a large map costs address space only. Reserving it well
+// ahead of the data makes resizes, which hold back every reader and cannot
+// happen inside a batch, all but disappear. There is no point in reserving
+// more than the disk could hold.
+uint64_t BlockchainLMDB::get_reserved_mapsize() const
+{
+  MDB_envinfo mei;
+  mdb_env_info(m_env, &mei);
+  MDB_stat mst;
+  mdb_env_stat(m_env, &mst);
+
+  uint64_t size = RESERVED_MAPSIZE;
+  try
+  {
+    boost::filesystem::space_info si = boost::filesystem::space(boost::filesystem::path(m_folder));
+    size = std::min<uint64_t>(size, mst.ms_psize * mei.me_last_pgno + si.available);
+  }
+  catch(...)
+  {
+    MWARNING("Unable to query free disk space.");
+  }
+#ifndef _WIN32
+  // leave address space for everything else when it is limited
+  struct rlimit rl;
+  if (getrlimit(RLIMIT_AS, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY)
+    size = std::min<uint64_t>(size, rl.rlim_cur / 2);
+#endif
+  size -= size % mst.ms_psize;
+  return std::max<uint64_t>(size, mei.me_mapsize);
+}
+
+// streams m_spent_keys into a fresh filter, with room to grow before the next rebuild
+void BlockchainLMDB::build_key_image_filter(MDB_txn *txn)
+{
+  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  TIME_MEASURE_START(t);
+
+  MDB_stat db_stats;
+  if (auto result = mdb_stat(txn, m_spent_keys, &db_stats))
+    throw0(DB_ERROR(lmdb_error("Failed to query m_spent_keys: ", result).c_str()));
+  const uint64_t capacity = std::max<uint64_t>(db_stats.ms_entries + db_stats.ms_entries / 2, key_image_filter::MIN_CAPACITY);
+  std::shared_ptr<key_image_filter> filter = std::make_shared<key_image_filter>(capacity);
+
+  MDB_cursor *cur;
+  if (auto result = mdb_cursor_open(txn, m_spent_keys, &cur))
+    throw0(DB_ERROR(lmdb_error("Failed to open cursor: ", result).c_str()));
+  MDB_val k = zerokval, v;
+  int result = mdb_cursor_get(cur, &k, &v, MDB_SET);
+  if (!result)
+    result = mdb_cursor_get(cur, &k, &v, MDB_GET_MULTIPLE);
+  while (!result)
+  {
+    const crypto::key_image *images = (const crypto::key_image*)v.mv_data;
+    for (size_t i = 0; i < v.mv_size / sizeof(crypto::key_image); ++i)
+      filter->insert(images[i]);
+    result = mdb_cursor_get(cur, &k, &v, MDB_NEXT_MULTIPLE);
+  }
+  mdb_cursor_close(cur);
+  if (result != MDB_NOTFOUND)
+    throw0(DB_ERROR(lmdb_error("Failed to enumerate key images: ", result).c_str()));
+
+  std::atomic_store(&m_key_image_filter, filter);
+  TIME_MEASURE_FINISH(t);
+  MINFO("Key image filter built for " << filter->size() << " key images (" << filter->memory_usage() / 1024 << " kB) in " << t << " ms");
 }
 
 // threshold_size is used for batch transactions
@@ -1240,6 +1323,15 @@ void BlockchainLMDB::add_spent_key(const crypto::key_image& k_image)
     else
       throw1(DB_ERROR(lmdb_error("Error adding spent key image to db transaction: ", result).c_str()));
   }
+
+  // must happen before the txn commits, readers trust the filter's negatives
+  if (m_key_image_filter)
+  {
+    if (m_key_image_filter->full())
+      build_key_image_filter(*m_write_txn);
+    else
+      m_key_image_filter->insert(k_image);
+  }
 }
 
 void BlockchainLMDB::remove_spent_key(const crypto::key_image& k_image)
@@ -1250,6 +1342,7 @@ void BlockchainLMDB::remove_spent_key(const crypto::key_image& k_image)
 
   CURSOR(spent_keys)
 
+  // the key image stays in m_key_image_filter, has_key_image falls back to the db for it
   MDB_val k = {sizeof(k_image), (void *)&k_image};
   auto result = mdb_cursor_get(m_cur_spent_keys, (MDB_val *)&zerokval, &k, MDB_GET_BOTH);
   if (result != 0 && result != MDB_NOTFOUND)
@@ -1289,6 +1382,8 @@ BlockchainLMDB::BlockchainLMDB(bool batch_transactions): BlockchainDB()
   m_batch_active = false;
   m_cum_size = 0;
   m_cum_count = 0;
+  m_rtxn_registry = std::make_shared<mdb_rtxn_registry>();
+  m_reserve_mapsize = false;
 
   // reset may also need changing when initialize things here
 
@@ -1402,6 +1497,21 @@ void BlockchainLMDB::open(const std::string& filename, const int db_flags)
     LOG_PRINT_L1("LMDB memory map size: " << cur_mapsize);
   }
 
+#if !defined(_WIN32)
+  m_reserve_mapsize = sizeof(void*) >= 8 && !(mdb_flags & (MDB_RDONLY | MDB_WRITEMAP));
+#endif
+  if (m_reserve_mapsize)
+  {
+    const uint64_t reserved_mapsize = get_reserved_mapsize();
+    if (reserved_mapsize > cur_mapsize)
+    {
+      if (auto result = mdb_env_set_mapsize(m_env, reserved_mapsize))
+        throw0(DB_ERROR(lmdb_error("Failed to reserve memory map size: ", result).c_str()));
+      cur_mapsize = reserved_mapsize;
+      LOG_PRINT_L1("LMDB memory map reserved: " << cur_mapsize);
+    }
+  }
+
   if (need_resize())
   {
     LOG_PRINT_L0("LMDB memory map needs to be resized, doing that now.");
@@ -1515,6 +1625,11 @@ void BlockchainLMDB::open(const std::string& filename, const int db_flags)
       txn.commit();
       m_open = true;
       migrate(db_version);
+
+      mdb_txn_safe filter_txn;
+      if (auto mdb_res = mdb_txn_begin(m_env, NULL, MDB_RDONLY, filter_txn))
+        throw0(DB_ERROR(lmdb_error("Failed to create a transaction for the db: ", mdb_res).c_str()));
+      build_key_image_filter(filter_txn);
       return;
     }
 #endif
@@ -1557,6 +1672,11 @@ void BlockchainLMDB::open(const std::string& filename, const int db_flags)
     }
   }
 
+  // other processes may write to a read-only opened db behind our back,
+  // which would leave the filter stale
+  if (!(mdb_flags & MDB_RDONLY))
+    build_key_image_filter(txn);
+
   // commit the transaction
   txn.commit();
 
@@ -1574,6 +1694,7 @@ void BlockchainLMDB::close()
   }
   this->sync();
   m_tinfo.reset();
+  std::atomic_store(&m_key_image_filter, std::shared_ptr<key_image_filter>());
 
   // FIXME: not yet thread safe!!!  Use with care.
   mdb_env_close(m_env);
@@ -1650,6 +1771,8 @@ void BlockchainLMDB::reset()
   txn.commit();
   m_cum_size = 0;
   m_cum_count = 0;
+  if (m_key_image_filter)
+    std::atomic_store(&m_key_image_filter, std::make_shared<key_image_filter>(key_image_filter::MIN_CAPACITY));
 }
 
 std::vector<std::string> BlockchainLMDB::get_filenames() const
@@ -3531,6 +3654,12 @@ bool BlockchainLMDB::has_key_image(const crypto::key_image& img) const
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
   check_open();
 
+  // key images enter the filter before their txn commits, so a negative
+  // holds for any snapshot a read txn started here could see
+  const std::shared_ptr<key_image_filter> filter = std::atomic_load(&m_key_image_filter);
+  if (filter && !filter->may_contain(img))
+    return false;
+
   bool ret;
 
   TXN_PREFIX_RDONLY();
@@ -3929,6 +4058,12 @@ bool BlockchainLMDB::block_rtxn_start(MDB_txn **mtxn, mdb_txn_cursors **mcur) co
     memset(&tinfo->m_ti_rflags, 0, sizeof(tinfo->m_ti_rflags));
     if (auto mdb_res = lmdb_txn_begin(m_env, NULL, MDB_RDONLY, &tinfo->m_ti_rtxn))
       throw0(DB_ERROR_TXN_START(lmdb_error("Failed to create a read transaction for the db: ", mdb_res).c_str()));
+    tinfo->m_ti_rtxn_start = 0;
+    tinfo->m_ti_registry = m_rtxn_registry;
+    {
+      boost::lock_guard<boost::mutex> lock(m_rtxn_registry->m_lock);
+      m_rtxn_registry->m_threads.insert(tinfo);
+    }
     ret = true;
   } else if (!tinfo->m_ti_rflags.m_rf_txn)
   {
@@ -3937,7 +4072,10 @@ bool BlockchainLMDB::block_rtxn_start(MDB_txn **mtxn, mdb_txn_cursors **mcur) co
     ret = true;
   }
   if (ret)
+  {
     tinfo->m_ti_rflags.m_rf_txn = true;
+    tinfo->m_ti_rtxn_start = epee::misc_utils::get_tick_count();
+  }
   *mtxn = tinfo->m_ti_rtxn;
   *mcur = &tinfo->m_ti_rcursors;
 
@@ -3949,6 +4087,9 @@ bool BlockchainLMDB::block_rtxn_start(MDB_txn **mtxn, mdb_txn_cursors **mcur) co
 void BlockchainLMDB::block_rtxn_stop() const
 {
   LOG_PRINT_L3("BlockchainLMDB::" << __func__);
+  const uint64_t age = epee::misc_utils::get_tick_count() - m_tinfo->m_ti_rtxn_start.exchange(0);
+  if (age > 60000)
+    MWARNING("Read snapshot was held for " << age << " ms, old pages could not be reused meanwhile");
   mdb_txn_reset(m_tinfo->m_ti_rtxn);
   memset(&m_tinfo->m_ti_rflags, 0, sizeof(m_tinfo->m_ti_rflags));
 }
@@ -4123,41 +4264,90 @@ void BlockchainLMDB::get_output_key(const epee::span<const uint64_t> &amounts, c
   TIME_MEASURE_START(db3);
   check_open();
   outputs.clear();
-  outputs.reserve(offsets.size());
+  outputs.resize(offsets.size());
+
+  const auto amount_of = [&](size_t i) { return amounts.size() == 1 ? amounts[0] : amounts[i]; };
+
+  // An amount's outputs are one sorted array of fixed size records
+  // (MDB_DUPFIXED), so visit them in (amount, index) order: after a search,
+  // every other requested output on the same page is read straight off it,
+  // nearby pages are reached by stepping to the sibling page rather than
+  // searching again, and pages are touched in file order.
+  std::vector<size_t> order(offsets.size());
+  std::iota(order.begin(), order.end(), 0);
+  const auto by_key = [&](size_t a, size_t b) { return std::make_pair(amount_of(a), offsets[a]) < std::make_pair(amount_of(b), offsets[b]); };
+  if (!std::is_sorted(order.begin(), order.end(), by_key))
+    std::sort(order.begin(), order.end(), by_key);
 
   TXN_PREFIX_RDONLY();
 
   RCURSOR(output_amounts);
 
-  for (size_t i = 0; i < offsets.size(); ++i)
+  size_t missing = offsets.size(); // first missing output, in request order
+  const uint8_t *page = nullptr;
+  uint64_t page_amount = 0;
+  size_t page_records = 0, record_size = 0;
+  for (const size_t i: order)
   {
-    const uint64_t amount = amounts.size() == 1 ? amounts[0] : amounts[i];
-    MDB_val_set(k, amount);
-    MDB_val_set(v, offsets[i]);
+    if (i > missing)
+      continue;
+    const uint64_t amount = amount_of(i);
+    const uint64_t index = offsets[i];
 
-    auto get_result = mdb_cursor_get(m_cur_output_amounts, &k, &v, MDB_GET_BOTH);
-    if (get_result == MDB_NOTFOUND)
+    const uint8_t *record = nullptr;
+    if (page && amount == page_amount)
     {
-      if (allow_partial)
+      uint64_t first = *(const uint64_t *)page; // amount_index of the page's first record
+      while (index >= first + page_records && index - first < 4 * page_records)
       {
-        MDEBUG("Partial result: " << outputs.size() << "/" << offsets.size());
-        break;
+        MDB_val k, records = {0, nullptr};
+        if (mdb_cursor_get(m_cur_output_amounts, &k, &records, MDB_NEXT_MULTIPLE) || !records.mv_data)
+        {
+          page = nullptr;
+          break;
+        }
+        page = (const uint8_t *)records.mv_data;
+        page_records = records.mv_size / record_size;
+        first = *(const uint64_t *)page;
+      }
+      if (page && index >= first && index - first < page_records && *(const uint64_t *)(page + (index - first) * record_size) == index)
+        record = page + (index - first) * record_size;
+    }
+    if (!record)
+    {
+      MDB_val_set(k, amount);
+      MDB_val_set(v, index);
+      auto get_result = mdb_cursor_get(m_cur_output_amounts, &k, &v, MDB_GET_BOTH);
+      if (get_result == MDB_NOTFOUND)
+      {
+        missing = i;
+        page = nullptr;
+        continue;
+      }
+      else if (get_result)
+        throw0(DB_ERROR(lmdb_error("Error attempting to retrieve an output pubkey from the db", get_result).c_str()));
+      record = (const uint8_t *)v.mv_data;
+
+      MDB_val records = {0, nullptr};
+      page = nullptr;
+      if (mdb_cursor_get(m_cur_output_amounts, &k, &records, MDB_GET_MULTIPLE) == 0 && records.mv_data)
+      {
+        page = (const uint8_t *)records.mv_data;
+        page_amount = amount;
+        record_size = amount == 0 ? sizeof(outkey) : sizeof(pre_rct_outkey);
+        page_records = records.mv_size / record_size;
       }
-      throw1(OUTPUT_DNE((std::string("Attempting to get output pubkey by global index (amount ") + boost::lexical_cast<std::string>(amount) + ", index " + boost::lexical_cast<std::string>(offsets[i]) + ", count " + boost::lexical_cast<std::string>(get_num_outputs(amount)) + "), but key does not exist (current height " + boost::lexical_cast<std::string>(height()) + ")").c_str()));
     }
-    else if (get_result)
-      throw0(DB_ERROR(lmdb_error("Error attempting to retrieve an output pubkey from the db", get_result).c_str()));
 
     if (amount == 0)
     {
-      const outkey *okp = (const outkey *)v.mv_data;
-      outputs.push_back(okp->data);
+      const outkey *okp = (const outkey *)record;
+      outputs[i] = okp->data;
     }
     else
     {
-      const pre_rct_outkey *okp = (const pre_rct_outkey *)v.mv_data;
-      outputs.resize(outputs.size() + 1);
-      output_data_t &data = outputs.back();
+      const pre_rct_outkey *okp = (const pre_rct_outkey *)record;
+      output_data_t &data = outputs[i];
       memcpy(&data, &okp->data, sizeof(pre_rct_output_data_t));
       data.commitment = rct::zeroCommit(amount);
     }
@@ -4165,6 +4355,14 @@ void BlockchainLMDB::get_output_key(const epee::span<const uint64_t> &amounts, c
 
   TXN_POSTFIX_RDONLY();
 
+  if (missing < offsets.size())
+  {
+    if (!allow_partial)
+      throw1(OUTPUT_DNE((std::string("Attempting to get output pubkey by global index (amount ") + boost::lexical_cast<std::string>(amount_of(missing)) + ", index " + boost::lexical_cast<std::string>(offsets[missing]) + ", count " + boost::lexical_cast<std::string>(get_num_outputs(amount_of(missing))) + "), but key does not exist (current height " + boost::lexical_cast<std::string>(height()) + ")").c_str()));
+    MDEBUG("Partial result: " << missing << "/" << offsets.size());
+    outputs.resize(missing);
+  }
+
   TIME_MEASURE_FINISH(db3);
   LOG_PRINT_L3("db3: " << db3);
 }
@@ -4531,6 +4729,25 @@ uint64_t BlockchainLMDB::get_database_size() const
   return size;
 }
 
+uint64_t BlockchainLMDB::get_read_txn_max_age() const
+{
+  const uint64_t now = epee::misc_utils::get_tick_count();
+  uint64_t max_age = 0;
+  boost::lock_guard<boost::mutex> lock(m_rtxn_registry->m_lock);
+  for (const mdb_threadinfo *tinfo: m_rtxn_registry->m_threads)
+  {
+    const uint64_t start = tinfo->m_ti_rtxn_start;
+    if (start && now > start)
+      max_age = std::max(max_age, now - start);
+  }
+  return max_age;
+}
+
+uint64_t BlockchainLMDB::get_resize_time() const
+{
+  return mdb_txn_safe::gate_closed_time;
+}
+
 // void BlockchainLMDB::fixup()
 // {
 //  LOG_PRINT_L3("BlockchainLMDB::" << __func__);
@@ -28,11 +28,15 @@
 #pragma once
 
 #include <atomic>
+#include <memory>
+#include <unordered_set>
 
 #include "blockchain_db/blockchain_db.h"
+#include "blockchain_db/key_image_filter.h"
 #include "cryptonote_basic/blobdatatype.h" // for type blobdata
 #include "ringct/rctTypes.h"
 #include <boost/thread/tss.hpp>
+#include <boost/thread/mutex.hpp>
 
 #include <lmdb.h>
 
@@ -117,11 +121,22 @@ typedef struct mdb_rflags
   bool m_rf_properties;
 } mdb_rflags;
 
+struct mdb_threadinfo;
+
+// the per-thread read txns of a db, so the age of the open ones can be reported
+struct mdb_rtxn_registry
+{
+  boost::mutex m_lock;
+  std::unordered_set<const mdb_threadinfo*> m_threads;
+};
+
 typedef struct mdb_threadinfo
 {
   MDB_txn *m_ti_rtxn;	// per-thread read txn
   mdb_txn_cursors m_ti_rcursors;	// per-thread read cursors
   mdb_rflags m_ti_rflags;	// per-thread read state
+  std::atomic<uint64_t> m_ti_rtxn_start;	// tick count when the read txn was last begun/renewed, 0 while it is reset
+  std::shared_ptr<mdb_rtxn_registry> m_ti_registry;	// where this read txn is registered, if anywhere
 
   ~mdb_threadinfo();
 } mdb_threadinfo;
@@ -154,7 +169,8 @@ struct mdb_txn_safe
 
   static void prevent_new_txns();
   static void wait_no_active_txns();
-  static void allow_new_txns();
+  // returns how long new txns were held back, in ms
+  static uint64_t allow_new_txns();
 
   mdb_threadinfo* m_tinfo;
   MDB_txn* m_txn;
@@ -164,6 +180,8 @@ struct mdb_txn_safe
 
   // could use a mutex here, but this should be sufficient.
   static std::atomic_flag creation_gate;
+  static uint64_t gate_closed_at; // only touched while holding creation_gate
+  static std::atomic<uint64_t> gate_closed_time; // ms, total for map resizes
 };
 
 
@@ -362,6 +380,10 @@ private:
   void check_mmap_support();
   void do_resize(uint64_t size_increase=0);
 
+  uint64_t get_reserved_mapsize() const;
+
+  void build_key_image_filter(MDB_txn *txn);
+
   bool need_resize(uint64_t threshold_size=0) const;
   void check_and_resize_for_batch(uint64_t batch_num_blocks, uint64_t batch_bytes);
   uint64_t get_estimated_batch_size(uint64_t batch_num_blocks, uint64_t batch_bytes) const;
@@ -418,6 +440,10 @@ private:
 
   virtual uint64_t get_database_size() const;
 
+  virtual uint64_t get_read_txn_max_age() const;
+
+  virtual uint64_t get_resize_time() const;
+
   std::vector<uint64_t> get_block_info_64bit_fields(uint64_t start_height, size_t count, off_t offset) const;
 
   uint64_t get_max_block_size();
@@ -488,6 +514,9 @@ private:
 
   mdb_txn_cursors m_wcursors;
   mutable boost::thread_specific_ptr<mdb_threadinfo> m_tinfo;
+  std::shared_ptr<mdb_rtxn_registry> m_rtxn_registry; // outlives the db for threads still holding a read txn
+  bool m_reserve_mapsize; // map is reserved ahead of the data, see get_reserved_mapsize
+  std::shared_ptr<key_image_filter> m_key_image_filter; // null when disabled, swapped atomically on rebuild
 
 #if defined(__arm__)
   // force a value so it can compile with 32-bit ARM
@@ -501,6 +530,9 @@ private:
 #endif
 
   constexpr static float RESIZE_PERCENT = 0.9f;
+
+  // upper bound for the map reserved up front on 64-bit systems
+  constexpr static uint64_t RESERVED_MAPSIZE = 1LL << 40;
 };
 
 }  // namespace cryptonote
@@ -51,6 +51,7 @@ int main(int argc, char* argv[])
   uint64_t block_start = 0;
   uint64_t block_stop = 0;
   bool blocks_dat = false;
+  bool indexed = false;
 
   tools::on_startup();
 
@@ -63,6 +64,7 @@ int main(int argc, char* argv[])
   const command_line::arg_descriptor<uint64_t> arg_block_start = {"block-start", "Start at block number", block_start};
   const command_line::arg_descriptor<uint64_t> arg_block_stop = {"block-stop", "Stop at block number", block_stop};
   const command_line::arg_descriptor<bool> arg_blocks_dat = {"blocksdat", "Output in blocks.dat format", blocks_dat};
+  const command_line::arg_descriptor<bool> arg_indexed = {"indexed", "Output checksummed, compressed chunks with a height index (bootstrap format v2)", indexed};
 
 
   command_line::add_arg(desc_cmd_sett, cryptonote::arg_data_dir);
@@ -73,6 +75,7 @@ int main(int argc, char* argv[])
   command_line::add_arg(desc_cmd_sett, arg_block_start);
   command_line::add_arg(desc_cmd_sett, arg_block_stop);
   command_line::add_arg(desc_cmd_sett, arg_blocks_dat);
+  command_line::add_arg(desc_cmd_sett, arg_indexed);
 
   command_line::add_arg(desc_cmd_only, command_line::arg_help);
 
@@ -114,6 +117,12 @@ int main(int argc, char* argv[])
     return 1;
   }
   bool opt_blocks_dat = command_line::get_arg(vm, arg_blocks_dat);
+  bool opt_indexed = command_line::get_arg(vm, arg_indexed);
+  if (opt_blocks_dat && opt_indexed)
+  {
+    std::cerr << "Can't specify both --blocksdat and --indexed" << std::endl;
+    return 1;
+  }
 
   std::string m_config_folder;
 
@@ -183,7 +192,7 @@ int main(int argc, char* argv[])
   else
   {
     BootstrapFile bootstrap;
-    r = bootstrap.store_blockchain_raw(core_storage, NULL, output_file_path, block_start, block_stop);
+    r = bootstrap.store_blockchain_raw(core_storage, NULL, output_file_path, block_start, block_stop, opt_indexed);
   }
   CHECK_AND_ASSERT_MES(r, 1, "Failed to export blockchain raw data");
   LOG_PRINT_L0("Blockchain raw data exported OK");
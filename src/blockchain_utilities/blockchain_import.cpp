@@ -38,11 +38,13 @@
 #include "misc_log_ex.h"
 #include "bootstrap_file.h"
 #include "bootstrap_serialization.h"
+#include "import_reader.h"
 #include "blocks/blocks.h"
 #include "cryptonote_basic/cryptonote_format_utils.h"
 #include "serialization/binary_utils.h" // dump_binary(), parse_binary()
 #include "serialization/json_utils.h" // dump_json()
 #include "include_base_utils.h"
+#include "common/threadpool.h"
 #include "cryptonote_core/cryptonote_core.h"
 
 #undef WAZN_DEFAULT_LOG_CATEGORY
@@ -70,6 +72,13 @@ uint64_t db_batch_size = 100;
 // frequently saved
 uint64_t db_batch_size_verify = 5000;
 
+// number of blocks read and deserialized ahead of the import
+uint64_t read_ahead_blocks = 1000;
+const size_t read_buffer_size = 4 * 1024 * 1024;
+
+// kept next to the database, lets --resume skip scanning the bootstrap file
+const char IMPORT_CHECKPOINT_FILENAME[] = "import.checkpoint";
+
 std::string refresh_string = "\r                                    \r";
 }
 
@@ -128,7 +137,14 @@ int pop_blocks(cryptonote::core& core, int num_blocks)
   return num_blocks;
 }
 
-int check_flush(cryptonote::core &core, std::vector<block_complete_entry> &blocks, bool force)
+// a block read and deserialized ahead of being imported
+boost::filesystem::path get_checkpoint_path(cryptonote::core &core)
+{
+  const std::vector<std::string> filenames = core.get_blockchain_storage().get_db().get_filenames();
+  return boost::filesystem::path(filenames.front()).parent_path() / IMPORT_CHECKPOINT_FILENAME;
+}
+
+int check_flush(cryptonote::core &core, std::vector<block_complete_entry> &blocks, std::vector<crypto::hash> &hashes, bool force)
 {
   if (blocks.empty())
     return 0;
@@ -140,19 +156,6 @@ int check_flush(cryptonote::core &core, std::vector<block_complete_entry> &block
   if (!force && new_height % HASH_OF_HASHES_STEP)
     return 0;
 
-  std::vector<crypto::hash> hashes;
-  for (const auto &b: blocks)
-  {
-    cryptonote::block block;
-    if (!parse_and_validate_block_from_blob(b.block, block))
-    {
-      MERROR("Failed to parse block: "
-          << epee::string_tools::pod_to_hex(get_blob_hash(b.block)));
-      core.cleanup_handle_incoming_blocks();
-      return 1;
-    }
-    hashes.push_back(cryptonote::get_block_hash(block));
-  }
   core.prevalidate_block_hashes(core.get_blockchain_storage().get_db().height(), hashes, {});
 
   std::vector<block> pblocks;
@@ -210,6 +213,7 @@ int check_flush(cryptonote::core &core, std::vector<block_complete_entry> &block
     return 1;
 
   blocks.clear();
+  hashes.clear();
   return 0;
 }
 
@@ -228,17 +232,58 @@ int import_from_file(cryptonote::core& core, const std::string& import_file_path
     return false;
   }
 
+  // large sequential reads, the file is only ever read front to back
+  std::unique_ptr<char[]> read_buffer(new char[read_buffer_size]);
+  std::ifstream import_file;
+  import_file.rdbuf()->pubsetbuf(read_buffer.get(), read_buffer_size);
+  import_file.open(import_file_path, std::ios_base::binary | std::ifstream::in);
+  if (import_file.fail())
+  {
+    MFATAL("import_file.open() fail");
+    return false;
+  }
+
+  // 4 byte magic + (currently) 1024 byte header structures
+  BootstrapFile bootstrap;
+  uint8_t major_version, minor_version;
   uint64_t block_first, block_last;
+  bootstrap.seek_to_first_chunk(import_file, major_version, minor_version, block_first, block_last);
+
   uint64_t start_height = 1, seek_height;
   if (opt_resume)
     start_height = core.get_blockchain_storage().get_current_blockchain_height();
 
   seek_height = start_height;
-  BootstrapFile bootstrap;
   std::streampos pos;
-  // BootstrapFile bootstrap(import_file_path);
-  uint64_t total_source_blocks = bootstrap.count_blocks(import_file_path, pos, seek_height, block_first);
+  uint64_t total_source_blocks;
+  const boost::filesystem::path checkpoint_path = get_checkpoint_path(core);
+  import_checkpoint checkpoint;
+  // indexed files seek through their own index instead
+  const bool use_checkpoint = major_version < 2;
+  if (opt_resume && use_checkpoint && load_import_checkpoint(checkpoint_path, import_file_path, core.get_blockchain_storage().get_db(), checkpoint))
+  {
+    // the block count was taken by scanning the file when the import started,
+    // the header's block_last is not kept up to date by every exporter
+    MINFO("Resuming from import checkpoint at height " << checkpoint.height);
+    total_source_blocks = checkpoint.source_blocks;
+    pos = checkpoint.pos;
+    seek_height = checkpoint.height;
+  }
+  else
+  {
+    // BootstrapFile bootstrap(import_file_path);
+    total_source_blocks = bootstrap.count_blocks(import_file_path, pos, seek_height, block_first);
+  }
   MINFO("bootstrap file last block number: " << total_source_blocks+block_first-1 << " (zero-based height)  total blocks: " << total_source_blocks);
+  import_source source;
+  source.major_version = major_version;
+  source.file_size = boost::filesystem::file_size(fs_import_file_path);
+  if (major_version >= 2)
+    source.index = bootstrap.get_source_index();
+
+  const auto store_checkpoint = [&](uint64_t end_pos) {
+    store_import_checkpoint(checkpoint_path, import_file_path, core.get_blockchain_storage().get_db(), end_pos, total_source_blocks);
+  };
 
   if (total_source_blocks+block_first-1 <= start_height)
   {
@@ -249,27 +294,8 @@ int import_from_file(cryptonote::core& core, const std::string& import_file_path
   std::cout << "Preparing to read blocks..." << ENDL;
   std::cout << ENDL;
 
-  std::ifstream import_file;
-  import_file.open(import_file_path, std::ios_base::binary | std::ifstream::in);
-
   uint64_t h = 0;
   uint64_t num_imported = 0;
-  if (import_file.fail())
-  {
-    MFATAL("import_file.open() fail");
-    return false;
-  }
-
-  // 4 byte magic + (currently) 1024 byte header structures
-  uint8_t major_version, minor_version;
-  uint64_t dummy;
-  bootstrap.seek_to_first_chunk(import_file, major_version, minor_version, dummy, dummy);
-
-  std::string str1;
-  char buffer1[1024];
-  char buffer_block[BUFFER_SIZE];
-  block b;
-  transaction tx;
   int quit = 0;
   uint64_t bytes_read;
 
@@ -292,8 +318,21 @@ int import_from_file(cryptonote::core& core, const std::string& import_file_path
   std::cout << ENDL;
 
   std::vector<block_complete_entry> blocks;
+  std::vector<crypto::hash> hashes;
+  import_group group, next_group;
+  uint64_t import_pos, first_pos, imported_pos;
+  uint64_t skip_blocks = 0;
 
   // Skip to start_height before we start adding.
+  if (major_version >= 2)
+  {
+    // chunks hold many blocks, the leading ones are dropped as they are read
+    import_file.seekg(pos);
+    bytes_read = 0;
+    skip_blocks = start_height - seek_height;
+    h = start_height;
+  }
+  else
   {
     bool q2 = false;
     import_file.seekg(pos);
@@ -305,109 +344,55 @@ int import_from_file(cryptonote::core& core, const std::string& import_file_path
     }
     h = start_height;
   }
+  import_pos = first_pos = imported_pos = import_file.tellg();
 
   if (use_batch)
   {
-    uint64_t bytes, h2;
+    uint64_t bytes = 0, h2;
     bool q2;
-    pos = import_file.tellg();
-    bytes = bootstrap.count_bytes(import_file, db_batch_size, h2, q2);
-    if (import_file.eof())
-      import_file.clear();
-    import_file.seekg(pos);
-    core.get_blockchain_storage().get_db().batch_start(db_batch_size, bytes);
-  }
-  while (! quit)
-  {
-    uint32_t chunk_size;
-    import_file.read(buffer1, sizeof(chunk_size));
-    // TODO: bootstrap.read_chunk();
-    if (! import_file) {
-      std::cout << refresh_string;
-      MINFO("End of file reached");
-      quit = 1;
-      break;
-    }
-    bytes_read += sizeof(chunk_size);
-
-    str1.assign(buffer1, sizeof(chunk_size));
-    if (! ::serialization::parse_binary(str1, chunk_size))
+    if (major_version < 2)
     {
-      throw std::runtime_error("Error in deserialization of chunk size");
-    }
-    MDEBUG("chunk_size: " << chunk_size);
-
-    if (chunk_size > BUFFER_SIZE)
-    {
-      MWARNING("WARNING: chunk_size " << chunk_size << " > BUFFER_SIZE " << BUFFER_SIZE);
-      throw std::runtime_error("Aborting: chunk size exceeds buffer size");
-    }
-    if (chunk_size > CHUNK_SIZE_WARNING_THRESHOLD)
-    {
-      MINFO("NOTE: chunk_size " << chunk_size << " > " << CHUNK_SIZE_WARNING_THRESHOLD);
-    }
-    else if (chunk_size == 0) {
-      MFATAL("ERROR: chunk_size == 0");
-      return 2;
-    }
-    import_file.read(buffer_block, chunk_size);
-    if (! import_file) {
+      bytes = bootstrap.count_bytes(import_file, db_batch_size, h2, q2);
       if (import_file.eof())
-      {
-        std::cout << refresh_string;
-        MINFO("End of file reached - file was truncated");
-        quit = 1;
-        break;
-      }
-      else
-      {
-        MFATAL("ERROR: unexpected end of file: bytes read before error: "
-            << import_file.gcount() << " of chunk_size " << chunk_size);
-        return 2;
-      }
+        import_file.clear();
+      import_file.seekg(import_pos);
     }
-    bytes_read += chunk_size;
-    MDEBUG("Total bytes read: " << bytes_read);
+    core.get_blockchain_storage().get_db().batch_start(db_batch_size, bytes);
+  }
 
-    if (h > block_stop)
-    {
-      std::cout << refresh_string << "block " << h-1
-        << " / " << block_stop
-        << "\r" << std::flush;
-      std::cout << ENDL << ENDL;
-      MINFO("Specified block number reached - stopping.  block: " << h-1 << "  total blocks: " << h);
-      quit = 1;
-      break;
-    }
+  // blocks are read and deserialized one group ahead of the one being imported
+  read_import_group(import_file, source, read_ahead_blocks, import_pos, group);
+  while (! quit)
+  {
+    boost::thread reader;
+    if (!group.quit)
+      reader = boost::thread([&]() { read_import_group(import_file, source, read_ahead_blocks, import_pos, next_group); });
 
+    int display_interval = 1000;
+    int progress_interval = 10;
     try
     {
-      str1.assign(buffer_block, chunk_size);
-      bootstrap::block_package bp;
-      bool res;
-      if (major_version == 0)
+      for (import_block &ib: group.blocks)
       {
-        bootstrap::block_package_1 bp1;
-        res = ::serialization::parse_binary(str1, bp1);
-        if (res)
+        if (skip_blocks)
         {
-          bp.block = std::move(bp1.block);
-          bp.txs = std::move(bp1.txs);
-          bp.block_weight = bp1.block_weight;
-          bp.cumulative_difficulty = bp1.cumulative_difficulty;
-          bp.coins_generated = bp1.coins_generated;
+          --skip_blocks;
+          imported_pos = ib.end_pos;
+          continue;
         }
-      }
-      else
-        res = ::serialization::parse_binary(str1, bp);
-      if (!res)
-        throw std::runtime_error("Error in deserialization of chunk");
-
-      int display_interval = 1000;
-      int progress_interval = 10;
-      // NOTE: use of NUM_BLOCKS_PER_CHUNK is a placeholder in case multi-block chunks are later supported.
-      for (int chunk_ind = 0; chunk_ind < NUM_BLOCKS_PER_CHUNK; ++chunk_ind)
-      {
+        if (h > block_stop)
+        {
+          std::cout << refresh_string << "block " << h-1
+            << " / " << block_stop
+            << "\r" << std::flush;
+          std::cout << ENDL << ENDL;
+          MINFO("Specified block number reached - stopping.  block: " << h-1 << "  total blocks: " << h);
+          quit = 1;
+          break;
+        }
+
+        bytes_read += ib.end_pos - imported_pos;
+        imported_pos = ib.end_pos;
         ++h;
         if ((h-1) % display_interval == 0)
         {
@@ -418,8 +403,7 @@ int import_from_file(cryptonote::core& core, const std::string& import_file_path
         {
           MDEBUG("loading block number " << h-1);
         }
-        b = bp.block;
-        MDEBUG("block prev_id: " << b.prev_id << ENDL);
+        MDEBUG("block prev_id: " << ib.blk.prev_id << ENDL);
 
         if ((h-1) % progress_interval == 0)
         {
@@ -430,60 +414,30 @@ int import_from_file(cryptonote::core& core, const std::string& import_file_path
 
         if (opt_verify)
         {
-          cryptonote::blobdata block;
-          cryptonote::block_to_blob(bp.block, block);
-          std::vector<tx_blob_entry> txs;
-          for (const auto &tx: bp.txs)
-          {
-            txs.push_back({cryptonote::blobdata(), crypto::null_hash});
-            cryptonote::tx_to_blob(tx, txs.back().blob);
-          }
           block_complete_entry bce;
           bce.pruned = false;
-          bce.block = std::move(block);
-          bce.txs = std::move(txs);
-          blocks.push_back(bce);
-          int ret = check_flush(core, blocks, false);
+          bce.block = std::move(ib.block_blob);
+          for (auto &tx: ib.txs)
+            bce.txs.push_back({std::move(tx.second), crypto::null_hash});
+          blocks.push_back(std::move(bce));
+          hashes.push_back(ib.hash);
+          int ret = check_flush(core, blocks, hashes, false);
           if (ret)
           {
             quit = 2; // make sure we don't commit partial block data
             break;
           }
+          if (use_checkpoint && blocks.empty())
+            store_checkpoint(ib.end_pos);
         }
         else
         {
-          std::vector<std::pair<transaction, blobdata>> txs;
-          std::vector<transaction> archived_txs;
-
-          archived_txs = bp.txs;
-
-          // tx number 1: coinbase tx
-          // tx number 2 onwards: archived_txs
-          for (const transaction &tx : archived_txs)
-          {
-            // add blocks with verification.
-            // for Blockchain and blockchain_storage add_new_block().
-            // for add_block() method, without (much) processing.
-            // don't add coinbase transaction to txs.
-            //
-            // because add_block() calls
-            // add_transaction(blk_hash, blk.miner_tx) first, and
-            // then a for loop for the transactions in txs.
-            txs.push_back(std::make_pair(tx, tx_to_blob(tx)));
-          }
-
-          size_t block_weight;
-          difficulty_type cumulative_difficulty;
-          uint64_t coins_generated;
-
-          block_weight = bp.block_weight;
-          cumulative_difficulty = bp.cumulative_difficulty;
-          coins_generated = bp.coins_generated;
-
+          // add blocks without verification, through add_block() directly.
+          // the coinbase tx isn't part of txs, add_block() adds blk.miner_tx itself.
           try
           {
-            uint64_t long_term_block_weight = core.get_blockchain_storage().get_next_long_term_block_weight(block_weight);
-            core.get_blockchain_storage().get_db().add_block(std::make_pair(b, block_to_blob(b)), block_weight, long_term_block_weight, cumulative_difficulty, coins_generated, txs);
+            uint64_t long_term_block_weight = core.get_blockchain_storage().get_next_long_term_block_weight(ib.block_weight);
+            core.get_blockchain_storage().get_db().add_block(std::make_pair(std::move(ib.blk), std::move(ib.block_blob)), ib.block_weight, long_term_block_weight, ib.cumulative_difficulty, ib.coins_generated, ib.txs);
           }
           catch (const std::exception& e)
           {
@@ -493,23 +447,22 @@ int import_from_file(cryptonote::core& core, const std::string& import_file_path
             break;
           }
 
-          if (use_batch)
+          if ((h-1) % db_batch_size == 0)
           {
-            if ((h-1) % db_batch_size == 0)
+            if (use_batch)
             {
-              uint64_t bytes, h2;
-              bool q2;
               std::cout << refresh_string;
               // zero-based height
               std::cout << ENDL << "[- batch commit at height " << h-1 << " -]" << ENDL;
               core.get_blockchain_storage().get_db().batch_stop();
-              pos = import_file.tellg();
-              bytes = bootstrap.count_bytes(import_file, db_batch_size, h2, q2);
-              import_file.seekg(pos);
+              // the file is busy being read ahead, so size the next batch on the blocks so far
+              const uint64_t bytes = (ib.end_pos - first_pos) / (num_imported + 1) * db_batch_size;
               core.get_blockchain_storage().get_db().batch_start(db_batch_size, bytes);
               std::cout << ENDL;
               core.get_blockchain_storage().get_db().show_stats();
             }
+            if (use_checkpoint)
+              store_checkpoint(ib.end_pos);
           }
         }
         ++num_imported;
@@ -519,16 +472,30 @@ int import_from_file(cryptonote::core& core, const std::string& import_file_path
     {
       std::cout << refresh_string;
       MFATAL("exception while reading from file, height=" << h << ": " << e.what());
-      return 2;
+      quit = 2;
+    }
+
+    if (reader.joinable())
+      reader.join();
+    if (!quit && group.quit)
+    {
+      std::cout << refresh_string;
+      if (group.quit > 1)
+        MFATAL(group.message);
+      else
+        MINFO(group.message);
+      quit = group.quit;
     }
+    group = std::move(next_group);
+    next_group = import_group();
   } // while
 
 quitting:
   import_file.close();
 
-  if (opt_verify)
+  if (opt_verify && quit <= 1)
   {
-    int ret = check_flush(core, blocks, true);
+    int ret = check_flush(core, blocks, hashes, true);
     if (ret)
       return ret;
   }
@@ -545,6 +512,8 @@ quitting:
       core.get_blockchain_storage().get_db().batch_stop();
     }
   }
+  if (use_checkpoint && quit <= 1 && num_imported)
+    store_checkpoint(imported_pos);
 
   core.get_blockchain_storage().get_db().show_stats();
   MINFO("Number of blocks imported: " << num_imported);
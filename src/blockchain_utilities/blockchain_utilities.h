@@ -37,4 +37,7 @@
 #define BUFFER_SIZE (2 * 1024 * 1024)
 #define CHUNK_SIZE_WARNING_THRESHOLD 500000
 #define NUM_BLOCKS_PER_CHUNK 1
+// indexed (v2) bootstrap files group this many blocks per compressed chunk
+#define BLOCKS_PER_INDEXED_CHUNK 256
+#define INDEXED_BUFFER_SIZE (BLOCKS_PER_INDEXED_CHUNK * BUFFER_SIZE)
 #define BLOCKCHAIN_RAW "blockchain.raw"
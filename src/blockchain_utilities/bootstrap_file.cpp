@@ -30,9 +30,15 @@
 #include "bootstrap_serialization.h"
 #include "serialization/binary_utils.h" // dump_binary(), parse_binary()
 #include "serialization/json_utils.h" // dump_json()
+#include "common/threadpool.h"
+#include "crypto/hash.h"
 
 #include "bootstrap_file.h"
 
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
 #undef WAZN_DEFAULT_LOG_CATEGORY
 #define WAZN_DEFAULT_LOG_CATEGORY "bcutil"
 
@@ -48,6 +54,15 @@ namespace
   const uint32_t blockchain_raw_magic = 0x28721586;
   const uint32_t header_size = 1024;
 
+  // leading 4 bytes of: echo Wazn bootstrap index | sha1sum
+  const uint32_t blockchain_raw_index_magic = 0xe3be79e4;
+  // trailer of indexed files: index position, index magic
+  const size_t index_trailer_size = sizeof(uint64_t) + sizeof(uint32_t);
+  const uint32_t max_chunk_info_size = 1024;
+
+  // exports are written once and copied around many times, favour ratio over speed
+  const int zstd_compression_level = 9;
+
   std::string refresh_string = "\r                                    \r";
 }
 
@@ -89,12 +104,36 @@ bool BootstrapFile::open_writer(const boost::filesystem::path& file_path, uint64
   }
   else
   {
-    std::streampos dummy_pos;
-    uint64_t dummy_height = 0;
-    num_blocks = count_blocks(file_path.string(), dummy_pos, dummy_height, block_first);
+    std::ifstream existing_file(file_path.string(), std::ios_base::binary | std::ifstream::in);
+    uint8_t major_version, minor_version;
+    uint64_t block_last;
+    seek_to_first_chunk(existing_file, major_version, minor_version, block_first, block_last);
+    if ((major_version >= 2) != m_indexed)
+    {
+      MFATAL("existing file " << file_path << " is in a different bootstrap format, export to a new file");
+      return false;
+    }
+    if (m_indexed)
+    {
+      // drop the index, it is written again once the new chunks are appended
+      const uint64_t chunks_end = scan_chunk_index(existing_file, m_index);
+      existing_file.close();
+      boost::filesystem::resize_file(file_path, chunks_end);
+      num_blocks = m_index.heights.empty() ? 0 : m_index.block_end - block_first;
+    }
+    else
+    {
+      existing_file.close();
+      std::streampos dummy_pos;
+      uint64_t dummy_height = 0;
+      num_blocks = count_blocks(file_path.string(), dummy_pos, dummy_height, block_first);
+    }
     MDEBUG("appending to existing file with height: " << num_blocks+block_first-1 << "  total blocks: " << num_blocks);
   }
   m_height = num_blocks+block_first;
+  m_cur_height = m_height;
+  m_block_first = do_initialize_file ? start_block : block_first;
+  m_file_path = file_path;
 
   if (do_initialize_file)
     m_raw_data_file->open(file_path.string(), std::ios_base::binary | std::ios_base::out | std::ios::trunc);
@@ -115,6 +154,12 @@ bool BootstrapFile::open_writer(const boost::filesystem::path& file_path, uint64
 }
 
 bool BootstrapFile::initialize_file(uint64_t first_block, uint64_t last_block)
+{
+  write_header(*m_raw_data_file, first_block, last_block);
+  return true;
+}
+
+void BootstrapFile::write_header(std::ostream& out, uint64_t first_block, uint64_t last_block)
 {
   const uint32_t file_magic = blockchain_raw_magic;
 
@@ -123,10 +168,10 @@ bool BootstrapFile::initialize_file(uint64_t first_block, uint64_t last_block)
   {
     throw std::runtime_error("Error in serialization of file magic");
   }
-  *m_raw_data_file << blob;
+  out << blob;
 
   bootstrap::file_info bfi;
-  bfi.major_version = 1;
+  bfi.major_version = m_indexed ? 2 : 1;
   bfi.minor_version = 0;
   bfi.header_size = header_size;
 
@@ -165,8 +210,23 @@ bool BootstrapFile::initialize_file(uint64_t first_block, uint64_t last_block)
   output_stream_header.flush();
   output_stream_header << std::string(header_size-buffer2.size(), 0); // fill in rest with null bytes
   output_stream_header.flush();
-  std::copy(buffer2.begin(), buffer2.end(), std::ostreambuf_iterator<char>(*m_raw_data_file));
+  std::copy(buffer2.begin(), buffer2.end(), std::ostreambuf_iterator<char>(out));
+}
 
+// the header is fixed size, so it can be rewritten in place once the range of blocks is known
+bool BootstrapFile::update_header(uint64_t first_block, uint64_t last_block)
+{
+  std::fstream file(m_file_path.string(), std::ios_base::binary | std::ios_base::in | std::ios_base::out);
+  if (file.fail())
+    return false;
+  write_header(file, first_block, last_block);
+  file.flush();
+  if (file.fail())
+  {
+    MFATAL("Failed to update the header of " << m_file_path);
+    return false;
+  }
+  MDEBUG("updated header:  blocks " << first_block << " - " << last_block);
   return true;
 }
 
@@ -209,7 +269,7 @@ void BootstrapFile::flush_chunk()
   MDEBUG("flushed chunk:  chunk_size: " << chunk_size);
 }
 
-void BootstrapFile::write_block(block& block)
+bootstrap::block_package BootstrapFile::get_block_package(const block& block)
 {
   bootstrap::block_package bp;
   bp.block = block;
@@ -247,10 +307,121 @@ void BootstrapFile::write_block(block& block)
     bp.coins_generated = coins_generated;
   }
 
+  return bp;
+}
+
+void BootstrapFile::write_block(block& block)
+{
+  bootstrap::block_package bp = get_block_package(block);
   blobdata bd = t_serializable_object_to_blob(bp);
   m_output_stream->write((const char*)bd.data(), bd.size());
 }
 
+// safe to call from several threads at once, it only reads from the db
+void BootstrapFile::pack_indexed_chunk(uint64_t block_first, uint64_t block_last, bootstrap::chunk_info& info, std::string& data)
+{
+  bootstrap::chunk_data cd;
+  for (uint64_t height = block_first; height <= block_last; ++height)
+    cd.blocks.push_back(get_block_package(m_blockchain_storage->get_db().get_block_from_height(height)));
+
+  pack_chunk_data(cd, block_first, true, info, data);
+}
+
+// serializes a chunk's blocks, compressing them if that saves space, safe to call from several threads at once
+void BootstrapFile::pack_chunk_data(bootstrap::chunk_data& cd, uint64_t block_first, bool compress, bootstrap::chunk_info& info, std::string& data)
+{
+  std::string raw;
+  if (! ::serialization::dump_binary(cd, raw))
+    throw std::runtime_error("Error in serialization of chunk");
+
+  info.block_first = block_first;
+  info.num_blocks = cd.blocks.size();
+  info.codec = bootstrap::codec_none;
+  info.raw_size = raw.size();
+  info.checksum = crypto::cn_fast_hash(raw.data(), raw.size());
+
+#ifdef HAVE_ZSTD
+  if (compress)
+  {
+    data.resize(ZSTD_compressBound(raw.size()));
+    const size_t size = ZSTD_compress(&data[0], data.size(), raw.data(), raw.size(), zstd_compression_level);
+    if (ZSTD_isError(size))
+      throw std::runtime_error(std::string("Error compressing chunk: ") + ZSTD_getErrorName(size));
+    if (size < raw.size())
+    {
+      data.resize(size);
+      info.codec = bootstrap::codec_zstd;
+    }
+  }
+#endif
+  if (info.codec == bootstrap::codec_none)
+    data = std::move(raw);
+  info.data_size = data.size();
+}
+
+void BootstrapFile::write_indexed_chunk(const bootstrap::chunk_info& info, const std::string& data)
+{
+  m_index.heights.push_back(info.block_first);
+  m_index.offsets.push_back(m_raw_data_file->tellp());
+  m_index.block_end = info.block_first + info.num_blocks;
+
+  blobdata bd = t_serializable_object_to_blob(info);
+  uint32_t info_size = bd.size();
+  std::string blob;
+  if (! ::serialization::dump_binary(info_size, blob))
+  {
+    throw std::runtime_error("Error in serialization of chunk info size");
+  }
+  *m_raw_data_file << blob << bd;
+  m_raw_data_file->write(data.data(), data.size());
+  if (! *m_raw_data_file)
+  {
+    MFATAL("Error writing chunk:  height: " << info.block_first << "  chunk_size: " << data.size());
+    throw std::runtime_error("Error writing chunk");
+  }
+
+  if (m_max_chunk < data.size())
+  {
+    m_max_chunk = data.size();
+  }
+  MDEBUG("wrote chunk:  height: " << info.block_first << "  blocks: " << info.num_blocks << "  raw size: " << info.raw_size << "  stored size: " << info.data_size);
+}
+
+// layout: end of chunks marker (0), index size, index, index position, index magic
+void BootstrapFile::write_chunk_index()
+{
+  std::string blob;
+  uint32_t end_marker = 0;
+  if (! ::serialization::dump_binary(end_marker, blob))
+  {
+    throw std::runtime_error("Error in serialization of chunk end marker");
+  }
+  *m_raw_data_file << blob;
+
+  uint64_t index_pos = m_raw_data_file->tellp();
+  blobdata bd = t_serializable_object_to_blob(m_index);
+  uint32_t index_size = bd.size();
+  if (! ::serialization::dump_binary(index_size, blob))
+  {
+    throw std::runtime_error("Error in serialization of chunk index size");
+  }
+  *m_raw_data_file << blob << bd;
+
+  uint32_t index_magic = blockchain_raw_index_magic;
+  if (! ::serialization::dump_binary(index_pos, blob))
+  {
+    throw std::runtime_error("Error in serialization of chunk index position");
+  }
+  *m_raw_data_file << blob;
+  if (! ::serialization::dump_binary(index_magic, blob))
+  {
+    throw std::runtime_error("Error in serialization of chunk index magic");
+  }
+  *m_raw_data_file << blob;
+  m_raw_data_file->flush();
+  MDEBUG("wrote chunk index:  chunks: " << m_index.heights.size() << "  size: " << index_size);
+}
+
 bool BootstrapFile::close()
 {
   if (m_raw_data_file->fail())
@@ -259,14 +430,21 @@ bool BootstrapFile::close()
   m_raw_data_file->flush();
   delete m_output_stream;
   delete m_raw_data_file;
+
+  // the header was written with the requested range, and is stale once appended to
+  if (m_cur_height > m_block_first)
+    return update_header(m_block_first, m_cur_height - 1);
   return true;
 }
 
 
-bool BootstrapFile::store_blockchain_raw(Blockchain* _blockchain_storage, tx_memory_pool* _tx_pool, boost::filesystem::path& output_file, uint64_t start_block, uint64_t requested_block_stop)
+bool BootstrapFile::store_blockchain_raw(Blockchain* _blockchain_storage, tx_memory_pool* _tx_pool, boost::filesystem::path& output_file, uint64_t start_block, uint64_t requested_block_stop, bool indexed)
 {
   uint64_t num_blocks_written = 0;
   m_max_chunk = 0;
+  m_indexed = indexed;
+  m_index = bootstrap::chunk_index();
+  m_index.block_end = 0;
   m_blockchain_storage = _blockchain_storage;
   m_tx_pool = _tx_pool;
   uint64_t progress_interval = 100;
@@ -295,25 +473,75 @@ bool BootstrapFile::store_blockchain_raw(Blockchain* _blockchain_storage, tx_mem
   }
   uint64_t block_start = m_height ? m_height : start_block;
   MINFO("Starting block height: " << block_start);
-  for (m_cur_height = block_start; m_cur_height <= block_stop; ++m_cur_height)
+  if (m_indexed)
   {
-    // this method's height refers to 0-based height (genesis block = height 0)
-    crypto::hash hash = m_blockchain_storage->get_block_id_by_height(m_cur_height);
-    m_blockchain_storage->get_block_by_hash(hash, b);
-    write_block(b);
-    if (m_cur_height % NUM_BLOCKS_PER_CHUNK == 0) {
-      flush_chunk();
-      num_blocks_written += NUM_BLOCKS_PER_CHUNK;
-    }
-    if (m_cur_height % progress_interval == 0) {
+    // pack one chunk per thread at a time, then write them out in order
+    tools::threadpool& tpool = tools::threadpool::getInstance();
+    const size_t chunks_per_round = std::max(1u, tpool.get_max_concurrency());
+    for (m_cur_height = block_start; m_cur_height <= block_stop; )
+    {
+      std::vector<uint64_t> chunk_first;
+      for (uint64_t height = m_cur_height; height <= block_stop && chunk_first.size() < chunks_per_round; height += BLOCKS_PER_INDEXED_CHUNK)
+        chunk_first.push_back(height);
+
+      std::vector<bootstrap::chunk_info> infos(chunk_first.size());
+      std::vector<std::string> data(chunk_first.size()), errors(chunk_first.size());
+      tools::threadpool::waiter waiter(tpool);
+      for (size_t i = 0; i < chunk_first.size(); ++i)
+      {
+        tpool.submit(&waiter, [&, i]() {
+          try
+          {
+            pack_indexed_chunk(chunk_first[i], std::min<uint64_t>(chunk_first[i] + BLOCKS_PER_INDEXED_CHUNK - 1, block_stop), infos[i], data[i]);
+          }
+          catch (const std::exception& e)
+          {
+            errors[i] = e.what();
+            waiter.set_error();
+          }
+        }, true);
+      }
+      if (!waiter.wait())
+      {
+        for (size_t i = 0; i < chunk_first.size(); ++i)
+          if (!errors[i].empty())
+            MFATAL("Error exporting chunk at height " << chunk_first[i] << ": " << errors[i]);
+        return false;
+      }
+
+      for (size_t i = 0; i < chunk_first.size(); ++i)
+      {
+        write_indexed_chunk(infos[i], data[i]);
+        num_blocks_written += infos[i].num_blocks;
+      }
+      m_cur_height = m_index.block_end;
       std::cout << refresh_string;
-      std::cout << "block " << m_cur_height << "/" << block_stop << "\r" << std::flush;
+      std::cout << "block " << m_cur_height-1 << "/" << block_stop << "\r" << std::flush;
     }
+    write_chunk_index();
   }
-  // NOTE: use of NUM_BLOCKS_PER_CHUNK is a placeholder in case multi-block chunks are later supported.
-  if (m_cur_height % NUM_BLOCKS_PER_CHUNK != 0)
+  else
   {
-    flush_chunk();
+    for (m_cur_height = block_start; m_cur_height <= block_stop; ++m_cur_height)
+    {
+      // this method's height refers to 0-based height (genesis block = height 0)
+      crypto::hash hash = m_blockchain_storage->get_block_id_by_height(m_cur_height);
+      m_blockchain_storage->get_block_by_hash(hash, b);
+      write_block(b);
+      if (m_cur_height % NUM_BLOCKS_PER_CHUNK == 0) {
+        flush_chunk();
+        num_blocks_written += NUM_BLOCKS_PER_CHUNK;
+      }
+      if (m_cur_height % progress_interval == 0) {
+        std::cout << refresh_string;
+        std::cout << "block " << m_cur_height << "/" << block_stop << "\r" << std::flush;
+      }
+    }
+    // NOTE: use of NUM_BLOCKS_PER_CHUNK is a placeholder in case multi-block chunks are later supported.
+    if (m_cur_height % NUM_BLOCKS_PER_CHUNK != 0)
+    {
+      flush_chunk();
+    }
   }
   // print message for last block, which may not have been printed yet due to progress_interval
   std::cout << refresh_string;
@@ -496,6 +724,14 @@ uint64_t BootstrapFile::count_blocks(const std::string& import_file_path, std::s
   uint64_t block_last;
   full_header_size = seek_to_first_chunk(import_file, major_version, minor_version, block_first, block_last);
 
+  if (major_version >= 2)
+  {
+    h = count_indexed_blocks(import_file, start_pos, seek_height, block_first);
+    import_file.close();
+    std::cout << "Number of blocks: " << h << ENDL;
+    return h;
+  }
+
   MINFO("Scanning blockchain from bootstrap file...");
   bool quit = false;
   uint64_t bytes_read = 0, blocks;
@@ -534,3 +770,211 @@ uint64_t BootstrapFile::count_blocks(const std::string& import_file_path, std::s
   // one-based height.
   return h;
 }
+
+uint64_t BootstrapFile::count_indexed_blocks(std::ifstream& import_file, std::streampos& start_pos, uint64_t& seek_height, uint64_t block_first)
+{
+  const std::streampos first_chunk_pos = import_file.tellg();
+  bootstrap::chunk_index &index = m_source_index;
+  if (!read_chunk_index(import_file, index))
+  {
+    MINFO("bootstrap file has no index, scanning chunks...");
+    import_file.clear();
+    import_file.seekg(first_chunk_pos);
+    scan_chunk_index(import_file, index);
+  }
+
+  // start from the chunk holding seek_height, the caller skips blocks before it
+  if (seek_height)
+  {
+    auto it = std::upper_bound(index.heights.begin(), index.heights.end(), seek_height);
+    if (it == index.heights.begin())
+    {
+      start_pos = first_chunk_pos;
+      seek_height = block_first;
+    }
+    else
+    {
+      const size_t chunk = it - index.heights.begin() - 1;
+      start_pos = index.offsets[chunk];
+      seek_height = index.heights[chunk];
+    }
+  }
+
+  return index.heights.empty() ? 0 : index.block_end - block_first;
+}
+
+// reads the index at the end of a complete indexed file, returns false if there is none
+bool BootstrapFile::read_chunk_index(std::ifstream& import_file, bootstrap::chunk_index& index)
+{
+  import_file.seekg(0, std::ios_base::end);
+  const uint64_t file_size = import_file.tellg();
+  if (file_size < index_trailer_size)
+    return false;
+
+  std::string str1;
+  char buf1[index_trailer_size];
+  import_file.seekg(file_size - index_trailer_size);
+  import_file.read(buf1, index_trailer_size);
+  if (! import_file)
+    return false;
+
+  uint64_t index_pos;
+  uint32_t index_magic;
+  str1.assign(buf1, sizeof(index_pos));
+  if (! ::serialization::parse_binary(str1, index_pos))
+    return false;
+  str1.assign(buf1 + sizeof(index_pos), sizeof(index_magic));
+  if (! ::serialization::parse_binary(str1, index_magic) || index_magic != blockchain_raw_index_magic)
+    return false;
+
+  uint32_t index_size;
+  if (index_pos + sizeof(index_size) > file_size - index_trailer_size)
+    return false;
+  import_file.seekg(index_pos);
+  import_file.read(buf1, sizeof(index_size));
+  str1.assign(buf1, sizeof(index_size));
+  if (! import_file || ! ::serialization::parse_binary(str1, index_size))
+    return false;
+  if (index_size != file_size - index_trailer_size - index_pos - sizeof(index_size))
+    return false;
+
+  str1.resize(index_size);
+  import_file.read(&str1[0], index_size);
+  if (! import_file || ! ::serialization::parse_binary(str1, index))
+    return false;
+
+  if (index.heights.size() != index.offsets.size())
+    return false;
+  for (size_t i = 1; i < index.heights.size(); ++i)
+    if (index.heights[i] <= index.heights[i - 1] || index.offsets[i] <= index.offsets[i - 1])
+      return false;
+  if (!index.heights.empty() && (index.block_end <= index.heights.back() || index.offsets.back() >= index_pos))
+    return false;
+  return true;
+}
+
+// rebuilds the index by walking the chunk headers from the current position,
+// returns the offset just past the last complete chunk
+uint64_t BootstrapFile::scan_chunk_index(std::ifstream& import_file, bootstrap::chunk_index& index)
+{
+  uint64_t pos = import_file.tellg();
+  import_file.seekg(0, std::ios_base::end);
+  const uint64_t file_size = import_file.tellg();
+  import_file.seekg(pos);
+
+  index = bootstrap::chunk_index();
+  index.block_end = 0;
+  bootstrap::chunk_info info;
+  while (read_indexed_chunk(import_file, info, NULL, file_size))
+  {
+    const uint64_t next_pos = import_file.tellg();
+    if (!index.heights.empty() && info.block_first != index.block_end)
+      throw std::runtime_error("Aborting: bootstrap chunks are not contiguous");
+    index.heights.push_back(info.block_first);
+    index.offsets.push_back(pos);
+    index.block_end = info.block_first + info.num_blocks;
+    pos = next_pos;
+  }
+  import_file.clear();
+  import_file.seekg(pos);
+  return pos;
+}
+
+// returns false at the end of the chunks or if the chunk's data does not end by data_end (the
+// next chunk's offset, or the end of the file), skips the chunk's data if data is NULL
+bool BootstrapFile::read_indexed_chunk(std::istream& import_file, bootstrap::chunk_info& info, std::string* data, uint64_t data_end)
+{
+  uint32_t info_size;
+  char buf1[sizeof(info_size)];
+  std::string str1;
+  import_file.read(buf1, sizeof(info_size));
+  if (! import_file)
+    return false;
+  str1.assign(buf1, sizeof(info_size));
+  if (! ::serialization::parse_binary(str1, info_size))
+    throw std::runtime_error("Error in deserialization of chunk info size");
+  if (info_size == 0)
+    return false; // end of chunks, the index follows
+  if (info_size > max_chunk_info_size)
+    throw std::runtime_error("Aborting: chunk info size exceeds buffer size");
+
+  str1.resize(info_size);
+  import_file.read(&str1[0], info_size);
+  if (! import_file)
+    return false;
+  if (! ::serialization::parse_binary(str1, info))
+    throw std::runtime_error("Error in deserialization of chunk info");
+  if (info.num_blocks == 0 || info.num_blocks > BLOCKS_PER_INDEXED_CHUNK || info.raw_size > info.num_blocks * BUFFER_SIZE || info.data_size > INDEXED_BUFFER_SIZE)
+    throw std::runtime_error("Aborting: chunk size exceeds buffer size");
+
+  // check the size against the file before allocating for it
+  const std::streamoff data_pos = import_file.tellg();
+  if (data_pos < 0 || static_cast<uint64_t>(data_pos) > data_end || info.data_size > data_end - static_cast<uint64_t>(data_pos))
+  {
+    MWARNING("bootstrap chunk at height " << info.block_first << " is truncated");
+    return false;
+  }
+
+  if (!data)
+  {
+    import_file.seekg(info.data_size, std::ios_base::cur);
+    return true;
+  }
+  data->resize(info.data_size);
+  import_file.read(&(*data)[0], info.data_size);
+  if (! import_file)
+  {
+    MWARNING("bootstrap chunk at height " << info.block_first << " is truncated");
+    return false;
+  }
+  return true;
+}
+
+// decompresses and checks a chunk, safe to call from several threads at once
+bool BootstrapFile::unpack_indexed_chunk(const bootstrap::chunk_info& info, const std::string& data, std::vector<bootstrap::block_package>& packages)
+{
+  if (info.num_blocks == 0 || info.num_blocks > BLOCKS_PER_INDEXED_CHUNK || info.raw_size > info.num_blocks * BUFFER_SIZE || data.size() != info.data_size)
+  {
+    MERROR("Bad sizes in chunk at height " << info.block_first);
+    return false;
+  }
+
+  std::string decompressed;
+  const std::string* raw = &data;
+  if (info.codec == bootstrap::codec_zstd)
+  {
+#ifdef HAVE_ZSTD
+    decompressed.resize(info.raw_size);
+    const size_t size = ZSTD_decompress(&decompressed[0], decompressed.size(), data.data(), data.size());
+    if (ZSTD_isError(size) || size != info.raw_size)
+    {
+      MERROR("Failed to decompress chunk at height " << info.block_first);
+      return false;
+    }
+    raw = &decompressed;
+#else
+    MERROR("Chunk at height " << info.block_first << " is zstd compressed, but this build has no zstd support");
+    return false;
+#endif
+  }
+  else if (info.codec != bootstrap::codec_none)
+  {
+    MERROR("Chunk at height " << info.block_first << " uses unknown codec " << unsigned(info.codec));
+    return false;
+  }
+
+  if (raw->size() != info.raw_size || crypto::cn_fast_hash(raw->data(), raw->size()) != info.checksum)
+  {
+    MERROR("Checksum mismatch in chunk at height " << info.block_first);
+    return false;
+  }
+
+  bootstrap::chunk_data cd;
+  if (! ::serialization::parse_binary(*raw, cd) || cd.blocks.size() != info.num_blocks)
+  {
+    MERROR("Error in deserialization of chunk at height " << info.block_first);
+    return false;
+  }
+  packages = std::move(cd.blocks);
+  return true;
+}
@@ -48,6 +48,7 @@
 #include "version.h"
 
 #include "blockchain_utilities.h"
+#include "bootstrap_serialization.h"
 
 
 using namespace cryptonote;
@@ -62,8 +63,17 @@ public:
   uint64_t count_blocks(const std::string& dir_path);
   uint64_t seek_to_first_chunk(std::ifstream& import_file, uint8_t &major_version, uint8_t &minor_version, uint64_t &block_first, uint64_t &block_last);
 
+  // indexed (version 2) files
+  bool read_chunk_index(std::ifstream& import_file, bootstrap::chunk_index& index);
+  uint64_t scan_chunk_index(std::ifstream& import_file, bootstrap::chunk_index& index);
+  static bool read_indexed_chunk(std::istream& import_file, bootstrap::chunk_info& info, std::string* data, uint64_t data_end);
+  static void pack_chunk_data(bootstrap::chunk_data& cd, uint64_t block_first, bool compress, bootstrap::chunk_info& info, std::string& data);
+  static bool unpack_indexed_chunk(const bootstrap::chunk_info& info, const std::string& data, std::vector<bootstrap::block_package>& packages);
+  // index of the indexed file last counted by count_blocks
+  const bootstrap::chunk_index& get_source_index() const { return m_source_index; }
+
   bool store_blockchain_raw(cryptonote::Blockchain* cs, cryptonote::tx_memory_pool* txp,
-      boost::filesystem::path& output_file, uint64_t start_block=0, uint64_t stop_block=0);
+      boost::filesystem::path& output_file, uint64_t start_block=0, uint64_t stop_block=0, bool indexed=false);
 
 protected:
 
@@ -78,13 +88,23 @@ protected:
   // open export file for write
   bool open_writer(const boost::filesystem::path& file_path, uint64_t start_block, uint64_t stop_block);
   bool initialize_file(uint64_t start_block, uint64_t stop_block);
+  void write_header(std::ostream& out, uint64_t block_first, uint64_t block_last);
+  bool update_header(uint64_t block_first, uint64_t block_last);
   bool close();
+  bootstrap::block_package get_block_package(const block& block);
   void write_block(block& block);
   void flush_chunk();
+  void pack_indexed_chunk(uint64_t block_first, uint64_t block_last, bootstrap::chunk_info& info, std::string& data);
+  void write_indexed_chunk(const bootstrap::chunk_info& info, const std::string& data);
+  void write_chunk_index();
+  uint64_t count_indexed_blocks(std::ifstream& import_file, std::streampos& start_pos, uint64_t& seek_height, uint64_t block_first);
 
-private:
-
+  boost::filesystem::path m_file_path;
+  uint64_t m_block_first; // first block in the file being written
   uint64_t m_height;
   uint64_t m_cur_height; // tracks current height during export
   uint32_t m_max_chunk;
+  bool m_indexed;
+  bootstrap::chunk_index m_index; // chunks written so far, for indexed exports
+  bootstrap::chunk_index m_source_index; // chunks of the file being read
 };
@@ -101,6 +101,55 @@ namespace cryptonote
       END_SERIALIZE()
     };
 
+    // version 2 files store blocks in checksummed, optionally compressed chunks
+    // followed by an index, see BootstrapFile::read_chunk_index
+    enum chunk_codec : uint8_t
+    {
+      codec_none = 0,
+      codec_zstd = 1,
+    };
+
+    struct chunk_info
+    {
+      uint64_t block_first;  // height of the chunk's first block
+      uint64_t num_blocks;
+      uint8_t codec;
+      uint64_t raw_size;     // size of the serialized chunk_data
+      uint64_t data_size;    // size of the (compressed) data following this header
+      crypto::hash checksum; // cn_fast_hash of the serialized chunk_data
+
+      BEGIN_SERIALIZE_OBJECT()
+        VARINT_FIELD(block_first)
+        VARINT_FIELD(num_blocks)
+        FIELD(codec)
+        VARINT_FIELD(raw_size)
+        VARINT_FIELD(data_size)
+        FIELD(checksum)
+      END_SERIALIZE()
+    };
+
+    struct chunk_data
+    {
+      std::vector<block_package> blocks;
+
+      BEGIN_SERIALIZE_OBJECT()
+        FIELD(blocks)
+      END_SERIALIZE()
+    };
+
+    struct chunk_index
+    {
+      std::vector<uint64_t> heights; // first block height of each chunk
+      std::vector<uint64_t> offsets; // file offset of each chunk
+      uint64_t block_end;            // one past the height of the last block
+
+      BEGIN_SERIALIZE_OBJECT()
+        FIELD(heights)
+        FIELD(offsets)
+        VARINT_FIELD(block_end)
+      END_SERIALIZE()
+    };
+
   }
 
 }
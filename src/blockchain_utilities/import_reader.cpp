@@ -0,0 +1,318 @@
+// Copyright (c) 2019-2021 WAZN Project
+// Copyright (c) 2014-2020, The Monero Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <algorithm>
+#include <boost/filesystem.hpp>
+#include "misc_log_ex.h"
+#include "string_tools.h"
+#include "common/threadpool.h"
+#include "cryptonote_basic/cryptonote_format_utils.h"
+#include "serialization/binary_utils.h" // dump_binary(), parse_binary()
+#include "bootstrap_file.h"
+#include "import_reader.h"
+
+#undef WAZN_DEFAULT_LOG_CATEGORY
+#define WAZN_DEFAULT_LOG_CATEGORY "bcutil"
+
+using namespace cryptonote;
+
+namespace
+{
+void unpack_block_package(bootstrap::block_package &bp, import_block &ib)
+{
+  ib.blk = std::move(bp.block);
+  ib.block_blob = block_to_blob(ib.blk);
+  ib.hash = get_block_hash(ib.blk);
+  ib.txs.reserve(bp.txs.size());
+  for (transaction &tx: bp.txs)
+  {
+    blobdata blob = tx_to_blob(tx);
+    ib.txs.push_back(std::make_pair(std::move(tx), std::move(blob)));
+  }
+  ib.block_weight = bp.block_weight;
+  ib.cumulative_difficulty = bp.cumulative_difficulty;
+  ib.coins_generated = bp.coins_generated;
+}
+
+bool parse_block_package(const std::string &chunk, uint8_t major_version, import_block &ib)
+{
+  bootstrap::block_package bp;
+  if (major_version == 0)
+  {
+    bootstrap::block_package_1 bp1;
+    if (!::serialization::parse_binary(chunk, bp1))
+      return false;
+    bp.block = std::move(bp1.block);
+    bp.txs = std::move(bp1.txs);
+    bp.block_weight = bp1.block_weight;
+    bp.cumulative_difficulty = bp1.cumulative_difficulty;
+    bp.coins_generated = bp1.coins_generated;
+  }
+  else if (!::serialization::parse_binary(chunk, bp))
+    return false;
+
+  unpack_block_package(bp, ib);
+  return true;
+}
+
+// reads up to max_blocks blocks from an indexed (v2) file, chunks are unpacked on the threadpool
+void read_indexed_group(std::ifstream &import_file, const import_source &source, uint64_t max_blocks, uint64_t &pos, import_group &group)
+{
+  std::vector<bootstrap::chunk_info> infos;
+  std::vector<std::string> chunks;
+  std::vector<uint64_t> end_pos;
+  uint64_t num_blocks = 0;
+
+  try
+  {
+    while (num_blocks < max_blocks)
+    {
+      bootstrap::chunk_info info;
+      std::string data;
+      // the chunk must end by the next one in the index, or by the end of the file
+      const auto next = std::upper_bound(source.index.offsets.begin(), source.index.offsets.end(), pos);
+      const uint64_t data_end = next == source.index.offsets.end() ? source.file_size : *next;
+      if (!BootstrapFile::read_indexed_chunk(import_file, info, &data, data_end))
+      {
+        group.quit = 1;
+        group.message = "End of file reached";
+        break;
+      }
+      pos = import_file.tellg();
+      infos.push_back(info);
+      chunks.push_back(std::move(data));
+      end_pos.push_back(pos);
+      num_blocks += info.num_blocks;
+    }
+  }
+  catch (const std::exception &e)
+  {
+    group.quit = 2;
+    group.message = e.what();
+  }
+
+  std::vector<std::vector<import_block>> unpacked(chunks.size());
+  tools::threadpool& tpool = tools::threadpool::getInstance();
+  tools::threadpool::waiter waiter(tpool);
+  for (size_t i = 0; i < chunks.size(); ++i)
+  {
+    tpool.submit(&waiter, [&, i]() {
+      try
+      {
+        std::vector<bootstrap::block_package> packages;
+        if (!BootstrapFile::unpack_indexed_chunk(infos[i], chunks[i], packages))
+        {
+          waiter.set_error();
+          return;
+        }
+        unpacked[i].resize(packages.size());
+        for (size_t j = 0; j < packages.size(); ++j)
+        {
+          unpack_block_package(packages[j], unpacked[i][j]);
+          unpacked[i][j].end_pos = end_pos[i];
+        }
+      }
+      catch (const std::exception &e)
+      {
+        waiter.set_error();
+      }
+    }, true);
+  }
+  if (!waiter.wait())
+  {
+    group.quit = 2;
+    group.message = "Error in deserialization of chunk";
+    return;
+  }
+
+  group.blocks.reserve(num_blocks);
+  for (auto &blocks: unpacked)
+    std::move(blocks.begin(), blocks.end(), std::back_inserter(group.blocks));
+}
+
+}
+
+// reads up to max_blocks chunks sequentially, then deserializes them on the threadpool
+void read_import_group(std::ifstream &import_file, const import_source &source, uint64_t max_blocks, uint64_t &pos, import_group &group)
+{
+  const uint8_t major_version = source.major_version;
+  if (major_version >= 2)
+  {
+    read_indexed_group(import_file, source, max_blocks, pos, group);
+    return;
+  }
+
+  std::vector<std::string> chunks;
+  std::vector<uint64_t> end_pos;
+  char buffer1[sizeof(uint32_t)];
+  std::string str1;
+
+  while (chunks.size() < max_blocks)
+  {
+    uint32_t chunk_size;
+    import_file.read(buffer1, sizeof(chunk_size));
+    if (! import_file) {
+      group.quit = 1;
+      group.message = "End of file reached";
+      break;
+    }
+
+    str1.assign(buffer1, sizeof(chunk_size));
+    if (! ::serialization::parse_binary(str1, chunk_size))
+    {
+      group.quit = 2;
+      group.message = "Error in deserialization of chunk size";
+      break;
+    }
+    MDEBUG("chunk_size: " << chunk_size);
+
+    if (chunk_size > BUFFER_SIZE)
+    {
+      MWARNING("WARNING: chunk_size " << chunk_size << " > BUFFER_SIZE " << BUFFER_SIZE);
+      group.quit = 2;
+      group.message = "Aborting: chunk size exceeds buffer size";
+      break;
+    }
+    if (chunk_size > CHUNK_SIZE_WARNING_THRESHOLD)
+    {
+      MINFO("NOTE: chunk_size " << chunk_size << " > " << CHUNK_SIZE_WARNING_THRESHOLD);
+    }
+    else if (chunk_size == 0) {
+      group.quit = 2;
+      group.message = "ERROR: chunk_size == 0";
+      break;
+    }
+
+    chunks.emplace_back(chunk_size, '\0');
+    import_file.read(&chunks.back()[0], chunk_size);
+    if (! import_file) {
+      if (import_file.eof())
+      {
+        group.quit = 1;
+        group.message = "End of file reached - file was truncated";
+      }
+      else
+      {
+        group.quit = 2;
+        group.message = "ERROR: unexpected end of file: bytes read before error: "
+          + std::to_string(import_file.gcount()) + " of chunk_size " + std::to_string(chunk_size);
+      }
+      chunks.pop_back();
+      break;
+    }
+    pos += sizeof(chunk_size) + chunk_size;
+    end_pos.push_back(pos);
+  }
+
+  group.blocks.resize(chunks.size());
+  tools::threadpool& tpool = tools::threadpool::getInstance();
+  tools::threadpool::waiter waiter(tpool);
+  const size_t threads = std::max(1u, tpool.get_max_concurrency());
+  const size_t blocks_per_thread = (chunks.size() + threads - 1) / threads;
+  for (size_t start = 0; start < chunks.size(); start += blocks_per_thread)
+  {
+    const size_t end = std::min(start + blocks_per_thread, chunks.size());
+    tpool.submit(&waiter, [&, start, end]() {
+      for (size_t i = start; i < end; ++i)
+      {
+        try
+        {
+          if (!parse_block_package(chunks[i], major_version, group.blocks[i]))
+          {
+            waiter.set_error();
+            return;
+          }
+        }
+        catch (const std::exception &e)
+        {
+          waiter.set_error();
+          return;
+        }
+        group.blocks[i].end_pos = end_pos[i];
+      }
+    }, true);
+  }
+  if (!waiter.wait())
+  {
+    group.blocks.clear();
+    group.quit = 2;
+    group.message = "Error in deserialization of chunk";
+  }
+}
+
+bool load_import_checkpoint(const boost::filesystem::path &checkpoint_path, const std::string &import_file_path, const BlockchainDB &db, import_checkpoint &checkpoint)
+{
+  std::ifstream checkpoint_file(checkpoint_path.string());
+  if (!checkpoint_file)
+    return false;
+
+  std::string top_hash;
+  std::getline(checkpoint_file, checkpoint.file);
+  checkpoint_file >> checkpoint.file_size >> checkpoint.height >> checkpoint.pos >> top_hash >> checkpoint.source_blocks;
+  if (!checkpoint_file || !epee::string_tools::hex_to_pod(top_hash, checkpoint.top_hash))
+  {
+    MWARNING("Ignoring unreadable import checkpoint " << checkpoint_path);
+    return false;
+  }
+
+  // the checkpoint is only usable if it is for this file and the db still has the block it was taken at
+  boost::system::error_code ec;
+  if (checkpoint.file != boost::filesystem::absolute(import_file_path).string()
+      || checkpoint.file_size != boost::filesystem::file_size(import_file_path, ec) || ec
+      || checkpoint.height == 0 || checkpoint.height > db.height()
+      || checkpoint.pos > checkpoint.file_size || checkpoint.source_blocks == 0
+      || db.get_block_hash_from_height(checkpoint.height - 1) != checkpoint.top_hash)
+  {
+    MINFO("Import checkpoint " << checkpoint_path << " does not match the bootstrap file or database, ignoring it");
+    return false;
+  }
+  return true;
+}
+
+void store_import_checkpoint(const boost::filesystem::path &checkpoint_path, const std::string &import_file_path, const BlockchainDB &db, uint64_t pos, uint64_t source_blocks)
+{
+  const boost::filesystem::path tmp_path = checkpoint_path.string() + ".tmp";
+  boost::system::error_code ec;
+
+  // write aside and rename, so a crash leaves either the old or the new checkpoint
+  {
+    std::ofstream checkpoint_file(tmp_path.string(), std::ios_base::trunc);
+    checkpoint_file << boost::filesystem::absolute(import_file_path).string() << ENDL
+      << boost::filesystem::file_size(import_file_path, ec) << " " << db.height() << " " << pos << " "
+      << epee::string_tools::pod_to_hex(db.top_block_hash()) << " " << source_blocks << ENDL;
+    if (!checkpoint_file || ec)
+    {
+      MWARNING("Failed to write import checkpoint " << tmp_path);
+      return;
+    }
+  }
+  boost::filesystem::rename(tmp_path, checkpoint_path, ec);
+  if (ec)
+    MWARNING("Failed to write import checkpoint " << checkpoint_path << ": " << ec.message());
+}
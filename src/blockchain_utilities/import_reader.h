@@ -0,0 +1,111 @@
+// Copyright (c) 2019-2021 WAZN Project
+// Copyright (c) 2014-2020, The Monero Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include <boost/filesystem/path.hpp>
+
+#include "cryptonote_basic/cryptonote_basic.h"
+#include "cryptonote_basic/difficulty.h"
+#include "blockchain_db/blockchain_db.h"
+#include "bootstrap_serialization.h"
+
+// a block read from a bootstrap file, deserialized and ready to import
+struct import_block
+{
+  cryptonote::block blk;
+  cryptonote::blobdata block_blob;
+  crypto::hash hash;
+  std::vector<std::pair<cryptonote::transaction, cryptonote::blobdata>> txs;
+  size_t block_weight;
+  cryptonote::difficulty_type cumulative_difficulty;
+  uint64_t coins_generated;
+  uint64_t end_pos; // file offset just past this block's chunk
+};
+
+struct import_group
+{
+  std::vector<import_block> blocks;
+  int quit = 0;
+  std::string message; // why reading stopped, if quit is set
+};
+
+// what the reader knows about the bootstrap file
+struct import_source
+{
+  uint8_t major_version;
+  uint64_t file_size;
+  bootstrap::chunk_index index; // indexed files only, each chunk must end by the next one's offset
+};
+
+// where to restart reading the bootstrap file once the db holds `height` blocks
+struct import_checkpoint
+{
+  std::string file;
+  uint64_t file_size;
+  uint64_t height;
+  uint64_t pos;
+  crypto::hash top_hash;
+  uint64_t source_blocks; // blocks in the file, as counted when the import started
+};
+
+/**
+ * @brief reads the next group of blocks from a bootstrap file
+ *
+ * Reads up to max_blocks blocks (whole chunks for indexed files) from the
+ * current position and deserializes them on the threadpool. Safe to run on
+ * a reader thread while the previous group is imported, as long as nothing
+ * else touches the stream.
+ *
+ * @param import_file the bootstrap file, positioned at a chunk
+ * @param source the file's version and extent, chunks reaching past it are not read
+ * @param max_blocks how many blocks to read at most
+ * @param pos the file offset, advanced past the chunks read
+ * @param group return-by-reference the blocks read, quit is 1 at the end of
+ * the file and 2 on error
+ */
+void read_import_group(std::ifstream &import_file, const import_source &source, uint64_t max_blocks, uint64_t &pos, import_group &group);
+
+/**
+ * @brief loads an import checkpoint
+ *
+ * @return true if the checkpoint is readable, was taken for this bootstrap
+ * file (same path and size), and the db still has the block it was taken at
+ */
+bool load_import_checkpoint(const boost::filesystem::path &checkpoint_path, const std::string &import_file_path, const cryptonote::BlockchainDB &db, import_checkpoint &checkpoint);
+
+/**
+ * @brief stores an import checkpoint for the db's current height
+ *
+ * The checkpoint is written aside and renamed over the old one.
+ */
+void store_import_checkpoint(const boost::filesystem::path &checkpoint_path, const std::string &import_file_path, const cryptonote::BlockchainDB &db, uint64_t pos, uint64_t source_blocks);
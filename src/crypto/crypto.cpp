@@ -35,6 +35,7 @@
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <memory>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/lock_guard.hpp>
 #include <boost/shared_ptr.hpp>
@@ -203,6 +204,37 @@ namespace crypto {
     return true;
   }
 
+  void crypto_ops::generate_key_derivations(const std::vector<public_key> &keys, const secret_key &key2, std::vector<boost::optional<key_derivation>> &derivations) {
+    const size_t n = keys.size();
+    signed char e[64];
+    ge_p3 point;
+    ge_p2 point2;
+    ge_p1p1 point3;
+    std::vector<ge_p2> points(n);
+    std::unique_ptr<fe[]> tmp(new fe[n]);
+    std::vector<key_derivation> results(n);
+    assert(sc_check(&key2) == 0);
+    ge_scalarmult_recode(e, &unwrap(key2));
+    derivations.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+      if (ge_frombytes_vartime(&point, &keys[i]) != 0) {
+        // keep a valid point in the batch, the result is dropped below
+        ge_p3_to_p2(&points[i], &ge_p3_identity);
+        derivations[i] = boost::none;
+        continue;
+      }
+      ge_scalarmult_recoded(&point2, e, &point);
+      ge_mul8(&point3, &point2);
+      ge_p1p1_to_p2(&points[i], &point3);
+      derivations[i] = key_derivation();
+    }
+    ge_tobytes_batch((unsigned char*)results.data(), points.data(), tmp.get(), n);
+    for (size_t i = 0; i < n; ++i)
+      if (derivations[i])
+        *derivations[i] = results[i];
+    memwipe(e, sizeof(e));
+  }
+
   void crypto_ops::derivation_to_scalar(const key_derivation &derivation, size_t output_index, ec_scalar &res) {
     struct {
       key_derivation derivation;
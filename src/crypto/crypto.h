@@ -119,6 +119,8 @@ namespace crypto {
     friend bool secret_key_to_public_key(const secret_key &, public_key &);
     static bool generate_key_derivation(const public_key &, const secret_key &, key_derivation &);
     friend bool generate_key_derivation(const public_key &, const secret_key &, key_derivation &);
+    static void generate_key_derivations(const std::vector<public_key> &, const secret_key &, std::vector<boost::optional<key_derivation>> &);
+    friend void generate_key_derivations(const std::vector<public_key> &, const secret_key &, std::vector<boost::optional<key_derivation>> &);
     static void derivation_to_scalar(const key_derivation &derivation, size_t output_index, ec_scalar &res);
     friend void derivation_to_scalar(const key_derivation &derivation, size_t output_index, ec_scalar &res);
     static bool derive_public_key(const key_derivation &, std::size_t, const public_key &, public_key &);
@@ -220,6 +222,13 @@ namespace crypto {
   inline bool generate_key_derivation(const public_key &key1, const secret_key &key2, key_derivation &derivation) {
     return crypto_ops::generate_key_derivation(key1, key2, derivation);
   }
+  /* Same as generate_key_derivation on each key, with the secret key recoded
+   * once and a single field inversion shared by the whole batch. Invalid keys
+   * yield boost::none.
+   */
+  inline void generate_key_derivations(const std::vector<public_key> &keys, const secret_key &key2, std::vector<boost::optional<key_derivation>> &derivations) {
+    crypto_ops::generate_key_derivations(keys, key2, derivations);
+  }
   inline bool derive_public_key(const key_derivation &derivation, std::size_t output_index,
     const public_key &base, public_key &derived_key) {
     return crypto_ops::derive_public_key(derivation, output_index, base, derived_key);
@@ -42,6 +42,20 @@ namespace crypto {
         return wazn_crypto_generate_key_derivation(out.data, tx_pub.data, view_sec.data) == 0;
       }
 
+      inline
+      void generate_key_derivations(const std::vector<public_key> &tx_pubs, const secret_key &view_sec, std::vector<boost::optional<key_derivation>> &out)
+      {
+        out.resize(tx_pubs.size());
+        for (size_t i = 0; i < tx_pubs.size(); ++i)
+        {
+          key_derivation derivation;
+          if (generate_key_derivation(tx_pubs[i], view_sec, derivation))
+            out[i] = derivation;
+          else
+            out[i] = boost::none;
+        }
+      }
+
       inline
       bool derive_subaddress_public_key(const public_key &output_pub, const key_derivation &d, std::size_t index, public_key &out)
       {
@@ -51,6 +65,7 @@ namespace crypto {
       }
 #else
     using ::crypto::generate_key_derivation;
+    using ::crypto::generate_key_derivations;
     using ::crypto::derive_subaddress_public_key;
 #endif
   }
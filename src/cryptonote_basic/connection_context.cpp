@@ -64,6 +64,12 @@ namespace cryptonote
       return 1024 * 1024; // 1 MB
     case cryptonote::NOTIFY_GET_TXPOOL_COMPLEMENT::ID:
       return 1024 * 1024 * 4; // 4 MB
+    case cryptonote::NOTIFY_NEW_COMPACT_BLOCK::ID:
+      return 1024 * 1024 * 4; // 4 MB, block without tx hashes plus 6 bytes per tx
+    case cryptonote::NOTIFY_TX_INVENTORY::ID:
+      return 1024 * 1024; // 1 MB
+    case cryptonote::NOTIFY_REQUEST_TXS::ID:
+      return 1024 * 1024; // 1 MB
     default:
       break;
     };
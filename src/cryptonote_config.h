@@ -109,6 +109,11 @@
 #define CRYPTONOTE_DANDELIONPP_EPOCH_RANGE       30 // seconds
 #define CRYPTONOTE_DANDELIONPP_FLUSH_AVERAGE      5 // seconds average for poisson distributed fluff flush
 #define CRYPTONOTE_DANDELIONPP_EMBARGO_AVERAGE   39 // seconds (see tx_pool.cpp for more info)
+#define CRYPTONOTE_TX_RELAY_FLOOD_FANOUT          8 // outgoing tx inventory peers that still get full fluffed txes
+#define CRYPTONOTE_TX_INVENTORY_MAX_HASHES     1000 // most tx hashes in a NOTIFY_TX_INVENTORY or NOTIFY_REQUEST_TXS
+#define CRYPTONOTE_TX_REQUEST_TIMEOUT            20 // seconds before a tx requested from one peer may be requested from another
+#define CRYPTONOTE_TX_REQUEST_MAX_ANNOUNCERS      8 // peers kept per requested tx to ask next if the request fails
+#define CRYPTONOTE_TX_REQUEST_REPLY_SIZE (4*1024*1024) // most bytes of txes per NOTIFY_NEW_TRANSACTIONS answering NOTIFY_REQUEST_TXS
 
 // see src/cryptonote_protocol/levin_notify.cpp
 #define CRYPTONOTE_NOISE_MIN_EPOCH                      5      // minutes
@@ -153,7 +158,9 @@
 #define P2P_IDLE_CONNECTION_KILL_INTERVAL               (5*60) //5 minutes
 
 #define P2P_SUPPORT_FLAG_FLUFFY_BLOCKS                  0x01
-#define P2P_SUPPORT_FLAGS                               P2P_SUPPORT_FLAG_FLUFFY_BLOCKS
+#define P2P_SUPPORT_FLAG_COMPACT_BLOCKS                 0x02
+#define P2P_SUPPORT_FLAG_TX_INVENTORY                   0x04
+#define P2P_SUPPORT_FLAGS                               (P2P_SUPPORT_FLAG_FLUFFY_BLOCKS | P2P_SUPPORT_FLAG_COMPACT_BLOCKS | P2P_SUPPORT_FLAG_TX_INVENTORY)
 
 #define RPC_IP_FAILS_BEFORE_BLOCK                       3
 
@@ -162,6 +169,7 @@
 #define CRYPTONOTE_BLOCKCHAINDATA_LOCK_FILENAME "lock.mdb"
 #define P2P_NET_DATA_FILENAME                   "p2pstate.bin"
 #define RPC_PAYMENTS_DATA_FILENAME              "rpcpayments.bin"
+#define CRYPTONOTE_BLOCK_QUEUE_SPILL_FILENAME   "block_queue.spill"
 #define MINER_CONFIG_FILE_NAME                  "miner_conf.json"
 
 #define THREAD_STACK_SIZE                       5 * 1024 * 1024
@@ -86,6 +86,21 @@ DISABLE_VS_WARNINGS(4267)
 // used to overestimate the block reward when estimating a per kB to use
 #define BLOCK_REWARD_OVERESTIMATE (10 * 1000000000000)
 
+// deepest reorg the rct output mirror follows without reloading
+#define RCT_OUTPUTS_CACHE_REORG_DEPTH 1024
+
+static crypto::hash get_ring_hash(const rct::ctkeyM &mix_ring)
+{
+  std::vector<rct::key> keys;
+  for (const auto &ring: mix_ring)
+    for (const rct::ctkey &k: ring)
+    {
+      keys.push_back(k.dest);
+      keys.push_back(k.mask);
+    }
+  return crypto::cn_fast_hash(keys.data(), keys.size() * sizeof(rct::key));
+}
+
 //------------------------------------------------------------------
 Blockchain::Blockchain(tx_memory_pool& tx_pool) :
   m_db(), m_tx_pool(tx_pool), m_hardfork(NULL), m_timestamps_and_difficulties_height(0), m_reset_timestamps_and_difficulties_height(true), m_current_block_cumul_weight_limit(0), m_current_block_cumul_weight_median(0),
@@ -96,9 +111,11 @@ Blockchain::Blockchain(tx_memory_pool& tx_pool) :
   m_long_term_block_weights_cache_rolling_median(CRYPTONOTE_LONG_TERM_BLOCK_WEIGHT_WINDOW_SIZE),
   m_difficulty_for_next_block_top_hash(crypto::null_hash),
   m_difficulty_for_next_block(1),
+  m_rct_outputs_cache_loaded(false),
   m_btc_valid(false),
   m_batch_success(true),
-  m_prepare_height(0)
+  m_prepare_height(0),
+  m_prefetch_waiter(tools::threadpool::getInstance())
 {
   LOG_PRINT_L3("Blockchain::" << __func__);
 }
@@ -456,6 +473,9 @@ bool Blockchain::init(BlockchainDB* db, const network_type nettype, bool offline
     if (!update_next_cumulative_weight_limit())
       return false;
   }
+
+  // warm the rct output distribution mirror without holding up init or the blockchain lock
+  m_async_service.post([this](){ load_rct_outputs_cache(); });
   return true;
 }
 //------------------------------------------------------------------
@@ -505,6 +525,9 @@ bool Blockchain::deinit()
 
   MTRACE("Stopping blockchain read/write activity");
 
+  // wait for any block prefetch still in flight, it reads from the db
+  m_prefetch_waiter.wait();
+
  // stop async service
   m_async_work_idle.reset();
   m_async_pool.join_all();
@@ -641,6 +664,7 @@ block Blockchain::pop_block_from_blockchain()
 
   m_blocks_longhash_table.clear();
   m_scan_table.clear();
+  m_batch_verified_txs.clear();
   m_blocks_txs_check.clear();
 
   CHECK_AND_ASSERT_THROW_MES(update_next_cumulative_weight_limit(), "Error updating next cumulative weight limit");
@@ -2246,7 +2270,9 @@ crypto::public_key Blockchain::get_output_key(uint64_t amount, uint64_t global_i
 bool Blockchain::get_outs(const COMMAND_RPC_GET_OUTPUTS_BIN::request& req, COMMAND_RPC_GET_OUTPUTS_BIN::response& res) const
 {
   LOG_PRINT_L3("Blockchain::" << __func__);
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  // all reads come from one pinned snapshot, so there is no need to
+  // serialize behind block processing on m_blockchain_lock
+  db_rtxn_guard rtxn_guard(m_db);
 
   res.outs.clear();
   res.outs.reserve(req.outputs.size());
@@ -2323,6 +2349,7 @@ bool Blockchain::get_output_distribution(uint64_t amount, uint64_t from_height,
     start_height = from_height;
 
   distribution.clear();
+  db_rtxn_guard rtxn_guard(m_db);
   uint64_t db_height = m_db->height();
   if (db_height == 0)
     return false;
@@ -2330,9 +2357,20 @@ bool Blockchain::get_output_distribution(uint64_t amount, uint64_t from_height,
     return false;
   if (amount == 0)
   {
+    const uint64_t real_start_height = start_height > 0 ? start_height-1 : start_height;
+    if (get_cached_rct_outputs(real_start_height, to_height, distribution))
+    {
+      if (start_height > 0)
+      {
+        base = distribution[0];
+        distribution.erase(distribution.begin());
+      }
+      return true;
+    }
+
+    // the mirror is not loaded yet, read the db directly
     std::vector<uint64_t> heights;
     heights.reserve(to_height + 1 - start_height);
-    const uint64_t real_start_height = start_height > 0 ? start_height-1 : start_height;
     for (uint64_t h = real_start_height; h <= to_height; ++h)
       heights.push_back(h);
     distribution = m_db->get_block_cumulative_rct_outputs(heights);
@@ -2518,7 +2556,7 @@ static bool fill(BlockchainDB *db, const crypto::hash &tx_hash, tx_blob_entry &t
 bool Blockchain::get_transactions_blobs(const std::vector<crypto::hash>& txs_ids, std::vector<cryptonote::blobdata>& txs, std::vector<crypto::hash>& missed_txs, bool pruned) const
 {
   LOG_PRINT_L3("Blockchain::" << __func__);
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  db_rtxn_guard rtxn_guard(m_db);
 
   txs.reserve(txs_ids.size());
   for (const auto& tx_hash : txs_ids)
@@ -2542,7 +2580,7 @@ bool Blockchain::get_transactions_blobs(const std::vector<crypto::hash>& txs_ids
 bool Blockchain::get_transactions_blobs(const std::vector<crypto::hash>& txs_ids, std::vector<tx_blob_entry>& txs, std::vector<crypto::hash>& missed_txs, bool pruned) const
 {
   LOG_PRINT_L3("Blockchain::" << __func__);
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  db_rtxn_guard rtxn_guard(m_db);
 
   txs.reserve(txs_ids.size());
   for (const auto& tx_hash : txs_ids)
@@ -2578,7 +2616,7 @@ template<class t_ids_container, class t_tx_container, class t_missed_container>
 bool Blockchain::get_split_transactions_blobs(const t_ids_container& txs_ids, t_tx_container& txs, t_missed_container& missed_txs) const
 {
   LOG_PRINT_L3("Blockchain::" << __func__);
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  db_rtxn_guard rtxn_guard(m_db);
 
   reserve_container(txs, txs_ids.size());
   for (const auto& tx_hash : txs_ids)
@@ -2612,7 +2650,7 @@ template<class t_ids_container, class t_tx_container, class t_missed_container>
 bool Blockchain::get_transactions(const t_ids_container& txs_ids, t_tx_container& txs, t_missed_container& missed_txs) const
 {
   LOG_PRINT_L3("Blockchain::" << __func__);
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  db_rtxn_guard rtxn_guard(m_db);
 
   reserve_container(txs, txs_ids.size());
   for (const auto& tx_hash : txs_ids)
@@ -3525,7 +3563,19 @@ bool Blockchain::check_tx_inputs(transaction& tx, tx_verification_context &tvc,
         }
       }
 
-      if (!rct::verRctNonSemanticsSimple(rv))
+      // already checked as part of a batch in prepare_handle_incoming_blocks
+      bool batch_verified = !m_batch_verified_txs.empty() && m_batch_verified_txs.find(get_transaction_hash(tx)) != m_batch_verified_txs.end();
+      // or ahead of pool admission, against these very rings
+      if (!batch_verified)
+      {
+        CRITICAL_REGION_LOCAL(m_preverified_txs_lock);
+        if (!m_preverified_txs.empty())
+        {
+          const auto it = m_preverified_txs.find(get_transaction_hash(tx));
+          batch_verified = it != m_preverified_txs.end() && it->second == get_ring_hash(rv.mixRing);
+        }
+      }
+      if (!batch_verified && !rct::verRctNonSemanticsSimple(rv))
       {
         MERROR_VER("Failed to check ringct signatures!");
         return false;
@@ -4628,13 +4678,83 @@ void Blockchain::block_longhash_worker(uint64_t height, const epee::span<const b
     if (m_cancel)
        break;
     crypto::hash id = get_block_hash(block);
-    crypto::hash pow = get_block_longhash(this, block, height++, 0);
+    crypto::hash pow;
+    const auto it = m_prefetched_longhashes.find(id);
+    if (it != m_prefetched_longhashes.end() && it->second.height == height &&
+        (block.major_version < RX_BLOCK_VERSION || it->second.seed_hash == get_pending_block_id_by_height(rx_seedheight(height))))
+      pow = it->second.pow;
+    else
+      pow = get_block_longhash(this, block, height, 0);
+    ++height;
     map.emplace(id, pow);
   }
 
   slow_hash_free_state();
   TIME_MEASURE_FINISH(t);
 }
+//------------------------------------------------------------------
+void Blockchain::block_longhash_prefetch_worker(uint64_t height, const blobdata &blob, const crypto::hash &seed_hash, prefetched_longhash_t &result) const
+{
+  if (m_cancel)
+    return;
+
+  block b;
+  crypto::hash id;
+  if (!parse_and_validate_block_from_blob(blob, b, id))
+    return;
+
+  // the seed could not be resolved when the prefetch was started
+  const bool rx = b.major_version >= RX_BLOCK_VERSION;
+  if (rx && seed_hash == crypto::null_hash)
+    return;
+
+  crypto::hash pow;
+  get_block_longhash(this, b, pow, height, rx ? &seed_hash : NULL, 0);
+  result = {id, height, seed_hash, pow, true};
+}
+//------------------------------------------------------------------
+void Blockchain::prefetch_incoming_blocks(uint64_t height, std::shared_ptr<const std::vector<block_complete_entry>> blocks, const std::vector<block> &pending_blocks)
+{
+  MTRACE("Blockchain::" << __func__);
+
+  // only one span in flight, drop whatever was not picked up
+  m_prefetch_waiter.wait();
+  m_prefetch_blocks.reset();
+  m_prefetch_results.clear();
+  m_prefetched_longhashes.clear();
+
+  if (!blocks || blocks->empty() || m_cancel)
+    return;
+
+  std::vector<crypto::hash> seed_hashes(blocks->size(), crypto::null_hash);
+  {
+    CRITICAL_REGION_LOCAL(m_blockchain_lock);
+    const uint64_t db_height = m_db->height();
+    if (height != db_height + pending_blocks.size())
+      return;
+    // below the precomputed block hashes, the PoW is not checked
+    if (height + blocks->size() < m_blocks_hash_check.size())
+      return;
+
+    for (size_t i = 0; i < blocks->size(); ++i)
+    {
+      const uint64_t seed_height = rx_seedheight(height + i);
+      if (seed_height < db_height)
+        seed_hashes[i] = m_db->get_block_hash_from_height(seed_height);
+      else if (seed_height - db_height < pending_blocks.size())
+        seed_hashes[i] = get_block_hash(pending_blocks[seed_height - db_height]);
+    }
+  }
+
+  // the block queue may drop the span meanwhile, the blobs live on in m_prefetch_blocks
+  m_prefetch_blocks = std::move(blocks);
+  m_prefetch_results.resize(m_prefetch_blocks->size(), prefetched_longhash_t{crypto::null_hash, 0, crypto::null_hash, crypto::null_hash, false});
+
+  // one job per block, so a thread waiting on another waiter never steals much of it
+  tools::threadpool& tpool = tools::threadpool::getInstance();
+  for (size_t i = 0; i < m_prefetch_blocks->size(); ++i)
+    tpool.submit(&m_prefetch_waiter, boost::bind(&Blockchain::block_longhash_prefetch_worker, this, height + i, std::cref((*m_prefetch_blocks)[i].block), seed_hashes[i], std::ref(m_prefetch_results[i])), true);
+}
 
 //------------------------------------------------------------------
 bool Blockchain::cleanup_handle_incoming_blocks(bool force_sync)
@@ -4696,6 +4816,7 @@ bool Blockchain::cleanup_handle_incoming_blocks(bool force_sync)
   TIME_MEASURE_FINISH(t1);
   m_blocks_longhash_table.clear();
   m_scan_table.clear();
+  m_batch_verified_txs.clear();
   m_blocks_txs_check.clear();
 
   // when we're well clear of the precomputed hashes, free the memory
@@ -4984,6 +5105,15 @@ bool Blockchain::prepare_handle_incoming_blocks(const std::vector<block_complete
 
     if (!blocks_exist)
     {
+      // pick up the PoW computed ahead by prefetch_incoming_blocks, if any
+      m_prefetch_waiter.wait();
+      for (const prefetched_longhash_t &ph: m_prefetch_results)
+        if (ph.valid)
+          m_prefetched_longhashes.emplace(ph.id, ph);
+      m_prefetch_blocks.reset();
+      m_prefetch_results.clear();
+      MDEBUG(m_prefetched_longhashes.size() << "/" << blocks_entry.size() << " block hashes were prefetched");
+
       m_blocks_longhash_table.clear();
       uint64_t thread_height = height;
       tools::threadpool::waiter waiter(tpool);
@@ -4999,7 +5129,9 @@ bool Blockchain::prepare_handle_incoming_blocks(const std::vector<block_complete
         thread_height += nblocks;
       }
 
-      if (!waiter.wait())
+      const bool ok = waiter.wait();
+      m_prefetched_longhashes.clear();
+      if (!ok)
         return false;
       m_prepare_height = 0;
 
@@ -5026,6 +5158,7 @@ bool Blockchain::prepare_handle_incoming_blocks(const std::vector<block_complete
   m_fake_pow_calc_time = 0;
 
   m_scan_table.clear();
+  m_batch_verified_txs.clear();
 
   TIME_MEASURE_FINISH(prepare);
   m_fake_pow_calc_time = prepare / blocks_entry.size();
@@ -5047,6 +5180,7 @@ bool Blockchain::prepare_handle_incoming_blocks(const std::vector<block_complete
         do { \
             MERROR_VER(m) ;\
             m_scan_table.clear(); \
+            m_batch_verified_txs.clear(); \
             return false; \
         } while(0); \
 
@@ -5065,7 +5199,15 @@ bool Blockchain::prepare_handle_incoming_blocks(const std::vector<block_complete
       crypto::hash &tx_prefix_hash = txes[tx_index].second;
       ++tx_index;
 
-      if (!parse_and_validate_tx_base_from_blob(tx_blob.blob, tx))
+      // unpruned txes are parsed whole, so batch_verify_ring_signatures can
+      // check their signatures without parsing them again
+      bool parsed = tx_blob.prunable_hash == crypto::null_hash && parse_and_validate_tx_from_blob(tx_blob.blob, tx);
+      if (!parsed)
+      {
+        tx = transaction();
+        parsed = parse_and_validate_tx_base_from_blob(tx_blob.blob, tx);
+      }
+      if (!parsed)
         SCAN_TABLE_QUIT("Could not parse tx from incoming blocks.");
       cryptonote::get_transaction_prefix_hash(tx, tx_prefix_hash);
 
@@ -5213,9 +5355,158 @@ bool Blockchain::prepare_handle_incoming_blocks(const std::vector<block_complete
       MDEBUG("Prepare scantable took: " << scantable << " ms");
   }
 
+  if (total_txs > 0)
+    batch_verify_ring_signatures(blocks_entry, txes);
+
   return true;
 }
 
+//------------------------------------------------------------------
+// Verify the ring signatures of all the simple rct txes in the incoming blocks
+// whose rings are fully resolved by m_scan_table, as one batch. If the whole
+// batch passes, the txes are recorded in m_batch_verified_txs so check_tx_inputs
+// can skip the per tx signature check. If it fails, nothing is recorded and each
+// tx is checked on its own later, which also pinpoints the offender.
+void Blockchain::batch_verify_ring_signatures(const std::vector<block_complete_entry> &blocks_entry, std::vector<std::pair<transaction, crypto::hash>> &txes)
+{
+  TIME_MEASURE_START(ringsigs);
+
+  std::vector<const transaction*> batch_txes;
+  batch_txes.reserve(txes.size());
+  size_t tx_index = 0;
+  for (const auto &entry : blocks_entry)
+  {
+    for (const auto &tx_blob : entry.txs)
+    {
+      if (m_cancel)
+        return;
+      if (tx_index >= txes.size())
+        return;
+      transaction &tx = txes[tx_index].first;
+      const crypto::hash &tx_prefix_hash = txes[tx_index].second;
+      ++tx_index;
+
+      if (tx.version < 2 || tx_blob.prunable_hash != crypto::null_hash || tx.pruned)
+        continue;
+      const uint8_t type = tx.rct_signatures.type;
+      if (type != rct::RCTTypeSimple && type != rct::RCTTypeBulletproof && type != rct::RCTTypeBulletproof2 && type != rct::RCTTypeCLSAG)
+        continue;
+
+      // only txes whose every ring member is already known in the scan table
+      // are verified here, so check_tx_inputs will see the exact same rings
+      const auto its = m_scan_table.find(tx_prefix_hash);
+      if (its == m_scan_table.end())
+        continue;
+      std::vector<std::vector<rct::ctkey>> pubkeys(tx.vin.size());
+      bool complete = true;
+      for (size_t n = 0; complete && n < tx.vin.size(); ++n)
+      {
+        const txin_to_key &in_to_key = boost::get<txin_to_key>(tx.vin[n]);
+        const auto it = its->second.find(in_to_key.k_image);
+        if (it == its->second.end() || it->second.size() != in_to_key.key_offsets.size())
+        {
+          complete = false;
+          break;
+        }
+        pubkeys[n].reserve(it->second.size());
+        for (const output_data_t &od : it->second)
+          pubkeys[n].push_back(rct::ctkey({rct::pk2rct(od.pubkey), od.commitment}));
+      }
+      if (!complete)
+        continue;
+
+      if (expand_transaction_2(tx, tx_prefix_hash, pubkeys))
+        batch_txes.push_back(&tx);
+    }
+  }
+
+  if (batch_txes.empty())
+    return;
+
+  std::vector<const rct::rctSig*> rvv;
+  rvv.reserve(batch_txes.size());
+  for (const transaction *tx : batch_txes)
+    rvv.push_back(&tx->rct_signatures);
+
+  const bool ok = rct::verRctNonSemanticsSimple(rvv);
+  if (ok)
+  {
+    for (const transaction *tx : batch_txes)
+      m_batch_verified_txs.insert(get_transaction_hash(*tx));
+  }
+
+  TIME_MEASURE_FINISH(ringsigs);
+  if(m_show_time_stats)
+    MDEBUG("Prepare ring signatures (" << batch_txes.size() << " txes, " << (ok ? "passed" : "failed, falling back to per tx checks") << ") took: " << ringsigs << " ms");
+}
+
+//------------------------------------------------------------------
+void Blockchain::preverify_tx_signatures(const std::vector<transaction*> &txs)
+{
+  PERF_TIMER(preverify_tx_signatures);
+
+  std::vector<crypto::hash> ring_hashes(txs.size(), crypto::null_hash);
+  tools::threadpool& tpool = tools::threadpool::getInstance();
+  tools::threadpool::waiter waiter(tpool);
+  for (size_t i = 0; i < txs.size(); ++i)
+  {
+    tpool.submit(&waiter, [this, &txs, &ring_hashes, i]() {
+      transaction &tx = *txs[i];
+      if (tx.version < 2 || tx.pruned)
+        return;
+      const uint8_t type = tx.rct_signatures.type;
+      if (type != rct::RCTTypeSimple && type != rct::RCTTypeBulletproof && type != rct::RCTTypeBulletproof2 && type != rct::RCTTypeCLSAG)
+        return;
+
+      // any failure here just leaves the tx to check_tx_inputs
+      try
+      {
+        db_rtxn_guard rtxn_guard(m_db);
+        std::vector<std::vector<rct::ctkey>> pubkeys(tx.vin.size());
+        for (size_t n = 0; n < tx.vin.size(); ++n)
+        {
+          if (tx.vin[n].type() != typeid(txin_to_key))
+            return;
+          const txin_to_key &in_to_key = boost::get<txin_to_key>(tx.vin[n]);
+          if (in_to_key.key_offsets.empty())
+            return;
+          const std::vector<uint64_t> absolute_offsets = relative_output_offsets_to_absolute(in_to_key.key_offsets);
+          std::vector<output_data_t> outputs;
+          m_db->get_output_key(epee::span<const uint64_t>(&in_to_key.amount, 1), absolute_offsets, outputs, true);
+          if (outputs.size() != absolute_offsets.size())
+            return;
+          pubkeys[n].reserve(outputs.size());
+          for (const output_data_t &od: outputs)
+            pubkeys[n].push_back(rct::ctkey({rct::pk2rct(od.pubkey), od.commitment}));
+        }
+        if (!expand_transaction_2(tx, get_transaction_prefix_hash(tx), pubkeys))
+          return;
+        if (!rct::verRctNonSemanticsSimple(tx.rct_signatures))
+          return;
+        ring_hashes[i] = get_ring_hash(tx.rct_signatures.mixRing);
+      }
+      catch (const std::exception &e)
+      {
+        MDEBUG("Failed to preverify tx " << get_transaction_hash(tx) << ": " << e.what());
+      }
+    });
+  }
+  if (!waiter.wait())
+    return;
+
+  CRITICAL_REGION_LOCAL(m_preverified_txs_lock);
+  for (size_t i = 0; i < txs.size(); ++i)
+    if (ring_hashes[i] != crypto::null_hash)
+      m_preverified_txs[get_transaction_hash(*txs[i])] = ring_hashes[i];
+}
+//------------------------------------------------------------------
+void Blockchain::forget_preverified_txs(const std::vector<crypto::hash> &txids)
+{
+  CRITICAL_REGION_LOCAL(m_preverified_txs_lock);
+  for (const crypto::hash &txid: txids)
+    m_preverified_txs.erase(txid);
+}
+//------------------------------------------------------------------
 void Blockchain::add_txpool_tx(const crypto::hash &txid, const cryptonote::blobdata &blob, const txpool_tx_meta_t &meta)
 {
   m_db->add_txpool_tx(txid, blob, meta);
@@ -5515,6 +5806,90 @@ bool Blockchain::for_all_outputs(uint64_t amount, std::function<bool(uint64_t he
   return m_db->for_all_outputs(amount, f);
 }
 
+bool Blockchain::get_cached_rct_outputs(uint64_t from_height, uint64_t to_height, std::vector<uint64_t> &distribution) const
+{
+  // don't queue up behind the initial load
+  if (!m_rct_outputs_cache_loaded)
+    return false;
+  CRITICAL_REGION_LOCAL(m_rct_outputs_cache_lock);
+  sync_rct_outputs_cache();
+  // the mirror may be ahead of an older read txn, whose blocks it still has
+  const uint64_t db_height = m_db->height();
+  if (db_height == 0)
+    return false;
+  to_height = std::min(to_height, db_height - 1);
+  if (from_height > to_height || to_height >= m_rct_outputs_cache.size())
+    return false;
+  distribution.assign(m_rct_outputs_cache.begin() + from_height, m_rct_outputs_cache.begin() + to_height + 1);
+  return true;
+}
+
+void Blockchain::load_rct_outputs_cache() const
+{
+  try
+  {
+    db_rtxn_guard rtxn_guard(m_db);
+    CRITICAL_REGION_LOCAL(m_rct_outputs_cache_lock);
+    TIME_MEASURE_START(t);
+    sync_rct_outputs_cache();
+    m_rct_outputs_cache_loaded = true;
+    TIME_MEASURE_FINISH(t);
+    MDEBUG("Loaded cumulative rct output counts for " << m_rct_outputs_cache.size() << " blocks in " << t << " ms");
+  }
+  catch (const std::exception &e)
+  {
+    MERROR("Failed to load cumulative rct output counts, reading them from the db: " << e.what());
+  }
+}
+
+void Blockchain::sync_rct_outputs_cache() const
+{
+  // only committed blocks are visible in the read txn, so popped or aborted
+  // blocks show up as a hash mismatch at the txn's top. A txn on an older
+  // snapshot just sees fewer blocks, and the mirror is kept past its top
+  const uint64_t db_height = m_db->height();
+  std::vector<uint64_t> &counts = m_rct_outputs_cache;
+  std::deque<crypto::hash> &top_hashes = m_rct_outputs_cache_top_hashes;
+
+  // blocks below the top hashes are deeper than any reorg, and taken as final
+  const uint64_t top = std::min<uint64_t>(counts.size(), db_height);
+  const uint64_t tail_start = counts.size() - top_hashes.size();
+  uint64_t height = top;
+  while (height > tail_start && top_hashes[height - 1 - tail_start] != m_db->get_block_hash_from_height(height - 1))
+    --height;
+  if (height < top)
+  {
+    if (height == tail_start)
+    {
+      MDEBUG("Cumulative rct output mirror forked too deep, reloading");
+      height = 0;
+    }
+    top_hashes.resize(top_hashes.size() - std::min<uint64_t>(top_hashes.size(), counts.size() - height));
+    counts.resize(height);
+  }
+  if (counts.size() >= db_height)
+    return;
+
+  height = counts.size();
+  std::vector<uint64_t> heights;
+  heights.reserve(db_height - height);
+  for (uint64_t h = height; h < db_height; ++h)
+    heights.push_back(h);
+  const std::vector<uint64_t> new_counts = m_db->get_block_cumulative_rct_outputs(heights);
+  counts.insert(counts.end(), new_counts.begin(), new_counts.end());
+
+  // keep the hashes of the top blocks contiguous, refilling any trimmed above
+  const uint64_t new_tail_start = db_height - std::min<uint64_t>(db_height, RCT_OUTPUTS_CACHE_REORG_DEPTH);
+  if (height < new_tail_start)
+    top_hashes.clear();
+  for (uint64_t h = std::max(height, new_tail_start); h < db_height; ++h)
+    top_hashes.push_back(m_db->get_block_hash_from_height(h));
+  while (top_hashes.size() > RCT_OUTPUTS_CACHE_REORG_DEPTH)
+    top_hashes.pop_front();
+  while (top_hashes.size() < db_height - new_tail_start)
+    top_hashes.push_front(m_db->get_block_hash_from_height(db_height - top_hashes.size() - 1));
+}
+
 void Blockchain::invalidate_block_template_cache()
 {
   MDEBUG("Invalidating block template cache");
@@ -43,6 +43,7 @@
 #include <boost/multi_index/hashed_index.hpp>
 #include <boost/multi_index/member.hpp>
 #include <atomic>
+#include <deque>
 #include <functional>
 #include <unordered_map>
 #include <unordered_set>
@@ -62,6 +63,7 @@
 #include "checkpoints/checkpoints.h"
 #include "cryptonote_basic/hardfork.h"
 #include "blockchain_db/blockchain_db.h"
+#include "common/threadpool.h"
 
 namespace tools { class Notify; }
 
@@ -252,6 +254,23 @@ namespace cryptonote
      */
     bool cleanup_handle_incoming_blocks(bool force_sync = false);
 
+    /**
+     * @brief starts computing the proof of work of the next span of blocks
+     *
+     * This is meant to be called between prepare_handle_incoming_blocks and
+     * cleanup_handle_incoming_blocks, so the next span is hashed on the
+     * threadpool while the current one is being added and committed. Seed
+     * hashes are resolved now, against the chain and the pending blocks.
+     * prepare_handle_incoming_blocks uses the results only if the chain
+     * still has the same seed at that point, and computes the hashes as
+     * usual otherwise. Only one span is prefetched at a time.
+     *
+     * @param height the height of the first block of the span
+     * @param blocks the blocks of the span, kept alive until they are hashed
+     * @param pending_blocks the blocks currently being added, which must end right before height
+     */
+    void prefetch_incoming_blocks(uint64_t height, std::shared_ptr<const std::vector<block_complete_entry>> blocks, const std::vector<block> &pending_blocks);
+
     /**
      * @brief search the blockchain for a transaction by hash
      *
@@ -588,6 +607,27 @@ namespace cryptonote
      */
     bool check_tx_inputs(transaction& tx, uint64_t& pmax_used_block_height, crypto::hash& max_used_block_id, tx_verification_context &tvc, bool kept_by_block = false) const;
 
+    /**
+     * @brief checks the ring signatures of transactions bound for the pool, ahead of admission
+     *
+     * Ring members are read from a db read snapshot and signatures are
+     * verified on the threadpool, all without the blockchain lock. The
+     * transactions which pass are remembered with a hash of their rings,
+     * and check_tx_inputs skips their signature check as long as it
+     * resolves the same rings. Others are left for check_tx_inputs as usual.
+     * The transactions' rct signatures, if any, are expanded.
+     *
+     * @param txs the transactions, with their hashes set
+     */
+    void preverify_tx_signatures(const std::vector<transaction*> &txs);
+
+    /**
+     * @brief forgets transactions remembered by preverify_tx_signatures
+     *
+     * @param txids the hashes of the transactions given to preverify_tx_signatures
+     */
+    void forget_preverified_txs(const std::vector<crypto::hash> &txids);
+
     /**
      * @brief get fee quantization mask
      *
@@ -1085,6 +1125,9 @@ namespace cryptonote
 
     // metadata containers
     std::unordered_map<crypto::hash, std::unordered_map<crypto::key_image, std::vector<output_data_t>>> m_scan_table;
+    std::unordered_set<crypto::hash> m_batch_verified_txs;
+    std::unordered_map<crypto::hash, crypto::hash> m_preverified_txs; // txid -> hash of the rings it was verified against
+    mutable epee::critical_section m_preverified_txs_lock;
     std::unordered_map<crypto::hash, crypto::hash> m_blocks_longhash_table;
 
     // Keccak hashes for each block and for fast pow checking
@@ -1113,9 +1156,18 @@ namespace cryptonote
     mutable epee::misc_utils::rolling_median_t<uint64_t> m_long_term_block_weights_cache_rolling_median;
 
     epee::critical_section m_difficulty_lock;
+
     crypto::hash m_difficulty_for_next_block_top_hash;
     difficulty_type m_difficulty_for_next_block;
 
+    // in-memory mirror of the per block cumulative rct output counts, loaded
+    // in the background at init and synced to the committed chain on read,
+    // with the hashes of its top blocks to spot reorgs
+    mutable epee::critical_section m_rct_outputs_cache_lock;
+    mutable std::vector<uint64_t> m_rct_outputs_cache;
+    mutable std::deque<crypto::hash> m_rct_outputs_cache_top_hashes;
+    mutable std::atomic<bool> m_rct_outputs_cache_loaded;
+
     boost::asio::io_service m_async_service;
     boost::thread_group m_async_pool;
     std::unique_ptr<boost::asio::io_service::work> m_async_work_idle;
@@ -1162,6 +1214,20 @@ namespace cryptonote
     uint64_t m_prepare_nblocks;
     std::vector<block> *m_prepare_blocks;
 
+    // for prefetch_incoming_blocks
+    struct prefetched_longhash_t
+    {
+      crypto::hash id;
+      uint64_t height;
+      crypto::hash seed_hash;
+      crypto::hash pow;
+      bool valid;
+    };
+    tools::threadpool::waiter m_prefetch_waiter;
+    std::shared_ptr<const std::vector<block_complete_entry>> m_prefetch_blocks;
+    std::vector<prefetched_longhash_t> m_prefetch_results;
+    std::unordered_map<crypto::hash, prefetched_longhash_t> m_prefetched_longhashes;
+
     /**
      * @brief collects the keys for all outputs being "spent" as an input
      *
@@ -1523,6 +1589,62 @@ namespace cryptonote
      */
     bool expand_transaction_2(transaction &tx, const crypto::hash &tx_prefix_hash, const std::vector<std::vector<rct::ctkey>> &pubkeys) const;
 
+    /**
+     * @brief verifies the ring signatures of a set of incoming blocks as one batch
+     *
+     * Only simple rct transactions whose rings are fully resolved by
+     * m_scan_table take part. If the batch verifies, their hashes are
+     * recorded in m_batch_verified_txs, so check_tx_inputs does not need
+     * to check their signatures again. On failure nothing is recorded.
+     *
+     * @param blocks_entry the incoming blocks
+     * @param txes the parsed transactions and their prefix hashes, in block order; the verified ones are expanded in place
+     */
+    void batch_verify_ring_signatures(const std::vector<block_complete_entry> &blocks_entry, std::vector<std::pair<transaction, crypto::hash>> &txes);
+
+    /**
+     * @brief computes the "long" hash of a block ahead of its import
+     *
+     * @param height the height of the block
+     * @param blob the block blob
+     * @param seed_hash the seed hash to use (ignored for pre RandomX blocks)
+     * @param result return-by-reference the computed hash, marked valid on success
+     */
+    void block_longhash_prefetch_worker(uint64_t height, const blobdata &blob, const crypto::hash &seed_hash,
+        prefetched_longhash_t &result) const;
+
+    /**
+     * @brief gets cumulative rct output counts from the in-memory mirror
+     *
+     * Must be called within a db read txn, the mirror is synced to what
+     * that txn sees before reading it. Blocks past that txn's top are
+     * never returned.
+     *
+     * @param from_height the first height to get
+     * @param to_height the last height to get, capped to the txn's top block
+     * @param distribution return-by-reference the counts for [from_height, to_height]
+     *
+     * @return false if the mirror is not loaded yet or does not cover to_height, true otherwise
+     */
+    bool get_cached_rct_outputs(uint64_t from_height, uint64_t to_height, std::vector<uint64_t> &distribution) const;
+
+    /**
+     * @brief loads the cumulative rct output mirror from the db
+     *
+     * Run from the async pool after init, it only takes the mirror's lock.
+     */
+    void load_rct_outputs_cache() const;
+
+    /**
+     * @brief brings the cumulative rct output mirror in step with the db
+     *
+     * Must be called within a db read txn and with m_rct_outputs_cache_lock
+     * held. Blocks no longer in the committed chain are trimmed by comparing
+     * the mirror's top hashes, and new blocks are appended. A txn on an older
+     * snapshot leaves the blocks past its top alone.
+     */
+    void sync_rct_outputs_cache() const;
+
     /**
      * @brief invalidates any cached block template
      */
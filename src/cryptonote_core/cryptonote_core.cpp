@@ -123,6 +123,11 @@ namespace cryptonote
   , "Set maximum size of block download queue in bytes (0 for default)"
   , 0
   };
+  const command_line::arg_descriptor<size_t> arg_block_download_memory_limit  = {
+    "block-download-memory-limit"
+  , "Keep at most this many bytes of the block download queue in memory, spilling the rest to a file in the data directory (0 to keep it all in memory)"
+  , 0
+  };
   const command_line::arg_descriptor<bool> arg_sync_pruned_blocks  = {
     "sync-pruned-blocks"
   , "Allow syncing from nodes with only pruned blocks"
@@ -341,6 +346,7 @@ namespace cryptonote
     command_line::add_arg(desc, arg_offline);
     command_line::add_arg(desc, arg_disable_dns_checkpoints);
     command_line::add_arg(desc, arg_block_download_max_size);
+    command_line::add_arg(desc, arg_block_download_memory_limit);
     command_line::add_arg(desc, arg_sync_pruned_blocks);
     command_line::add_arg(desc, arg_max_txpool_weight);
     command_line::add_arg(desc, arg_block_notify);
@@ -1048,6 +1054,42 @@ namespace cryptonote
     if (!tx_info.empty())
       handle_incoming_tx_accumulated_batch(tx_info, tx_relay == relay_method::block);
 
+    // check ring signatures of new relayed txes in parallel now, rather than
+    // one tx at a time below, under the pool and blockchain locks. Only txes
+    // which get past the pool's cheap checks are worth it, the others will be
+    // rejected for free by add_new_tx
+    std::vector<crypto::hash> preverified;
+    if (tx_relay != relay_method::block)
+    {
+      std::vector<transaction*> txs;
+      std::unordered_set<crypto::key_image> batch_key_images;
+      const uint8_t version = m_blockchain_storage.get_current_hard_fork_version();
+      it = tx_blobs.begin();
+      for (size_t i = 0; i < tx_blobs.size(); i++, ++it)
+      {
+        if (!results[i].res || already_have[i])
+          continue;
+        const transaction &tx = results[i].tx;
+        const uint64_t weight = tx.pruned ? get_pruned_transaction_weight(tx) : get_transaction_weight(tx, it->blob.size());
+        if (!m_mempool.precheck_tx(tx, results[i].hash, weight, version))
+          continue;
+        bool double_spend = false;
+        for (const txin_v &in: tx.vin)
+          if (in.type() == typeid(txin_to_key) && !batch_key_images.insert(boost::get<txin_to_key>(in).k_image).second)
+            double_spend = true;
+        if (double_spend)
+          continue;
+        txs.push_back(&results[i].tx);
+        preverified.push_back(results[i].hash);
+      }
+      if (!txs.empty())
+        m_blockchain_storage.preverify_tx_signatures(txs);
+    }
+    const auto forget_preverified = epee::misc_utils::create_scope_leave_handler([&](){
+      if (!preverified.empty())
+        m_blockchain_storage.forget_preverified_txs(preverified);
+    });
+
     bool valid_events = false;
     bool ok = true;
     it = tx_blobs.begin();
@@ -1375,7 +1417,7 @@ namespace cryptonote
     return true;
   }
   //-----------------------------------------------------------------------------------------------
-  void core::on_transactions_relayed(const epee::span<const cryptonote::blobdata> tx_blobs, const relay_method tx_relay)
+  std::vector<crypto::hash> core::on_transactions_relayed(const epee::span<const cryptonote::blobdata> tx_blobs, const relay_method tx_relay)
   {
     std::vector<crypto::hash> tx_hashes{};
     tx_hashes.resize(tx_blobs.size());
@@ -1386,10 +1428,11 @@ namespace cryptonote
       if (!parse_and_validate_tx_from_blob(tx_blobs[i], tx, tx_hashes[i]))
       {
         LOG_ERROR("Failed to parse relayed transaction");
-        return;
+        return {};
       }
     }
     m_mempool.set_relayed(epee::to_span(tx_hashes), tx_relay);
+    return tx_hashes;
   }
   //-----------------------------------------------------------------------------------------------
   bool core::get_block_template(block& b, const account_public_address& adr, difficulty_type& diffic, uint64_t& height, uint64_t& expected_reward, const blobdata& ex_nonce, uint64_t &seed_height, crypto::hash &seed_hash)
@@ -1555,6 +1598,12 @@ namespace cryptonote
     return success;
   }
 
+  //-----------------------------------------------------------------------------------------------
+  void core::prefetch_incoming_blocks(uint64_t height, std::shared_ptr<const std::vector<block_complete_entry>> blocks, const std::vector<block> &pending_blocks)
+  {
+    m_blockchain_storage.prefetch_incoming_blocks(height, std::move(blocks), pending_blocks);
+  }
+
   //-----------------------------------------------------------------------------------------------
   bool core::handle_incoming_block(const blobdata& block_blob, const block *b, block_verification_context& bvc, bool update_miner_blocktemplate)
   {
@@ -72,6 +72,7 @@ namespace cryptonote
   extern const command_line::arg_descriptor<difficulty_type> arg_fixed_difficulty;
   extern const command_line::arg_descriptor<bool> arg_offline;
   extern const command_line::arg_descriptor<size_t> arg_block_download_max_size;
+  extern const command_line::arg_descriptor<size_t> arg_block_download_memory_limit;
   extern const command_line::arg_descriptor<bool> arg_sync_pruned_blocks;
 
   /************************************************************************/
@@ -197,6 +198,13 @@ namespace cryptonote
       */
      bool cleanup_handle_incoming_blocks(bool force_sync = false);
 
+     /**
+      * @copydoc Blockchain::prefetch_incoming_blocks
+      *
+      * @note see Blockchain::prefetch_incoming_blocks
+      */
+     void prefetch_incoming_blocks(uint64_t height, std::shared_ptr<const std::vector<block_complete_entry>> blocks, const std::vector<block> &pending_blocks);
+
      /**
       * @brief check the size of a block against the current maximum
       *
@@ -240,8 +248,10 @@ namespace cryptonote
      /**
       * @brief called when a transaction is relayed.
       * @note Should only be invoked from `levin_notify`.
+      *
+      * @return the hashes of the transactions, or empty if they could not be parsed
       */
-     virtual void on_transactions_relayed(epee::span<const cryptonote::blobdata> tx_blobs, relay_method tx_relay) final;
+     virtual std::vector<crypto::hash> on_transactions_relayed(epee::span<const cryptonote::blobdata> tx_blobs, relay_method tx_relay) final;
 
 
      /**
@@ -29,9 +29,11 @@
 
 #pragma once
 
+#include "crypto/hash.h"
 #include "cryptonote_basic/blobdatatype.h"
 #include "cryptonote_protocol/enums.h"
 #include "span.h"
+#include <vector>
 
 namespace cryptonote
 {
@@ -42,6 +44,7 @@ namespace cryptonote
 
     virtual uint64_t get_current_blockchain_height() const = 0;
     virtual bool is_synchronized() const = 0;
-    virtual void on_transactions_relayed(epee::span<const cryptonote::blobdata> tx_blobs, relay_method tx_relay) = 0;
+    //! \return Hashes of `tx_blobs`, or empty if they could not be parsed.
+    virtual std::vector<crypto::hash> on_transactions_relayed(epee::span<const cryptonote::blobdata> tx_blobs, relay_method tx_relay) = 0;
   };
 }
@@ -129,7 +129,7 @@ namespace cryptonote
   }
   //---------------------------------------------------------------------------------
   //---------------------------------------------------------------------------------
-  tx_memory_pool::tx_memory_pool(Blockchain& bchs): m_blockchain(bchs), m_cookie(0), m_txpool_max_weight(DEFAULT_TXPOOL_MAX_WEIGHT), m_txpool_weight(0), m_mine_stem_txes(false), m_next_check(std::time(nullptr))
+  tx_memory_pool::tx_memory_pool(Blockchain& bchs): m_blockchain(bchs), m_cookie(0), m_txpool_max_weight(DEFAULT_TXPOOL_MAX_WEIGHT), m_txpool_weight(0), m_mine_stem_txes(false), m_template_candidates_version(0), m_next_check(std::time(nullptr))
   {
     // class code expects unsigned values throughout
     if (m_next_check < time_t(0))
@@ -144,95 +144,13 @@ namespace cryptonote
     CRITICAL_REGION_LOCAL(m_transactions_lock);
 
     PERF_TIMER(add_tx);
-    if (tx.version == 0)
-    {
-      // v0 never accepted
-      LOG_PRINT_L1("transaction version 0 is invalid");
-      tvc.m_verifivation_failed = true;
-      return false;
-    }
-
-    // we do not accept transactions that timed out before, unless they're
-    // kept_by_block
-    if (!kept_by_block && m_timed_out_transactions.find(id) != m_timed_out_transactions.end())
-    {
-      // not clear if we should set that, since verifivation (sic) did not fail before, since
-      // the tx was accepted before timing out.
-      tvc.m_verifivation_failed = true;
-      return false;
-    }
-
-    if(!check_inputs_types_supported(tx))
-    {
-      tvc.m_verifivation_failed = true;
-      tvc.m_invalid_input = true;
-      return false;
-    }
-
     // fee per kilobyte, size rounded up.
     uint64_t fee;
-
-    if (tx.version == 1)
+    if (!check_tx_cheap(tx, id, tx_weight, version, kept_by_block, fee, tvc))
     {
-      uint64_t inputs_amount = 0;
-      if(!get_inputs_money_amount(tx, inputs_amount))
-      {
-        tvc.m_verifivation_failed = true;
-        return false;
-      }
-
-      uint64_t outputs_amount = get_outs_money_amount(tx);
-      if(outputs_amount > inputs_amount)
-      {
-        LOG_PRINT_L1("transaction use more money than it has: use " << print_money(outputs_amount) << ", have " << print_money(inputs_amount));
-        tvc.m_verifivation_failed = true;
-        tvc.m_overspend = true;
-        return false;
-      }
-      else if(outputs_amount == inputs_amount)
-      {
-        LOG_PRINT_L1("transaction fee is zero: outputs_amount == inputs_amount, rejecting.");
-        tvc.m_verifivation_failed = true;
-        tvc.m_fee_too_low = true;
-        return false;
-      }
-
-      fee = inputs_amount - outputs_amount;
-    }
-    else
-    {
-      fee = tx.rct_signatures.txnFee;
-    }
-
-    if (!kept_by_block && !m_blockchain.check_fee(tx_weight, fee))
-    {
-      tvc.m_verifivation_failed = true;
-      tvc.m_fee_too_low = true;
-      return false;
-    }
-
-    size_t tx_weight_limit = get_transaction_weight_limit(version);
-    if ((!kept_by_block || version >= HF_VERSION_PER_BYTE_FEE) && tx_weight > tx_weight_limit)
-    {
-      LOG_PRINT_L1("transaction is too heavy: " << tx_weight << " bytes, maximum weight: " << tx_weight_limit);
-      tvc.m_verifivation_failed = true;
-      tvc.m_too_big = true;
-      return false;
-    }
-
-    // if the transaction came from a block popped from the chain,
-    // don't check if we have its key images as spent.
-    // TODO: Investigate why not?
-    if(!kept_by_block)
-    {
-      if(have_tx_keyimges_as_spent(tx, id))
-      {
+      if (tvc.m_double_spend)
         mark_double_spend(tx);
-        LOG_PRINT_L1("Transaction with id= "<< id << " used already spent key images");
-        tvc.m_verifivation_failed = true;
-        tvc.m_double_spend = true;
-        return false;
-      }
+      return false;
     }
 
     if (!m_blockchain.check_tx_outputs(tx, tvc))
@@ -353,6 +271,7 @@ namespace cryptonote
 
           m_blockchain.remove_txpool_tx(id);
           m_blockchain.add_txpool_tx(id, blob, meta);
+          m_template_candidates.erase(id);
           m_txs_by_fee_and_receive_time.emplace(std::pair<double, std::time_t>(fee / (double)(tx_weight ? tx_weight : 1), receive_time), id);
         }
         lock.commit();
@@ -381,6 +300,97 @@ namespace cryptonote
     return true;
   }
   //---------------------------------------------------------------------------------
+  bool tx_memory_pool::check_tx_cheap(const transaction &tx, const crypto::hash &id, size_t tx_weight, uint8_t version, bool kept_by_block, uint64_t &fee, tx_verification_context &tvc) const
+  {
+    if (tx.version == 0)
+    {
+      // v0 never accepted
+      LOG_PRINT_L1("transaction version 0 is invalid");
+      tvc.m_verifivation_failed = true;
+      return false;
+    }
+
+    // we do not accept transactions that timed out before, unless they're
+    // kept_by_block
+    if (!kept_by_block && m_timed_out_transactions.find(id) != m_timed_out_transactions.end())
+    {
+      // not clear if we should set that, since verifivation (sic) did not fail before, since
+      // the tx was accepted before timing out.
+      tvc.m_verifivation_failed = true;
+      return false;
+    }
+
+    if(!check_inputs_types_supported(tx))
+    {
+      tvc.m_verifivation_failed = true;
+      tvc.m_invalid_input = true;
+      return false;
+    }
+
+    if (tx.version == 1)
+    {
+      uint64_t inputs_amount = 0;
+      if(!get_inputs_money_amount(tx, inputs_amount))
+      {
+        tvc.m_verifivation_failed = true;
+        return false;
+      }
+
+      uint64_t outputs_amount = get_outs_money_amount(tx);
+      if(outputs_amount > inputs_amount)
+      {
+        LOG_PRINT_L1("transaction use more money than it has: use " << print_money(outputs_amount) << ", have " << print_money(inputs_amount));
+        tvc.m_verifivation_failed = true;
+        tvc.m_overspend = true;
+        return false;
+      }
+      else if(outputs_amount == inputs_amount)
+      {
+        LOG_PRINT_L1("transaction fee is zero: outputs_amount == inputs_amount, rejecting.");
+        tvc.m_verifivation_failed = true;
+        tvc.m_fee_too_low = true;
+        return false;
+      }
+
+      fee = inputs_amount - outputs_amount;
+    }
+    else
+    {
+      fee = tx.rct_signatures.txnFee;
+    }
+
+    if (!kept_by_block && !m_blockchain.check_fee(tx_weight, fee))
+    {
+      tvc.m_verifivation_failed = true;
+      tvc.m_fee_too_low = true;
+      return false;
+    }
+
+    size_t tx_weight_limit = get_transaction_weight_limit(version);
+    if ((!kept_by_block || version >= HF_VERSION_PER_BYTE_FEE) && tx_weight > tx_weight_limit)
+    {
+      LOG_PRINT_L1("transaction is too heavy: " << tx_weight << " bytes, maximum weight: " << tx_weight_limit);
+      tvc.m_verifivation_failed = true;
+      tvc.m_too_big = true;
+      return false;
+    }
+
+    // if the transaction came from a block popped from the chain,
+    // don't check if we have its key images as spent.
+    // TODO: Investigate why not?
+    if(!kept_by_block)
+    {
+      if(have_tx_keyimges_as_spent(tx, id))
+      {
+        LOG_PRINT_L1("Transaction with id= "<< id << " used already spent key images");
+        tvc.m_verifivation_failed = true;
+        tvc.m_double_spend = true;
+        return false;
+      }
+    }
+    return true;
+  }
+  //---------------------------------------------------------------------------------
   bool tx_memory_pool::add_tx(transaction &tx, tx_verification_context& tvc, relay_method tx_relay, bool relayed, uint8_t version)
   {
     crypto::hash h = null_hash;
@@ -404,6 +414,29 @@ namespace cryptonote
     m_txpool_max_weight = bytes;
   }
   //---------------------------------------------------------------------------------
+  bool tx_memory_pool::precheck_tx(const transaction &tx, const crypto::hash &id, size_t tx_weight, uint8_t version) const
+  {
+    CRITICAL_REGION_LOCAL(m_transactions_lock);
+
+    tx_verification_context tvc{};
+    uint64_t fee;
+    if (!check_tx_cheap(tx, id, tx_weight, version, false, fee, tvc))
+      return false;
+
+    // it would be pruned right after being added
+    if (m_txpool_weight + tx_weight > m_txpool_max_weight && !m_txs_by_fee_and_receive_time.empty())
+    {
+      const double fee_per_byte = fee / (double)(tx_weight ? tx_weight : 1);
+      if (fee_per_byte < (--m_txs_by_fee_and_receive_time.end())->first.first)
+        return false;
+    }
+
+    // add_tx leaves these to check_tx_inputs, but they are as cheap to look up
+    if (m_blockchain.have_tx_keyimges_as_spent(tx))
+      return false;
+    return true;
+  }
+  //---------------------------------------------------------------------------------
   void tx_memory_pool::prune(size_t bytes)
   {
     CRITICAL_REGION_LOCAL(m_transactions_lock);
@@ -446,6 +479,7 @@ namespace cryptonote
         m_blockchain.remove_txpool_tx(txid);
         m_txpool_weight -= meta.weight;
         remove_transaction_keyimages(tx, txid);
+        m_template_candidates.erase(txid);
         MINFO("Pruned tx " << txid << " from txpool: weight: " << meta.weight << ", fee/byte: " << it->first.first);
         m_txs_by_fee_and_receive_time.erase(it--);
         changed = true;
@@ -566,6 +600,9 @@ namespace cryptonote
       m_blockchain.remove_txpool_tx(id);
       m_txpool_weight -= tx_weight;
       remove_transaction_keyimages(tx, id);
+      m_template_candidates.erase(id);
+      // anything else spending these key images is a double spend once this tx is mined
+      invalidate_template_candidates(tx);
       lock.commit();
     }
     catch (const std::exception &e)
@@ -729,6 +766,7 @@ namespace cryptonote
             m_blockchain.remove_txpool_tx(txid);
             m_txpool_weight -= entry.second;
             remove_transaction_keyimages(tx, txid);
+            m_template_candidates.erase(txid);
           }
         }
         catch (const std::exception &e)
@@ -851,6 +889,7 @@ namespace cryptonote
             meta.last_relayed_time = std::chrono::system_clock::to_time_t(now);
 
           m_blockchain.update_txpool_tx(hash, meta);
+          m_template_candidates.erase(hash);
         }
       }
       catch (const std::exception &e)
@@ -1150,6 +1189,11 @@ namespace cryptonote
     CRITICAL_REGION_LOCAL(m_transactions_lock);
     m_input_cache.clear();
     m_parsed_tx_cache.clear();
+    // ready txes stay ready on top of a new block (those it conflicts with
+    // were dropped as it was taken from the pool), the rest may become ready
+    for (auto &e: m_template_candidates)
+      if (e.second.state == template_candidate::not_ready)
+        e.second.state = template_candidate::unknown;
     return true;
   }
   //---------------------------------------------------------------------------------
@@ -1158,6 +1202,7 @@ namespace cryptonote
     CRITICAL_REGION_LOCAL(m_transactions_lock);
     m_input_cache.clear();
     m_parsed_tx_cache.clear();
+    m_template_candidates.clear();
     return true;
   }
   //---------------------------------------------------------------------------------
@@ -1292,26 +1337,16 @@ namespace cryptonote
     return true;
   }
   //---------------------------------------------------------------------------------
-  bool tx_memory_pool::have_key_images(const std::unordered_set<crypto::key_image>& k_images, const transaction_prefix& tx)
-  {
-    for(size_t i = 0; i!= tx.vin.size(); i++)
-    {
-      CHECKED_GET_SPECIFIC_VARIANT(tx.vin[i], const txin_to_key, itk, false);
-      if(k_images.count(itk.k_image))
-        return true;
-    }
-    return false;
-  }
-  //---------------------------------------------------------------------------------
-  bool tx_memory_pool::append_key_images(std::unordered_set<crypto::key_image>& k_images, const transaction_prefix& tx)
+  void tx_memory_pool::invalidate_template_candidates(const transaction_prefix& tx)
   {
-    for(size_t i = 0; i!= tx.vin.size(); i++)
+    for (const auto &in: tx.vin)
     {
-      CHECKED_GET_SPECIFIC_VARIANT(tx.vin[i], const txin_to_key, itk, false);
-      auto i_res = k_images.insert(itk.k_image);
-      CHECK_AND_ASSERT_MES(i_res.second, false, "internal error: key images pool cache - inserted duplicate image in set: " << itk.k_image);
+      CHECKED_GET_SPECIFIC_VARIANT(in, const txin_to_key, itk, void());
+      const key_images_container::const_iterator it = m_spent_key_images.find(itk.k_image);
+      if (it != m_spent_key_images.end())
+        for (const crypto::hash &txid: it->second)
+          m_template_candidates.erase(txid);
     }
-    return true;
   }
   //---------------------------------------------------------------------------------
   void tx_memory_pool::mark_double_spend(const transaction &tx)
@@ -1415,35 +1450,51 @@ namespace cryptonote
 
     LOG_PRINT_L2("Filling block template, median weight " << median_weight << ", " << m_txs_by_fee_and_receive_time.size() << " txes in the pool");
 
-    LockedTXN lock(m_blockchain.get_db());
+    // candidate states were checked against the rules for a given block version
+    if (version != m_template_candidates_version)
+    {
+      for (auto &e: m_template_candidates)
+        e.second.state = template_candidate::unknown;
+      m_template_candidates_version = version;
+    }
+
+    // only txes not seen before need the db, don't open a write txn for nothing
+    std::unique_ptr<LockedTXN> lock;
 
     auto sorted_it = m_txs_by_fee_and_receive_time.begin();
     for (; sorted_it != m_txs_by_fee_and_receive_time.end(); ++sorted_it)
     {
-      txpool_tx_meta_t meta;
-      if (!m_blockchain.get_txpool_tx_meta(sorted_it->second, meta))
+      const crypto::hash &txid = sorted_it->second;
+      auto ci = m_template_candidates.find(txid);
+      if (ci == m_template_candidates.end())
       {
-        static bool warned = false;
-        if (!warned)
-          MERROR("  failed to find tx meta: " << sorted_it->second << " (will only print once)");
-        warned = true;
-        continue;
+        txpool_tx_meta_t meta;
+        if (!m_blockchain.get_txpool_tx_meta(txid, meta))
+        {
+          static bool warned = false;
+          if (!warned)
+            MERROR("  failed to find tx meta: " << txid << " (will only print once)");
+          warned = true;
+          continue;
+        }
+        template_candidate candidate;
+        candidate.state = template_candidate::unknown;
+        candidate.eligible = !meta.pruned && (meta.matches(relay_category::legacy) || (m_mine_stem_txes && meta.get_relay_method() == relay_method::stem));
+        candidate.weight = meta.weight;
+        candidate.fee = meta.fee;
+        ci = m_template_candidates.emplace(txid, std::move(candidate)).first;
       }
-      LOG_PRINT_L2("Considering " << sorted_it->second << ", weight " << meta.weight << ", current block weight " << total_weight << "/" << max_total_weight << ", current coinbase " << print_money(best_coinbase) << ", relay method " << (unsigned)meta.get_relay_method());
+      template_candidate &candidate = ci->second;
+      LOG_PRINT_L2("Considering " << txid << ", weight " << candidate.weight << ", current block weight " << total_weight << "/" << max_total_weight << ", current coinbase " << print_money(best_coinbase));
 
-      if (!meta.matches(relay_category::legacy) && !(m_mine_stem_txes && meta.get_relay_method() == relay_method::stem))
+      if (!candidate.eligible)
       {
-        LOG_PRINT_L2("  tx relay method is " << (unsigned)meta.get_relay_method());
-        continue;
-      }
-      if (meta.pruned)
-      {
-        LOG_PRINT_L2("  tx is pruned");
+        LOG_PRINT_L2("  tx is pruned, or its relay method does not allow mining it");
         continue;
       }
 
       // Can not exceed maximum block weight
-      if (max_total_weight < total_weight + meta.weight)
+      if (max_total_weight < total_weight + candidate.weight)
       {
         LOG_PRINT_L2("  would exceed maximum block weight");
         continue;
@@ -1455,12 +1506,12 @@ namespace cryptonote
         // If we're getting lower coinbase tx,
         // stop including more tx
         uint64_t block_reward;
-        if(!get_block_reward(median_weight, total_weight + meta.weight, already_generated_coins, block_reward, version))
+        if(!get_block_reward(median_weight, total_weight + candidate.weight, already_generated_coins, block_reward, version))
         {
           LOG_PRINT_L2("  would exceed maximum block weight");
           continue;
         }
-        coinbase = block_reward + fee + meta.fee;
+        coinbase = block_reward + fee + candidate.fee;
         if (coinbase < template_accept_threshold(best_coinbase))
         {
           LOG_PRINT_L2("  would decrease coinbase to " << print_money(coinbase));
@@ -1478,56 +1529,77 @@ namespace cryptonote
         }
       }
 
-      // "local" and "stem" txes are filtered above
-      cryptonote::blobdata txblob = m_blockchain.get_txpool_tx_blob(sorted_it->second, relay_category::all);
+      if (candidate.state == template_candidate::unknown)
+      {
+        if (!lock)
+          lock.reset(new LockedTXN(m_blockchain.get_db()));
+        txpool_tx_meta_t meta;
+        if (!m_blockchain.get_txpool_tx_meta(txid, meta))
+        {
+          MERROR("  failed to find tx meta: " << txid);
+          continue;
+        }
+
+        // "local" and "stem" txes are filtered above
+        cryptonote::blobdata txblob = m_blockchain.get_txpool_tx_blob(txid, relay_category::all);
 
-      cryptonote::transaction tx;
+        cryptonote::transaction tx;
 
-      // Skip transactions that are not ready to be
-      // included into the blockchain or that are
-      // missing key images
-      const cryptonote::txpool_tx_meta_t original_meta = meta;
-      bool ready = false;
-      try
-      {
-        ready = is_transaction_ready_to_go(meta, sorted_it->second, txblob, tx);
-      }
-      catch (const std::exception &e)
-      {
-        MERROR("Failed to check transaction readiness: " << e.what());
-        // continue, not fatal
-      }
-      if (memcmp(&original_meta, &meta, sizeof(meta)))
-      {
+        // Skip transactions that are not ready to be
+        // included into the blockchain or that are
+        // missing key images
+        const cryptonote::txpool_tx_meta_t original_meta = meta;
+        bool ready = false;
         try
-	{
-	  m_blockchain.update_txpool_tx(sorted_it->second, meta);
-	}
+        {
+          ready = is_transaction_ready_to_go(meta, txid, txblob, tx);
+        }
         catch (const std::exception &e)
-	{
-	  MERROR("Failed to update tx meta: " << e.what());
-	  // continue, not fatal
-	}
+        {
+          MERROR("Failed to check transaction readiness: " << e.what());
+          // continue, not fatal
+        }
+        if (memcmp(&original_meta, &meta, sizeof(meta)))
+        {
+          try
+          {
+            m_blockchain.update_txpool_tx(txid, meta);
+          }
+          catch (const std::exception &e)
+          {
+            MERROR("Failed to update tx meta: " << e.what());
+            // continue, not fatal
+          }
+        }
+        candidate.state = ready ? template_candidate::ready : template_candidate::not_ready;
+        candidate.key_images.clear();
+        if (ready)
+        {
+          for (const auto &in: tx.vin)
+            if (in.type() == typeid(txin_to_key))
+              candidate.key_images.push_back(boost::get<txin_to_key>(in).k_image);
+        }
       }
-      if (!ready)
+      if (candidate.state != template_candidate::ready)
       {
         LOG_PRINT_L2("  not ready to go");
         continue;
       }
-      if (have_key_images(k_images, tx))
+      if (std::any_of(candidate.key_images.begin(), candidate.key_images.end(), [&k_images](const crypto::key_image &ki) { return k_images.count(ki) != 0; }))
       {
         LOG_PRINT_L2("  key images already seen");
         continue;
       }
 
-      bl.tx_hashes.push_back(sorted_it->second);
-      total_weight += meta.weight;
-      fee += meta.fee;
+      bl.tx_hashes.push_back(txid);
+      total_weight += candidate.weight;
+      fee += candidate.fee;
       best_coinbase = coinbase;
-      append_key_images(k_images, tx);
+      k_images.insert(candidate.key_images.begin(), candidate.key_images.end());
       LOG_PRINT_L2("  added, new block weight " << total_weight << "/" << max_total_weight << ", coinbase " << print_money(best_coinbase));
     }
-    lock.commit();
+    if (lock)
+      lock->commit();
 
     expected_reward = best_coinbase;
     LOG_PRINT_L2("Block template filled with " << bl.tx_hashes.size() << " txes, weight "
@@ -1576,6 +1648,7 @@ namespace cryptonote
           m_blockchain.remove_txpool_tx(txid);
           m_txpool_weight -= get_transaction_weight(tx, txblob.size());
           remove_transaction_keyimages(tx, txid);
+          m_template_candidates.erase(txid);
           auto sorted_it = find_tx_in_sorted_container(txid);
           if (sorted_it == m_txs_by_fee_and_receive_time.end())
           {
@@ -1608,6 +1681,7 @@ namespace cryptonote
     m_txpool_max_weight = max_txpool_weight ? max_txpool_weight : DEFAULT_TXPOOL_MAX_WEIGHT;
     m_txs_by_fee_and_receive_time.clear();
     m_spent_key_images.clear();
+    m_template_candidates.clear();
     m_txpool_weight = 0;
     std::vector<crypto::hash> remove;
 
@@ -53,6 +53,8 @@
 #include "rpc/core_rpc_server_commands_defs.h"
 #include "rpc/message_data_structs.h"
 
+class txpool_accessor_test;
+
 namespace cryptonote
 {
   class Blockchain;
@@ -133,6 +135,24 @@ namespace cryptonote
      */
     bool add_tx(transaction &tx, tx_verification_context& tvc, relay_method tx_relay, bool relayed, uint8_t version);
 
+    /**
+     * @brief checks whether a new transaction passes add_tx's cheap checks
+     *
+     * Runs the checks add_tx would reject a relayed transaction on before
+     * looking at its inputs: fee, weight, key images already spent in the
+     * pool or the chain, and a full pool it would be pruned from straight
+     * away. Meant to keep the costly signature checks for transactions
+     * which stand a chance. add_tx still runs every check.
+     *
+     * @param tx the transaction
+     * @param id the transaction's hash
+     * @param tx_weight the transaction's weight
+     * @param version the hard fork version
+     *
+     * @return false if add_tx would reject the transaction, true otherwise
+     */
+    bool precheck_tx(const transaction &tx, const crypto::hash &id, size_t tx_weight, uint8_t version) const;
+
     /**
      * @brief takes a transaction with the given hash from the pool
      *
@@ -453,6 +473,7 @@ namespace cryptonote
     bool get_complement(const std::vector<crypto::hash> &hashes, std::vector<cryptonote::blobdata> &txes) const;
 
   private:
+    friend class ::txpool_accessor_test;
 
     /**
      * @brief insert key images into m_spent_key_images
@@ -497,6 +518,25 @@ namespace cryptonote
      */
     bool have_tx_keyimges_as_spent(const transaction& tx, const crypto::hash& txid) const;
 
+    /**
+     * @brief run the checks which do not need a transaction's inputs
+     *
+     * Version, timed out transactions, input types, fee, weight limit and
+     * key images already spent in the pool: the cheap part of add_tx,
+     * shared with precheck_tx.
+     *
+     * @param tx the transaction
+     * @param id the transaction's hash
+     * @param tx_weight the transaction's weight
+     * @param version the hard fork version
+     * @param kept_by_block whether the transaction comes from a block
+     * @param fee return-by-reference the transaction's fee
+     * @param tvc return-by-reference why the transaction was rejected
+     *
+     * @return true if the transaction passes, otherwise false
+     */
+    bool check_tx_cheap(const transaction &tx, const crypto::hash &id, size_t tx_weight, uint8_t version, bool kept_by_block, uint64_t &fee, tx_verification_context &tvc) const;
+
     /**
      * @brief forget a transaction's spent key images
      *
@@ -512,24 +552,11 @@ namespace cryptonote
     bool remove_transaction_keyimages(const transaction_prefix& tx, const crypto::hash &txid);
 
     /**
-     * @brief check if any of a transaction's spent key images are present in a given set
+     * @brief drop the block template state of pool txes spending a transaction's key images
      *
-     * @param kic the set of key images to check against
-     * @param tx the transaction to check
-     *
-     * @return true if any key images present in the set, otherwise false
+     * @param tx the transaction whose key images were spent
      */
-    static bool have_key_images(const std::unordered_set<crypto::key_image>& kic, const transaction_prefix& tx);
-
-    /**
-     * @brief append the key images from a transaction to the given set
-     *
-     * @param kic the set of key images to append to
-     * @param tx the transaction
-     *
-     * @return false if any append fails, otherwise true
-     */
-    static bool append_key_images(std::unordered_set<crypto::key_image>& kic, const transaction_prefix& tx);
+    void invalidate_template_candidates(const transaction_prefix& tx);
 
     /**
      * @brief check if a transaction is a valid candidate for inclusion in a block
@@ -615,6 +642,24 @@ private:
 
     std::unordered_map<crypto::hash, transaction> m_parsed_tx_cache;
 
+    //! what fill_block_template needs to know about a pool tx, kept across calls
+    /*! Filled the first time a tx is considered for a template, so later
+     *  templates don't go back to the db, reparse or recheck it. A ready tx
+     *  stays ready as the chain grows, unless a block spends one of its key
+     *  images; anything else is rechecked at the next chain top.
+     */
+    struct template_candidate
+    {
+      enum state_t { unknown, ready, not_ready };
+      state_t state;
+      bool eligible; //!< not pruned, and relayed in a way that allows mining it
+      uint64_t weight;
+      uint64_t fee;
+      std::vector<crypto::key_image> key_images; //!< set once the tx is found ready
+    };
+    std::unordered_map<crypto::hash, template_candidate> m_template_candidates;
+    uint8_t m_template_candidates_version; //!< block version the candidate states were checked for
+
     //! Next timestamp that a DB check for relayable txes is allowed
     std::atomic<time_t> m_next_check;
   };
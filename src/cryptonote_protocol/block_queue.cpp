@@ -29,11 +29,15 @@
 //
 // Parts of this file are originally copyright (c) 2012-2013 The Cryptonote developers
 
+#include <algorithm>
+#include <cmath>
 #include <vector>
 #include <unordered_map>
 #include <boost/uuid/nil_generator.hpp>
 #include <boost/uuid/uuid_io.hpp>
+#include <boost/filesystem/operations.hpp>
 #include "string_tools.h"
+#include "storages/portable_storage_template_helper.h"
 #include "cryptonote_protocol_defs.h"
 #include "common/pruning.h"
 #include "block_queue.h"
@@ -41,6 +45,13 @@
 #undef WAZN_DEFAULT_LOG_CATEGORY
 #define WAZN_DEFAULT_LOG_CATEGORY "cn.block_queue"
 
+#define PEER_RATE_WEIGHT 0.3f // weight of the latest span in the moving average
+#define PEER_RATE_MIN_SAMPLES 2 // spans received before a peer's rate is trusted
+#define PEER_RATE_FULL_SPAN 0.5f // peers at least this fraction of the best rate get full spans
+#define PEER_RATE_MIN_SPAN_DIVISOR 8 // slowest peers still get max_blocks / N blocks per span
+#define PEER_RATE_SLOW 0.2f // peers under this fraction of the best rate are demoted
+#define PEER_RATE_MIN_DURATION_US 1000 // spans received faster than this are too short to time
+
 namespace std {
   static_assert(sizeof(size_t) <= sizeof(boost::uuids::uuid), "boost::uuids::uuid too small");
   template<> struct hash<boost::uuids::uuid> {
@@ -50,9 +61,46 @@ namespace std {
   };
 }
 
+namespace
+{
+  struct spilled_span
+  {
+    std::vector<cryptonote::block_complete_entry> blocks;
+
+    BEGIN_KV_SERIALIZE_MAP()
+      KV_SERIALIZE(blocks)
+    END_KV_SERIALIZE_MAP()
+  };
+}
+
 namespace cryptonote
 {
 
+block_queue::~block_queue()
+{
+  // spans may still be spilled at shutdown, they go away with the queue
+  boost::unique_lock<boost::recursive_mutex> lock(mutex);
+  close_spill_file();
+}
+
+bool block_queue::set_spill_file(const std::string &path, size_t limit)
+{
+  boost::unique_lock<boost::recursive_mutex> lock(mutex);
+  for (const auto &span: blocks)
+    CHECK_AND_ASSERT_THROW_MES(span.spill_size == 0, "Cannot change spill file with spilled spans");
+  close_spill_file();
+  if (path.empty() || limit == 0)
+    return true;
+
+  spill_file.open(path, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!spill_file.is_open())
+    return false;
+  spill_path = path;
+  memory_limit = limit;
+  MINFO("Block queue spilling to " << path << " beyond " << limit / 1048576.f << " MB in memory");
+  return true;
+}
+
 void block_queue::add_blocks(uint64_t height, std::vector<cryptonote::block_complete_entry> bcel, const boost::uuids::uuid &connection_id, const epee::net_utils::network_address &addr, float rate, size_t size)
 {
   boost::unique_lock<boost::recursive_mutex> lock(mutex);
@@ -68,6 +116,7 @@ void block_queue::add_blocks(uint64_t height, std::vector<cryptonote::block_comp
     }
     set_span_hashes(height, connection_id, hashes);
   }
+  spill_spans();
 }
 
 void block_queue::add_blocks(uint64_t height, uint64_t nblocks, const boost::uuids::uuid &connection_id, const epee::net_utils::network_address &addr, boost::posix_time::ptime time)
@@ -84,7 +133,7 @@ void block_queue::flush_spans(const boost::uuids::uuid &connection_id, bool all)
   while (i != blocks.end())
   {
     block_map::iterator j = i++;
-    if (j->connection_id == connection_id && (all || j->blocks.size() == 0))
+    if (j->connection_id == connection_id && (all || j->blocks->empty()))
     {
       erase_block(j);
     }
@@ -94,6 +143,7 @@ void block_queue::flush_spans(const boost::uuids::uuid &connection_id, bool all)
 void block_queue::erase_block(block_map::iterator j)
 {
   CHECK_AND_ASSERT_THROW_MES(j != blocks.end(), "Invalid iterator");
+  release_spill(*j);
   for (const crypto::hash &h: j->hashes)
   {
     requested_hashes.erase(h);
@@ -109,11 +159,18 @@ void block_queue::flush_stale_spans(const std::set<boost::uuids::uuid> &live_con
   while (i != blocks.end())
   {
     block_map::iterator j = i++;
-    if (j->blocks.empty() && live_connections.find(j->connection_id) == live_connections.end())
+    if (j->blocks->empty() && live_connections.find(j->connection_id) == live_connections.end())
     {
       erase_block(j);
     }
   }
+  for (auto i = peer_rates.begin(); i != peer_rates.end(); )
+  {
+    if (live_connections.find(i->first) == live_connections.end())
+      i = peer_rates.erase(i);
+    else
+      ++i;
+  }
 }
 
 bool block_queue::remove_span(uint64_t start_block_height, std::vector<crypto::hash> *hashes)
@@ -169,7 +226,7 @@ uint64_t block_queue::get_next_needed_height(uint64_t blockchain_height) const
   {
     if (span.start_block_height + span.nblocks - 1 < blockchain_height)
       continue;
-    if (span.start_block_height != last_needed_height || (first && span.blocks.empty()))
+    if (span.start_block_height != last_needed_height || (first && span.blocks->empty()))
       return last_needed_height;
     last_needed_height = span.start_block_height + span.nblocks;
     first = false;
@@ -182,7 +239,7 @@ void block_queue::print() const
   boost::unique_lock<boost::recursive_mutex> lock(mutex);
   MDEBUG("Block queue has " << blocks.size() << " spans");
   for (const auto &span: blocks)
-    MDEBUG("  " << span.start_block_height << " - " << (span.start_block_height+span.nblocks-1) << " (" << span.nblocks << ") - " << (span.blocks.empty() ? "scheduled" : "filled    ") << "  " << span.connection_id << " (" << ((unsigned)(span.rate*10/1024.f))/10.f << " kB/s)");
+    MDEBUG("  " << span.start_block_height << " - " << (span.start_block_height+span.nblocks-1) << " (" << span.nblocks << ") - " << (span.blocks->empty() ? "scheduled" : "filled    ") << "  " << span.connection_id << " (" << ((unsigned)(span.rate*10/1024.f))/10.f << " kB/s)");
 }
 
 std::string block_queue::get_overview(uint64_t blockchain_height) const
@@ -203,7 +260,7 @@ std::string block_queue::get_overview(uint64_t blockchain_height) const
     {
       if (expected < i->start_block_height)
         s += std::string(std::max((uint64_t)1, (i->start_block_height - expected) / (i->nblocks ? i->nblocks : 1)), '_');
-      s += i->blocks.empty() ? "." : i->start_block_height == blockchain_height ? "m" : "o";
+      s += i->blocks->empty() ? "." : i->start_block_height == blockchain_height ? "m" : i->spill_size ? "s" : "o";
       expected = i->start_block_height + i->nblocks;
     }
     ++i;
@@ -319,7 +376,7 @@ std::pair<uint64_t, uint64_t> block_queue::get_next_span_if_scheduled(std::vecto
   block_map::const_iterator i = blocks.begin();
   if (i == blocks.end())
     return std::make_pair(0, 0);
-  if (!i->blocks.empty())
+  if (!i->blocks->empty())
     return std::make_pair(0, 0);
   hashes = i->hashes;
   connection_id = i->connection_id;
@@ -333,7 +390,7 @@ void block_queue::reset_next_span_time(boost::posix_time::ptime t)
   CHECK_AND_ASSERT_THROW_MES(!blocks.empty(), "No next span to reset time");
   block_map::iterator i = blocks.begin();
   CHECK_AND_ASSERT_THROW_MES(i != blocks.end(), "No next span to reset time");
-  CHECK_AND_ASSERT_THROW_MES(i->blocks.empty(), "Next span is not empty");
+  CHECK_AND_ASSERT_THROW_MES(i->blocks->empty(), "Next span is not empty");
   (boost::posix_time::ptime&)i->time = t; // sod off, time doesn't influence sorting
 }
 
@@ -345,6 +402,7 @@ void block_queue::set_span_hashes(uint64_t start_height, const boost::uuids::uui
     if (i->start_block_height == start_height && i->connection_id == connection_id)
     {
       span s = *i;
+      ((span&)*i).spill_size = 0; // the spilled data now belongs to s
       erase_block(i);
       s.hashes = std::move(hashes);
       for (const crypto::hash &h: s.hashes)
@@ -363,10 +421,13 @@ bool block_queue::get_next_span(uint64_t &height, std::vector<cryptonote::block_
   block_map::const_iterator i = blocks.begin();
   for (; i != blocks.end(); ++i)
   {
-    if (!filled || !i->blocks.empty())
+    if (!filled || !i->blocks->empty())
     {
       height = i->start_block_height;
-      bcel = i->blocks;
+      if (i->spill_size)
+        CHECK_AND_ASSERT_THROW_MES(load_span(*i, bcel), "Failed to read back spilled span at height " << i->start_block_height);
+      else
+        bcel = *i->blocks;
       connection_id = i->connection_id;
       addr = i->origin;
       return true;
@@ -375,6 +436,30 @@ bool block_queue::get_next_span(uint64_t &height, std::vector<cryptonote::block_
   return false;
 }
 
+bool block_queue::get_span_blocks(uint64_t height, std::shared_ptr<const std::vector<cryptonote::block_complete_entry>> &bcel) const
+{
+  boost::unique_lock<boost::recursive_mutex> lock(mutex);
+  for (block_map::const_iterator i = blocks.begin(); i != blocks.end(); ++i)
+  {
+    if (i->start_block_height == height)
+    {
+      if (i->blocks->empty())
+        return false;
+      if (i->spill_size)
+      {
+        std::vector<cryptonote::block_complete_entry> spilled;
+        if (!load_span(*i, spilled))
+          return false;
+        bcel = std::make_shared<const std::vector<cryptonote::block_complete_entry>>(std::move(spilled));
+      }
+      else
+        bcel = i->blocks;
+      return true;
+    }
+  }
+  return false;
+}
+
 bool block_queue::has_next_span(const boost::uuids::uuid &connection_id, bool &filled, boost::posix_time::ptime &time) const
 {
   boost::unique_lock<boost::recursive_mutex> lock(mutex);
@@ -385,7 +470,7 @@ bool block_queue::has_next_span(const boost::uuids::uuid &connection_id, bool &f
     return false;
   if (i->connection_id != connection_id)
     return false;
-  filled = !i->blocks.empty();
+  filled = !i->blocks->empty();
   time = i->time;
   return true;
 }
@@ -400,7 +485,7 @@ bool block_queue::has_next_span(uint64_t height, bool &filled, boost::posix_time
     return false;
   if (i->start_block_height > height)
     return false;
-  filled = !i->blocks.empty();
+  filled = !i->blocks->empty();
   time = i->time;
   connection_id = i->connection_id;
   return true;
@@ -415,6 +500,16 @@ size_t block_queue::get_data_size() const
   return size;
 }
 
+size_t block_queue::get_memory_size() const
+{
+  boost::unique_lock<boost::recursive_mutex> lock(mutex);
+  size_t size = 0;
+  for (const auto &span: blocks)
+    if (!span.spill_size)
+      size += span.size;
+  return size;
+}
+
 size_t block_queue::get_num_filled_spans_prefix() const
 {
   boost::unique_lock<boost::recursive_mutex> lock(mutex);
@@ -423,7 +518,7 @@ size_t block_queue::get_num_filled_spans_prefix() const
     return 0;
   block_map::const_iterator i = blocks.begin();
   size_t size = 0;
-  while (i != blocks.end() && !i->blocks.empty())
+  while (i != blocks.end() && !i->blocks->empty())
   {
     ++i;
     ++size;
@@ -436,7 +531,7 @@ size_t block_queue::get_num_filled_spans() const
   boost::unique_lock<boost::recursive_mutex> lock(mutex);
   size_t size = 0;
   for (const auto &span: blocks)
-  if (!span.blocks.empty())
+  if (!span.blocks->empty())
     ++size;
   return size;
 }
@@ -476,7 +571,7 @@ float block_queue::get_speed(const boost::uuids::uuid &connection_id) const
   std::unordered_map<boost::uuids::uuid, float> speeds;
   for (const auto &span: blocks)
   {
-    if (span.blocks.empty())
+    if (span.blocks->empty())
       continue;
     // note that the average below does not average over the whole set, but over the
     // previous pseudo average and the latest rate: this gives much more importance
@@ -512,7 +607,7 @@ float block_queue::get_download_rate(const boost::uuids::uuid &connection_id) co
   float conn_rate = -1.f;
   for (const auto &span: blocks)
   {
-    if (span.blocks.empty())
+    if (span.blocks->empty())
       continue;
     if (span.connection_id != connection_id)
       continue;
@@ -531,6 +626,201 @@ float block_queue::get_download_rate(const boost::uuids::uuid &connection_id) co
   return conn_rate;
 }
 
+void block_queue::update_peer_rate(const boost::uuids::uuid &connection_id, float rate)
+{
+  if (!(rate > 0.0f))
+    return;
+  boost::unique_lock<boost::recursive_mutex> lock(mutex);
+  auto i = peer_rates.find(connection_id);
+  if (i == peer_rates.end())
+    peer_rates.emplace(connection_id, peer_rate{rate, 1});
+  else
+  {
+    i->second.rate += (rate - i->second.rate) * PEER_RATE_WEIGHT;
+    ++i->second.samples;
+  }
+}
+
+void block_queue::update_peer_rate(const boost::uuids::uuid &connection_id, size_t bytes, const boost::posix_time::ptime &first_byte, const boost::posix_time::ptime &last_byte)
+{
+  if (first_byte.is_special() || last_byte.is_special())
+    return;
+  const int64_t dt = (last_byte - first_byte).total_microseconds();
+  if (dt < PEER_RATE_MIN_DURATION_US)
+  {
+    MTRACE("Span from " << connection_id << " arrived in " << dt << " us, too short to measure");
+    return;
+  }
+  update_peer_rate(connection_id, bytes * 1e6f / dt);
+}
+
+void block_queue::close_spill_file() noexcept
+{
+  if (spill_file.is_open())
+    spill_file.close();
+  if (!spill_path.empty())
+  {
+    boost::system::error_code ec;
+    boost::filesystem::remove(spill_path, ec);
+  }
+  spill_path.clear();
+  spill_free.clear();
+  spill_end = 0;
+  memory_limit = 0;
+}
+
+void block_queue::spill_spans()
+{
+  if (!memory_limit)
+    return;
+  size_t size = get_memory_size();
+  if (size <= memory_limit)
+    return;
+
+  // the span at the front is about to be imported, spill the ones furthest away first
+  for (block_map::reverse_iterator i = blocks.rbegin(); size > memory_limit && i != blocks.rend(); ++i)
+  {
+    if (i->blocks->empty() || i->spill_size || i->start_block_height == blocks.begin()->start_block_height)
+      continue;
+    if (!spill_span(*i))
+      break;
+    size -= i->size;
+  }
+}
+
+bool block_queue::spill_span(const span &s)
+{
+  spilled_span data;
+  std::string blob;
+  data.blocks = *s.blocks;
+  if (!epee::serialization::store_t_to_binary(data, blob))
+  {
+    MERROR("Failed to serialize span at height " << s.start_block_height);
+    return false;
+  }
+
+  uint64_t offset = spill_end;
+  auto extent = std::find_if(spill_free.begin(), spill_free.end(),
+      [&blob](const std::pair<const uint64_t, uint64_t> &e) { return e.second >= blob.size(); });
+  if (extent != spill_free.end())
+  {
+    offset = extent->first;
+    if (extent->second > blob.size())
+      spill_free.emplace(offset + blob.size(), extent->second - blob.size());
+    spill_free.erase(extent);
+  }
+  else
+    spill_end += blob.size();
+
+  spill_file.seekp(offset);
+  spill_file.write(blob.data(), blob.size());
+  spill_file.flush();
+  if (!spill_file)
+  {
+    MERROR("Failed to write span at height " << s.start_block_height << " to " << spill_path);
+    spill_file.clear();
+    span failed = s;
+    failed.spill_offset = offset;
+    failed.spill_size = blob.size();
+    release_spill(failed);
+    return false;
+  }
+
+  span &spilled = (span&)s; // sod off, neither the blocks nor the spill extent influence sorting
+  spilled.blocks = std::make_shared<const std::vector<cryptonote::block_complete_entry>>(s.blocks->size());
+  spilled.spill_offset = offset;
+  spilled.spill_size = blob.size();
+  MDEBUG("Spilled span " << s.start_block_height << " (" << s.size << " bytes) at offset " << offset);
+  return true;
+}
+
+bool block_queue::load_span(const span &s, std::vector<cryptonote::block_complete_entry> &bcel) const
+{
+  std::string blob(s.spill_size, '\0');
+  spill_file.seekg(s.spill_offset);
+  spill_file.read(&blob[0], blob.size());
+  if (!spill_file)
+  {
+    MERROR("Failed to read span at height " << s.start_block_height << " from " << spill_path);
+    spill_file.clear();
+    return false;
+  }
+
+  spilled_span data;
+  if (!epee::serialization::load_t_from_binary(data, blob) || data.blocks.size() != s.blocks->size())
+  {
+    MERROR("Failed to parse span at height " << s.start_block_height << " from " << spill_path);
+    return false;
+  }
+  bcel = std::move(data.blocks);
+  return true;
+}
+
+void block_queue::release_spill(const span &s)
+{
+  if (!s.spill_size)
+    return;
+
+  auto i = spill_free.emplace(s.spill_offset, s.spill_size).first;
+  auto next = std::next(i);
+  if (next != spill_free.end() && i->first + i->second == next->first)
+  {
+    i->second += next->second;
+    spill_free.erase(next);
+  }
+  if (i != spill_free.begin())
+  {
+    auto prev = std::prev(i);
+    if (prev->first + prev->second == i->first)
+    {
+      prev->second += i->second;
+      spill_free.erase(i);
+      i = prev;
+    }
+  }
+  if (i->first + i->second == spill_end)
+  {
+    spill_end = i->first;
+    spill_free.erase(i);
+  }
+}
+
+float block_queue::get_peer_rate(const boost::uuids::uuid &connection_id) const
+{
+  boost::unique_lock<boost::recursive_mutex> lock(mutex);
+  const auto i = peer_rates.find(connection_id);
+  return i == peer_rates.end() ? 0.0f : i->second.rate;
+}
+
+float block_queue::get_relative_peer_rate(const boost::uuids::uuid &connection_id) const
+{
+  boost::unique_lock<boost::recursive_mutex> lock(mutex);
+  const auto i = peer_rates.find(connection_id);
+  if (i == peer_rates.end() || i->second.samples < PEER_RATE_MIN_SAMPLES)
+    return 1.0f; // not measured yet, assume good speed
+  float best_rate = 0.0f;
+  for (const auto &e: peer_rates)
+    if (e.second.samples >= PEER_RATE_MIN_SAMPLES)
+      best_rate = std::max(best_rate, e.second.rate);
+  return best_rate > 0.0f ? i->second.rate / best_rate : 1.0f;
+}
+
+uint64_t block_queue::get_span_size(const boost::uuids::uuid &connection_id, uint64_t max_blocks) const
+{
+  const float relative = get_relative_peer_rate(connection_id);
+  if (relative >= PEER_RATE_FULL_SPAN)
+    return max_blocks;
+  const uint64_t min_blocks = std::max<uint64_t>(1, max_blocks / PEER_RATE_MIN_SPAN_DIVISOR);
+  const uint64_t nblocks = std::ceil(max_blocks * relative / PEER_RATE_FULL_SPAN);
+  MTRACE("Span size for " << connection_id << ": " << std::max(min_blocks, nblocks) << "/" << max_blocks << " at relative rate " << relative);
+  return std::min(max_blocks, std::max(min_blocks, nblocks));
+}
+
+bool block_queue::is_slow_peer(const boost::uuids::uuid &connection_id) const
+{
+  return get_relative_peer_rate(connection_id) < PEER_RATE_SLOW;
+}
+
 bool block_queue::foreach(std::function<bool(const span&)> f) const
 {
   boost::unique_lock<boost::recursive_mutex> lock(mutex);
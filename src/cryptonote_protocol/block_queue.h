@@ -33,11 +33,16 @@
 
 #include <string>
 #include <vector>
+#include <fstream>
+#include <map>
+#include <memory>
 #include <set>
 #include <unordered_set>
 #include <boost/thread/recursive_mutex.hpp>
 #include <boost/uuid/uuid.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 #include "net/net_utils_base.h"
+#include "cryptonote_basic/blobdatatype.h"
 
 #undef WAZN_DEFAULT_LOG_CATEGORY
 #define WAZN_DEFAULT_LOG_CATEGORY "cn.block_queue"
@@ -53,24 +58,28 @@ namespace cryptonote
     {
       uint64_t start_block_height;
       std::vector<crypto::hash> hashes;
-      std::vector<cryptonote::block_complete_entry> blocks;
+      std::shared_ptr<const std::vector<cryptonote::block_complete_entry>> blocks; // shared with prefetches of the span, never null
       boost::uuids::uuid connection_id;
       uint64_t nblocks;
       float rate;
       size_t size;
       boost::posix_time::ptime time;
       epee::net_utils::network_address origin{};
+      uint64_t spill_offset; // when spilled, blocks only holds empty placeholders
+      uint64_t spill_size;
 
       span(uint64_t start_block_height, std::vector<cryptonote::block_complete_entry> blocks, const boost::uuids::uuid &connection_id, const epee::net_utils::network_address &addr, float rate, size_t size):
-        start_block_height(start_block_height), blocks(std::move(blocks)), connection_id(connection_id), nblocks(this->blocks.size()), rate(rate), size(size), time(boost::date_time::min_date_time), origin(addr) {}
+        start_block_height(start_block_height), blocks(std::make_shared<const std::vector<cryptonote::block_complete_entry>>(std::move(blocks))), connection_id(connection_id), nblocks(this->blocks->size()), rate(rate), size(size), time(boost::date_time::min_date_time), origin(addr), spill_offset(0), spill_size(0) {}
       span(uint64_t start_block_height, uint64_t nblocks, const boost::uuids::uuid &connection_id, const epee::net_utils::network_address &addr, boost::posix_time::ptime time):
-        start_block_height(start_block_height), connection_id(connection_id), nblocks(nblocks), rate(0.0f), size(0), time(time), origin(addr) {}
+        start_block_height(start_block_height), blocks(std::make_shared<const std::vector<cryptonote::block_complete_entry>>()), connection_id(connection_id), nblocks(nblocks), rate(0.0f), size(0), time(time), origin(addr), spill_offset(0), spill_size(0) {}
 
       bool operator<(const span &s) const { return start_block_height < s.start_block_height; }
     };
     typedef std::set<span> block_map;
 
   public:
+    ~block_queue();
+    bool set_spill_file(const std::string &path, size_t memory_limit);
     void add_blocks(uint64_t height, std::vector<cryptonote::block_complete_entry> bcel, const boost::uuids::uuid &connection_id, const epee::net_utils::network_address &addr, float rate, size_t size);
     void add_blocks(uint64_t height, uint64_t nblocks, const boost::uuids::uuid &connection_id, const epee::net_utils::network_address &addr, boost::posix_time::ptime time = boost::date_time::min_date_time);
     void flush_spans(const boost::uuids::uuid &connection_id, bool all = false);
@@ -87,9 +96,11 @@ namespace cryptonote
     void reset_next_span_time(boost::posix_time::ptime t = boost::posix_time::microsec_clock::universal_time());
     void set_span_hashes(uint64_t start_height, const boost::uuids::uuid &connection_id, std::vector<crypto::hash> hashes);
     bool get_next_span(uint64_t &height, std::vector<cryptonote::block_complete_entry> &bcel, boost::uuids::uuid &connection_id, epee::net_utils::network_address &addr, bool filled = true) const;
+    bool get_span_blocks(uint64_t height, std::shared_ptr<const std::vector<cryptonote::block_complete_entry>> &bcel) const;
     bool has_next_span(const boost::uuids::uuid &connection_id, bool &filled, boost::posix_time::ptime &time) const;
     bool has_next_span(uint64_t height, bool &filled, boost::posix_time::ptime &time, boost::uuids::uuid &connection_id) const;
     size_t get_data_size() const;
+    size_t get_memory_size() const;
     size_t get_num_filled_spans_prefix() const;
     size_t get_num_filled_spans() const;
     crypto::hash get_last_known_hash(const boost::uuids::uuid &connection_id) const;
@@ -99,15 +110,38 @@ namespace cryptonote
     bool foreach(std::function<bool(const span&)> f) const;
     bool requested(const crypto::hash &hash) const;
     bool have(const crypto::hash &hash) const;
+    void update_peer_rate(const boost::uuids::uuid &connection_id, float rate);
+    void update_peer_rate(const boost::uuids::uuid &connection_id, size_t bytes, const boost::posix_time::ptime &first_byte, const boost::posix_time::ptime &last_byte);
+    float get_peer_rate(const boost::uuids::uuid &connection_id) const;
+    float get_relative_peer_rate(const boost::uuids::uuid &connection_id) const;
+    uint64_t get_span_size(const boost::uuids::uuid &connection_id, uint64_t max_blocks) const;
+    bool is_slow_peer(const boost::uuids::uuid &connection_id) const;
 
   private:
+    struct peer_rate
+    {
+      float rate; // bytes/s, moving average of the rate spans arrive at, from their first to their last byte
+      unsigned samples;
+    };
+
     void erase_block(block_map::iterator j);
     inline bool requested_internal(const crypto::hash &hash) const;
+    void close_spill_file() noexcept;
+    void spill_spans();
+    bool spill_span(const span &s);
+    bool load_span(const span &s, std::vector<cryptonote::block_complete_entry> &bcel) const;
+    void release_spill(const span &s);
 
   private:
     block_map blocks;
     mutable boost::recursive_mutex mutex;
     std::unordered_set<crypto::hash> requested_hashes;
     std::unordered_set<crypto::hash> have_blocks;
+    std::map<boost::uuids::uuid, peer_rate> peer_rates; // outlives the spans, until the connection goes away
+    std::string spill_path;
+    mutable std::fstream spill_file;
+    std::map<uint64_t, uint64_t> spill_free; // offset -> size of reusable extents in the spill file
+    uint64_t spill_end = 0;
+    size_t memory_limit = 0; // 0 means never spill
   };
 }
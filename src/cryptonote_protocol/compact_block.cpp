@@ -0,0 +1,96 @@
+// Copyright (c) 2019-2021 WAZN Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include <cstring>
+#include <unordered_map>
+#include <boost/endian/conversion.hpp>
+#include "compact_block.h"
+
+namespace cryptonote
+{
+  uint64_t get_compact_short_id(const crypto::hash &txid, const uint64_t nonce)
+  {
+    char data[sizeof(nonce) + sizeof(txid)];
+    const uint64_t nonce_le = boost::endian::native_to_little(nonce);
+    memcpy(data, &nonce_le, sizeof(nonce_le));
+    memcpy(data + sizeof(nonce_le), txid.data, sizeof(txid));
+
+    crypto::hash h;
+    crypto::cn_fast_hash(data, sizeof(data), h);
+    uint64_t id = 0;
+    for (std::size_t i = 0; i < COMPACT_BLOCK_SHORT_ID_SIZE; ++i)
+      id |= uint64_t(uint8_t(h.data[i])) << (8 * i);
+    return id;
+  }
+
+  std::string get_compact_short_ids(const std::vector<crypto::hash> &tx_hashes, const uint64_t nonce)
+  {
+    std::string out;
+    out.reserve(tx_hashes.size() * COMPACT_BLOCK_SHORT_ID_SIZE);
+    for (const crypto::hash &txid: tx_hashes)
+    {
+      const uint64_t id = get_compact_short_id(txid, nonce);
+      for (std::size_t i = 0; i < COMPACT_BLOCK_SHORT_ID_SIZE; ++i)
+        out.push_back(char(id >> (8 * i)));
+    }
+    return out;
+  }
+
+  bool get_compact_block_tx_hashes(const std::string &short_ids, const uint64_t nonce, const std::vector<crypto::hash> &pool, std::vector<crypto::hash> &tx_hashes, std::vector<uint64_t> &missing)
+  {
+    if (short_ids.size() % COMPACT_BLOCK_SHORT_ID_SIZE)
+      return false;
+
+    // null_hash marks a short id shared by several pool txes
+    std::unordered_map<uint64_t, crypto::hash> ids;
+    ids.reserve(pool.size());
+    for (const crypto::hash &txid: pool)
+    {
+      auto res = ids.emplace(get_compact_short_id(txid, nonce), txid);
+      if (!res.second)
+        res.first->second = crypto::null_hash;
+    }
+
+    const std::size_t count = short_ids.size() / COMPACT_BLOCK_SHORT_ID_SIZE;
+    tx_hashes.assign(count, crypto::null_hash);
+    missing.clear();
+    for (std::size_t n = 0; n < count; ++n)
+    {
+      uint64_t id = 0;
+      for (std::size_t i = 0; i < COMPACT_BLOCK_SHORT_ID_SIZE; ++i)
+        id |= uint64_t(uint8_t(short_ids[n * COMPACT_BLOCK_SHORT_ID_SIZE + i])) << (8 * i);
+      const auto it = ids.find(id);
+      if (it == ids.end() || it->second == crypto::null_hash)
+        missing.push_back(n);
+      else
+        tx_hashes[n] = it->second;
+    }
+    return true;
+  }
+}
@@ -0,0 +1,55 @@
+// Copyright (c) 2019-2021 WAZN Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "crypto/hash.h"
+
+namespace cryptonote
+{
+  //! Size in bytes of the salted short tx ids carried by NOTIFY_NEW_COMPACT_BLOCK
+  constexpr const std::size_t COMPACT_BLOCK_SHORT_ID_SIZE = 6;
+
+  //! \return Short id of `txid` under the per-block `nonce`, in the low 48 bits.
+  uint64_t get_compact_short_id(const crypto::hash &txid, uint64_t nonce);
+
+  //! \return Packed short ids for `tx_hashes`, `COMPACT_BLOCK_SHORT_ID_SIZE` bytes each.
+  std::string get_compact_short_ids(const std::vector<crypto::hash> &tx_hashes, uint64_t nonce);
+
+  /*!
+    Maps packed `short_ids` back to txids using the txids in `pool`. Short ids
+    with no match, or matching more than one pool tx, are left as
+    `crypto::null_hash` in `tx_hashes` and their index added to `missing`.
+
+    \return False if `short_ids` is not a whole number of short ids.
+  */
+  bool get_compact_block_tx_hashes(const std::string &short_ids, uint64_t nonce, const std::vector<crypto::hash> &pool, std::vector<crypto::hash> &tx_hashes, std::vector<uint64_t> &missing);
+}
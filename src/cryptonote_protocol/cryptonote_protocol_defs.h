@@ -144,22 +144,25 @@ namespace cryptonote
       {
         KV_SERIALIZE(txs)
       }
-      else
+      else if (is_store)
       {
-        std::vector<blobdata> txs;
-        if (is_store)
+        // store the blobs straight from the entries, without an intermediate vector of copies
+        if (!this_ref.txs.empty())
         {
-          txs.reserve(this_ref.txs.size());
-          for (const auto &e: this_ref.txs) txs.push_back(e.blob);
+          auto harray = stg.insert_first_value("txs", blobdata(this_ref.txs.front().blob), hparent_section);
+          CHECK_AND_ASSERT_MES(harray, false, "failed to insert first value to storage");
+          for (size_t i = 1; i < this_ref.txs.size(); ++i)
+            stg.insert_next_value(harray, blobdata(this_ref.txs[i].blob));
         }
+      }
+      else
+      {
+        std::vector<blobdata> txs;
         epee::serialization::selector<is_store>::serialize(txs, stg, hparent_section, "txs");
-        if (!is_store)
-        {
-          block_complete_entry &self = const_cast<block_complete_entry&>(this_ref);
-          self.txs.clear();
-          self.txs.reserve(txs.size());
-          for (auto &e: txs) self.txs.push_back({std::move(e), crypto::null_hash});
-        }
+        block_complete_entry &self = const_cast<block_complete_entry&>(this_ref);
+        self.txs.clear();
+        self.txs.reserve(txs.size());
+        for (auto &e: txs) self.txs.push_back({std::move(e), crypto::null_hash});
       }
     END_KV_SERIALIZE_MAP()
 
@@ -377,4 +380,66 @@ namespace cryptonote
     typedef epee::misc_utils::struct_init<request_t> request;
   };
 
+  /************************************************************************/
+  /*                                                                      */
+  /************************************************************************/
+  struct NOTIFY_NEW_COMPACT_BLOCK
+  {
+    const static int ID = BC_COMMANDS_POOL_BASE + 11;
+
+    struct request_t
+    {
+      blobdata block; // block with tx_hashes stripped, miner tx included
+      crypto::hash block_hash;
+      uint64_t nonce;
+      std::string short_ids; // COMPACT_BLOCK_SHORT_ID_SIZE bytes per tx, in block order
+      uint64_t current_blockchain_height;
+
+      BEGIN_KV_SERIALIZE_MAP()
+        KV_SERIALIZE(block)
+        KV_SERIALIZE_VAL_POD_AS_BLOB(block_hash)
+        KV_SERIALIZE(nonce)
+        KV_SERIALIZE(short_ids)
+        KV_SERIALIZE(current_blockchain_height)
+      END_KV_SERIALIZE_MAP()
+    };
+    typedef epee::misc_utils::struct_init<request_t> request;
+  };
+
+  /************************************************************************/
+  /*                                                                      */
+  /************************************************************************/
+  struct NOTIFY_TX_INVENTORY
+  {
+    const static int ID = BC_COMMANDS_POOL_BASE + 12;
+
+    struct request_t
+    {
+      std::vector<crypto::hash> hashes;
+
+      BEGIN_KV_SERIALIZE_MAP()
+        KV_SERIALIZE_CONTAINER_POD_AS_BLOB(hashes)
+      END_KV_SERIALIZE_MAP()
+    };
+    typedef epee::misc_utils::struct_init<request_t> request;
+  };
+
+  /************************************************************************/
+  /*                                                                      */
+  /************************************************************************/
+  struct NOTIFY_REQUEST_TXS
+  {
+    const static int ID = BC_COMMANDS_POOL_BASE + 13;
+
+    struct request_t
+    {
+      std::vector<crypto::hash> hashes;
+
+      BEGIN_KV_SERIALIZE_MAP()
+        KV_SERIALIZE_CONTAINER_POD_AS_BLOB(hashes)
+      END_KV_SERIALIZE_MAP()
+    };
+    typedef epee::misc_utils::struct_init<request_t> request;
+  };
+
 }
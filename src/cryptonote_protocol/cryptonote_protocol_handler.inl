@@ -39,6 +39,7 @@
 #include <boost/interprocess/detail/atomic.hpp>
 #include <list>
 #include <ctime>
+#include <boost/filesystem.hpp>
 
 #include "cryptonote_basic/cryptonote_format_utils.h"
 #include "profile_tools.h"
@@ -89,7 +90,8 @@ namespace cryptonote
                                                                                                               m_synchronized(offline),
                                                                                                               m_ask_for_txpool_complement(true),
                                                                                                               m_stopping(false),
-                                                                                                              m_no_sync(false)
+                                                                                                              m_no_sync(false),
+                                                                                                              m_tx_requests(std::chrono::seconds(CRYPTONOTE_TX_REQUEST_TIMEOUT), CRYPTONOTE_TX_REQUEST_MAX_ANNOUNCERS)
 
   {
     if(!m_p2p)
@@ -109,10 +111,28 @@ namespace cryptonote
     m_sync_bad_spans_downloaded = 0;
     m_sync_download_chain_size = 0;
     m_sync_download_objects_size = 0;
+    m_sync_prepare_time = 0;
+    m_sync_txs_time = 0;
+    m_sync_blocks_time = 0;
+    m_sync_commit_time = 0;
 
     m_block_download_max_size = command_line::get_arg(vm, cryptonote::arg_block_download_max_size);
     m_sync_pruned_blocks = command_line::get_arg(vm, cryptonote::arg_sync_pruned_blocks);
 
+    const size_t block_download_memory_limit = command_line::get_arg(vm, cryptonote::arg_block_download_memory_limit);
+    if (block_download_memory_limit)
+    {
+      const boost::filesystem::path data_dir = command_line::get_arg(vm, cryptonote::arg_data_dir);
+      boost::system::error_code ec;
+      boost::filesystem::create_directories(data_dir, ec);
+      const std::string spill_path = (data_dir / CRYPTONOTE_BLOCK_QUEUE_SPILL_FILENAME).string();
+      if (!m_block_queue.set_spill_file(spill_path, block_download_memory_limit))
+      {
+        MERROR("Failed to create block download spill file " << spill_path);
+        return false;
+      }
+    }
+
     return true;
   }
   //------------------------------------------------------------------------------------------------------------------------
@@ -905,6 +925,67 @@ namespace cryptonote
   }
   //------------------------------------------------------------------------------------------------------------------------
   template<class t_core>
+  int t_cryptonote_protocol_handler<t_core>::handle_notify_new_compact_block(int command, NOTIFY_NEW_COMPACT_BLOCK::request& arg, cryptonote_connection_context& context)
+  {
+    MLOG_P2P_MESSAGE("Received NOTIFY_NEW_COMPACT_BLOCK " << arg.block_hash << " (height " << arg.current_blockchain_height << ", " << arg.short_ids.size() / COMPACT_BLOCK_SHORT_ID_SIZE << " txes)");
+    if(context.m_state != cryptonote_connection_context::state_normal)
+      return 1;
+    if(!is_synchronized())
+    {
+      LOG_DEBUG_CC(context, "Received new block while syncing, ignored");
+      return 1;
+    }
+    if(m_core.have_block(arg.block_hash))
+      return 1;
+
+    block new_block;
+    if(!parse_and_validate_block_from_blob(arg.block, new_block) || !new_block.tx_hashes.empty())
+    {
+      LOG_ERROR_CCONTEXT("sent wrong compact block: failed to parse and validate block, dropping connection");
+      drop_connection(context, false, false);
+      return 1;
+    }
+
+    std::vector<crypto::hash> pool_hashes;
+    m_core.get_pool_transaction_hashes(pool_hashes, false);
+    std::vector<uint64_t> need_tx_indices;
+    if(!get_compact_block_tx_hashes(arg.short_ids, arg.nonce, pool_hashes, new_block.tx_hashes, need_tx_indices))
+    {
+      LOG_ERROR_CCONTEXT("sent wrong compact block: bad short ids size " << arg.short_ids.size() << ", dropping connection");
+      drop_connection(context, false, false);
+      return 1;
+    }
+    new_block.invalidate_hashes();
+
+    if(need_tx_indices.empty())
+    {
+      if(get_block_hash(new_block) == arg.block_hash)
+      {
+        // the block is whole again, the fluffy path takes it from here
+        NOTIFY_NEW_FLUFFY_BLOCK::request fluffy_arg = AUTO_VAL_INIT(fluffy_arg);
+        fluffy_arg.b.block = block_to_blob(new_block);
+        fluffy_arg.current_blockchain_height = arg.current_blockchain_height;
+        return handle_notify_new_fluffy_block(NOTIFY_NEW_FLUFFY_BLOCK::ID, fluffy_arg, context);
+      }
+      // a short id matched the wrong pool tx, ask for the block with its full tx hashes
+      MDEBUG("Compact block " << arg.block_hash << " did not reconstruct, requesting fluffy block");
+    }
+    else
+    {
+      MDEBUG("We are missing " << need_tx_indices.size() << " txes for this compact block");
+    }
+
+    // one round trip: the answer is a fluffy block carrying every tx we lack
+    NOTIFY_REQUEST_FLUFFY_MISSING_TX::request missing_tx_req;
+    missing_tx_req.block_hash = arg.block_hash;
+    missing_tx_req.current_blockchain_height = arg.current_blockchain_height;
+    missing_tx_req.missing_tx_indices = std::move(need_tx_indices);
+    MLOG_P2P_MESSAGE("-->>NOTIFY_REQUEST_FLUFFY_MISSING_TX: missing_tx_indices.size()=" << missing_tx_req.missing_tx_indices.size() );
+    post_notify<NOTIFY_REQUEST_FLUFFY_MISSING_TX>(missing_tx_req, context);
+    return 1;
+  }
+  //------------------------------------------------------------------------------------------------------------------------
+  template<class t_core>
   int t_cryptonote_protocol_handler<t_core>::handle_notify_get_txpool_complement(int command, NOTIFY_GET_TXPOOL_COMPLEMENT::request& arg, cryptonote_connection_context& context)
   {
     MLOG_P2P_MESSAGE("Received NOTIFY_GET_TXPOOL_COMPLEMENT (" << arg.hashes.size() << " txes)");
@@ -935,6 +1016,100 @@ namespace cryptonote
   }
   //------------------------------------------------------------------------------------------------------------------------
   template<class t_core>
+  int t_cryptonote_protocol_handler<t_core>::handle_notify_tx_inventory(int command, NOTIFY_TX_INVENTORY::request& arg, cryptonote_connection_context& context)
+  {
+    MLOG_P2P_MESSAGE("Received NOTIFY_TX_INVENTORY (" << arg.hashes.size() << " txes)");
+    if(context.m_state != cryptonote_connection_context::state_normal)
+      return 1;
+    if(!is_synchronized())
+    {
+      LOG_DEBUG_CC(context, "Received tx inventory while syncing, ignored");
+      return 1;
+    }
+
+    if (arg.hashes.size() > CRYPTONOTE_TX_INVENTORY_MAX_HASHES)
+    {
+      LOG_ERROR_CCONTEXT("Tx inventory too large (" << arg.hashes.size() << "), expected at most " << CRYPTONOTE_TX_INVENTORY_MAX_HASHES << ", dropping connection");
+      drop_connection(context, false, false);
+      return 1;
+    }
+
+    // ask a single peer at a time, others announcing the same txes are kept
+    // and asked in turn if it fails to answer in time
+    NOTIFY_REQUEST_TXS::request req;
+    for (const crypto::hash &tx_hash: arg.hashes)
+    {
+      if (!m_core.pool_has_tx(tx_hash) && m_tx_requests.request(tx_hash, context.m_connection_id))
+        req.hashes.push_back(tx_hash);
+    }
+    if (req.hashes.empty())
+      return 1;
+
+    MLOG_P2P_MESSAGE("-->>NOTIFY_REQUEST_TXS: hashes.size()=" << req.hashes.size());
+    post_notify<NOTIFY_REQUEST_TXS>(req, context);
+    return 1;
+  }
+  //------------------------------------------------------------------------------------------------------------------------
+  template<class t_core>
+  void t_cryptonote_protocol_handler<t_core>::request_txs(const tx_request_tracker::requests &requests)
+  {
+    for (const auto &e: requests)
+    {
+      NOTIFY_REQUEST_TXS::request req;
+      for (const crypto::hash &tx_hash: e.second)
+      {
+        if (m_core.pool_has_tx(tx_hash))
+          m_tx_requests.on_tx_received(tx_hash);
+        else
+          req.hashes.push_back(tx_hash);
+      }
+      if (req.hashes.empty())
+        continue;
+
+      // if the peer is gone too, the request times out and moves on
+      m_p2p->for_connection(e.first, [&](cryptonote_connection_context& context, nodetool::peerid_type peer_id, uint32_t f)->bool{
+        MLOG_P2P_MESSAGE("-->>NOTIFY_REQUEST_TXS: hashes.size()=" << req.hashes.size() << " (retry)");
+        post_notify<NOTIFY_REQUEST_TXS>(req, context);
+        return true;
+      });
+    }
+  }
+  //------------------------------------------------------------------------------------------------------------------------
+  template<class t_core>
+  int t_cryptonote_protocol_handler<t_core>::handle_request_txs(int command, NOTIFY_REQUEST_TXS::request& arg, cryptonote_connection_context& context)
+  {
+    MLOG_P2P_MESSAGE("Received NOTIFY_REQUEST_TXS (" << arg.hashes.size() << " txes)");
+    if(context.m_state != cryptonote_connection_context::state_normal)
+      return 1;
+    if (arg.hashes.size() > CRYPTONOTE_TX_INVENTORY_MAX_HASHES)
+    {
+      LOG_ERROR_CCONTEXT("Requested txes count is too big (" << arg.hashes.size() << "), expected at most " << CRYPTONOTE_TX_INVENTORY_MAX_HASHES << ", dropping connection");
+      drop_connection(context, false, false);
+      return 1;
+    }
+
+    // only txes that were already fluffed, stem txes stay hidden
+    std::vector<cryptonote::blobdata> txs;
+    for (const crypto::hash &tx_hash: arg.hashes)
+    {
+      cryptonote::blobdata txblob;
+      if (m_core.get_pool_transaction(tx_hash, txblob, relay_category::broadcasted))
+        txs.push_back(std::move(txblob));
+    }
+
+    // the txes may add up to more than a levin packet, send them in parts
+    for (auto &part: split_tx_blobs(std::move(txs), CRYPTONOTE_TX_REQUEST_REPLY_SIZE))
+    {
+      NOTIFY_NEW_TRANSACTIONS::request new_txes;
+      new_txes.dandelionpp_fluff = true;
+      new_txes.txs = std::move(part);
+      MLOG_P2P_MESSAGE("-->>NOTIFY_NEW_TRANSACTIONS: txs.size()=" << new_txes.txs.size());
+      post_notify<NOTIFY_NEW_TRANSACTIONS>(new_txes, context);
+    }
+    return 1;
+  }
+  //------------------------------------------------------------------------------------------------------------------------
+  template<class t_core>
   int t_cryptonote_protocol_handler<t_core>::handle_notify_new_transactions(int command, NOTIFY_NEW_TRANSACTIONS::request& arg, cryptonote_connection_context& context)
   {
     MLOG_P2P_MESSAGE("Received NOTIFY_NEW_TRANSACTIONS (" << arg.txs.size() << " txes)");
@@ -1272,6 +1447,10 @@ namespace cryptonote
       const float rate = size * 1e6 / (dt.total_microseconds() + 1);
       MDEBUG(context << " adding span: " << arg.blocks.size() << " at height " << start_height << ", " << dt.total_microseconds()/1e6 << " seconds, " << (rate/1024) << " kB/s, size now " << (m_block_queue.get_data_size() + blocks_size) / 1048576.f << " MB");
       m_block_queue.add_blocks(start_height, arg.blocks, context.m_connection_id, context.m_remote_address, rate, blocks_size);
+      // span sizing goes by how fast the response itself came in, from its first byte to its
+      // last: the span rate above also counts the request round trip, and the connection's
+      // speed counts idle time and other traffic
+      m_block_queue.update_peer_rate(context.m_connection_id, size, context.m_message_recv_start, context.m_message_recv_end);
 
       const crypto::hash last_block_hash = cryptonote::get_block_hash(b);
       context.m_last_known_hash = last_block_hash;
@@ -1365,6 +1544,7 @@ namespace cryptonote
         m_sync_start_time = boost::posix_time::microsec_clock::universal_time();
         m_sync_start_height = m_core.get_current_blockchain_height();
         m_period_start_time = m_sync_start_time;
+        m_sync_prepare_time = m_sync_txs_time = m_sync_blocks_time = m_sync_commit_time = 0;
 
         while (1)
         {
@@ -1467,6 +1647,7 @@ namespace cryptonote
             }
           }
 
+          TIME_MEASURE_START(prepare_time);
           std::vector<block> pblocks;
           if (!m_core.prepare_handle_incoming_blocks(blocks, pblocks))
           {
@@ -1480,6 +1661,16 @@ namespace cryptonote
             LOG_ERROR_CCONTEXT("Internal error: blocks.size() != block_entry.txs.size()");
             return 1;
           }
+          TIME_MEASURE_FINISH(prepare_time);
+          m_sync_prepare_time += prepare_time;
+
+          // while this span is being added and committed, hash the next one
+          if (!pblocks.empty())
+          {
+            std::shared_ptr<const std::vector<cryptonote::block_complete_entry>> next_blocks;
+            if (m_block_queue.get_span_blocks(start_height + blocks.size(), next_blocks))
+              m_core.prefetch_incoming_blocks(start_height + blocks.size(), std::move(next_blocks), pblocks);
+          }
 
           uint64_t block_process_time_full = 0, transactions_process_time_full = 0;
           size_t num_txs = 0, blockidx = 0;
@@ -1598,13 +1789,19 @@ namespace cryptonote
 
           } // each download block
 
-          MDEBUG(context << "Block process time (" << blocks.size() << " blocks, " << num_txs << " txs): " << block_process_time_full + transactions_process_time_full << " (" << transactions_process_time_full << "/" << block_process_time_full << ") ms");
-
+          TIME_MEASURE_START(commit_time);
           if (!m_core.cleanup_handle_incoming_blocks())
           {
             LOG_PRINT_CCONTEXT_L0("Failure in cleanup_handle_incoming_blocks");
             return 1;
           }
+          TIME_MEASURE_FINISH(commit_time);
+          m_sync_txs_time += transactions_process_time_full;
+          m_sync_blocks_time += block_process_time_full;
+          m_sync_commit_time += commit_time;
+
+          MDEBUG(context << "Block process time (" << blocks.size() << " blocks, " << num_txs << " txs): " << prepare_time + block_process_time_full + transactions_process_time_full + commit_time
+              << " (prepare/txs/blocks/commit " << prepare_time << "/" << transactions_process_time_full << "/" << block_process_time_full << "/" << commit_time << ") ms");
 
           m_block_queue.remove_spans(span_connection_id, start_height);
 
@@ -1641,7 +1838,13 @@ namespace cryptonote
                 + std::to_string(m_block_queue.get_num_filled_spans()) + " spans, stripe "
                 + std::to_string(previous_stripe) + " -> " + std::to_string(current_stripe);
             if (ELPP->vRegistry()->allowed(el::Level::Debug, "sync-info"))
+            {
+              const uint64_t stages_time = std::max<uint64_t>(m_sync_prepare_time + m_sync_txs_time + m_sync_blocks_time + m_sync_commit_time, 1);
+              timing_message += std::string(", stages prepare/txs/blocks/commit ")
+                + std::to_string(m_sync_prepare_time * 100 / stages_time) + "/" + std::to_string(m_sync_txs_time * 100 / stages_time) + "/"
+                + std::to_string(m_sync_blocks_time * 100 / stages_time) + "/" + std::to_string(m_sync_commit_time * 100 / stages_time) + "%";
               timing_message += std::string(": ") + m_block_queue.get_overview(current_blockchain_height);
+            }
             MGINFO_YELLOW("Synced " << current_blockchain_height << "/" << target_blockchain_height
                 << progress_message << timing_message);
             if (previous_stripe != current_stripe)
@@ -1705,6 +1908,7 @@ skip:
     m_idle_peer_kicker.do_call(boost::bind(&t_cryptonote_protocol_handler<t_core>::kick_idle_peers, this));
     m_standby_checker.do_call(boost::bind(&t_cryptonote_protocol_handler<t_core>::check_standby_peers, this));
     m_sync_search_checker.do_call(boost::bind(&t_cryptonote_protocol_handler<t_core>::update_sync_search, this));
+    m_tx_request_pruner.do_call([this](){ request_txs(m_tx_requests.prune()); return true; });
     return m_core.on_idle();
   }
   //------------------------------------------------------------------------------------------------------------------------
@@ -1880,6 +2084,14 @@ skip:
         const double dl_speed = context.m_max_speed_down;
         if (standby && dt >= REQUEST_NEXT_SCHEDULED_SPAN_THRESHOLD_STANDBY && dl_speed > 0)
         {
+          // a demoted peer holding up the next span gets raced by any peer which is not
+          if (m_block_queue.is_slow_peer(connection_id) && !m_block_queue.is_slow_peer(context.m_connection_id))
+          {
+            MDEBUG(context << " we should download it as the downloading peer is slow (" << m_block_queue.get_peer_rate(connection_id)
+                << " vs " << m_block_queue.get_peer_rate(context.m_connection_id) << " B/s) after " << dt/1e6 << " seconds");
+            return true;
+          }
+
           bool download = false;
           if (m_p2p->for_connection(connection_id, [&](cryptonote_connection_context& ctx, nodetool::peerid_type peer_id, uint32_t f)->bool{
             const time_t nowt = time(NULL);
@@ -2177,7 +2389,8 @@ skip:
       NOTIFY_REQUEST_GET_OBJECTS::request req;
       bool is_next = false;
       size_t count = 0;
-      const size_t count_limit = m_core.get_block_sync_size(m_core.get_current_blockchain_height());
+      // spans shrink for peers much slower than the fastest one, so they do not hold up the import for long
+      const size_t count_limit = m_block_queue.get_span_size(context.m_connection_id, m_core.get_block_sync_size(m_core.get_current_blockchain_height()));
       std::pair<uint64_t, uint64_t> span = std::make_pair(0, 0);
       if (force_next_span)
       {
@@ -2676,14 +2889,19 @@ skip:
     fluffy_arg.b = arg.b;
     fluffy_arg.b.txs = fluffy_txs;
 
-    // sort peers between fluffy ones and others
-    std::vector<std::pair<epee::net_utils::zone, boost::uuids::uuid>> fullConnections, fluffyConnections;
-    m_p2p->for_each_connection([this, &exclude_context, &fullConnections, &fluffyConnections](connection_context& context, nodetool::peerid_type peer_id, uint32_t support_flags)
+    // sort peers between compact, fluffy and others
+    std::vector<std::pair<epee::net_utils::zone, boost::uuids::uuid>> fullConnections, fluffyConnections, compactConnections;
+    m_p2p->for_each_connection([this, &exclude_context, &fullConnections, &fluffyConnections, &compactConnections](connection_context& context, nodetool::peerid_type peer_id, uint32_t support_flags)
     {
       // peer_id also filters out connections before handshake
       if (peer_id && exclude_context.m_connection_id != context.m_connection_id && context.m_remote_address.get_zone() == epee::net_utils::zone::public_)
       {
-        if(m_core.fluffy_blocks_enabled() && (support_flags & P2P_SUPPORT_FLAG_FLUFFY_BLOCKS))
+        if(m_core.fluffy_blocks_enabled() && (support_flags & P2P_SUPPORT_FLAG_COMPACT_BLOCKS))
+        {
+          LOG_DEBUG_CC(context, "PEER SUPPORTS COMPACT BLOCKS - RELAYING SHORT TX IDS");
+          compactConnections.push_back({context.m_remote_address.get_zone(), context.m_connection_id});
+        }
+        else if(m_core.fluffy_blocks_enabled() && (support_flags & P2P_SUPPORT_FLAG_FLUFFY_BLOCKS))
         {
           LOG_DEBUG_CC(context, "PEER SUPPORTS FLUFFY BLOCKS - RELAYING THIN/COMPACT WHATEVER BLOCK");
           fluffyConnections.push_back({context.m_remote_address.get_zone(), context.m_connection_id});
@@ -2697,7 +2915,31 @@ skip:
       return true;
     });
 
-    // send fluffy ones first, we want to encourage people to run that
+    // send compact and fluffy ones first, we want to encourage people to run that
+    if (!compactConnections.empty())
+    {
+      block b;
+      if (parse_and_validate_block_from_blob(arg.b.block, b))
+      {
+        NOTIFY_NEW_COMPACT_BLOCK::request compact_arg = AUTO_VAL_INIT(compact_arg);
+        compact_arg.current_blockchain_height = arg.current_blockchain_height;
+        compact_arg.block_hash = get_block_hash(b);
+        compact_arg.nonce = crypto::rand<uint64_t>();
+        compact_arg.short_ids = get_compact_short_ids(b.tx_hashes, compact_arg.nonce);
+        b.tx_hashes.clear();
+        b.invalidate_hashes();
+        compact_arg.block = block_to_blob(b);
+
+        std::string compactBlob;
+        epee::serialization::store_t_to_binary(compact_arg, compactBlob);
+        m_p2p->relay_notify_to_list(NOTIFY_NEW_COMPACT_BLOCK::ID, epee::strspan<uint8_t>(compactBlob), std::move(compactConnections));
+      }
+      else
+      {
+        MERROR("Failed to parse block to relay, sending it fluffy instead");
+        fluffyConnections.insert(fluffyConnections.end(), compactConnections.begin(), compactConnections.end());
+      }
+    }
     if (!fluffyConnections.empty())
     {
       std::string fluffyBlob;
@@ -2900,6 +3142,7 @@ skip:
     }
 
     m_block_queue.flush_spans(context.m_connection_id, false);
+    request_txs(m_tx_requests.on_connection_close(context.m_connection_id));
     MLOG_PEER_STATE("closed");
   }
 
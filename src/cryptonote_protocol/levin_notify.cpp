@@ -29,10 +29,12 @@
 
 #include "levin_notify.h"
 
+#include <algorithm>
 #include <boost/asio/steady_timer.hpp>
 #include <boost/system/system_error.hpp>
 #include <boost/uuid/uuid_io.hpp>
 #include <chrono>
+#include <cstring>
 #include <deque>
 #include <stdexcept>
 #include <utility>
@@ -218,6 +220,35 @@ namespace levin
       return p2p.notify(NOTIFY_NEW_TRANSACTIONS::ID, epee::strspan<std::uint8_t>(blob), destination);
     }
 
+    bool make_payload_send_inventory(connections& p2p, const std::vector<crypto::hash>& hashes, const boost::uuids::uuid& destination)
+    {
+      // receivers drop larger inventories
+      for (std::size_t start = 0; start < hashes.size(); start += CRYPTONOTE_TX_INVENTORY_MAX_HASHES)
+      {
+        NOTIFY_TX_INVENTORY::request request{};
+        const auto first = hashes.begin() + start;
+        request.hashes.assign(first, first + std::min<std::size_t>(hashes.size() - start, CRYPTONOTE_TX_INVENTORY_MAX_HASHES));
+
+        std::string blob;
+        if (!epee::serialization::store_t_to_binary(request, blob))
+          throw std::runtime_error{"Failed to serialize to epee binary format"};
+
+        p2p.for_connection(destination, [&blob](detail::p2p_context& context) {
+          on_levin_traffic(context, true, true, false, blob.size(), NOTIFY_TX_INVENTORY::ID);
+          return true;
+        });
+        if (!p2p.notify(NOTIFY_TX_INVENTORY::ID, epee::strspan<std::uint8_t>(blob), destination))
+          return false;
+      }
+      return true;
+    }
+
+    //! \return True if `context` can be sent hashes instead of full txes.
+    bool is_inventory_peer(const detail::p2p_context& context) noexcept
+    {
+      return context.handshake_complete() && (context.support_flags & P2P_SUPPORT_FLAG_TX_INVENTORY);
+    }
+
     /* The current design uses `asio::strand`s. The documentation isn't as clear
        as it should be - a `strand` has an internal `mutex` and `bool`. The
        `mutex` synchronizes thread access and the `bool` is set when a thread is
@@ -276,7 +307,7 @@ namespace levin
   {
     struct zone
     {
-      explicit zone(boost::asio::io_service& io_service, std::shared_ptr<connections> p2p, epee::byte_slice noise_in, epee::net_utils::zone zone, bool pad_txs)
+      explicit zone(boost::asio::io_service& io_service, std::shared_ptr<connections> p2p, epee::byte_slice noise_in, epee::net_utils::zone zone, bool pad_txs, std::size_t flood_fanout)
         : p2p(std::move(p2p)),
           noise(std::move(noise_in)),
           next_epoch(io_service),
@@ -288,6 +319,7 @@ namespace levin
           flush_callbacks(0),
           nzone(zone),
           pad_txs(pad_txs),
+          flood_fanout(flood_fanout),
           fluffing(false)
       {
         for (std::size_t count = 0; !noise.empty() && count < CRYPTONOTE_NOISE_CHANNELS; ++count)
@@ -305,6 +337,7 @@ namespace levin
       std::uint32_t flush_callbacks;             //!< Number of active fluff flush callbacks queued
       const epee::net_utils::zone nzone;         //!< Zone is public ipv4/ipv6 connections, or i2p or tor
       const bool pad_txs;                        //!< Pad txs to the next boundary for privacy
+      const std::size_t flood_fanout;            //!< Outbound inventory peers that still receive full txes
       bool fluffing;                             //!< Zone is in Dandelion++ fluff epoch
     };
   } // detail
@@ -375,15 +408,20 @@ namespace levin
         const auto now = std::chrono::steady_clock::now();
         auto next_flush = std::chrono::steady_clock::time_point::max();
         std::vector<std::pair<std::vector<blobdata>, boost::uuids::uuid>> connections{};
-        zone_->p2p->foreach_connection([timer_error, now, &next_flush, &connections] (detail::p2p_context& context)
+        std::vector<std::pair<std::vector<crypto::hash>, boost::uuids::uuid>> announcements{};
+        zone_->p2p->foreach_connection([timer_error, now, &next_flush, &connections, &announcements] (detail::p2p_context& context)
         {
-          if (!context.fluff_txs.empty())
+          if (!context.fluff_txs.empty() || !context.announce_txs.empty())
           {
             if (context.flush_time <= now || timer_error) // flush on canceled timer
             {
               context.flush_time = std::chrono::steady_clock::time_point::max();
-              connections.emplace_back(std::move(context.fluff_txs), context.m_connection_id);
+              if (!context.fluff_txs.empty())
+                connections.emplace_back(std::move(context.fluff_txs), context.m_connection_id);
+              if (!context.announce_txs.empty())
+                announcements.emplace_back(std::move(context.announce_txs), context.m_connection_id);
               context.fluff_txs.clear();
+              context.announce_txs.clear();
             }
             else // not flushing yet
               next_flush = std::min(next_flush, context.flush_time);
@@ -404,6 +442,14 @@ namespace levin
           make_payload_send_txs(*zone_->p2p, std::move(connection.first), connection.second, zone_->pad_txs, true);
         }
 
+        for (auto& announcement : announcements)
+        {
+          std::sort(announcement.first.begin(), announcement.first.end(), [] (const crypto::hash& lhs, const crypto::hash& rhs) {
+            return std::memcmp(lhs.data, rhs.data, sizeof(lhs.data)) < 0;
+          }); // don't leak receive order
+          make_payload_send_inventory(*zone_->p2p, std::move(announcement.first), announcement.second);
+        }
+
         if (next_flush != std::chrono::steady_clock::time_point::max())
           fluff_flush::queue(std::move(zone_), next_flush);
       }
@@ -412,19 +458,26 @@ namespace levin
     /*! The "fluff" portion of the Dandelion++ algorithm. Every tx is queued
         per-connection and flushed with a randomized poisson timer. This
         implementation only has one system timer per-zone, and instead tracks
-        the lowest flush time. */
+        the lowest flush time.
+
+        In the public zone, only `flood_fanout` random outbound peers that
+        support `P2P_SUPPORT_FLAG_TX_INVENTORY` receive the full txes. The
+        remaining inventory peers are sent the tx hashes, and fetch only the
+        txes missing from their pool with `NOTIFY_REQUEST_TXS`. */
     struct fluff_notify
     {
       std::shared_ptr<detail::zone> zone_;
       std::vector<blobdata> txs_;
+      std::vector<crypto::hash> tx_hashes_;
       boost::uuids::uuid source_;
 
       void operator()()
       {
-        run(std::move(zone_), epee::to_span(txs_), source_);
+        run(std::move(zone_), epee::to_span(txs_), epee::to_span(tx_hashes_), source_);
       }
 
-      static void run(std::shared_ptr<detail::zone> zone, epee::span<const blobdata> txs, const boost::uuids::uuid& source)
+      //! \param tx_hashes Hashes of `txs`, as given by `on_transactions_relayed`. Empty to flood every peer.
+      static void run(std::shared_ptr<detail::zone> zone, epee::span<const blobdata> txs, epee::span<const crypto::hash> tx_hashes, const boost::uuids::uuid& source)
       {
         if (!zone || !zone->p2p || txs.empty())
           return;
@@ -440,15 +493,38 @@ namespace levin
 
         MDEBUG("Queueing " << txs.size() << " transaction(s) for Dandelion++ fluffing");
 
-        zone->p2p->foreach_connection([txs, now, &zone, &source, &in_duration, &out_duration, &next_flush] (detail::p2p_context& context)
+        if (zone->nzone != epee::net_utils::zone::public_ || tx_hashes.size() != txs.size())
+          tx_hashes = epee::span<const crypto::hash>{}; // flood everything instead
+
+        std::vector<boost::uuids::uuid> flood{};
+        if (!tx_hashes.empty())
+        {
+          zone->p2p->foreach_connection([&source, &flood] (detail::p2p_context& context)
+          {
+            if (!context.m_is_income && source != context.m_connection_id && is_inventory_peer(context))
+              flood.push_back(context.m_connection_id);
+            return true;
+          });
+          std::shuffle(flood.begin(), flood.end(), crypto::random_device{});
+          flood.resize(std::min(flood.size(), zone->flood_fanout));
+          std::sort(flood.begin(), flood.end());
+        }
+
+        zone->p2p->foreach_connection([txs, now, &zone, &source, &tx_hashes, &flood, &in_duration, &out_duration, &next_flush] (detail::p2p_context& context)
         {
           // When i2p/tor, only fluff to outbound connections
           if (context.handshake_complete() && source != context.m_connection_id && (zone->nzone == epee::net_utils::zone::public_ || !context.m_is_income))
           {
-            if (context.fluff_txs.empty())
+            if (context.fluff_txs.empty() && context.announce_txs.empty())
               context.flush_time = now + (context.m_is_income ? in_duration() : out_duration());
 
             next_flush = std::min(next_flush, context.flush_time);
+            if (!tx_hashes.empty() && is_inventory_peer(context) && !std::binary_search(flood.begin(), flood.end(), context.m_connection_id))
+            {
+              context.announce_txs.insert(context.announce_txs.end(), tx_hashes.begin(), tx_hashes.end());
+              return true;
+            }
+
             context.fluff_txs.reserve(context.fluff_txs.size() + txs.size());
             for (const blobdata& tx : txs)
               context.fluff_txs.push_back(tx); // must copy instead of move (multiple conns)
@@ -576,8 +652,8 @@ namespace levin
           MERROR("Unable to send transaction(s) via Dandelion++ stem");
         }
 
-        core_->on_transactions_relayed(epee::to_span(txs_), relay_method::fluff);
-        fluff_notify::run(std::move(zone_), epee::to_span(txs_), source_);
+        const std::vector<crypto::hash> tx_hashes = core_->on_transactions_relayed(epee::to_span(txs_), relay_method::fluff);
+        fluff_notify::run(std::move(zone_), epee::to_span(txs_), epee::to_span(tx_hashes), source_);
       }
     };
 
@@ -722,8 +798,8 @@ namespace levin
     };
   } // anonymous
 
-  notify::notify(boost::asio::io_service& service, std::shared_ptr<connections> p2p, epee::byte_slice noise, epee::net_utils::zone zone, const bool pad_txs, i_core_events& core)
-    : zone_(std::make_shared<detail::zone>(service, std::move(p2p), std::move(noise), zone, pad_txs))
+  notify::notify(boost::asio::io_service& service, std::shared_ptr<connections> p2p, epee::byte_slice noise, epee::net_utils::zone zone, const bool pad_txs, i_core_events& core, const std::size_t flood_fanout)
+    : zone_(std::make_shared<detail::zone>(service, std::move(p2p), std::move(noise), zone, pad_txs, flood_fanout))
     , core_(std::addressof(core))
   {
     if (!zone_->p2p)
@@ -867,8 +943,10 @@ namespace levin
              routine. A "fluff" over i2p/tor is not the same as a "fluff" over
              ipv4/6. Marking it as "fluff" here will make the tx immediately
              visible externally from this node, which is not desired. */
-          core_->on_transactions_relayed(epee::to_span(txs), tx_relay);
-          zone_->strand.dispatch(fluff_notify{zone_, std::move(txs), source});
+          {
+            std::vector<crypto::hash> tx_hashes = core_->on_transactions_relayed(epee::to_span(txs), tx_relay);
+            zone_->strand.dispatch(fluff_notify{zone_, std::move(txs), std::move(tx_hashes), source});
+          }
           break;
       }
     }
@@ -35,6 +35,7 @@
 #include <vector>
 
 #include "byte_slice.h"
+#include "cryptonote_config.h"
 #include "cryptonote_basic/blobdatatype.h"
 #include "cryptonote_protocol/enums.h"
 #include "cryptonote_protocol/fwd.h"
@@ -85,8 +86,12 @@ namespace levin
       , core_(nullptr)
     {}
 
-    //! Construct an instance with available notification `zones`.
-    explicit notify(boost::asio::io_service& service, std::shared_ptr<connections> p2p, epee::byte_slice noise, epee::net_utils::zone zone, bool pad_txs, i_core_events& core);
+    /*! Construct an instance with available notification `zones`.
+
+        \param flood_fanout Number of outbound public peers, supporting tx
+          inventory, that are still sent full txes when fluffing. The other
+          inventory peers only receive tx hashes. */
+    explicit notify(boost::asio::io_service& service, std::shared_ptr<connections> p2p, epee::byte_slice noise, epee::net_utils::zone zone, bool pad_txs, i_core_events& core, std::size_t flood_fanout = CRYPTONOTE_TX_RELAY_FLOOD_FANOUT);
 
     notify(const notify&) = delete;
     notify(notify&&) = default;
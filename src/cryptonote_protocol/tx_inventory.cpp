@@ -0,0 +1,134 @@
+// Copyright (c) 2019-2021 WAZN Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <algorithm>
+#include "tx_inventory.h"
+
+namespace cryptonote
+{
+  tx_request_tracker::tx_request_tracker(const std::chrono::steady_clock::duration timeout, const size_t max_announcers)
+    : m_timeout(timeout), m_max_announcers(max_announcers)
+  {
+  }
+
+  bool tx_request_tracker::request(const crypto::hash &tx_hash, const boost::uuids::uuid &connection_id, const std::chrono::steady_clock::time_point now)
+  {
+    boost::unique_lock<boost::mutex> lock(m_lock);
+    const auto i = m_requests.find(tx_hash);
+    if (i == m_requests.end())
+    {
+      m_requests[tx_hash] = {connection_id, now, {}};
+      return true;
+    }
+
+    in_flight &request = i->second;
+    auto &announcers = request.announcers;
+    if (now < request.time + m_timeout)
+    {
+      if (request.connection_id != connection_id && announcers.size() < m_max_announcers && std::find(announcers.begin(), announcers.end(), connection_id) == announcers.end())
+        announcers.push_back(connection_id);
+      return false;
+    }
+
+    // timed out, not pruned yet
+    announcers.erase(std::remove(announcers.begin(), announcers.end(), connection_id), announcers.end());
+    request.connection_id = connection_id;
+    request.time = now;
+    return true;
+  }
+
+  void tx_request_tracker::on_tx_received(const crypto::hash &tx_hash)
+  {
+    boost::unique_lock<boost::mutex> lock(m_lock);
+    m_requests.erase(tx_hash);
+  }
+
+  bool tx_request_tracker::next_announcer(const crypto::hash &tx_hash, in_flight &request, const std::chrono::steady_clock::time_point now, requests &out)
+  {
+    if (request.announcers.empty())
+      return false;
+    request.connection_id = request.announcers.front();
+    request.announcers.pop_front();
+    request.time = now;
+    out[request.connection_id].push_back(tx_hash);
+    return true;
+  }
+
+  tx_request_tracker::requests tx_request_tracker::on_connection_close(const boost::uuids::uuid &connection_id, const std::chrono::steady_clock::time_point now)
+  {
+    requests out;
+    boost::unique_lock<boost::mutex> lock(m_lock);
+    for (auto i = m_requests.begin(); i != m_requests.end(); )
+    {
+      auto &announcers = i->second.announcers;
+      announcers.erase(std::remove(announcers.begin(), announcers.end(), connection_id), announcers.end());
+      if (i->second.connection_id == connection_id && !next_announcer(i->first, i->second, now, out))
+        i = m_requests.erase(i);
+      else
+        ++i;
+    }
+    return out;
+  }
+
+  tx_request_tracker::requests tx_request_tracker::prune(const std::chrono::steady_clock::time_point now)
+  {
+    requests out;
+    boost::unique_lock<boost::mutex> lock(m_lock);
+    for (auto i = m_requests.begin(); i != m_requests.end(); )
+    {
+      if (now >= i->second.time + m_timeout && !next_announcer(i->first, i->second, now, out))
+        i = m_requests.erase(i);
+      else
+        ++i;
+    }
+    return out;
+  }
+
+  size_t tx_request_tracker::size() const
+  {
+    boost::unique_lock<boost::mutex> lock(m_lock);
+    return m_requests.size();
+  }
+
+  std::vector<std::vector<blobdata>> split_tx_blobs(std::vector<blobdata> txs, const size_t max_bytes)
+  {
+    std::vector<std::vector<blobdata>> groups;
+    size_t bytes = 0;
+    for (blobdata &tx: txs)
+    {
+      if (groups.empty() || (!groups.back().empty() && bytes + tx.size() > max_bytes))
+      {
+        groups.emplace_back();
+        bytes = 0;
+      }
+      bytes += tx.size();
+      groups.back().push_back(std::move(tx));
+    }
+    return groups;
+  }
+}
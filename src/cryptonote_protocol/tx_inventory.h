@@ -0,0 +1,92 @@
+// Copyright (c) 2019-2021 WAZN Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/lock_types.hpp>
+#include <boost/uuid/uuid.hpp>
+#include "crypto/hash.h"
+#include "cryptonote_basic/blobdatatype.h"
+
+namespace cryptonote
+{
+  /*!
+    Txes requested from peers after a NOTIFY_TX_INVENTORY, so each is fetched
+    from a single peer at a time however many announce it. A request left
+    unanswered for the timeout, or made to a peer which went away, is handed
+    to the next peer announcing the tx. Up to `max_announcers` peers are kept
+    per tx for this. Thread safe.
+  */
+  class tx_request_tracker
+  {
+  public:
+    //! Txes to request, by the connection to request them from.
+    typedef std::map<boost::uuids::uuid, std::vector<crypto::hash>> requests;
+
+    tx_request_tracker(std::chrono::steady_clock::duration timeout, size_t max_announcers);
+
+    //! \return True if `tx_hash` should be requested from `connection_id`, it is then recorded as in flight. Otherwise `connection_id` is kept as a fallback.
+    bool request(const crypto::hash &tx_hash, const boost::uuids::uuid &connection_id, std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+
+    //! Forgets `tx_hash`, which was received.
+    void on_tx_received(const crypto::hash &tx_hash);
+
+    //! Forgets `connection_id`. \return The requests it had in flight, handed to the next announcers.
+    requests on_connection_close(const boost::uuids::uuid &connection_id, std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+
+    //! Forgets the requests which timed out. \return Those with another announcer, handed to it.
+    requests prune(std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+
+    size_t size() const;
+
+  private:
+    struct in_flight
+    {
+      boost::uuids::uuid connection_id;
+      std::chrono::steady_clock::time_point time;
+      std::deque<boost::uuids::uuid> announcers; //!< next peers to ask, in announcement order
+    };
+
+    //! Hands `request` to its next announcer, added to `out`. \return False if there was none.
+    static bool next_announcer(const crypto::hash &tx_hash, in_flight &request, std::chrono::steady_clock::time_point now, requests &out);
+
+    const std::chrono::steady_clock::duration m_timeout;
+    const size_t m_max_announcers;
+    mutable boost::mutex m_lock;
+    std::unordered_map<crypto::hash, in_flight> m_requests;
+  };
+
+  //! \return `txs` in order, split into groups of at most `max_bytes`. A tx larger than that gets a group of its own.
+  std::vector<std::vector<blobdata>> split_tx_blobs(std::vector<blobdata> txs, size_t max_bytes);
+}
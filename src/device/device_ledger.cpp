@@ -1101,6 +1101,18 @@ namespace hw {
       return r;
     }
 
+    void device_ledger::generate_key_derivations(const std::vector<crypto::public_key> &pubs, const crypto::secret_key &sec, std::vector<boost::optional<crypto::key_derivation>> &derivations) {
+      // the device derives one key per command, so there is nothing to batch
+      derivations.resize(pubs.size());
+      for (size_t i = 0; i < pubs.size(); ++i) {
+        crypto::key_derivation derivation;
+        if (this->generate_key_derivation(pubs[i], sec, derivation))
+          derivations[i] = derivation;
+        else
+          derivations[i] = boost::none;
+      }
+    }
+
     bool device_ledger::conceal_derivation(crypto::key_derivation &derivation, const crypto::public_key &tx_pub_key, const std::vector<crypto::public_key> &additional_tx_pub_keys, const crypto::key_derivation &main_derivation, const std::vector<crypto::key_derivation> &additional_derivations) {
       const crypto::public_key *pkey=NULL;
       if (derivation == main_derivation) {
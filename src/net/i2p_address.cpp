@@ -39,6 +39,7 @@
 #include "net/error.h"
 #include "serialization/keyvalue_serialization.h"
 #include "storages/portable_storage.h"
+#include "storages/portable_storage_direct.h"
 #include "string_tools.h"
 
 namespace net
@@ -121,7 +122,8 @@ namespace net
         return i2p_address{host, porti};
     }
 
-    bool i2p_address::_load(epee::serialization::portable_storage& src, epee::serialization::section* hparent)
+    template<typename t_storage>
+    bool i2p_address::load_from(t_storage& src, typename t_storage::hsection hparent)
     {
         i2p_serialized in{};
         if (in._load(src, hparent) && in.host.size() < sizeof(host_) && (in.host == unknown_host || !host_check(in.host).has_error()))
@@ -137,12 +139,28 @@ namespace net
         return false;
     }
 
+    bool i2p_address::_load(epee::serialization::portable_storage& src, epee::serialization::section* hparent)
+    {
+        return load_from(src, hparent);
+    }
+
+    bool i2p_address::_load(epee::serialization::binary_reader& src, epee::serialization::binary_reader_section* hparent)
+    {
+        return load_from(src, hparent);
+    }
+
     bool i2p_address::store(epee::serialization::portable_storage& dest, epee::serialization::section* hparent) const
     {
         const i2p_serialized out{std::string{host_}, port_};
         return out.store(dest, hparent);
     }
 
+    bool i2p_address::store(epee::serialization::binary_writer& dest, epee::serialization::binary_writer_section* hparent) const
+    {
+        const i2p_serialized out{std::string{host_}, port_};
+        return out.store(dest, hparent);
+    }
+
     i2p_address::i2p_address(const i2p_address& rhs) noexcept
       : port_(rhs.port_)
     {
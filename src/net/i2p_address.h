@@ -43,6 +43,10 @@ namespace serialization
 {
     class portable_storage;
     struct section;
+    class binary_writer;
+    struct binary_writer_section;
+    class binary_reader;
+    struct binary_reader_section;
 }
 }
 
@@ -57,6 +61,9 @@ namespace net
         //! Keep in private, `host.size()` has no runtime check
         i2p_address(boost::string_ref host, std::uint16_t port) noexcept;
 
+        template<typename t_storage>
+        bool load_from(t_storage& src, typename t_storage::hsection hparent);
+
     public:
         //! \return Size of internal buffer for host.
         static constexpr std::size_t buffer_size() noexcept { return sizeof(host_); }
@@ -79,9 +86,11 @@ namespace net
 
         //! Load from epee p2p format, and \return false if not valid tor address
         bool _load(epee::serialization::portable_storage& src, epee::serialization::section* hparent);
+        bool _load(epee::serialization::binary_reader& src, epee::serialization::binary_reader_section* hparent);
 
         //! Store in epee p2p format
         bool store(epee::serialization::portable_storage& dest, epee::serialization::section* hparent) const;
+        bool store(epee::serialization::binary_writer& dest, epee::serialization::binary_writer_section* hparent) const;
 
         // Moves and copies are currently identical
 
@@ -39,6 +39,7 @@
 #include "net/error.h"
 #include "serialization/keyvalue_serialization.h"
 #include "storages/portable_storage.h"
+#include "storages/portable_storage_direct.h"
 #include "string_tools.h"
 
 namespace net
@@ -123,7 +124,8 @@ namespace net
         return tor_address{host, porti};
     }
 
-    bool tor_address::_load(epee::serialization::portable_storage& src, epee::serialization::section* hparent)
+    template<typename t_storage>
+    bool tor_address::load_from(t_storage& src, typename t_storage::hsection hparent)
     {
         tor_serialized in{};
         if (in._load(src, hparent) && in.host.size() < sizeof(host_) && (in.host == unknown_host || !host_check(in.host).has_error()))
@@ -139,12 +141,28 @@ namespace net
         return false;
     }
 
+    bool tor_address::_load(epee::serialization::portable_storage& src, epee::serialization::section* hparent)
+    {
+        return load_from(src, hparent);
+    }
+
+    bool tor_address::_load(epee::serialization::binary_reader& src, epee::serialization::binary_reader_section* hparent)
+    {
+        return load_from(src, hparent);
+    }
+
     bool tor_address::store(epee::serialization::portable_storage& dest, epee::serialization::section* hparent) const
     {
         const tor_serialized out{std::string{host_}, port_};
         return out.store(dest, hparent);
     }
 
+    bool tor_address::store(epee::serialization::binary_writer& dest, epee::serialization::binary_writer_section* hparent) const
+    {
+        const tor_serialized out{std::string{host_}, port_};
+        return out.store(dest, hparent);
+    }
+
     tor_address::tor_address(const tor_address& rhs) noexcept
       : port_(rhs.port_)
     {
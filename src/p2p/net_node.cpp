@@ -168,6 +168,9 @@ namespace nodetool
       "pad-transactions", "Pad relayed transactions to help defend against traffic volume analysis", false
     };
 
+    const command_line::arg_descriptor<unsigned> arg_p2p_io_shards = {"p2p-io-shards", "Pin public p2p connections to this many io threads (0 to share one io_service)", 0};
+    const command_line::arg_descriptor<unsigned> arg_tx_relay_fanout = {"tx-relay-fanout", "Number of outgoing peers sent full transactions, other peers supporting it only receive tx hashes", CRYPTONOTE_TX_RELAY_FLOOD_FANOUT};
+
     boost::optional<std::vector<proxy>> get_proxies(boost::program_options::variables_map const& vm)
     {
         namespace ip = boost::asio::ip;
@@ -113,6 +113,7 @@ namespace nodetool
   {
     p2p_connection_context_t()
       : fluff_txs(),
+        announce_txs(),
         flush_time(std::chrono::steady_clock::time_point::max()),
         peer_id(0),
         support_flags(0),
@@ -120,6 +121,7 @@ namespace nodetool
     {}
 
     std::vector<cryptonote::blobdata> fluff_txs;
+    std::vector<crypto::hash> announce_txs; //!< fluffed txes sent as NOTIFY_TX_INVENTORY at `flush_time`
     std::chrono::steady_clock::time_point flush_time;
     peerid_type peer_id;
     uint32_t support_flags;
@@ -550,6 +552,8 @@ namespace nodetool
     extern const command_line::arg_descriptor<int64_t> arg_limit_rate_down;
     extern const command_line::arg_descriptor<int64_t> arg_limit_rate;
     extern const command_line::arg_descriptor<bool> arg_pad_transactions;
+    extern const command_line::arg_descriptor<unsigned> arg_p2p_io_shards;
+    extern const command_line::arg_descriptor<unsigned> arg_tx_relay_fanout;
 }
 
 POP_WARNINGS
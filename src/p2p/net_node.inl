@@ -132,6 +132,8 @@ namespace nodetool
     command_line::add_arg(desc, arg_limit_rate_down);
     command_line::add_arg(desc, arg_limit_rate);
     command_line::add_arg(desc, arg_pad_transactions);
+    command_line::add_arg(desc, arg_p2p_io_shards);
+    command_line::add_arg(desc, arg_tx_relay_fanout);
   }
   //-----------------------------------------------------------------------------------
   template<class t_payload_net_handler>
@@ -415,7 +417,8 @@ namespace nodetool
     m_use_ipv6 = command_line::get_arg(vm, arg_p2p_use_ipv6);
     m_require_ipv4 = !command_line::get_arg(vm, arg_p2p_ignore_ipv4);
     public_zone.m_notifier = cryptonote::levin::notify{
-      public_zone.m_net_server.get_io_service(), public_zone.m_net_server.get_config_shared(), nullptr, epee::net_utils::zone::public_, pad_txs, m_payload_handler.get_core()
+      public_zone.m_net_server.get_io_service(), public_zone.m_net_server.get_config_shared(), nullptr, epee::net_utils::zone::public_, pad_txs, m_payload_handler.get_core(),
+      command_line::get_arg(vm, arg_tx_relay_fanout)
     };
 
     if (command_line::has_arg(vm, arg_p2p_add_peer))
@@ -914,6 +917,8 @@ namespace nodetool
     //configure self
 
     public_zone.m_net_server.set_threads_prefix("P2P"); // all zones use these threads/asio::io_service
+    // anonymity zones share the public io_service, so only public connections are sharded
+    public_zone.m_net_server.set_io_shards(command_line::get_arg(vm, arg_p2p_io_shards));
 
     // from here onwards, it's online stuff
     if (m_offline)
@@ -2437,8 +2442,11 @@ namespace nodetool
     const epee::net_utils::zone zone_type = context.m_remote_address.get_zone();
     network_zone& zone = m_network_zones.at(zone_type);
 
+    // sample among the peers not sent yet, rather than sampling and then dropping those
     std::vector<peerlist_entry> local_peerlist_new;
-    zone.m_peerlist.get_peerlist_head(local_peerlist_new, true, P2P_DEFAULT_PEERS_IN_HANDSHAKE);
+    zone.m_peerlist.get_peerlist_head(local_peerlist_new, true, P2P_DEFAULT_PEERS_IN_HANDSHAKE, [&context](const peerlist_entry &pe) {
+      return !context.sent_addresses.count(pe.adr) && !pe.adr.is_same_host(context.m_remote_address);
+    });
 
     //only include out peers we did not already send
     rsp.local_peerlist_new.reserve(local_peerlist_new.size());
@@ -2569,7 +2577,9 @@ namespace nodetool
     });
 
     //fill response
-    zone.m_peerlist.get_peerlist_head(rsp.local_peerlist_new, true);
+    zone.m_peerlist.get_peerlist_head(rsp.local_peerlist_new, true, P2P_DEFAULT_PEERS_IN_HANDSHAKE, [&context](const peerlist_entry &pe) {
+      return !pe.adr.is_same_host(context.m_remote_address);
+    });
     for (const auto &e: rsp.local_peerlist_new)
       context.sent_addresses.insert(e.adr);
     get_local_node_data(rsp.node_data, zone);
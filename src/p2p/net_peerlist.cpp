@@ -30,6 +30,7 @@
 #include "net_peerlist.h"
 
 #include <algorithm>
+#include <cstring>
 #include <functional>
 #include <fstream>
 #include <iterator>
@@ -73,6 +74,45 @@ namespace nodetool
       }
     };
 
+    //! Erase all ports of the host in `adr` from `index`, ordered by address.
+    template<typename T>
+    void erase_host(T& index, const epee::net_utils::network_address& adr)
+    {
+      // addresses are ordered by type, then host, then port, so all ports of a host are adjacent
+      auto first = index.lower_bound(adr);
+      while (first != index.begin() && std::prev(first)->adr.is_same_host(adr))
+        --first;
+      auto last = first;
+      while (last != index.end() && last->adr.is_same_host(adr))
+        ++last;
+      index.erase(first, last);
+    }
+
+    //! \return The ipv4 address as ipv4-mapped ipv6 address, or the reverse, if applicable.
+    boost::optional<epee::net_utils::network_address> get_mapped_host(const epee::net_utils::network_address& adr)
+    {
+      if (adr.get_type_id() == epee::net_utils::ipv4_network_address::get_type_id())
+      {
+        const uint32_t ip = adr.as<epee::net_utils::ipv4_network_address>().ip();
+        boost::asio::ip::address_v6::bytes_type bytes{};
+        bytes[10] = bytes[11] = 0xff;
+        std::memcpy(&bytes[12], &ip, sizeof(ip)); // ip is in network byte order
+        return {epee::net_utils::ipv6_network_address{boost::asio::ip::address_v6{bytes}, 0}};
+      }
+      if (adr.get_type_id() == epee::net_utils::ipv6_network_address::get_type_id())
+      {
+        const boost::asio::ip::address_v6 ip = adr.as<epee::net_utils::ipv6_network_address>().ip();
+        if (ip.is_v4_mapped())
+        {
+          const auto bytes = ip.to_bytes();
+          uint32_t v4 = 0;
+          std::memcpy(&v4, &bytes[12], sizeof(v4));
+          return {epee::net_utils::ipv4_network_address{v4, 0}};
+        }
+      }
+      return boost::none;
+    }
+
     template<typename Elem, typename Archive>
     std::vector<Elem> load_peers(Archive& a, unsigned ver)
     {
@@ -292,15 +332,11 @@ namespace nodetool
 
   void peerlist_manager::evict_host_from_white_peerlist(const peerlist_entry& pr)
   {
-    peers_indexed::index<by_time>::type& sorted_index=m_peers_white.get<by_time>();
-    auto i = sorted_index.begin();
-    while (i != sorted_index.end())
-    {
-      if (i->adr.is_same_host(pr.adr))
-        i = sorted_index.erase(i);
-      else
-        ++i;
-    }
+    peers_indexed::index<by_addr>::type& addr_index=m_peers_white.get<by_addr>();
+    erase_host(addr_index, pr.adr);
+    const boost::optional<epee::net_utils::network_address> mapped = get_mapped_host(pr.adr);
+    if (mapped)
+      erase_host(addr_index, *mapped);
   }
 }
 
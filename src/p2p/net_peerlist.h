@@ -31,13 +31,18 @@
 
 #pragma once
 
+#include <functional>
 #include <iosfwd>
 #include <list>
 #include <string>
 #include <vector>
 
+#include <boost/version.hpp>
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/ordered_index.hpp>
+#if BOOST_VERSION >= 105900
+#include <boost/multi_index/ranked_index.hpp>
+#endif
 #include <boost/multi_index/identity.hpp>
 #include <boost/multi_index/member.hpp>
 #include <boost/optional/optional.hpp>
@@ -104,7 +109,7 @@ namespace nodetool
     size_t get_white_peers_count(){CRITICAL_REGION_LOCAL(m_peerlist_lock); return m_peers_white.size();}
     size_t get_gray_peers_count(){CRITICAL_REGION_LOCAL(m_peerlist_lock); return m_peers_gray.size();}
     bool merge_peerlist(const std::vector<peerlist_entry>& outer_bs, const std::function<bool(const peerlist_entry&)> &f = NULL);
-    bool get_peerlist_head(std::vector<peerlist_entry>& bs_head, bool anonymize, uint32_t depth = P2P_DEFAULT_PEERS_IN_HANDSHAKE);
+    bool get_peerlist_head(std::vector<peerlist_entry>& bs_head, bool anonymize, uint32_t depth = P2P_DEFAULT_PEERS_IN_HANDSHAKE, const std::function<bool(const peerlist_entry&)> &f = NULL);
     void get_peerlist(std::vector<peerlist_entry>& pl_gray, std::vector<peerlist_entry>& pl_white);
     void get_peerlist(peerlist_types& peers);
     bool get_white_peer_by_index(peerlist_entry& p, size_t i);
@@ -166,8 +171,12 @@ namespace nodetool
       boost::multi_index::indexed_by<
       // access by peerlist_entry::net_adress
       boost::multi_index::ordered_unique<boost::multi_index::tag<by_addr>, boost::multi_index::member<peerlist_entry,epee::net_utils::network_address,&peerlist_entry::adr> >,
-      // sort by peerlist_entry::last_seen<
+      // sort by peerlist_entry::last_seen<, ranked so the n-th peer is found in O(log n)
+#if BOOST_VERSION >= 105900
+      boost::multi_index::ranked_non_unique<boost::multi_index::tag<by_time>, boost::multi_index::member<peerlist_entry,int64_t,&peerlist_entry::last_seen> >
+#else
       boost::multi_index::ordered_non_unique<boost::multi_index::tag<by_time>, boost::multi_index::member<peerlist_entry,int64_t,&peerlist_entry::last_seen> >
+#endif
       >
     > peers_indexed;
 
@@ -184,6 +193,7 @@ namespace nodetool
   private:
     void trim_white_peerlist();
     void trim_gray_peerlist();
+    static const peerlist_entry& get_nth_recent(peers_indexed& peers, size_t i);
 
     friend class boost::serialization::access;
     epee::critical_section m_peerlist_lock;
@@ -214,6 +224,16 @@ namespace nodetool
     }
   }
   //--------------------------------------------------------------------------------------------------
+  inline const peerlist_entry& peerlist_manager::get_nth_recent(peers_indexed& peers, size_t i)
+  {
+    peers_indexed::index<by_time>::type& by_time_index = peers.get<by_time>();
+#if BOOST_VERSION >= 105900
+    return *by_time_index.nth(by_time_index.size() - 1 - i);
+#else
+    return *epee::misc_utils::move_it_backward(--by_time_index.end(), i);
+#endif
+  }
+  //--------------------------------------------------------------------------------------------------
   inline
   bool peerlist_manager::merge_peerlist(const std::vector<peerlist_entry>& outer_bs, const std::function<bool(const peerlist_entry&)> &f)
   {
@@ -235,8 +255,7 @@ namespace nodetool
     if(i >= m_peers_white.size())
       return false;
 
-    peers_indexed::index<by_time>::type& by_time_index = m_peers_white.get<by_time>();
-    p = *epee::misc_utils::move_it_backward(--by_time_index.end(), i);
+    p = get_nth_recent(m_peers_white, i);
     return true;
   }
   //--------------------------------------------------------------------------------------------------
@@ -247,8 +266,7 @@ namespace nodetool
     if(i >= m_peers_gray.size())
       return false;
 
-    peers_indexed::index<by_time>::type& by_time_index = m_peers_gray.get<by_time>();
-    p = *epee::misc_utils::move_it_backward(--by_time_index.end(), i);
+    p = get_nth_recent(m_peers_gray, i);
     return true;
   }
   //--------------------------------------------------------------------------------------------------
@@ -266,11 +284,10 @@ namespace nodetool
   }
   //--------------------------------------------------------------------------------------------------
   inline
-  bool peerlist_manager::get_peerlist_head(std::vector<peerlist_entry>& bs_head, bool anonymize, uint32_t depth)
+  bool peerlist_manager::get_peerlist_head(std::vector<peerlist_entry>& bs_head, bool anonymize, uint32_t depth, const std::function<bool(const peerlist_entry&)> &f)
   {
     CRITICAL_REGION_LOCAL(m_peerlist_lock);
     peers_indexed::index<by_time>::type& by_time_index=m_peers_white.get<by_time>();
-    uint32_t cnt = 0;
 
     // picks a random set of peers within the whole set, rather pick the first depth elements.
     // The intent is that if someone asks twice, they can't easily tell:
@@ -284,23 +301,31 @@ namespace nodetool
     //
     // See Cao, Tong et al. "Exploring the WAZN Peer-to-Peer Network". https://eprint.iacr.org/2019/411
     //
-    const uint32_t pick_depth = anonymize ? m_peers_white.size() : depth;
-    bs_head.reserve(pick_depth);
-    for(const peers_indexed::value_type& vl: boost::adaptors::reverse(by_time_index))
+    // The random set is a partial shuffle of indices, so only the picked peers are copied.
+    bs_head.reserve(std::min<size_t>(depth, m_peers_white.size()));
+    if (!anonymize)
     {
-      if(cnt++ >= pick_depth)
-        break;
-
-      bs_head.push_back(vl);
+      for(const peers_indexed::value_type& vl: boost::adaptors::reverse(by_time_index))
+      {
+        if(bs_head.size() >= depth)
+          break;
+        if (!f || f(vl))
+          bs_head.push_back(vl);
+      }
+      return true;
     }
 
-    if (anonymize)
+    std::vector<uint32_t> indices(m_peers_white.size());
+    for (size_t i = 0; i < indices.size(); ++i)
+      indices[i] = i;
+    for (size_t i = 0; i < indices.size() && bs_head.size() < depth; ++i)
     {
-      std::shuffle(bs_head.begin(), bs_head.end(), crypto::random_device{});
-      if (bs_head.size() > depth)
-        bs_head.resize(depth);
-      for (auto &e: bs_head)
-        e.last_seen = 0;
+      std::swap(indices[i], indices[i + crypto::rand_idx(indices.size() - i)]);
+      const peerlist_entry& pe = get_nth_recent(m_peers_white, indices[i]);
+      if (f && !f(pe))
+        continue;
+      bs_head.push_back(pe);
+      bs_head.back().last_seen = 0;
     }
 
     return true;
@@ -437,8 +462,7 @@ namespace nodetool
 
     size_t random_index = crypto::rand_idx(m_peers_gray.size());
 
-    peers_indexed::index<by_time>::type& by_time_index = m_peers_gray.get<by_time>();
-    pe = *epee::misc_utils::move_it_backward(--by_time_index.end(), random_index);
+    pe = get_nth_recent(m_peers_gray, random_index);
 
     return true;
 
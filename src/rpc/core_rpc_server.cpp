@@ -334,6 +334,8 @@ namespace cryptonote
     if (m_rpc_payment)
       m_net_server.add_idle_handler([this](){ return m_rpc_payment->on_idle(); }, 60 * 1000);
 
+    m_net_server.set_io_shards(rpc_config->io_shards);
+
     auto rng = [](size_t len, uint8_t *ptr){ return crypto::rand(len, ptr); };
     return epee::http_server_impl_base<core_rpc_server, connection_context>::init(
       rng, std::move(port), std::move(bind_ip_str),
@@ -498,6 +500,8 @@ namespace cryptonote
     res.database_size = m_core.get_blockchain_storage().get_db().get_database_size();
     if (restricted)
       res.database_size = round_up(res.database_size, 5ull* 1024 * 1024 * 1024);
+    res.database_read_txn_max_age = restricted ? 0 : m_core.get_blockchain_storage().get_db().get_read_txn_max_age();
+    res.database_resize_time = restricted ? 0 : m_core.get_blockchain_storage().get_db().get_resize_time();
     res.update_available = restricted ? false : m_core.is_update_available();
     res.version = restricted ? "" : WAZN_VERSION_FULL;
     res.busy_syncing = m_p2p.get_payload_object().is_busy_syncing();
@@ -596,8 +600,8 @@ namespace cryptonote
     {
       res.blocks.resize(res.blocks.size()+1);
       res.blocks.back().pruned = req.prune;
-      res.blocks.back().block = bd.first.first;
-      size += bd.first.first.size();
+      res.blocks.back().block = std::move(bd.first.first);
+      size += res.blocks.back().block.size();
       res.output_indices.push_back(COMMAND_RPC_GET_BLOCKS_FAST::block_output_indices());
       ntxes += bd.second.size();
       res.output_indices.back().indices.reserve(1 + bd.second.size());
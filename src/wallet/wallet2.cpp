@@ -40,6 +40,9 @@
 #include <boost/asio/ip/address.hpp>
 #include <boost/range/adaptor/transformed.hpp>
 #include <boost/preprocessor/stringize.hpp>
+#include <boost/iostreams/stream.hpp>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
 #include <openssl/evp.h>
 #include "include_base_utils.h"
 using namespace epee;
@@ -82,6 +85,7 @@ using namespace epee;
 #include "common/perf_timer.h"
 #include "ringct/rctSigs.h"
 #include "ringdb.h"
+#include "wallet_cache.h"
 #include "device/device_cold.hpp"
 #include "device_trezor/device_trezor.hpp"
 #include "net/socks_connect.h"
@@ -143,6 +147,9 @@ using namespace cryptonote;
 
 #define IGNORE_LONG_PAYMENT_ID_FROM_BLOCK_VERSION 12
 
+#define CACHE_TRANSFERS_PER_RECORD 256
+#define CACHE_BLOCK_HASHES_PER_RECORD 4096
+
 static const std::string MULTISIG_SIGNATURE_MAGIC = "SigMultisigPkV1";
 static const std::string MULTISIG_EXTRA_INFO_MAGIC = "MultisigxV1";
 
@@ -153,6 +160,22 @@ std::string tools::wallet2::default_daemon_address = "";
 
 namespace
 {
+  // reads a cache blob in place, without the copy a stringstream would make
+  typedef boost::iostreams::stream<boost::iostreams::array_source> cache_istream;
+  typedef boost::iostreams::stream<boost::iostreams::back_insert_device<std::string>> cache_ostream;
+
+  // a range of a vector, serialized like a vector of its elements
+  template<typename T>
+  struct vector_range
+  {
+    typedef T value_type;
+    typedef typename std::vector<T>::iterator iterator;
+    iterator first, last;
+    size_t size() const { return last - first; }
+    iterator begin() const { return first; }
+    iterator end() const { return last; }
+  };
+
   std::string get_default_ringdb_path()
   {
     boost::filesystem::path dir = tools::get_default_data_dir();
@@ -1209,7 +1232,8 @@ wallet2::wallet2(network_type nettype, uint64_t kdf_rounds, bool unattended, std
   m_rpc_version(0),
   m_export_format(ExportFormat::Binary),
   m_load_deprecated_formats(false),
-  m_credits_target(0)
+  m_credits_target(0),
+  m_incremental_cache(false)
 {
   set_rpc_client_secret_key(rct::rct2sk(rct::skGen()));
 }
@@ -2690,11 +2714,19 @@ void wallet2::process_parsed_blocks(uint64_t start_height, const std::vector<cry
   tools::threadpool& tpool = tools::threadpool::getInstance();
   tools::threadpool::waiter waiter(tpool);
 
+  // flatten the txes of the whole batch, in tx_cache_data order, so the scan
+  // below can be cut into even chunks however the txes are spread over blocks
+  struct scan_entry
+  {
+    const cryptonote::transaction *tx; // nullptr if not to be scanned
+    const crypto::hash *txid; // nullptr for miner txes, hashed on demand
+    size_t n_vouts;
+  };
   size_t num_txes = 0;
-  std::vector<tx_cache_data> tx_cache_data;
   for (size_t i = 0; i < blocks.size(); ++i)
     num_txes += 1 + parsed_blocks[i].txes.size();
-  tx_cache_data.resize(num_txes);
+  std::vector<scan_entry> scan_entries(num_txes, scan_entry{nullptr, nullptr, 0});
+  std::vector<tx_cache_data> tx_cache_data(num_txes);
   size_t txidx = 0;
   for (size_t i = 0; i < blocks.size(); ++i)
   {
@@ -2706,46 +2738,40 @@ void wallet2::process_parsed_blocks(uint64_t start_height, const std::vector<cry
       continue;
     }
     if (m_refresh_type != RefreshNoCoinbase)
-      tpool.submit(&waiter, [&, i, txidx](){ cache_tx_data(parsed_blocks[i].block.miner_tx, get_transaction_hash(parsed_blocks[i].block.miner_tx), tx_cache_data[txidx]); });
+    {
+      const cryptonote::transaction &miner_tx = parsed_blocks[i].block.miner_tx;
+      scan_entries[txidx] = {&miner_tx, nullptr, m_refresh_type == RefreshOptimizeCoinbase ? 1 : miner_tx.vout.size()};
+    }
     ++txidx;
     for (size_t idx = 0; idx < parsed_blocks[i].txes.size(); ++idx)
     {
-      tpool.submit(&waiter, [&, i, idx, txidx](){ cache_tx_data(parsed_blocks[i].txes[idx], parsed_blocks[i].block.tx_hashes[idx], tx_cache_data[txidx]); });
+      scan_entries[txidx] = {&parsed_blocks[i].txes[idx], &parsed_blocks[i].block.tx_hashes[idx], parsed_blocks[i].txes[idx].vout.size()};
       ++txidx;
     }
   }
   THROW_WALLET_EXCEPTION_IF(txidx != num_txes, error::wallet_internal_error, "txidx does not match tx_cache_data size");
-  THROW_WALLET_EXCEPTION_IF(!waiter.wait(), error::wallet_internal_error, "Exception in thread pool");
 
   hw::device &hwdev =  m_account.get_device();
   hw::reset_mode rst(hwdev);
   hwdev.set_mode(hw::device::TRANSACTION_PARSE);
   const cryptonote::account_keys &keys = m_account.get_keys();
 
+  auto cache = [&](size_t n) {
+    const scan_entry &e = scan_entries[n];
+    cache_tx_data(*e.tx, e.txid ? *e.txid : get_transaction_hash(*e.tx), tx_cache_data[n]);
+  };
+
+  auto no_derivation = [](wallet2::is_out_data &iod) {
+    MWARNING("Failed to generate key derivation from tx pubkey, skipping");
+    static_assert(sizeof(iod.derivation) == sizeof(rct::key), "Mismatched sizes of key_derivation and rct::key");
+    memcpy(&iod.derivation, rct::identity().bytes, sizeof(iod.derivation));
+  };
+
   auto gender = [&](wallet2::is_out_data &iod) {
     if (!hwdev.generate_key_derivation(iod.pkey, keys.m_view_secret_key, iod.derivation))
-    {
-      MWARNING("Failed to generate key derivation from tx pubkey, skipping");
-      static_assert(sizeof(iod.derivation) == sizeof(rct::key), "Mismatched sizes of key_derivation and rct::key");
-      memcpy(&iod.derivation, rct::identity().bytes, sizeof(iod.derivation));
-    }
+      no_derivation(iod);
   };
 
-  for (size_t i = 0; i < tx_cache_data.size(); ++i)
-  {
-    if (tx_cache_data[i].empty())
-      continue;
-    tpool.submit(&waiter, [&hwdev, &gender, &tx_cache_data, i]() {
-      auto &slot = tx_cache_data[i];
-      boost::unique_lock<hw::device> hwdev_lock(hwdev);
-      for (auto &iod: slot.primary)
-        gender(iod);
-      for (auto &iod: slot.additional)
-        gender(iod);
-    }, true);
-  }
-  THROW_WALLET_EXCEPTION_IF(!waiter.wait(), error::wallet_internal_error, "Exception in thread pool");
-
   auto geniod = [&](const cryptonote::transaction &tx, size_t n_vouts, size_t txidx) {
     for (size_t k = 0; k < n_vouts; ++k)
     {
@@ -2768,31 +2794,81 @@ void wallet2::process_parsed_blocks(uint64_t start_height, const std::vector<cry
     }
   };
 
-  txidx = 0;
-  for (size_t i = 0; i < blocks.size(); ++i)
+  if (hwdev.get_type() == hw::device::SOFTWARE)
   {
-    if (should_skip_block(parsed_blocks[i].block, start_height + i))
+    // nothing to serialize on, so txes are handed out in chunks to keep
+    // pool queueing off the profile while leaving a few chunks per thread
+    // to balance load, and all the derivations of a chunk are done as one
+    // batch sharing the view key recoding and point normalization
+    const size_t chunk_size = std::max<size_t>(1, num_txes / (tpool.get_max_concurrency() * 4));
+    for (size_t begin = 0; begin < num_txes; begin += chunk_size)
     {
-      txidx += 1 + parsed_blocks[i].block.tx_hashes.size();
-      continue;
-    }
+      const size_t end = std::min(begin + chunk_size, num_txes);
+      tpool.submit(&waiter, [&, begin, end](){
+        std::vector<crypto::public_key> tx_pub_keys;
+        for (size_t n = begin; n < end; ++n)
+        {
+          if (!scan_entries[n].tx)
+            continue;
+          cache(n);
+          for (const auto &iod: tx_cache_data[n].primary)
+            tx_pub_keys.push_back(iod.pkey);
+          for (const auto &iod: tx_cache_data[n].additional)
+            tx_pub_keys.push_back(iod.pkey);
+        }
 
-    if (m_refresh_type != RefreshType::RefreshNoCoinbase)
-    {
-      THROW_WALLET_EXCEPTION_IF(txidx >= tx_cache_data.size(), error::wallet_internal_error, "txidx out of range");
-      const size_t n_vouts = m_refresh_type == RefreshType::RefreshOptimizeCoinbase ? 1 : parsed_blocks[i].block.miner_tx.vout.size();
-      tpool.submit(&waiter, [&, i, n_vouts, txidx](){ geniod(parsed_blocks[i].block.miner_tx, n_vouts, txidx); }, true);
+        std::vector<boost::optional<crypto::key_derivation>> derivations;
+        hwdev.generate_key_derivations(tx_pub_keys, keys.m_view_secret_key, derivations);
+        size_t d = 0;
+        auto set_derivation = [&](wallet2::is_out_data &iod) {
+          if (derivations[d])
+            iod.derivation = *derivations[d];
+          else
+            no_derivation(iod);
+          ++d;
+        };
+        for (size_t n = begin; n < end; ++n)
+        {
+          if (!scan_entries[n].tx)
+            continue;
+          for (auto &iod: tx_cache_data[n].primary)
+            set_derivation(iod);
+          for (auto &iod: tx_cache_data[n].additional)
+            set_derivation(iod);
+          geniod(*scan_entries[n].tx, scan_entries[n].n_vouts, n);
+        }
+      }, true);
     }
-    ++txidx;
-    for (size_t j = 0; j < parsed_blocks[i].txes.size(); ++j)
+    THROW_WALLET_EXCEPTION_IF(!waiter.wait(), error::wallet_internal_error, "Exception in thread pool");
+  }
+  else
+  {
+    // derivations need the device, one tx at a time
+    for (size_t n = 0; n < num_txes; ++n)
+      if (scan_entries[n].tx)
+        tpool.submit(&waiter, [&, n](){ cache(n); });
+    THROW_WALLET_EXCEPTION_IF(!waiter.wait(), error::wallet_internal_error, "Exception in thread pool");
+
+    for (size_t i = 0; i < tx_cache_data.size(); ++i)
     {
-      THROW_WALLET_EXCEPTION_IF(txidx >= tx_cache_data.size(), error::wallet_internal_error, "txidx out of range");
-      tpool.submit(&waiter, [&, i, j, txidx](){ geniod(parsed_blocks[i].txes[j], parsed_blocks[i].txes[j].vout.size(), txidx); }, true);
-      ++txidx;
+      if (tx_cache_data[i].empty())
+        continue;
+      tpool.submit(&waiter, [&hwdev, &gender, &tx_cache_data, i]() {
+        auto &slot = tx_cache_data[i];
+        boost::unique_lock<hw::device> hwdev_lock(hwdev);
+        for (auto &iod: slot.primary)
+          gender(iod);
+        for (auto &iod: slot.additional)
+          gender(iod);
+      }, true);
     }
+    THROW_WALLET_EXCEPTION_IF(!waiter.wait(), error::wallet_internal_error, "Exception in thread pool");
+
+    for (size_t n = 0; n < num_txes; ++n)
+      if (scan_entries[n].tx)
+        tpool.submit(&waiter, [&, n](){ geniod(*scan_entries[n].tx, scan_entries[n].n_vouts, n); }, true);
+    THROW_WALLET_EXCEPTION_IF(!waiter.wait(), error::wallet_internal_error, "Exception in thread pool");
   }
-  THROW_WALLET_EXCEPTION_IF(txidx != tx_cache_data.size(), error::wallet_internal_error, "txidx did not reach expected value");
-  THROW_WALLET_EXCEPTION_IF(!waiter.wait(), error::wallet_internal_error, "Exception in thread pool");
   hwdev.set_mode(hw::device::NONE);
 
   size_t tx_cache_data_offset = 0;
@@ -3968,6 +4044,9 @@ boost::optional<wallet2::keys_file_data> wallet2::get_keys_file_data(const epee:
   value2.SetUint64(m_credits_target);
   json.AddMember("credits_target", value2, json.GetAllocator());
 
+  value2.SetInt(m_incremental_cache ? 1 : 0);
+  json.AddMember("incremental_cache", value2, json.GetAllocator());
+
   // Serialize the JSON object
   rapidjson::StringBuffer buffer;
   rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
@@ -4115,6 +4194,7 @@ bool wallet2::load_keys_buf(const std::string& keys_buf, const epee::wipeable_st
     m_persistent_rpc_client_id = false;
     m_auto_mine_for_rpc_payment_threshold = -1.0f;
     m_credits_target = 0;
+    m_incremental_cache = false;
   }
   else if(json.IsObject())
   {
@@ -4343,6 +4423,8 @@ bool wallet2::load_keys_buf(const std::string& keys_buf, const epee::wipeable_st
     m_auto_mine_for_rpc_payment_threshold = field_auto_mine_for_rpc_payment;
     GET_FIELD_FROM_JSON_RETURN_ON_ERROR(json, credits_target, uint64_t, Uint64, false, 0);
     m_credits_target = field_credits_target;
+    GET_FIELD_FROM_JSON_RETURN_ON_ERROR(json, incremental_cache, int, Int, false, false);
+    m_incremental_cache = field_incremental_cache;
   }
   else
   {
@@ -5580,6 +5662,7 @@ void wallet2::generate_chacha_key_from_password(const epee::wipeable_string &pas
 void wallet2::load(const std::string& wallet_, const epee::wipeable_string& password, const std::string& keys_buf, const std::string& cache_buf)
 {
   clear();
+  m_cache_file.reset(new wallet_cache_file());
   prepare_file_names(wallet_);
 
   // determine if loading from file system or string buffer
@@ -5617,6 +5700,18 @@ void wallet2::load(const std::string& wallet_, const epee::wipeable_string& pass
     LOG_PRINT_L0("file not found: " << m_wallet_file << ", starting with empty blockchain");
     m_account_public_address = m_account.get_keys().m_account_address;
   }
+  else if (use_fs ? wallet_cache_file::is_cache_file(m_wallet_file) : wallet_cache_file::is_cache_buffer(cache_buf))
+  {
+    // caches in this format are only written with incremental_cache set,
+    // but are read either way
+    LOG_PRINT_L1("Loading cache file");
+    const bool opened = use_fs ? m_cache_file->open(m_wallet_file, m_cache_key) : m_cache_file->open_buffer(cache_buf, m_cache_key);
+    THROW_WALLET_EXCEPTION_IF(!opened || !load_cache_file(), error::file_read_error, use_fs ? m_wallet_file : "cache buffer");
+    THROW_WALLET_EXCEPTION_IF(
+      m_account_public_address.m_spend_public_key != m_account.get_keys().m_account_address.m_spend_public_key ||
+      m_account_public_address.m_view_public_key  != m_account.get_keys().m_account_address.m_view_public_key,
+      error::wallet_files_doesnt_correspond, m_keys_file, m_wallet_file);
+  }
   else if (use_fs || !cache_buf.empty())
   {
     wallet2::cache_file_data cache_file_data;
@@ -5635,17 +5730,21 @@ void wallet2::load(const std::string& wallet_, const epee::wipeable_string& pass
 
       r = ::serialization::parse_binary(use_fs ? cache_file_buf : cache_buf, cache_file_data);
       THROW_WALLET_EXCEPTION_IF(!r, error::wallet_internal_error, "internal error: failed to deserialize \"" + m_wallet_file + '\"');
-      std::string cache_data;
-      cache_data.resize(cache_file_data.cache_data.size());
-      crypto::chacha20(cache_file_data.cache_data.data(), cache_file_data.cache_data.size(), m_cache_key, cache_file_data.iv, &cache_data[0]);
+      // the ciphertext now lives in cache_file_data, don't keep a second copy around
+      if (use_fs)
+        std::string().swap(cache_file_buf);
+
+      // decrypt in place; chacha is its own inverse, so applying the same
+      // key again restores the ciphertext before trying the next scheme
+      std::string &cache_data = cache_file_data.cache_data;
+      crypto::chacha20(cache_data.data(), cache_data.size(), m_cache_key, cache_file_data.iv, &cache_data[0]);
 
       try {
         bool loaded = false;
 
         try
         {
-          std::stringstream iss;
-          iss << cache_data;
+          cache_istream iss(cache_data.data(), cache_data.size());
           binary_archive<false> ar(iss);
           if (::serialization::serialize(ar, *this))
             if (::serialization::check_stream_state(ar))
@@ -5655,8 +5754,7 @@ void wallet2::load(const std::string& wallet_, const epee::wipeable_string& pass
 
         if (!loaded)
         {
-          std::stringstream iss;
-          iss << cache_data;
+          cache_istream iss(cache_data.data(), cache_data.size());
           boost::archive::portable_binary_iarchive ar(iss);
           ar >> *this;
         }
@@ -5664,22 +5762,22 @@ void wallet2::load(const std::string& wallet_, const epee::wipeable_string& pass
       catch(...)
       {
         // try with previous scheme: direct from keys
+        crypto::chacha20(cache_data.data(), cache_data.size(), m_cache_key, cache_file_data.iv, &cache_data[0]);
         crypto::chacha_key key;
         generate_chacha_key_from_secret_keys(key);
-        crypto::chacha20(cache_file_data.cache_data.data(), cache_file_data.cache_data.size(), key, cache_file_data.iv, &cache_data[0]);
+        crypto::chacha20(cache_data.data(), cache_data.size(), key, cache_file_data.iv, &cache_data[0]);
         try {
-          std::stringstream iss;
-          iss << cache_data;
+          cache_istream iss(cache_data.data(), cache_data.size());
           boost::archive::portable_binary_iarchive ar(iss);
           ar >> *this;
         }
         catch (...)
         {
-          crypto::chacha8(cache_file_data.cache_data.data(), cache_file_data.cache_data.size(), key, cache_file_data.iv, &cache_data[0]);
+          crypto::chacha20(cache_data.data(), cache_data.size(), key, cache_file_data.iv, &cache_data[0]);
+          crypto::chacha8(cache_data.data(), cache_data.size(), key, cache_file_data.iv, &cache_data[0]);
           try
           {
-            std::stringstream iss;
-            iss << cache_data;
+            cache_istream iss(cache_data.data(), cache_data.size());
             boost::archive::portable_binary_iarchive ar(iss);
             ar >> *this;
           }
@@ -5687,9 +5785,7 @@ void wallet2::load(const std::string& wallet_, const epee::wipeable_string& pass
           {
             LOG_PRINT_L0("Failed to open portable binary, trying unportable");
             if (use_fs) boost::filesystem::copy_file(m_wallet_file, m_wallet_file + ".unportable", boost::filesystem::copy_option::overwrite_if_exists);
-            std::stringstream iss;
-            iss.str("");
-            iss << cache_data;
+            cache_istream iss(cache_data.data(), cache_data.size());
             boost::archive::binary_iarchive ar(iss);
             ar >> *this;
           }
@@ -5699,9 +5795,10 @@ void wallet2::load(const std::string& wallet_, const epee::wipeable_string& pass
     catch (...)
     {
       LOG_PRINT_L1("Failed to load encrypted cache, trying unencrypted");
+      if (use_fs && cache_file_buf.empty())
+        load_from_file(m_wallet_file, cache_file_buf, std::numeric_limits<size_t>::max());
       try {
-        std::stringstream iss;
-        iss << cache_file_buf;
+        cache_istream iss(cache_file_buf.data(), cache_file_buf.size());
         boost::archive::portable_binary_iarchive ar(iss);
         ar >> *this;
       }
@@ -5709,9 +5806,7 @@ void wallet2::load(const std::string& wallet_, const epee::wipeable_string& pass
       {
         LOG_PRINT_L0("Failed to open portable binary, trying unportable");
         if (use_fs) boost::filesystem::copy_file(m_wallet_file, m_wallet_file + ".unportable", boost::filesystem::copy_option::overwrite_if_exists);
-        std::stringstream iss;
-        iss.str("");
-        iss << cache_file_buf;
+        cache_istream iss(cache_file_buf.data(), cache_file_buf.size());
         boost::archive::binary_iarchive ar(iss);
         ar >> *this;
       }
@@ -5860,11 +5955,6 @@ void wallet2::store_to(const std::string &path, const epee::wipeable_string &pas
     }
   }
 
-  // get wallet cache data
-  boost::optional<wallet2::cache_file_data> cache_file_data = get_cache_file_data(password);
-  THROW_WALLET_EXCEPTION_IF(cache_file_data == boost::none, error::wallet_internal_error, "failed to generate wallet cache data");
-
-  const std::string new_file = same_file ? m_wallet_file + ".new" : path;
   const std::string old_file = m_wallet_file;
   const std::string old_keys_file = m_keys_file;
   const std::string old_address_file = m_wallet_file + ".address.txt";
@@ -5906,7 +5996,12 @@ void wallet2::store_to(const std::string &path, const epee::wipeable_string &pas
         LOG_ERROR("error removing file: " << old_mms_file);
       }
     }
-  } else {
+  } else if (!m_incremental_cache) {
+    // get wallet cache data
+    boost::optional<wallet2::cache_file_data> cache_file_data = get_cache_file_data(password);
+    THROW_WALLET_EXCEPTION_IF(cache_file_data == boost::none, error::wallet_internal_error, "failed to generate wallet cache data");
+    const std::string new_file = m_wallet_file + ".new";
+
     // save to new file
 #ifdef WIN32
     // On Windows avoid using std::ofstream which does not work with UTF-8 filenames
@@ -5930,6 +6025,22 @@ void wallet2::store_to(const std::string &path, const epee::wipeable_string &pas
     // here we have "*.new" file, we need to rename it to be without ".new"
     std::error_code e = tools::replace_file(new_file, m_wallet_file);
     THROW_WALLET_EXCEPTION_IF(e, error::file_save_error, m_wallet_file, e);
+
+    // the file no longer holds the records the cache file knows of
+    if (m_cache_file)
+      m_cache_file->reset();
+  } else {
+    // only the records which changed are appended; a cache in the older
+    // format, or one which cannot be appended to, is written whole to a
+    // *.new file which then replaces it
+    bool success = store_cache_file(m_wallet_file);
+    if (!success)
+    {
+      MWARNING("Failed to update the wallet cache, writing it whole");
+      m_cache_file.reset(new wallet_cache_file());
+      success = store_cache_file(m_wallet_file);
+    }
+    THROW_WALLET_EXCEPTION_IF(!success, error::file_save_error, m_wallet_file);
   }
 
   if (m_message_store.get_active())
@@ -5940,23 +6051,148 @@ void wallet2::store_to(const std::string &path, const epee::wipeable_string &pas
   }
 }
 //----------------------------------------------------------------------------------------------------
-boost::optional<wallet2::cache_file_data> wallet2::get_cache_file_data(const epee::wipeable_string &passwords)
+bool wallet2::load_cache_file()
+{
+  const auto unmap = epee::misc_utils::create_scope_leave_handler([this](){ m_cache_file->unmap(); });
+
+  try
+  {
+    std::string data;
+    cache_file_layout layout;
+    if (!m_cache_file->read(wallet_cache_file::record_state, 0, data, m_cache_key))
+      return false;
+    {
+      cache_istream iss(data.data(), data.size());
+      binary_archive<false> ar(iss);
+      if (!serialize_cache_file_state(ar, layout) || !::serialization::check_stream_state(ar))
+        return false;
+    }
+
+    // transfers are decrypted and parsed a record at a time, straight from
+    // the mapped file
+    m_transfers.clear();
+    m_transfers.reserve(layout.num_transfers);
+    std::vector<transfer_details> transfers;
+    for (uint64_t record = 0; m_transfers.size() < layout.num_transfers; ++record)
+    {
+      if (!m_cache_file->read(wallet_cache_file::record_transfers, record, data, m_cache_key))
+        return false;
+      cache_istream iss(data.data(), data.size());
+      binary_archive<false> ar(iss);
+      if (!::serialization::serialize(ar, transfers) || !::serialization::check_stream_state(ar) || transfers.empty())
+        return false;
+      std::move(transfers.begin(), transfers.end(), std::back_inserter(m_transfers));
+    }
+    if (m_transfers.size() != layout.num_transfers)
+      return false;
+
+    // block hash records are aligned on heights, so trimming the front of
+    // the chain leaves the others unchanged
+    m_blockchain.reset(layout.blockchain_offset, layout.genesis);
+    for (uint64_t height = layout.blockchain_offset; height < layout.blockchain_size; )
+    {
+      const uint64_t record = height / CACHE_BLOCK_HASHES_PER_RECORD;
+      const uint64_t count = std::min<uint64_t>((record + 1) * CACHE_BLOCK_HASHES_PER_RECORD, layout.blockchain_size) - height;
+      if (!m_cache_file->read(wallet_cache_file::record_blockchain, record, data, m_cache_key) || data.size() != count * sizeof(crypto::hash))
+        return false;
+      for (uint64_t i = 0; i < count; ++i)
+      {
+        crypto::hash hash;
+        memcpy(&hash, data.data() + i * sizeof(crypto::hash), sizeof(crypto::hash));
+        m_blockchain.push_back(hash);
+      }
+      height += count;
+    }
+  }
+  catch (const std::exception &e)
+  {
+    MERROR("Failed to load the wallet cache: " << e.what());
+    return false;
+  }
+  return true;
+}
+//----------------------------------------------------------------------------------------------------
+bool wallet2::store_cache_file(const std::string &path)
 {
   trim_hashchain();
+  if (!m_cache_file)
+    m_cache_file.reset(new wallet_cache_file());
+
   try
   {
-    std::stringstream oss;
-    binary_archive<true> ar(oss);
-    if (!::serialization::serialize(ar, *this))
-      return boost::none;
+    // every record is serialized, but the cache file only writes those
+    // which differ from what it holds
+    std::string data;
+    cache_file_layout layout{m_transfers.size(), m_blockchain.offset(), m_blockchain.size(), m_blockchain.genesis()};
+    {
+      cache_ostream oss(data);
+      binary_archive<true> ar(oss);
+      if (!serialize_cache_file_state(ar, layout))
+        return false;
+      oss.flush();
+    }
+    m_cache_file->write(wallet_cache_file::record_state, 0, std::move(data), m_cache_key);
+
+    const uint64_t transfer_records = (m_transfers.size() + CACHE_TRANSFERS_PER_RECORD - 1) / CACHE_TRANSFERS_PER_RECORD;
+    for (uint64_t record = 0; record < transfer_records; ++record)
+    {
+      const size_t first = record * CACHE_TRANSFERS_PER_RECORD;
+      const size_t last = std::min<size_t>(first + CACHE_TRANSFERS_PER_RECORD, m_transfers.size());
+      vector_range<transfer_details> range{m_transfers.begin() + first, m_transfers.begin() + last};
+      data = std::string();
+      {
+        cache_ostream oss(data);
+        binary_archive<true> ar(oss);
+        if (!do_serialize_container(ar, range))
+          return false;
+        oss.flush();
+      }
+      m_cache_file->write(wallet_cache_file::record_transfers, record, std::move(data), m_cache_key);
+    }
+    m_cache_file->keep(wallet_cache_file::record_transfers, 0, transfer_records);
+
+    const uint64_t first_hash_record = m_blockchain.offset() / CACHE_BLOCK_HASHES_PER_RECORD;
+    const uint64_t hash_records = (m_blockchain.size() + CACHE_BLOCK_HASHES_PER_RECORD - 1) / CACHE_BLOCK_HASHES_PER_RECORD;
+    for (uint64_t record = first_hash_record; record < hash_records; ++record)
+    {
+      const uint64_t first = std::max<uint64_t>(record * CACHE_BLOCK_HASHES_PER_RECORD, m_blockchain.offset());
+      const uint64_t last = std::min<uint64_t>((record + 1) * CACHE_BLOCK_HASHES_PER_RECORD, m_blockchain.size());
+      data = std::string();
+      data.reserve((last - first) * sizeof(crypto::hash));
+      for (uint64_t height = first; height < last; ++height)
+        data.append((const char*)&m_blockchain[height], sizeof(crypto::hash));
+      m_cache_file->write(wallet_cache_file::record_blockchain, record, std::move(data), m_cache_key);
+    }
+    m_cache_file->keep(wallet_cache_file::record_blockchain, first_hash_record, hash_records);
+  }
+  catch (const std::exception &e)
+  {
+    MERROR("Failed to serialize the wallet cache: " << e.what());
+    return false;
+  }
 
+  return m_cache_file->commit(path, m_cache_key);
+}
+//----------------------------------------------------------------------------------------------------
+boost::optional<wallet2::cache_file_data> wallet2::get_cache_file_data(const epee::wipeable_string &passwords)
+{
+  trim_hashchain();
+  try
+  {
+    // serialize straight into the cache blob and encrypt it in place, so
+    // only one copy of the cache is held at a time
     boost::optional<wallet2::cache_file_data> cache_file_data = (wallet2::cache_file_data) {};
-    cache_file_data.get().cache_data = oss.str();
-    std::string cipher;
-    cipher.resize(cache_file_data.get().cache_data.size());
+    std::string &cache_data = cache_file_data.get().cache_data;
+    {
+      boost::iostreams::stream<boost::iostreams::back_insert_device<std::string>> oss(cache_data);
+      binary_archive<true> ar(oss);
+      if (!::serialization::serialize(ar, *this))
+        return boost::none;
+      oss.flush();
+    }
+
     cache_file_data.get().iv = crypto::rand<crypto::chacha_iv>();
-    crypto::chacha20(cache_file_data.get().cache_data.data(), cache_file_data.get().cache_data.size(), m_cache_key, cache_file_data.get().iv, &cipher[0]);
-    cache_file_data.get().cache_data = cipher;
+    crypto::chacha20(cache_data.data(), cache_data.size(), m_cache_key, cache_file_data.get().iv, &cache_data[0]);
     return cache_file_data;
   }
   catch(...)
@@ -87,11 +87,14 @@
   THROW_ON_RPC_RESPONSE_ERROR(r, err, res, method, tools::error::wallet_generic_rpc_error, method, res.status)
 
 class Serialization_portability_wallet_Test;
+class Serialization_portability_wallet_cache_file_Test;
+class wallet_scan_chunked_matches_per_output_Test;
 class wallet_accessor_test;
 
 namespace tools
 {
   class ringdb;
+  class wallet_cache_file;
   class wallet2;
   class Notify;
 
@@ -203,6 +206,7 @@ private:
     bool empty() const { return m_blockchain.empty() && m_offset == 0; }
     void trim(size_t height) { while (height > m_offset && m_blockchain.size() > 1) { m_blockchain.pop_front(); ++m_offset; } m_blockchain.shrink_to_fit(); }
     void refill(const crypto::hash &hash) { m_blockchain.push_back(hash); --m_offset; }
+    void reset(size_t offset, const crypto::hash &genesis) { m_offset = offset; m_genesis = genesis; m_blockchain.clear(); }
 
     template <class t_archive>
     inline void serialize(t_archive &a, const unsigned int ver)
@@ -229,6 +233,8 @@ private:
   class wallet2
   {
     friend class ::Serialization_portability_wallet_Test;
+    friend class ::Serialization_portability_wallet_cache_file_Test;
+    friend class ::wallet_scan_chunked_matches_per_output_Test;
     friend class ::wallet_accessor_test;
     friend class wallet_keys_unlocker;
     friend class wallet_device_callback;
@@ -1141,6 +1147,14 @@ private:
       VERSION_FIELD(0)
       FIELD(m_blockchain)
       FIELD(m_transfers)
+      if (!serialize_cache_state(ar))
+        return false;
+    END_SERIALIZE()
+
+    //! The wallet cache past the block hashes and transfers, shared by both cache file formats
+    template <bool W, template <bool> class Archive>
+    bool serialize_cache_state(Archive<W> &ar)
+    {
       FIELD(m_account_public_address)
       FIELD(m_key_images)
       FIELD(m_unconfirmed_txs)
@@ -1164,7 +1178,8 @@ private:
       FIELD(m_device_last_key_image_sync)
       FIELD(m_cold_key_images)
       FIELD(m_rpc_client_secret_key)
-    END_SERIALIZE()
+      return ar.stream().good();
+    }
 
     /*!
      * \brief  Check if wallet keys and bin files exist
@@ -1247,6 +1262,8 @@ private:
     void set_rpc_client_secret_key(const crypto::secret_key &key) { m_rpc_client_secret_key = key; m_node_rpc_proxy.set_client_secret_key(key); }
     uint64_t credits_target() const { return m_credits_target; }
     void credits_target(uint64_t threshold) { m_credits_target = threshold; }
+    bool incremental_cache() const { return m_incremental_cache; }
+    void incremental_cache(bool value) { m_incremental_cache = value; }
 
     bool get_tx_key_cached(const crypto::hash &txid, crypto::secret_key &tx_key, std::vector<crypto::secret_key> &additional_tx_keys) const;
     void set_tx_key(const crypto::hash &txid, const crypto::secret_key &tx_key, const std::vector<crypto::secret_key> &additional_tx_keys, const boost::optional<cryptonote::account_public_address> &single_destination_subaddress = boost::none);
@@ -1575,6 +1592,46 @@ private:
      */
     bool load_keys_buf(const std::string& keys_buf, const epee::wipeable_string& password);
     bool load_keys_buf(const std::string& keys_buf, const epee::wipeable_string& password, boost::optional<crypto::chacha_key>& keys_to_encrypt);
+    /*!
+     * \brief Load the wallet cache from m_cache_file, once opened.
+     */
+    bool load_cache_file();
+    /*!
+     * \brief Store the wallet cache to a wallet_cache_file, writing only the records which changed.
+     * \param path           Name of the cache file
+     */
+    bool store_cache_file(const std::string& path);
+
+    //! What the state record of a wallet_cache_file holds besides the wallet state
+    struct cache_file_layout
+    {
+      uint64_t num_transfers;
+      uint64_t blockchain_offset;
+      uint64_t blockchain_size;
+      crypto::hash genesis;
+
+      BEGIN_SERIALIZE_OBJECT()
+        VERSION_FIELD(0)
+        VARINT_FIELD(num_transfers)
+        VARINT_FIELD(blockchain_offset)
+        VARINT_FIELD(blockchain_size)
+        FIELD(genesis)
+      END_SERIALIZE()
+    };
+
+    template <bool W, template <bool> class Archive>
+    bool serialize_cache_file_state(Archive<W> &ar, cache_file_layout &layout)
+    {
+      ar.begin_object();
+      MAGIC_FIELD("wazn wallet cache state")
+      VERSION_FIELD(0)
+      FIELD(layout)
+      if (!serialize_cache_state(ar))
+        return false;
+      ar.end_object();
+      return ar.stream().good();
+    }
+
     void process_new_transaction(const crypto::hash &txid, const cryptonote::transaction& tx, const std::vector<uint64_t> &o_indices, uint64_t height, uint8_t block_version, uint64_t ts, bool miner_tx, bool pool, bool double_spend_seen, const tx_cache_data &tx_cache_data, std::map<std::pair<uint64_t, uint64_t>, size_t> *output_tracker_cache = NULL);
     bool should_skip_block(const cryptonote::block &b, uint64_t height) const;
     void process_new_blockchain_entry(const cryptonote::block& b, const cryptonote::block_complete_entry& bche, const parsed_block &parsed_block, const crypto::hash& bl_id, uint64_t height, const std::vector<tx_cache_data> &tx_cache_data, size_t tx_cache_data_offset, std::map<std::pair<uint64_t, uint64_t>, size_t> *output_tracker_cache = NULL);
@@ -1760,6 +1817,7 @@ private:
     crypto::secret_key m_rpc_client_secret_key;
     rpc_payment_state_t m_rpc_payment_state;
     uint64_t m_credits_target;
+    bool m_incremental_cache;
 
     // Aux transaction data from device
     serializable_unordered_map<crypto::hash, std::string> m_tx_device;
@@ -1792,6 +1850,7 @@ private:
     crypto::secret_key m_original_view_secret_key;
 
     crypto::chacha_key m_cache_key;
+    std::unique_ptr<wallet_cache_file> m_cache_file;
     boost::optional<epee::wipeable_string> m_encrypt_keys_after_refresh;
     boost::mutex m_decrypt_keys_lock;
     unsigned int m_decrypt_keys_lockers;
@@ -0,0 +1,568 @@
+// Copyright (c) 2019-2021 WAZN Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <boost/filesystem.hpp>
+#ifdef WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "int-util.h"
+#include "misc_log_ex.h"
+#include "misc_language.h"
+#include "file_io_utils.h"
+#include "string_tools.h"
+#include "common/util.h"
+#include "crypto/crypto.h"
+#include "serialization/containers.h"
+#include "serialization/crypto.h"
+#include "serialization/binary_utils.h"
+#include "wallet_cache.h"
+
+#undef WAZN_DEFAULT_LOG_CATEGORY
+#define WAZN_DEFAULT_LOG_CATEGORY "wallet.cache"
+
+#define CACHE_FILE_MAGIC "WZNCACHE"
+#define CACHE_FILE_VERSION 1
+#define CACHE_HEADER_SLOT_SIZE 64
+#define CACHE_DATA_START (2 * CACHE_HEADER_SLOT_SIZE)
+
+namespace
+{
+  struct header
+  {
+    uint64_t seq;
+    uint64_t index_offset;
+    uint64_t index_size;
+    crypto::chacha_iv index_iv;
+    uint64_t end;
+  };
+
+  struct index_entry
+  {
+    uint32_t type;
+    uint64_t id;
+    uint64_t offset;
+    uint64_t size;
+    crypto::chacha_iv iv;
+    crypto::hash digest;
+
+    BEGIN_SERIALIZE_OBJECT()
+      VARINT_FIELD(type)
+      VARINT_FIELD(id)
+      VARINT_FIELD(offset)
+      VARINT_FIELD(size)
+      FIELD(iv)
+      FIELD(digest)
+    END_SERIALIZE()
+  };
+
+  struct index_data
+  {
+    std::vector<index_entry> entries;
+
+    BEGIN_SERIALIZE_OBJECT()
+      MAGIC_FIELD("wazn wallet cache index")
+      VERSION_FIELD(0)
+      FIELD(entries)
+    END_SERIALIZE()
+  };
+
+  void put64(char *p, uint64_t v) { v = SWAP64LE(v); memcpy(p, &v, sizeof(v)); }
+  uint64_t get64(const char *p) { uint64_t v; memcpy(&v, p, sizeof(v)); return SWAP64LE(v); }
+
+  void header_checksum(const char *slot, char *checksum)
+  {
+    crypto::hash h;
+    crypto::cn_fast_hash(slot, CACHE_HEADER_SLOT_SIZE - 8, h);
+    memcpy(checksum, &h, 8);
+  }
+
+  void write_header(const header &h, char *slot)
+  {
+    static_assert(sizeof(CACHE_FILE_MAGIC) - 1 + 4 + 4 + 5 * 8 + sizeof(crypto::chacha_iv) == CACHE_HEADER_SLOT_SIZE, "Unexpected header size");
+    memset(slot, 0, CACHE_HEADER_SLOT_SIZE);
+    memcpy(slot, CACHE_FILE_MAGIC, 8);
+    const uint32_t version = SWAP32LE((uint32_t)CACHE_FILE_VERSION);
+    memcpy(slot + 8, &version, 4);
+    put64(slot + 16, h.seq);
+    put64(slot + 24, h.index_offset);
+    put64(slot + 32, h.index_size);
+    memcpy(slot + 40, &h.index_iv, sizeof(h.index_iv));
+    put64(slot + 48, h.end);
+    header_checksum(slot, slot + 56);
+  }
+
+  bool read_header(const char *slot, uint64_t file_size, header &h)
+  {
+    char checksum[8];
+    header_checksum(slot, checksum);
+    uint32_t version;
+    memcpy(&version, slot + 8, 4);
+    if (memcmp(slot, CACHE_FILE_MAGIC, 8) || SWAP32LE(version) != CACHE_FILE_VERSION || memcmp(slot + 56, checksum, 8))
+      return false;
+    h.seq = get64(slot + 16);
+    h.index_offset = get64(slot + 24);
+    h.index_size = get64(slot + 32);
+    memcpy(&h.index_iv, slot + 40, sizeof(h.index_iv));
+    h.end = get64(slot + 48);
+    return h.index_offset >= CACHE_DATA_START && h.index_size <= h.end - h.index_offset && h.index_offset <= h.end && h.end <= file_size;
+  }
+
+  template<typename T>
+  void erase_outside(T &records, uint32_t type, uint64_t begin, uint64_t end)
+  {
+    typedef typename T::key_type key;
+    if (end <= begin)
+      begin = end = 0;
+    records.erase(records.lower_bound(key(type, 0)), records.lower_bound(key(type, begin)));
+    records.erase(records.lower_bound(key(type, end)), records.lower_bound(key(type + 1, 0)));
+  }
+
+  crypto::hash key_hash(const crypto::chacha_key &key)
+  {
+    crypto::hash h;
+    crypto::cn_fast_hash(key.data(), key.size(), h);
+    return h;
+  }
+
+  FILE *open_file(const std::string &path, const char *mode)
+  {
+#ifdef WIN32
+    // fopen does not take UTF-8 file names on Windows
+    try { return _wfopen(epee::string_tools::utf8_to_utf16(path).c_str(), epee::string_tools::utf8_to_utf16(mode).c_str()); }
+    catch (...) { return nullptr; }
+#else
+    return fopen(path.c_str(), mode);
+#endif
+  }
+
+  bool seek(FILE *f, uint64_t offset)
+  {
+#ifdef WIN32
+    return _fseeki64(f, offset, SEEK_SET) == 0;
+#else
+    return fseeko(f, offset, SEEK_SET) == 0;
+#endif
+  }
+
+  bool write_at(FILE *f, uint64_t offset, const std::string &data)
+  {
+    return seek(f, offset) && fwrite(data.data(), 1, data.size(), f) == data.size();
+  }
+
+  //! flushes writes to the disk, so the header is never written before what it points to
+  bool sync(FILE *f)
+  {
+    if (fflush(f))
+      return false;
+#ifdef WIN32
+    return _commit(_fileno(f)) == 0;
+#else
+    return fsync(fileno(f)) == 0;
+#endif
+  }
+}
+
+namespace tools
+{
+  wallet_cache_file::wallet_cache_file():
+    m_key_hash(crypto::null_hash),
+    m_seq(0),
+    m_end(CACHE_DATA_START),
+    m_last_commit_size(0),
+    m_data(nullptr),
+    m_size(0)
+  {
+  }
+
+  wallet_cache_file::~wallet_cache_file()
+  {
+    unmap();
+  }
+
+  bool wallet_cache_file::is_cache_file(const std::string &path)
+  {
+    char magic[sizeof(CACHE_FILE_MAGIC) - 1];
+    FILE *f = open_file(path, "rb");
+    if (!f)
+      return false;
+    const bool r = fread(magic, 1, sizeof(magic), f) == sizeof(magic) && !memcmp(magic, CACHE_FILE_MAGIC, sizeof(magic));
+    fclose(f);
+    return r;
+  }
+
+  bool wallet_cache_file::is_cache_buffer(const std::string &data)
+  {
+    return !data.compare(0, sizeof(CACHE_FILE_MAGIC) - 1, CACHE_FILE_MAGIC);
+  }
+
+  bool wallet_cache_file::open(const std::string &path, const crypto::chacha_key &key)
+  {
+    reset();
+
+#ifdef WIN32
+    // no mmap here, read it whole instead
+    if (!epee::file_io_utils::load_file_to_string(path, m_buffer))
+      return false;
+    m_data = m_buffer.data();
+    m_size = m_buffer.size();
+#else
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+      data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+      return false;
+    m_data = (const char *)data;
+    m_size = st.st_size;
+#endif
+
+    if (!open_index(path, key))
+      return false;
+    m_path = path;
+    return true;
+  }
+
+  bool wallet_cache_file::open_buffer(std::string data, const crypto::chacha_key &key)
+  {
+    reset();
+    m_buffer = std::move(data);
+    m_data = m_buffer.data();
+    m_size = m_buffer.size();
+    return open_index("cache buffer", key);
+  }
+
+  bool wallet_cache_file::open_index(const std::string &path, const crypto::chacha_key &key)
+  {
+    if (m_size < CACHE_DATA_START)
+    {
+      reset();
+      return false;
+    }
+
+    header h[2];
+    const bool valid[2] = {read_header(m_data, m_size, h[0]), read_header(m_data + CACHE_HEADER_SLOT_SIZE, m_size, h[1])};
+    if (!valid[0] && !valid[1])
+    {
+      MERROR("No valid header in " << path);
+      reset();
+      return false;
+    }
+    const header &latest = valid[0] && (!valid[1] || h[0].seq > h[1].seq) ? h[0] : h[1];
+
+    std::string blob(m_data + latest.index_offset, latest.index_size);
+    crypto::chacha20(blob.data(), blob.size(), key, latest.index_iv, &blob[0]);
+    index_data index;
+    if (!::serialization::parse_binary(blob, index))
+    {
+      MERROR("Failed to decrypt the index of " << path);
+      reset();
+      return false;
+    }
+    for (const index_entry &e: index.entries)
+    {
+      if (e.offset < CACHE_DATA_START || e.offset > latest.end || e.size > latest.end - e.offset)
+      {
+        MERROR("Invalid record in " << path);
+        reset();
+        return false;
+      }
+      m_entries[std::make_pair(e.type, e.id)] = {e.offset, e.size, e.iv, e.digest};
+    }
+
+    m_key_hash = key_hash(key);
+    m_seq = latest.seq;
+    m_end = latest.end;
+    return true;
+  }
+
+  void wallet_cache_file::unmap()
+  {
+#ifndef WIN32
+    if (m_data)
+      munmap((void *)m_data, m_size);
+#endif
+    std::string().swap(m_buffer);
+    m_data = nullptr;
+    m_size = 0;
+  }
+
+  void wallet_cache_file::reset()
+  {
+    unmap();
+    m_path.clear();
+    m_key_hash = crypto::null_hash;
+    m_seq = 0;
+    m_end = CACHE_DATA_START;
+    m_entries.clear();
+    m_pending.clear();
+  }
+
+  uint64_t wallet_cache_file::count(const record_type type) const
+  {
+    const auto end = m_entries.lower_bound(std::make_pair((uint32_t)type + 1, (uint64_t)0));
+    if (end == m_entries.begin() || std::prev(end)->first.first != type)
+      return 0;
+    return std::prev(end)->first.second + 1;
+  }
+
+  bool wallet_cache_file::read(const record_type type, const uint64_t id, std::string &data, const crypto::chacha_key &key) const
+  {
+    const auto i = m_entries.find(std::make_pair((uint32_t)type, id));
+    if (i == m_entries.end() || !m_data)
+      return false;
+    const entry &e = i->second;
+    data.assign(m_data + e.offset, e.size);
+    crypto::chacha20(data.data(), data.size(), key, e.iv, &data[0]);
+    crypto::hash digest;
+    crypto::cn_fast_hash(data.data(), data.size(), digest);
+    return digest == e.digest;
+  }
+
+  void wallet_cache_file::write(const record_type type, const uint64_t id, std::string data, const crypto::chacha_key &key)
+  {
+    const record_key k(type, id);
+    crypto::hash digest;
+    crypto::cn_fast_hash(data.data(), data.size(), digest);
+    // records read from a buffer are not in any file, so they are all written again
+    const auto i = m_entries.find(k);
+    if (!m_path.empty() && i != m_entries.end() && i->second.digest == digest && key_hash(key) == m_key_hash)
+    {
+      m_pending.erase(k);
+      return;
+    }
+
+    pending &p = m_pending[k];
+    p.e = {0, data.size(), crypto::rand<crypto::chacha_iv>(), digest};
+    crypto::chacha20(data.data(), data.size(), key, p.e.iv, &data[0]);
+    p.ciphertext = std::move(data);
+  }
+
+  void wallet_cache_file::keep(const record_type type, const uint64_t begin, const uint64_t end)
+  {
+    erase_outside(m_entries, type, begin, end);
+    erase_outside(m_pending, type, begin, end);
+  }
+
+  std::string wallet_cache_file::encrypt_index(const std::map<record_key, entry> &entries, const crypto::chacha_key &key, crypto::chacha_iv &iv)
+  {
+    index_data index;
+    index.entries.reserve(entries.size());
+    for (const auto &e: entries)
+      index.entries.push_back({e.first.first, e.first.second, e.second.offset, e.second.size, e.second.iv, e.second.digest});
+    std::string blob;
+    CHECK_AND_ASSERT_THROW_MES(::serialization::dump_binary(index, blob), "Failed to serialize wallet cache index");
+    iv = crypto::rand<crypto::chacha_iv>();
+    crypto::chacha20(blob.data(), blob.size(), key, iv, &blob[0]);
+    return blob;
+  }
+
+  bool wallet_cache_file::commit(const std::string &path, const crypto::chacha_key &key)
+  {
+    m_last_commit_size = 0;
+
+    // with a new key, every record must have been written again
+    if (!m_entries.empty() && key_hash(key) != m_key_hash)
+    {
+      for (const auto &e: m_entries)
+      {
+        if (!m_pending.count(e.first))
+        {
+          MERROR("Record " << e.first.first << "/" << e.first.second << " is missing, cannot change the key of " << m_path);
+          return false;
+        }
+      }
+      return rewrite(path, key);
+    }
+
+    if (m_path.empty() || path != m_path)
+      return rewrite(path, key);
+
+    uint64_t kept = 0, added = 0;
+    for (const auto &e: m_entries)
+      if (!m_pending.count(e.first))
+        kept += e.second.size;
+    for (const auto &p: m_pending)
+      added += p.second.ciphertext.size();
+
+    // replaced records and old indices are dead weight, drop them once
+    // they outweigh the live records
+    boost::system::error_code ec;
+    const uint64_t size = boost::filesystem::file_size(path, ec);
+    const uint64_t dead = m_end - CACHE_DATA_START - kept;
+    if (ec || size < m_end || dead > kept + added)
+      return rewrite(path, key);
+    return append(path, key);
+  }
+
+  bool wallet_cache_file::append(const std::string &path, const crypto::chacha_key &key)
+  {
+    FILE *f = open_file(path, "r+b");
+    if (!f)
+    {
+      MERROR("Failed to open " << path << " for writing");
+      return false;
+    }
+
+    std::map<record_key, entry> entries = m_entries;
+    uint64_t offset = m_end;
+    bool r = true;
+    for (const auto &p: m_pending)
+    {
+      entry &e = entries[p.first];
+      e = p.second.e;
+      e.offset = offset;
+      r = r && write_at(f, offset, p.second.ciphertext);
+      offset += e.size;
+    }
+
+    header h;
+    const std::string index = encrypt_index(entries, key, h.index_iv);
+    h.seq = m_seq + 1;
+    h.index_offset = offset;
+    h.index_size = index.size();
+    h.end = offset + index.size();
+    std::string slot(CACHE_HEADER_SLOT_SIZE, '\0');
+    write_header(h, &slot[0]);
+    r = r && write_at(f, offset, index) && sync(f);
+    r = r && write_at(f, (h.seq % 2) * CACHE_HEADER_SLOT_SIZE, slot) && sync(f);
+    r = fclose(f) == 0 && r;
+    if (!r)
+    {
+      MERROR("Failed to append to " << path);
+      return false;
+    }
+
+    m_last_commit_size = h.end - m_end;
+    m_entries = std::move(entries);
+    m_pending.clear();
+    m_seq = h.seq;
+    m_end = h.end;
+    return true;
+  }
+
+  bool wallet_cache_file::rewrite(const std::string &path, const crypto::chacha_key &key)
+  {
+    const std::string new_path = path + ".new";
+    FILE *in = nullptr, *out = open_file(new_path, "wb");
+    if (!out)
+    {
+      MERROR("Failed to open " << new_path << " for writing");
+      return false;
+    }
+    bool r = true;
+    if (!m_path.empty())
+    {
+      in = open_file(m_path, "rb");
+      r = in != nullptr;
+    }
+    const auto close_files = epee::misc_utils::create_scope_leave_handler([&](){
+      if (in)
+        fclose(in);
+      if (out)
+        fclose(out);
+    });
+
+    std::map<record_key, entry> entries;
+    uint64_t offset = CACHE_DATA_START;
+    std::string data;
+    r = r && write_at(out, 0, std::string(CACHE_DATA_START, '\0'));
+    auto p = m_pending.begin();
+    auto e = m_entries.begin();
+    while (r && (p != m_pending.end() || e != m_entries.end()))
+    {
+      // both maps are ordered, merge them with the pending records taking over
+      const bool use_pending = e == m_entries.end() || (p != m_pending.end() && p->first <= e->first);
+      entry &n = entries[use_pending ? p->first : e->first];
+      if (use_pending)
+      {
+        n = p->second.e;
+        r = write_at(out, offset, p->second.ciphertext);
+        if (e != m_entries.end() && e->first == p->first)
+          ++e;
+        ++p;
+      }
+      else
+      {
+        n = e->second;
+        data.resize(n.size);
+        r = in && seek(in, n.offset) && fread(&data[0], 1, n.size, in) == n.size && write_at(out, offset, data);
+        ++e;
+      }
+      n.offset = offset;
+      offset += n.size;
+    }
+
+    header h;
+    const std::string index = encrypt_index(entries, key, h.index_iv);
+    h.seq = m_seq + 1;
+    h.index_offset = offset;
+    h.index_size = index.size();
+    h.end = offset + index.size();
+    std::string slot(CACHE_HEADER_SLOT_SIZE, '\0');
+    write_header(h, &slot[0]);
+    r = r && write_at(out, offset, index) && write_at(out, 0, slot + slot) && sync(out);
+    r = fclose(out) == 0 && r;
+    out = nullptr;
+    if (r)
+    {
+      const std::error_code e = tools::replace_file(new_path, path);
+      if (e)
+        MERROR("Failed to replace " << path << ": " << e.message());
+      r = !e;
+    }
+    if (!r)
+    {
+      MERROR("Failed to write " << path);
+      boost::system::error_code ec;
+      boost::filesystem::remove(new_path, ec);
+      return false;
+    }
+
+    unmap();
+    m_last_commit_size = h.end - CACHE_DATA_START;
+    m_path = path;
+    m_key_hash = key_hash(key);
+    m_entries = std::move(entries);
+    m_pending.clear();
+    m_seq = h.seq;
+    m_end = h.end;
+    return true;
+  }
+}
@@ -0,0 +1,130 @@
+// Copyright (c) 2019-2021 WAZN Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include "crypto/chacha.h"
+#include "crypto/hash.h"
+
+namespace tools
+{
+  /*!
+    A wallet cache file made of separately encrypted records, each keyed by
+    a type and a number. Two header slots at the start of the file point to
+    an encrypted index of the records; the one with the highest sequence
+    number and a valid checksum is used, so a torn header write falls back
+    to the previous one.
+
+    Loading maps the file and decrypts only the index up front, records are
+    decrypted from the mapping when read. A commit appends only the records
+    whose contents changed, then a new index, then flips the header. The
+    file is rewritten whole when it holds more dead records than live ones,
+    or when committing to another file or with another key; a rewrite goes
+    to a temporary file which replaces the old one, with both header slots
+    filled.
+  */
+  class wallet_cache_file
+  {
+  public:
+    enum record_type: uint32_t
+    {
+      record_state = 0,
+      record_transfers = 1,
+      record_blockchain = 2,
+    };
+
+    wallet_cache_file();
+    ~wallet_cache_file();
+
+    //! \return True if `path` starts with a wallet cache file header.
+    static bool is_cache_file(const std::string &path);
+    //! \return True if `data` starts with a wallet cache file header.
+    static bool is_cache_buffer(const std::string &data);
+
+    //! Maps `path` and decrypts its index. \return False if it is not a cache file, or `key` does not open it.
+    bool open(const std::string &path, const crypto::chacha_key &key);
+    //! Takes a whole cache file in `data` and decrypts its index. No file holds its records, so the next commit writes all of them again. \return False if it is not a cache file, or `key` does not open it.
+    bool open_buffer(std::string data, const crypto::chacha_key &key);
+    //! Unmaps the file. The index is kept for the next commit.
+    void unmap();
+    //! Forgets the file and its index, the next commit writes a whole file.
+    void reset();
+
+    //! \return One past the highest number of the records of `type`, 0 if there are none.
+    uint64_t count(record_type type) const;
+    //! Decrypts a record from the mapped file. \return False if it is missing, corrupt, or the file is not mapped.
+    bool read(record_type type, uint64_t id, std::string &data, const crypto::chacha_key &key) const;
+
+    //! Sets a record for the next commit. Nothing is written for a record identical to the committed one, unless `key` changed.
+    void write(record_type type, uint64_t id, std::string data, const crypto::chacha_key &key);
+    //! Drops the records of `type` numbered outside of [`begin`, `end`).
+    void keep(record_type type, uint64_t begin, uint64_t end);
+
+    //! Commits the records to `path`. When `key` changed, all records must have been written again. \return False on errors, the previous commit is then left intact.
+    bool commit(const std::string &path, const crypto::chacha_key &key);
+
+    //! \return The bytes the last commit wrote, headers excluded.
+    uint64_t last_commit_size() const { return m_last_commit_size; }
+
+  private:
+    struct entry
+    {
+      uint64_t offset;
+      uint64_t size;
+      crypto::chacha_iv iv;
+      crypto::hash digest;
+    };
+    struct pending
+    {
+      entry e;
+      std::string ciphertext;
+    };
+    typedef std::pair<uint32_t, uint64_t> record_key;
+
+    bool open_index(const std::string &path, const crypto::chacha_key &key);
+    bool append(const std::string &path, const crypto::chacha_key &key);
+    bool rewrite(const std::string &path, const crypto::chacha_key &key);
+    static std::string encrypt_index(const std::map<record_key, entry> &entries, const crypto::chacha_key &key, crypto::chacha_iv &iv);
+
+    std::string m_path;
+    crypto::hash m_key_hash;
+    uint64_t m_seq;
+    uint64_t m_end;
+    std::map<record_key, entry> m_entries;
+    std::map<record_key, pending> m_pending;
+    uint64_t m_last_commit_size;
+
+    const char *m_data;
+    size_t m_size;
+    std::string m_buffer;
+  };
+}
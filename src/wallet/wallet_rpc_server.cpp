@@ -260,6 +260,7 @@ namespace tools
     check_background_mining();
 
     m_net_server.set_threads_prefix("RPC");
+    m_net_server.set_io_shards(rpc_config->io_shards);
     auto rng = [](size_t len, uint8_t *ptr) { return crypto::rand(len, ptr); };
     return epee::http_server_impl_base<wallet_rpc_server, connection_context>::init(
       rng, std::move(bind_port), std::move(rpc_config->bind_ip),
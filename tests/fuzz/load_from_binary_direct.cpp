@@ -0,0 +1,110 @@
+// Copyright (c) 2019-2021 WAZN Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "include_base_utils.h"
+#include "file_io_utils.h"
+#include "serialization/keyvalue_serialization.h"
+#include "storages/portable_storage_template_helper.h"
+#include "storages/portable_storage_direct.h"
+#include "fuzzer.h"
+
+namespace
+{
+  struct inner_t
+  {
+    uint32_t u32;
+    int16_t i16;
+    std::string s;
+    std::vector<std::string> strings;
+
+    BEGIN_KV_SERIALIZE_MAP()
+      KV_SERIALIZE(u32)
+      KV_SERIALIZE(i16)
+      KV_SERIALIZE(s)
+      KV_SERIALIZE(strings)
+    END_KV_SERIALIZE_MAP()
+  };
+
+  struct outer_t
+  {
+    uint64_t u64;
+    int64_t i64;
+    uint8_t u8;
+    double d;
+    bool b;
+    std::string blob;
+    std::vector<uint64_t> numbers;
+    std::vector<uint32_t> pod_blob;
+    inner_t inner;
+    std::list<inner_t> inners;
+
+    BEGIN_KV_SERIALIZE_MAP()
+      KV_SERIALIZE(u64)
+      KV_SERIALIZE_OPT(i64, (int64_t)0)
+      KV_SERIALIZE(u8)
+      KV_SERIALIZE(d)
+      KV_SERIALIZE_OPT(b, false)
+      KV_SERIALIZE(blob)
+      KV_SERIALIZE(numbers)
+      KV_SERIALIZE_CONTAINER_POD_AS_BLOB(pod_blob)
+      KV_SERIALIZE(inner)
+      KV_SERIALIZE(inners)
+    END_KV_SERIALIZE_MAP()
+  };
+
+  std::string store_with_portable_storage(const outer_t& o)
+  {
+    epee::serialization::portable_storage ps;
+    std::string blob;
+    if (!o.store(ps) || !ps.store_to_binary(blob))
+      return {};
+    return blob;
+  }
+}
+
+BEGIN_INIT_SIMPLE_FUZZER()
+END_INIT_SIMPLE_FUZZER()
+
+BEGIN_SIMPLE_FUZZER()
+  // the direct codec has to accept, reject and decode exactly like portable_storage
+  const epee::span<const uint8_t> data{buf, len};
+  epee::serialization::portable_storage ps;
+  epee::serialization::binary_reader reader;
+  const bool ps_loaded = ps.load_from_binary(data);
+  if (ps_loaded != reader.load_from_binary(data))
+    abort();
+  if (ps_loaded)
+  {
+    outer_t from_ps{}, from_reader{};
+    if (from_ps.load(ps) != from_reader.load(reader))
+      abort();
+    const std::string stored = store_with_portable_storage(from_ps);
+    if (stored != store_with_portable_storage(from_reader) || stored != epee::serialization::store_t_to_binary(from_ps))
+      abort();
+  }
+END_SIMPLE_FUZZER()
@@ -32,12 +32,18 @@
 #pragma once
 
 #include <vector>
+#include <algorithm>
 
 #include "cryptonote_basic/account.h"
 #include "cryptonote_basic/cryptonote_basic.h"
 #include "cryptonote_core/cryptonote_tx_utils.h"
 #include "crypto/crypto.h"
 #include "ringct/rctSigs.h"
+#include "ringct/rctOps.h"
+#include "cryptonote_core/blockchain.h"
+#include "cryptonote_core/tx_pool.h"
+#include "cryptonote_core/cryptonote_core.h"
+#include "blockchain_db/testdb.h"
 
 #include "multi_tx_test_base.h"
 
@@ -173,3 +179,147 @@ private:
   cryptonote::account_base m_alice;
   std::vector<cryptonote::transaction> m_txes;
 };
+
+// the ring signature stage of relayed tx admission, as Blockchain::preverify_tx_signatures
+// runs it: serially is one call per tx, in parallel one call for the whole batch
+template<size_t a_ring_size, size_t a_num_txes, bool a_parallel>
+class test_check_tx_signature_batch : private multi_tx_test_base<a_ring_size>
+{
+  static_assert(0 < a_ring_size, "ring_size must be greater than 0");
+
+  // a bare chain, and the ring members of the base class
+  class TestDB: public cryptonote::BaseTestDB
+  {
+  public:
+    TestDB() { m_open = true; }
+
+    virtual void add_block( const cryptonote::block& blk
+                          , size_t block_weight
+                          , uint64_t long_term_block_weight
+                          , const cryptonote::difficulty_type& cumulative_difficulty
+                          , const uint64_t& coins_generated
+                          , uint64_t num_rct_outs
+                          , const crypto::hash& blk_hash
+                          ) override {
+      blocks.push_back(blk_hash);
+    }
+    virtual uint64_t height() const override { return blocks.size(); }
+    virtual size_t get_block_weight(const uint64_t &h) const override { return 0; }
+    virtual uint64_t get_block_long_term_weight(const uint64_t &h) const override { return 0; }
+    virtual std::vector<uint64_t> get_block_weights(uint64_t start_height, size_t count) const override {
+      return std::vector<uint64_t>(std::min<uint64_t>(count, blocks.size() - std::min<uint64_t>(start_height, blocks.size())), 0);
+    }
+    virtual std::vector<uint64_t> get_long_term_block_weights(uint64_t start_height, size_t count) const override {
+      return get_block_weights(start_height, count);
+    }
+    virtual crypto::hash get_block_hash_from_height(const uint64_t &height) const override {
+      return height < blocks.size() ? blocks[height] : crypto::null_hash;
+    }
+    virtual crypto::hash top_block_hash(uint64_t *block_height = NULL) const override {
+      const uint64_t h = height();
+      if (block_height)
+        *block_height = h - 1;
+      return h ? blocks[h - 1] : crypto::null_hash;
+    }
+
+    virtual uint64_t get_num_outputs(const uint64_t& amount) const override { return amount == output_amount ? outputs.size() : 0; }
+    virtual void get_output_key(const epee::span<const uint64_t> &amounts, const std::vector<uint64_t> &offsets, std::vector<cryptonote::output_data_t> &outputs, bool allow_partial = false) const override {
+      outputs.clear();
+      outputs.reserve(offsets.size());
+      for (size_t i = 0; i < offsets.size(); ++i)
+      {
+        const uint64_t amount = amounts.size() == 1 ? amounts[0] : amounts[i];
+        if (amount != output_amount || offsets[i] >= this->outputs.size())
+        {
+          if (allow_partial)
+            return;
+          throw cryptonote::OUTPUT_DNE();
+        }
+        outputs.push_back(this->outputs[offsets[i]]);
+      }
+    }
+
+    void add_output(uint64_t amount, const crypto::public_key &key)
+    {
+      output_amount = amount;
+      cryptonote::output_data_t od;
+      od.pubkey = key;
+      od.unlock_time = 0;
+      od.height = 0;
+      od.commitment = rct::zeroCommit(amount);
+      outputs.push_back(od);
+    }
+
+  private:
+    std::vector<crypto::hash> blocks;
+    uint64_t output_amount;
+    std::vector<cryptonote::output_data_t> outputs;
+  };
+
+public:
+  static const size_t loop_count = a_ring_size <= 2 ? 10 : 2;
+  static const size_t ring_size = a_ring_size;
+  static const size_t num_txes = a_num_txes;
+  static const bool parallel = a_parallel;
+
+  typedef multi_tx_test_base<a_ring_size> base_class;
+
+  test_check_tx_signature_batch(): m_txpool(m_bc), m_bc(m_txpool), m_hard_forks{std::make_pair(1, (uint64_t)0), std::make_pair((uint8_t)0, (uint64_t)0)}, m_test_options{m_hard_forks, 5000} {}
+
+  bool init()
+  {
+    using namespace cryptonote;
+
+    if (!base_class::init())
+      return false;
+
+    TestDB *db = new TestDB();
+    for (size_t i = 0; i < ring_size; ++i)
+      db->add_output(this->m_source_amount, this->m_public_keys[i]);
+    if (!m_bc.init(db, FAKECHAIN, true, &m_test_options, 0, NULL))
+      return false;
+
+    m_alice.generate();
+
+    std::vector<tx_destination_entry> destinations;
+    destinations.push_back(tx_destination_entry(this->m_source_amount - 1, m_alice.get_keys().m_account_address, false));
+    destinations.push_back(tx_destination_entry(1, m_alice.get_keys().m_account_address, false));
+
+    crypto::secret_key tx_key;
+    std::vector<crypto::secret_key> additional_tx_keys;
+    std::unordered_map<crypto::public_key, cryptonote::subaddress_index> subaddresses;
+    subaddresses[this->m_miners[this->real_source_idx].get_keys().m_account_address.m_spend_public_key] = {0,0};
+
+    m_txes.resize(num_txes);
+    for (size_t n = 0; n < num_txes; ++n)
+    {
+      if (!construct_tx_and_get_tx_key(this->m_miners[this->real_source_idx].get_keys(), subaddresses, this->m_sources, destinations, cryptonote::account_public_address{}, std::vector<uint8_t>(), m_txes[n], 0, tx_key, additional_tx_keys, true, {rct::RangeProofPaddedBulletproof, 3}))
+        return false;
+      m_tx_ptrs.push_back(&m_txes[n]);
+    }
+
+    return true;
+  }
+
+  bool test()
+  {
+    if (parallel)
+    {
+      m_bc.preverify_tx_signatures(m_tx_ptrs);
+      return true;
+    }
+
+    for (cryptonote::transaction *tx: m_tx_ptrs)
+      m_bc.preverify_tx_signatures({tx});
+    return true;
+  }
+
+private:
+  cryptonote::tx_memory_pool m_txpool;
+  cryptonote::Blockchain m_bc;
+  const std::pair<uint8_t, uint64_t> m_hard_forks[2];
+  const cryptonote::test_options m_test_options;
+  cryptonote::account_base m_alice;
+  std::vector<cryptonote::transaction> m_txes;
+  std::vector<cryptonote::transaction*> m_tx_ptrs;
+};
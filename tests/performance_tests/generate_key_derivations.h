@@ -0,0 +1,64 @@
+// Copyright (c) 2019-2021 WAZN Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <vector>
+
+#include "crypto/crypto.h"
+
+template<size_t batch_size>
+class test_generate_key_derivations
+{
+public:
+  static const size_t loop_count = 10000 / batch_size + 10;
+
+  bool init()
+  {
+    crypto::public_key pub;
+    crypto::generate_keys(pub, m_view_secret_key);
+    m_tx_pub_keys.resize(batch_size);
+    for (auto &key: m_tx_pub_keys)
+    {
+      crypto::secret_key sec;
+      crypto::generate_keys(key, sec);
+    }
+    return true;
+  }
+
+  bool test()
+  {
+    std::vector<boost::optional<crypto::key_derivation>> derivations;
+    crypto::generate_key_derivations(m_tx_pub_keys, m_view_secret_key, derivations);
+    return derivations.size() == batch_size && derivations.back();
+  }
+
+private:
+  crypto::secret_key m_view_secret_key;
+  std::vector<crypto::public_key> m_tx_pub_keys;
+};
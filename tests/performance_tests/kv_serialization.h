@@ -0,0 +1,111 @@
+// Copyright (c) 2019-2021 WAZN Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include "cryptonote_protocol/cryptonote_protocol_defs.h"
+#include "storages/portable_storage_template_helper.h"
+
+// compares the direct binary codec against going through a portable_storage tree
+template<bool direct, bool load>
+class test_kv_serialization
+{
+public:
+  static const size_t loop_count = 1000;
+
+  bool init()
+  {
+    objects.current_blockchain_height = 1000000;
+    objects.missed_ids.resize(4, crypto::null_hash);
+    for (size_t i = 0; i < 20; ++i)
+    {
+      cryptonote::block_complete_entry e;
+      e.block = std::string(1500, 'b');
+      for (size_t j = 0; j < 10; ++j)
+        e.txs.push_back({std::string(2000, 't'), crypto::null_hash});
+      objects.blocks.push_back(std::move(e));
+    }
+    return epee::serialization::store_t_to_binary(objects, blob);
+  }
+
+  bool test()
+  {
+    if (load)
+    {
+      cryptonote::NOTIFY_RESPONSE_GET_OBJECTS::request out;
+      if (direct)
+        return epee::serialization::load_t_from_binary(out, blob);
+      epee::serialization::portable_storage ps;
+      return ps.load_from_binary(blob) && out.load(ps);
+    }
+
+    std::string out;
+    if (direct)
+      return epee::serialization::store_t_to_binary(objects, out);
+    epee::serialization::portable_storage ps;
+    return objects.store(ps) && ps.store_to_binary(out);
+  }
+
+private:
+  cryptonote::NOTIFY_RESPONSE_GET_OBJECTS::request objects;
+  std::string blob;
+};
+
+// compares the streaming JSON writer against dumping a portable_storage tree
+template<bool direct>
+class test_kv_json_serialization
+{
+public:
+  static const size_t loop_count = 1000;
+
+  bool init()
+  {
+    objects.current_blockchain_height = 1000000;
+    for (size_t i = 0; i < 20; ++i)
+    {
+      cryptonote::block_complete_entry e;
+      e.block = std::string(1500, 'b');
+      for (size_t j = 0; j < 10; ++j)
+        e.txs.push_back({std::string(2000, 't'), crypto::null_hash});
+      objects.blocks.push_back(std::move(e));
+    }
+    return true;
+  }
+
+  bool test()
+  {
+    std::string out;
+    if (direct)
+      return epee::serialization::store_t_to_json(objects, out);
+    epee::serialization::portable_storage ps;
+    return objects.store(ps) && ps.dump_as_json(out);
+  }
+
+private:
+  cryptonote::NOTIFY_RESPONSE_GET_OBJECTS::request objects;
+};
@@ -40,12 +40,14 @@
 #include "construct_tx.h"
 #include "check_tx_signature.h"
 #include "check_hash.h"
+#include "kv_serialization.h"
 #include "cn_slow_hash.h"
 #include "derive_public_key.h"
 #include "derive_secret_key.h"
 #include "ge_frombytes_vartime.h"
 #include "ge_tobytes.h"
 #include "generate_key_derivation.h"
+#include "generate_key_derivations.h"
 #include "generate_key_image.h"
 #include "generate_key_image_helper.h"
 #include "generate_keypair.h"
@@ -184,6 +186,11 @@ int main(int argc, char** argv)
   TEST_PERFORMANCE4(filter, p, test_check_tx_signature_aggregated_bulletproofs, 2, 2, 56, 16);
   TEST_PERFORMANCE4(filter, p, test_check_tx_signature_aggregated_bulletproofs, 10, 2, 56, 16);
 
+  TEST_PERFORMANCE3(filter, p, test_check_tx_signature_batch, 11, 16, false);
+  TEST_PERFORMANCE3(filter, p, test_check_tx_signature_batch, 11, 16, true);
+  TEST_PERFORMANCE3(filter, p, test_check_tx_signature_batch, 11, 64, false);
+  TEST_PERFORMANCE3(filter, p, test_check_tx_signature_batch, 11, 64, true);
+
   TEST_PERFORMANCE4(filter, p, test_check_hash, 0, 1, 0, 1);
   TEST_PERFORMANCE4(filter, p, test_check_hash, 0, 0xffffffffffffffff, 0, 0xffffffffffffffff);
   TEST_PERFORMANCE4(filter, p, test_check_hash, 0, 0xffffffffffffffff, 0, 1);
@@ -192,10 +199,20 @@ int main(int argc, char** argv)
   TEST_PERFORMANCE4(filter, p, test_check_hash, 0xffffffffffffffff, 0xffffffffffffffff, 0, 1);
   TEST_PERFORMANCE4(filter, p, test_check_hash, 0xffffffffffffffff, 0xffffffffffffffff, 0xffffffffffffffff, 0xffffffffffffffff);
 
+  TEST_PERFORMANCE2(filter, p, test_kv_serialization, false, false);
+  TEST_PERFORMANCE2(filter, p, test_kv_serialization, true, false);
+  TEST_PERFORMANCE2(filter, p, test_kv_serialization, false, true);
+  TEST_PERFORMANCE2(filter, p, test_kv_serialization, true, true);
+  TEST_PERFORMANCE1(filter, p, test_kv_json_serialization, false);
+  TEST_PERFORMANCE1(filter, p, test_kv_json_serialization, true);
+
   TEST_PERFORMANCE0(filter, p, test_is_out_to_acc);
   TEST_PERFORMANCE0(filter, p, test_is_out_to_acc_precomp);
   TEST_PERFORMANCE0(filter, p, test_generate_key_image_helper);
   TEST_PERFORMANCE0(filter, p, test_generate_key_derivation);
+  TEST_PERFORMANCE1(filter, p, test_generate_key_derivations, 1);
+  TEST_PERFORMANCE1(filter, p, test_generate_key_derivations, 16);
+  TEST_PERFORMANCE1(filter, p, test_generate_key_derivations, 256);
   TEST_PERFORMANCE0(filter, p, test_generate_key_image);
   TEST_PERFORMANCE0(filter, p, test_derive_public_key);
   TEST_PERFORMANCE0(filter, p, test_derive_secret_key);
@@ -27,6 +27,7 @@
 // STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
 // THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
+#include <boost/filesystem.hpp>
 #include <boost/uuid/uuid.hpp>
 #include "gtest/gtest.h"
 #include "crypto/crypto.h"
@@ -88,3 +89,155 @@ TEST(block_queue, flush_uuid)
   bq.add_blocks(0, 200, uuid1(), na);
   ASSERT_EQ(bq.get_max_block_height(), 399);
 }
+
+TEST(block_queue, span_blocks)
+{
+  cryptonote::block_queue bq;
+  epee::net_utils::network_address na;
+  std::shared_ptr<const std::vector<cryptonote::block_complete_entry>> blocks;
+
+  bq.add_blocks(0, 2, uuid1(), na);
+  ASSERT_FALSE(bq.get_span_blocks(0, blocks));
+
+  std::vector<cryptonote::block_complete_entry> bcel(2);
+  bcel[0].block = "block 0";
+  bcel[1].block = "block 1";
+  bcel[1].txs.push_back({"tx", crypto::null_hash});
+  bq.add_blocks(0, bcel, uuid1(), na, 1.0f, 16);
+  ASSERT_FALSE(bq.get_span_blocks(1, blocks));
+  ASSERT_TRUE(bq.get_span_blocks(0, blocks));
+  ASSERT_EQ(blocks->size(), 2);
+  ASSERT_EQ((*blocks)[0].block, "block 0");
+  ASSERT_EQ((*blocks)[1].block, "block 1");
+
+  // the blocks are shared with the queue, and outlive the span
+  std::shared_ptr<const std::vector<cryptonote::block_complete_entry>> again;
+  ASSERT_TRUE(bq.get_span_blocks(0, again));
+  ASSERT_EQ(again, blocks);
+  ASSERT_TRUE(bq.remove_span(0));
+  ASSERT_EQ((*blocks)[1].block, "block 1");
+}
+
+TEST(block_queue, peer_rate)
+{
+  cryptonote::block_queue bq;
+  epee::net_utils::network_address na;
+
+  ASSERT_EQ(bq.get_peer_rate(uuid1()), 0.0f);
+  ASSERT_EQ(bq.get_relative_peer_rate(uuid1()), 1.0f);
+  ASSERT_EQ(bq.get_span_size(uuid1(), 100), 100);
+  ASSERT_FALSE(bq.is_slow_peer(uuid1()));
+
+  // the span rate does not feed the peer rate, it includes the request latency
+  bq.add_blocks(0, std::vector<cryptonote::block_complete_entry>(1), uuid1(), na, 1.0f, 1);
+  bq.add_blocks(1, std::vector<cryptonote::block_complete_entry>(1), uuid2(), na, 1.0f, 1);
+  ASSERT_EQ(bq.get_peer_rate(uuid1()), 0.0f);
+
+  bq.update_peer_rate(uuid1(), 1000.0f);
+  bq.update_peer_rate(uuid2(), 10.0f);
+  bq.update_peer_rate(uuid2(), 0.0f); // no throughput measured yet
+  ASSERT_EQ(bq.get_peer_rate(uuid1()), 1000.0f);
+  ASSERT_EQ(bq.get_relative_peer_rate(uuid2()), 1.0f); // single sample, not trusted yet
+
+  bq.update_peer_rate(uuid1(), 1000.0f);
+  bq.update_peer_rate(uuid2(), 10.0f);
+  ASSERT_EQ(bq.get_relative_peer_rate(uuid1()), 1.0f);
+  ASSERT_FLOAT_EQ(bq.get_relative_peer_rate(uuid2()), 0.01f);
+  ASSERT_FALSE(bq.is_slow_peer(uuid1()));
+  ASSERT_TRUE(bq.is_slow_peer(uuid2()));
+  ASSERT_EQ(bq.get_span_size(uuid1(), 100), 100);
+  ASSERT_EQ(bq.get_span_size(uuid2(), 100), 12);
+  ASSERT_EQ(bq.get_span_size(uuid2(), 4), 1);
+
+  // rates survive the spans, but not the connection
+  bq.flush_spans(uuid2(), true);
+  ASSERT_TRUE(bq.is_slow_peer(uuid2()));
+  bq.flush_stale_spans({uuid1()});
+  ASSERT_EQ(bq.get_peer_rate(uuid2()), 0.0f);
+  ASSERT_FALSE(bq.is_slow_peer(uuid2()));
+}
+
+TEST(block_queue, idle_peer_not_slow)
+{
+  cryptonote::block_queue bq;
+  const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+  // uuid1 sends 1 MB in 100 ms, then idles for ten seconds before the next request,
+  // uuid2 is busy all the time sending 1 MB a second
+  for (int i = 0; i < 4; ++i)
+  {
+    const boost::posix_time::ptime t1 = start + boost::posix_time::seconds(10 * i);
+    bq.update_peer_rate(uuid1(), 1000000, t1, t1 + boost::posix_time::milliseconds(100));
+    const boost::posix_time::ptime t2 = start + boost::posix_time::seconds(i);
+    bq.update_peer_rate(uuid2(), 1000000, t2, t2 + boost::posix_time::seconds(1));
+  }
+  ASSERT_FLOAT_EQ(bq.get_peer_rate(uuid1()), 10000000.0f);
+  ASSERT_FLOAT_EQ(bq.get_peer_rate(uuid2()), 1000000.0f);
+  ASSERT_EQ(bq.get_relative_peer_rate(uuid1()), 1.0f);
+  ASSERT_FALSE(bq.is_slow_peer(uuid1()));
+  ASSERT_TRUE(bq.is_slow_peer(uuid2()));
+
+  // a response read in one go is too short to time, and missing times are ignored
+  bq.update_peer_rate(uuid2(), 1000000, start, start);
+  bq.update_peer_rate(uuid2(), 1000000, start, boost::posix_time::ptime());
+  ASSERT_FLOAT_EQ(bq.get_peer_rate(uuid2()), 1000000.0f);
+}
+
+TEST(block_queue, spill)
+{
+  cryptonote::block_queue bq;
+  epee::net_utils::network_address na;
+  const boost::filesystem::path path = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+  ASSERT_TRUE(bq.set_spill_file(path.string(), 100));
+
+  for (uint64_t height = 0; height < 40; height += 10)
+  {
+    std::vector<cryptonote::block_complete_entry> bcel(10);
+    for (size_t n = 0; n < bcel.size(); ++n)
+      bcel[n].block = "block " + std::to_string(height + n);
+    bq.add_blocks(height, std::move(bcel), uuid1(), na, 1.0f, 60);
+  }
+  ASSERT_EQ(bq.get_data_size(), 240);
+  ASSERT_LE(bq.get_memory_size(), 100);
+  ASSERT_EQ(bq.get_num_filled_spans(), 4);
+  ASSERT_EQ(bq.get_overview(0), "[msss]");
+
+  std::shared_ptr<const std::vector<cryptonote::block_complete_entry>> blocks;
+  ASSERT_TRUE(bq.get_span_blocks(30, blocks));
+  ASSERT_EQ(blocks->size(), 10);
+  ASSERT_EQ((*blocks)[9].block, "block 39");
+
+  // imported spans free their spill extents for the next ones
+  for (uint64_t height = 0; height < 40; height += 10)
+  {
+    uint64_t start_height;
+    std::vector<cryptonote::block_complete_entry> bcel;
+    boost::uuids::uuid connection_id;
+    ASSERT_TRUE(bq.get_next_span(start_height, bcel, connection_id, na));
+    ASSERT_EQ(start_height, height);
+    ASSERT_EQ(bcel.size(), 10);
+    ASSERT_EQ(bcel[0].block, "block " + std::to_string(height));
+    ASSERT_TRUE(bq.remove_span(height));
+  }
+  ASSERT_EQ(bq.get_data_size(), 0);
+
+  ASSERT_TRUE(boost::filesystem::exists(path));
+  ASSERT_TRUE(bq.set_spill_file(std::string(), 0));
+  ASSERT_FALSE(boost::filesystem::exists(path));
+}
+
+TEST(block_queue, destroy_spilled)
+{
+  epee::net_utils::network_address na;
+  const boost::filesystem::path path = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+  {
+    cryptonote::block_queue bq;
+    ASSERT_TRUE(bq.set_spill_file(path.string(), 100));
+    for (uint64_t height = 0; height < 40; height += 10)
+      bq.add_blocks(height, std::vector<cryptonote::block_complete_entry>(10), uuid1(), na, 1.0f, 60);
+    ASSERT_EQ(bq.get_overview(0), "[msss]");
+    ASSERT_THROW(bq.set_spill_file(std::string(), 0), std::exception);
+    ASSERT_TRUE(boost::filesystem::exists(path));
+  }
+  ASSERT_FALSE(boost::filesystem::exists(path));
+}
@@ -32,14 +32,19 @@
 #include <cstdio>
 #include <iostream>
 #include <chrono>
+#include <future>
+#include <numeric>
+#include <random>
 #include <thread>
 
 #include "gtest/gtest.h"
 
 #include "string_tools.h"
 #include "blockchain_db/blockchain_db.h"
+#include "blockchain_db/key_image_filter.h"
 #include "blockchain_db/lmdb/db_lmdb.h"
 #include "cryptonote_basic/cryptonote_format_utils.h"
+#include "ringct/rctOps.h"
 
 using namespace cryptonote;
 using epee::string_tools::pod_to_hex;
@@ -150,6 +155,107 @@ std::string h2b(const std::string& s)
   return result;
 }
 
+// a chain whose miner txes have many outputs, alternating between pre rct
+// (amount 1000) and rct (amount 0) outputs, so that each amount's outputs
+// fill several DUPFIXED pages; the blocks go on top of the existing chain
+void add_output_blocks(BlockchainDB *db, size_t num_blocks, size_t outputs_per_block)
+{
+  const uint64_t start_height = db->height();
+  crypto::hash prev_id = start_height ? db->top_block_hash() : crypto::null_hash;
+  uint64_t key_counter = start_height * outputs_per_block;
+  for (size_t height = start_height; height < start_height + num_blocks; ++height)
+  {
+    block b;
+    b.major_version = 1;
+    b.minor_version = 0;
+    b.timestamp = height;
+    b.prev_id = prev_id;
+    b.miner_tx.version = height % 2 ? 2 : 1;
+    b.miner_tx.unlock_time = height + 60;
+    b.miner_tx.vin.push_back(txin_gen{height});
+    for (size_t i = 0; i < outputs_per_block; ++i)
+    {
+      const uint64_t counter = key_counter++;
+      crypto::public_key key;
+      crypto::cn_fast_hash(&counter, sizeof(counter), (crypto::hash&)key);
+      b.miner_tx.vout.push_back(tx_out{1000, txout_to_key(key)});
+    }
+    if (b.miner_tx.version == 2)
+      b.miner_tx.rct_signatures.type = rct::RCTTypeNull;
+    db->add_block(std::make_pair(b, block_to_blob(b)), 100, 100, height + 1, 0, {});
+    prev_id = get_block_hash(b);
+  }
+}
+
+// a block whose txes spend the given key images, per_tx of them in each tx
+void add_key_image_block(BlockchainDB *db, const std::vector<crypto::key_image> &key_images, size_t begin, size_t end, size_t per_tx)
+{
+  const uint64_t height = db->height();
+  block b;
+  b.major_version = 1;
+  b.minor_version = 0;
+  b.timestamp = height;
+  b.prev_id = height ? db->top_block_hash() : crypto::null_hash;
+  b.nonce = 0;
+  b.miner_tx.version = 1;
+  b.miner_tx.unlock_time = height + 60;
+  b.miner_tx.vin.push_back(txin_gen{height});
+  std::vector<std::pair<transaction, blobdata>> txs;
+  for (size_t i = begin; i < end; i += per_tx)
+  {
+    transaction tx;
+    tx.version = 2;
+    tx.unlock_time = 0;
+    for (size_t j = i; j < std::min(i + per_tx, end); ++j)
+    {
+      txin_to_key in;
+      in.amount = 0;
+      in.key_offsets.push_back(0);
+      in.k_image = key_images[j];
+      tx.vin.push_back(in);
+    }
+    tx.rct_signatures.type = rct::RCTTypeNull;
+    b.tx_hashes.push_back(get_transaction_hash(tx));
+    blobdata bd = tx_to_blob(tx);
+    txs.push_back(std::make_pair(std::move(tx), std::move(bd)));
+  }
+  db->add_block(std::make_pair(b, block_to_blob(b)), 100, 100, height + 1, 0, txs);
+}
+
+void get_output_keys_one_by_one(BlockchainDB *db, const std::vector<uint64_t> &amounts, const std::vector<uint64_t> &offsets, std::vector<output_data_t> &outputs, bool allow_partial)
+{
+  outputs.clear();
+  for (size_t i = 0; i < offsets.size(); ++i)
+  {
+    try
+    {
+      outputs.push_back(db->get_output_key(amounts.size() == 1 ? amounts[0] : amounts[i], offsets[i], true));
+    }
+    catch (const OUTPUT_DNE &)
+    {
+      if (!allow_partial)
+        throw;
+      break;
+    }
+  }
+}
+
+void check_output_keys(BlockchainDB *db, const std::vector<uint64_t> &amounts, const std::vector<uint64_t> &offsets, bool allow_partial, size_t expected)
+{
+  std::vector<output_data_t> outputs, expected_outputs;
+  db->get_output_key(epee::to_span(amounts), offsets, outputs, allow_partial);
+  get_output_keys_one_by_one(db, amounts, offsets, expected_outputs, allow_partial);
+  ASSERT_EQ(outputs.size(), expected);
+  ASSERT_EQ(expected_outputs.size(), expected);
+  for (size_t i = 0; i < outputs.size(); ++i)
+  {
+    ASSERT_HASH_EQ(outputs[i].pubkey, expected_outputs[i].pubkey);
+    ASSERT_EQ(outputs[i].unlock_time, expected_outputs[i].unlock_time);
+    ASSERT_EQ(outputs[i].height, expected_outputs[i].height);
+    ASSERT_HASH_EQ(outputs[i].commitment, expected_outputs[i].commitment);
+  }
+}
+
 template <typename T>
 class BlockchainDBTest : public testing::Test
 {
@@ -342,4 +448,194 @@ TYPED_TEST(BlockchainDBTest, RetrieveBlockData)
   ASSERT_HASH_EQ(get_block_hash(this->m_blocks[1].first), hashes[1]);
 }
 
+TYPED_TEST(BlockchainDBTest, GetOutputKeys)
+{
+  boost::filesystem::path tempPath = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+  std::string dirPath = tempPath.string();
+
+  this->set_prefix(dirPath);
+
+  ASSERT_NO_THROW(this->m_db->open(dirPath));
+  this->get_filenames();
+  this->init_hard_fork();
+
+  // 400 outputs per amount, several pages of either record size
+  {
+    db_wtxn_guard guard(this->m_db);
+    ASSERT_NO_THROW(add_output_blocks(this->m_db, 8, 100));
+  }
+  ASSERT_EQ(this->m_db->get_num_outputs(0), 400);
+  ASSERT_EQ(this->m_db->get_num_outputs(1000), 400);
+
+  std::mt19937 rng(0);
+  std::uniform_int_distribution<uint64_t> index_dist(0, 399);
+  for (const uint64_t amount: {0, 1000})
+  {
+    const std::vector<uint64_t> amounts{amount};
+
+    // a whole amount in order, and backwards
+    std::vector<uint64_t> offsets(400);
+    std::iota(offsets.begin(), offsets.end(), 0);
+    check_output_keys(this->m_db, amounts, offsets, false, 400);
+    std::reverse(offsets.begin(), offsets.end());
+    check_output_keys(this->m_db, amounts, offsets, false, 400);
+
+    // unsorted, with duplicates, spread over all pages
+    offsets.clear();
+    for (size_t i = 0; i < 64; ++i)
+      offsets.push_back(index_dist(rng));
+    offsets.push_back(offsets[3]);
+    offsets.push_back(offsets[3]);
+    offsets.push_back(0);
+    offsets.push_back(399);
+    offsets.push_back(0);
+    check_output_keys(this->m_db, amounts, offsets, false, offsets.size());
+
+    // an offset past the end: partial results stop before it, in request order
+    offsets = {17, 350, 3, 400, 200, 5};
+    check_output_keys(this->m_db, amounts, offsets, true, 3);
+    offsets = {401, 17, 350};
+    check_output_keys(this->m_db, amounts, offsets, true, 0);
+    offsets = {17, 350, 3, 5, 100000};
+    check_output_keys(this->m_db, amounts, offsets, true, 4);
+
+    std::vector<output_data_t> outputs;
+    offsets = {17, 350, 3, 400, 200, 5};
+    ASSERT_THROW(this->m_db->get_output_key(epee::to_span(amounts), offsets, outputs, false), OUTPUT_DNE);
+  }
+
+  // one amount per offset, interleaving both amounts
+  std::vector<uint64_t> amounts, offsets;
+  for (size_t i = 0; i < 100; ++i)
+  {
+    amounts.push_back(i % 3 ? 0 : 1000);
+    offsets.push_back(index_dist(rng));
+  }
+  check_output_keys(this->m_db, amounts, offsets, false, 100);
+  amounts.push_back(1000);
+  offsets.push_back(3);
+  amounts.push_back(42);
+  offsets.push_back(0);
+  amounts.push_back(0);
+  offsets.push_back(3);
+  check_output_keys(this->m_db, amounts, offsets, true, 101);
+  std::vector<output_data_t> outputs;
+  ASSERT_THROW(this->m_db->get_output_key(epee::to_span(amounts), offsets, outputs, false), OUTPUT_DNE);
+
+  // mismatched sizes
+  amounts.pop_back();
+  ASSERT_THROW(this->m_db->get_output_key(epee::to_span(amounts), offsets, outputs, false), DB_ERROR);
+}
+
+TYPED_TEST(BlockchainDBTest, ReadSnapshotWhileAddingBlocks)
+{
+  boost::filesystem::path tempPath = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+  std::string dirPath = tempPath.string();
+
+  this->set_prefix(dirPath);
+
+  ASSERT_NO_THROW(this->m_db->open(dirPath));
+  this->get_filenames();
+  this->init_hard_fork();
+
+  {
+    db_wtxn_guard guard(this->m_db);
+    ASSERT_NO_THROW(add_output_blocks(this->m_db, 2, 10));
+  }
+  const crypto::hash top_hash = this->m_db->top_block_hash();
+  ASSERT_EQ(this->m_db->get_read_txn_max_age(), 0);
+
+  // like the RPC reads which do not take m_blockchain_lock: one pinned snapshot
+  // for the whole request, while another thread adds blocks
+  std::promise<void> pinned, added;
+  std::shared_future<void> added_future = added.get_future().share();
+  uint64_t height = 0, height_after = 0, num_outputs_after = 0;
+  crypto::hash top_hash_after = crypto::null_hash, new_top_hash = crypto::null_hash;
+  bool new_block_seen = true;
+  std::thread reader([&]{
+    db_rtxn_guard guard(this->m_db);
+    height = this->m_db->height();
+    pinned.set_value();
+    added_future.wait();
+    height_after = this->m_db->height();
+    top_hash_after = this->m_db->top_block_hash();
+    num_outputs_after = this->m_db->get_num_outputs(0);
+    new_block_seen = this->m_db->block_exists(new_top_hash);
+  });
+  pinned.get_future().wait();
+  {
+    db_wtxn_guard guard(this->m_db);
+    EXPECT_NO_THROW(add_output_blocks(this->m_db, 2, 10));
+  }
+  new_top_hash = this->m_db->top_block_hash();
+
+  // the snapshot is held until the reader is done, and asking does not reset it
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  const uint64_t age = this->m_db->get_read_txn_max_age();
+  EXPECT_GE(age, 50);
+  EXPECT_GE(this->m_db->get_read_txn_max_age(), age);
+
+  added.set_value();
+  reader.join();
+  ASSERT_EQ(height, 2);
+  ASSERT_EQ(height_after, 2);
+  ASSERT_HASH_EQ(top_hash_after, top_hash);
+  ASSERT_EQ(num_outputs_after, 10);
+  ASSERT_FALSE(new_block_seen);
+
+  // a new snapshot sees the new blocks, and no snapshot is open any more
+  ASSERT_EQ(this->m_db->height(), 4);
+  ASSERT_EQ(this->m_db->get_num_outputs(0), 20);
+  ASSERT_EQ(this->m_db->get_read_txn_max_age(), 0);
+}
+
+TYPED_TEST(BlockchainDBTest, HasKeyImage)
+{
+  boost::filesystem::path tempPath = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+  std::string dirPath = tempPath.string();
+
+  this->set_prefix(dirPath);
+
+  ASSERT_NO_THROW(this->m_db->open(dirPath));
+  this->get_filenames();
+  this->init_hard_fork();
+
+  // enough to fill the filter the db opened with, so it gets rebuilt from
+  // inside the write txn, plus a last block to pop
+  const size_t per_tx = 1 << 14;
+  const size_t num_kept = key_image_filter::MIN_CAPACITY + per_tx;
+  const size_t num_popped = 2 * per_tx;
+  std::vector<crypto::key_image> key_images(num_kept + num_popped + 1000);
+  for (size_t i = 0; i < key_images.size(); ++i)
+    crypto::cn_fast_hash(&i, sizeof(i), (crypto::hash&)key_images[i]);
+
+  {
+    db_wtxn_guard guard(this->m_db);
+    ASSERT_NO_THROW(add_key_image_block(this->m_db, key_images, 0, num_kept / 2, per_tx));
+    ASSERT_NO_THROW(add_key_image_block(this->m_db, key_images, num_kept / 2, num_kept, per_tx));
+    ASSERT_NO_THROW(add_key_image_block(this->m_db, key_images, num_kept, num_kept + num_popped, per_tx));
+  }
+  for (size_t i = 0; i < num_kept + num_popped; ++i)
+    ASSERT_TRUE(this->m_db->has_key_image(key_images[i])) << i;
+  for (size_t i = num_kept + num_popped; i < key_images.size(); ++i)
+    ASSERT_FALSE(this->m_db->has_key_image(key_images[i])) << i;
+
+  // popped key images stay in the filter, the db has the last word
+  block b;
+  std::vector<transaction> txs;
+  ASSERT_NO_THROW(this->m_db->pop_block(b, txs));
+  for (size_t i = 0; i < num_kept; ++i)
+    ASSERT_TRUE(this->m_db->has_key_image(key_images[i])) << i;
+  for (size_t i = num_kept; i < key_images.size(); ++i)
+    ASSERT_FALSE(this->m_db->has_key_image(key_images[i])) << i;
+
+  // the filter built on open has what the db has
+  ASSERT_NO_THROW(this->m_db->close());
+  ASSERT_NO_THROW(this->m_db->open(dirPath));
+  for (size_t i = 0; i < num_kept; ++i)
+    ASSERT_TRUE(this->m_db->has_key_image(key_images[i])) << i;
+  for (size_t i = num_kept; i < key_images.size(); ++i)
+    ASSERT_FALSE(this->m_db->has_key_image(key_images[i])) << i;
+}
+
 }  // anonymous namespace
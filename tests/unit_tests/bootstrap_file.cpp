@@ -0,0 +1,505 @@
+// Copyright (c) 2019-2021 WAZN Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include <boost/filesystem.hpp>
+#include <boost/thread/thread.hpp>
+#include "gtest/gtest.h"
+#include "cryptonote_basic/cryptonote_format_utils.h"
+#include "serialization/binary_utils.h"
+#include "blockchain_db/testdb.h"
+#include "blockchain_utilities/bootstrap_file.h"
+#include "blockchain_utilities/import_reader.h"
+
+namespace
+{
+  cryptonote::block make_block(uint64_t height)
+  {
+    cryptonote::block b;
+    b.major_version = 1;
+    b.minor_version = 0;
+    b.timestamp = 1000000 + height;
+    b.prev_id = crypto::null_hash;
+    b.nonce = height;
+    b.miner_tx.version = 1;
+    b.miner_tx.unlock_time = height + CRYPTONOTE_MINED_MONEY_UNLOCK_WINDOW;
+    b.miner_tx.vin.push_back(cryptonote::txin_gen{height});
+    return b;
+  }
+
+  bootstrap::block_package make_package(uint64_t height)
+  {
+    bootstrap::block_package bp;
+    bp.block = make_block(height);
+    bp.block_weight = 100 + height;
+    bp.cumulative_difficulty = height + 1;
+    bp.coins_generated = height * 10;
+    return bp;
+  }
+
+  // writes bootstrap files from made up blocks, without a blockchain
+  class test_bootstrap_writer: public BootstrapFile
+  {
+  public:
+    explicit test_bootstrap_writer(bool indexed)
+    {
+      m_indexed = indexed;
+      m_index = bootstrap::chunk_index();
+      m_index.block_end = 0;
+      m_max_chunk = 0;
+    }
+
+    bool open(const boost::filesystem::path &path, uint64_t start_block, uint64_t stop_block) { return open_writer(path, start_block, stop_block); }
+    uint64_t height() const { return m_height; }
+
+    void write_indexed(uint64_t block_first, uint64_t block_last, uint64_t blocks_per_chunk, bool compress)
+    {
+      for (uint64_t height = block_first; height <= block_last; height += blocks_per_chunk)
+      {
+        bootstrap::chunk_data cd;
+        for (uint64_t h = height; h <= std::min(block_last, height + blocks_per_chunk - 1); ++h)
+          cd.blocks.push_back(make_package(h));
+        bootstrap::chunk_info info;
+        std::string data;
+        pack_chunk_data(cd, height, compress, info, data);
+        write_indexed_chunk(info, data);
+      }
+      m_cur_height = block_last + 1;
+    }
+
+    void write(uint64_t block_first, uint64_t block_last)
+    {
+      for (uint64_t height = block_first; height <= block_last; ++height)
+      {
+        const cryptonote::blobdata bd = t_serializable_object_to_blob(make_package(height));
+        m_output_stream->write(bd.data(), bd.size());
+        flush_chunk();
+      }
+      m_cur_height = block_last + 1;
+    }
+
+    bool finish()
+    {
+      if (m_indexed)
+        write_chunk_index();
+      return close();
+    }
+  };
+
+  class checkpoint_db: public cryptonote::BaseTestDB
+  {
+  public:
+    checkpoint_db(uint64_t height): blockchain_height(height) {}
+    virtual uint64_t height() const override { return blockchain_height; }
+    virtual crypto::hash get_block_hash_from_height(const uint64_t& height) const override { return cryptonote::get_block_hash(make_block(height + fork)); }
+    virtual crypto::hash top_block_hash(uint64_t *block_height = NULL) const override
+    {
+      if (block_height)
+        *block_height = blockchain_height - 1;
+      return get_block_hash_from_height(blockchain_height - 1);
+    }
+
+    uint64_t blockchain_height;
+    uint64_t fork = 0;
+  };
+
+  struct temp_file
+  {
+    temp_file(): path(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path()) {}
+    ~temp_file() { boost::system::error_code ec; boost::filesystem::remove(path, ec); }
+    boost::filesystem::path path;
+  };
+
+  import_source open_source(const boost::filesystem::path &path, std::ifstream &import_file, uint64_t &pos)
+  {
+    import_source source;
+    BootstrapFile bootstrap;
+    bootstrap.count_blocks(path.string());
+    import_file.open(path.string(), std::ios_base::binary | std::ifstream::in);
+    uint8_t minor_version;
+    uint64_t block_first, block_last;
+    pos = bootstrap.seek_to_first_chunk(import_file, source.major_version, minor_version, block_first, block_last);
+    source.file_size = boost::filesystem::file_size(path);
+    source.index = bootstrap.get_source_index();
+    return source;
+  }
+
+  // reads all the blocks from the current position
+  std::vector<import_block> read_all(std::ifstream &import_file, const import_source &source, uint64_t pos, int &quit)
+  {
+    std::vector<import_block> blocks;
+    import_group group;
+    do
+    {
+      group = import_group();
+      read_import_group(import_file, source, 100, pos, group);
+      std::move(group.blocks.begin(), group.blocks.end(), std::back_inserter(blocks));
+    } while (!group.quit);
+    quit = group.quit;
+    return blocks;
+  }
+
+  void read_header(const boost::filesystem::path &path, uint8_t &major_version, uint64_t &block_first, uint64_t &block_last)
+  {
+    std::ifstream file(path.string(), std::ios_base::binary | std::ifstream::in);
+    uint8_t minor_version;
+    BootstrapFile().seek_to_first_chunk(file, major_version, minor_version, block_first, block_last);
+  }
+}
+
+TEST(bootstrap_file, append_updates_header)
+{
+  temp_file file;
+  uint8_t major_version;
+  uint64_t block_first, block_last;
+
+  test_bootstrap_writer writer(false);
+  ASSERT_TRUE(writer.open(file.path, 0, 100));
+  writer.write(0, 9);
+  ASSERT_TRUE(writer.finish());
+  read_header(file.path, major_version, block_first, block_last);
+  ASSERT_EQ(major_version, 1);
+  ASSERT_EQ(block_first, 0);
+  ASSERT_EQ(block_last, 9); // the blocks written, not the range asked for
+
+  test_bootstrap_writer appender(false);
+  ASSERT_TRUE(appender.open(file.path, 0, 100));
+  ASSERT_EQ(appender.height(), 10);
+  appender.write(10, 14);
+  ASSERT_TRUE(appender.finish());
+  read_header(file.path, major_version, block_first, block_last);
+  ASSERT_EQ(block_first, 0);
+  ASSERT_EQ(block_last, 14);
+  ASSERT_EQ(BootstrapFile().count_blocks(file.path.string()), 15);
+}
+
+TEST(bootstrap_file, read_ahead)
+{
+  temp_file file;
+  test_bootstrap_writer writer(false);
+  ASSERT_TRUE(writer.open(file.path, 0, 24));
+  writer.write(0, 24);
+  ASSERT_TRUE(writer.finish());
+
+  std::ifstream import_file;
+  uint64_t pos;
+  const import_source source = open_source(file.path, import_file, pos);
+
+  // as blockchain_import does: the next group is read on its own thread while the current one is checked
+  import_group group, next_group;
+  read_import_group(import_file, source, 10, pos, group);
+  uint64_t height = 0, last_pos = 0;
+  std::vector<size_t> group_sizes;
+  while (true)
+  {
+    boost::thread reader;
+    if (!group.quit)
+      reader = boost::thread([&]() { read_import_group(import_file, source, 10, pos, next_group); });
+    group_sizes.push_back(group.blocks.size());
+    for (const import_block &ib: group.blocks)
+    {
+      ASSERT_EQ(ib.hash, cryptonote::get_block_hash(make_block(height)));
+      ASSERT_EQ(cryptonote::get_block_height(ib.blk), height);
+      ASSERT_EQ(ib.block_weight, 100 + height);
+      ASSERT_EQ(ib.coins_generated, height * 10);
+      ASSERT_GT(ib.end_pos, last_pos);
+      last_pos = ib.end_pos;
+      ++height;
+    }
+    if (reader.joinable())
+      reader.join();
+    if (group.quit)
+    {
+      ASSERT_EQ(group.quit, 1);
+      break;
+    }
+    group = std::move(next_group);
+    next_group = import_group();
+  }
+  ASSERT_EQ(group_sizes, std::vector<size_t>({10, 10, 5}));
+  ASSERT_EQ(height, 25);
+  ASSERT_EQ(last_pos, boost::filesystem::file_size(file.path));
+}
+
+TEST(bootstrap_file, read_truncated)
+{
+  temp_file file;
+  test_bootstrap_writer writer(false);
+  ASSERT_TRUE(writer.open(file.path, 0, 4));
+  writer.write(0, 4);
+  ASSERT_TRUE(writer.finish());
+  boost::filesystem::resize_file(file.path, boost::filesystem::file_size(file.path) - 1);
+
+  std::ifstream import_file;
+  uint64_t pos;
+  const import_source source = open_source(file.path, import_file, pos);
+  import_group group;
+  read_import_group(import_file, source, 10, pos, group);
+  ASSERT_EQ(group.quit, 1);
+  ASSERT_EQ(group.blocks.size(), 4);
+  ASSERT_EQ(group.blocks.back().end_pos, pos);
+}
+
+TEST(bootstrap_file, checkpoint)
+{
+  temp_file file, checkpoint_file;
+  test_bootstrap_writer writer(false);
+  ASSERT_TRUE(writer.open(file.path, 0, 9));
+  writer.write(0, 9);
+  ASSERT_TRUE(writer.finish());
+
+  checkpoint_db db(6);
+  import_checkpoint checkpoint;
+  ASSERT_FALSE(load_import_checkpoint(checkpoint_file.path, file.path.string(), db, checkpoint));
+
+  store_import_checkpoint(checkpoint_file.path, file.path.string(), db, 1234, 10);
+  ASSERT_TRUE(load_import_checkpoint(checkpoint_file.path, file.path.string(), db, checkpoint));
+  ASSERT_EQ(checkpoint.height, 6);
+  ASSERT_EQ(checkpoint.pos, 1234);
+  ASSERT_EQ(checkpoint.source_blocks, 10);
+  ASSERT_EQ(checkpoint.top_hash, db.top_block_hash());
+
+  // the db moved on, the checkpoint block is still there
+  db.blockchain_height = 8;
+  ASSERT_TRUE(load_import_checkpoint(checkpoint_file.path, file.path.string(), db, checkpoint));
+
+  // the db was popped below the checkpoint
+  db.blockchain_height = 5;
+  ASSERT_FALSE(load_import_checkpoint(checkpoint_file.path, file.path.string(), db, checkpoint));
+
+  // the db is on another chain
+  db.blockchain_height = 8;
+  db.fork = 100;
+  ASSERT_FALSE(load_import_checkpoint(checkpoint_file.path, file.path.string(), db, checkpoint));
+  db.fork = 0;
+
+  // another bootstrap file
+  temp_file other_file;
+  boost::filesystem::copy_file(file.path, other_file.path);
+  ASSERT_FALSE(load_import_checkpoint(checkpoint_file.path, other_file.path.string(), db, checkpoint));
+
+  // the file grew
+  test_bootstrap_writer appender(false);
+  ASSERT_TRUE(appender.open(file.path, 0, 20));
+  appender.write(10, 11);
+  ASSERT_TRUE(appender.finish());
+  ASSERT_FALSE(load_import_checkpoint(checkpoint_file.path, file.path.string(), db, checkpoint));
+
+  // a checkpoint without the source block count
+  {
+    std::ofstream old_format(checkpoint_file.path.string(), std::ios_base::trunc);
+    old_format << boost::filesystem::absolute(file.path).string() << std::endl
+      << boost::filesystem::file_size(file.path) << " 6 1234 " << epee::string_tools::pod_to_hex(db.get_block_hash_from_height(5)) << std::endl;
+  }
+  ASSERT_FALSE(load_import_checkpoint(checkpoint_file.path, file.path.string(), db, checkpoint));
+}
+
+TEST(bootstrap_file, indexed_chunk_round_trip)
+{
+  bootstrap::chunk_data cd;
+  for (uint64_t height = 0; height < 20; ++height)
+    cd.blocks.push_back(make_package(height));
+
+  for (bool compress: {false, true})
+  {
+    bootstrap::chunk_info info;
+    std::string data;
+    BootstrapFile::pack_chunk_data(cd, 0, compress, info, data);
+    ASSERT_EQ(info.block_first, 0);
+    ASSERT_EQ(info.num_blocks, 20);
+    ASSERT_EQ(info.data_size, data.size());
+#ifdef HAVE_ZSTD
+    ASSERT_EQ(info.codec, compress ? bootstrap::codec_zstd : bootstrap::codec_none);
+#else
+    ASSERT_EQ(info.codec, bootstrap::codec_none);
+#endif
+    if (info.codec == bootstrap::codec_none)
+      ASSERT_EQ(info.raw_size, data.size());
+
+    std::vector<bootstrap::block_package> packages;
+    ASSERT_TRUE(BootstrapFile::unpack_indexed_chunk(info, data, packages));
+    ASSERT_EQ(packages.size(), 20);
+    for (uint64_t height = 0; height < 20; ++height)
+    {
+      ASSERT_EQ(cryptonote::get_block_hash(packages[height].block), cryptonote::get_block_hash(make_block(height)));
+      ASSERT_EQ(packages[height].block_weight, 100 + height);
+    }
+  }
+}
+
+TEST(bootstrap_file, indexed_chunk_rejects_bad_data)
+{
+  bootstrap::chunk_data cd;
+  for (uint64_t height = 0; height < 5; ++height)
+    cd.blocks.push_back(make_package(height));
+  bootstrap::chunk_info info;
+  std::string data;
+  BootstrapFile::pack_chunk_data(cd, 0, false, info, data);
+  std::vector<bootstrap::block_package> packages;
+
+  std::string corrupt = data;
+  corrupt[corrupt.size() / 2] ^= 1;
+  ASSERT_FALSE(BootstrapFile::unpack_indexed_chunk(info, corrupt, packages));
+
+  bootstrap::chunk_info bad_info = info;
+  bad_info.checksum.data[0] ^= 1;
+  ASSERT_FALSE(BootstrapFile::unpack_indexed_chunk(bad_info, data, packages));
+
+  // sizes which don't match the block count are refused before decompressing
+  bad_info = info;
+  bad_info.raw_size = 5 * BUFFER_SIZE + 1;
+  ASSERT_FALSE(BootstrapFile::unpack_indexed_chunk(bad_info, data, packages));
+  bad_info = info;
+  bad_info.num_blocks = 4;
+  ASSERT_FALSE(BootstrapFile::unpack_indexed_chunk(bad_info, data, packages));
+  bad_info = info;
+  bad_info.data_size = data.size() + 1;
+  ASSERT_FALSE(BootstrapFile::unpack_indexed_chunk(bad_info, data, packages));
+
+  ASSERT_TRUE(BootstrapFile::unpack_indexed_chunk(info, data, packages));
+}
+
+TEST(bootstrap_file, indexed_chunk_bounds)
+{
+  bootstrap::chunk_data cd;
+  for (uint64_t height = 0; height < 5; ++height)
+    cd.blocks.push_back(make_package(height));
+  bootstrap::chunk_info info;
+  std::string data;
+  BootstrapFile::pack_chunk_data(cd, 0, false, info, data);
+
+  const auto write_chunk = [](const bootstrap::chunk_info &info, const std::string &data) {
+    std::string blob;
+    const cryptonote::blobdata bd = t_serializable_object_to_blob(info);
+    uint32_t info_size = bd.size();
+    ::serialization::dump_binary(info_size, blob);
+    return blob + bd + data;
+  };
+
+  const std::string chunk = write_chunk(info, data);
+  bootstrap::chunk_info read_info;
+  std::string read_data;
+  {
+    std::istringstream in(chunk);
+    ASSERT_TRUE(BootstrapFile::read_indexed_chunk(in, read_info, &read_data, chunk.size()));
+    ASSERT_EQ(read_data, data);
+  }
+
+  // data reaching past the next chunk or the end of the file is not read
+  {
+    std::istringstream in(chunk);
+    ASSERT_FALSE(BootstrapFile::read_indexed_chunk(in, read_info, &read_data, chunk.size() - 1));
+  }
+  {
+    bootstrap::chunk_info big_info = info;
+    big_info.data_size = INDEXED_BUFFER_SIZE;
+    const std::string big_chunk = write_chunk(big_info, data);
+    std::istringstream in(big_chunk);
+    ASSERT_FALSE(BootstrapFile::read_indexed_chunk(in, read_info, &read_data, big_chunk.size()));
+  }
+
+  // raw sizes are bounded by the block count
+  {
+    bootstrap::chunk_info big_info = info;
+    big_info.raw_size = info.num_blocks * BUFFER_SIZE + 1;
+    const std::string big_chunk = write_chunk(big_info, data);
+    std::istringstream in(big_chunk);
+    ASSERT_THROW(BootstrapFile::read_indexed_chunk(in, read_info, &read_data, big_chunk.size()), std::exception);
+  }
+}
+
+TEST(bootstrap_file, indexed_file)
+{
+  temp_file file;
+  test_bootstrap_writer writer(true);
+  ASSERT_TRUE(writer.open(file.path, 0, 100));
+  writer.write_indexed(0, 24, 10, true);
+  ASSERT_TRUE(writer.finish());
+
+  uint8_t major_version;
+  uint64_t block_first, block_last;
+  read_header(file.path, major_version, block_first, block_last);
+  ASSERT_EQ(major_version, 2);
+  ASSERT_EQ(block_first, 0);
+  ASSERT_EQ(block_last, 24);
+
+  std::ifstream import_file;
+  uint64_t pos;
+  const import_source source = open_source(file.path, import_file, pos);
+  ASSERT_EQ(source.index.heights, std::vector<uint64_t>({0, 10, 20}));
+  ASSERT_EQ(source.index.block_end, 25);
+  int quit;
+  const std::vector<import_block> blocks = read_all(import_file, source, pos, quit);
+  ASSERT_EQ(quit, 1);
+  ASSERT_EQ(blocks.size(), 25);
+  for (uint64_t height = 0; height < blocks.size(); ++height)
+    ASSERT_EQ(blocks[height].hash, cryptonote::get_block_hash(make_block(height)));
+
+  // without the trailer, or without the whole index, the chunks are scanned instead
+  const uint64_t size = boost::filesystem::file_size(file.path);
+  boost::filesystem::resize_file(file.path, size - 1);
+  ASSERT_EQ(BootstrapFile().count_blocks(file.path.string()), 25);
+  boost::filesystem::resize_file(file.path, source.index.offsets.back());
+  ASSERT_EQ(BootstrapFile().count_blocks(file.path.string()), 20);
+}
+
+TEST(bootstrap_file, indexed_append)
+{
+  temp_file file;
+  test_bootstrap_writer writer(true);
+  ASSERT_TRUE(writer.open(file.path, 0, 100));
+  writer.write_indexed(0, 29, 10, false);
+  ASSERT_TRUE(writer.finish());
+
+  // an indexed file can't be appended to in the old format
+  test_bootstrap_writer old_format(false);
+  ASSERT_FALSE(old_format.open(file.path, 0, 100));
+
+  test_bootstrap_writer appender(true);
+  ASSERT_TRUE(appender.open(file.path, 0, 100));
+  ASSERT_EQ(appender.height(), 30);
+  appender.write_indexed(30, 44, 10, true);
+  ASSERT_TRUE(appender.finish());
+
+  uint8_t major_version;
+  uint64_t block_first, block_last;
+  read_header(file.path, major_version, block_first, block_last);
+  ASSERT_EQ(block_first, 0);
+  ASSERT_EQ(block_last, 44);
+
+  std::ifstream import_file;
+  uint64_t pos;
+  const import_source source = open_source(file.path, import_file, pos);
+  ASSERT_EQ(source.index.heights, std::vector<uint64_t>({0, 10, 20, 30, 40}));
+  int quit;
+  const std::vector<import_block> blocks = read_all(import_file, source, pos, quit);
+  ASSERT_EQ(quit, 1);
+  ASSERT_EQ(blocks.size(), 45);
+  for (uint64_t height = 0; height < blocks.size(); ++height)
+    ASSERT_EQ(blocks[height].hash, cryptonote::get_block_hash(make_block(height)));
+}
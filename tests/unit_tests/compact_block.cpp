@@ -0,0 +1,83 @@
+// Copyright (c) 2019-2021 WAZN Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include "gtest/gtest.h"
+#include "crypto/crypto.h"
+#include "cryptonote_protocol/compact_block.h"
+
+TEST(compact_block, short_ids_depend_on_nonce)
+{
+  const crypto::hash txid = crypto::rand<crypto::hash>();
+  const uint64_t id = cryptonote::get_compact_short_id(txid, 1);
+  ASSERT_EQ(id, cryptonote::get_compact_short_id(txid, 1));
+  ASSERT_NE(id, cryptonote::get_compact_short_id(txid, 2));
+  ASSERT_EQ(0, id >> (8 * cryptonote::COMPACT_BLOCK_SHORT_ID_SIZE));
+}
+
+TEST(compact_block, reconstruct)
+{
+  std::vector<crypto::hash> pool;
+  for (size_t i = 0; i < 100; ++i)
+    pool.push_back(crypto::rand<crypto::hash>());
+
+  // block has 4 pool txes and one we do not know
+  const std::vector<crypto::hash> block_txs{pool[7], crypto::rand<crypto::hash>(), pool[42], pool[3], pool[99]};
+  const uint64_t nonce = crypto::rand<uint64_t>();
+  const std::string short_ids = cryptonote::get_compact_short_ids(block_txs, nonce);
+  ASSERT_EQ(block_txs.size() * cryptonote::COMPACT_BLOCK_SHORT_ID_SIZE, short_ids.size());
+
+  std::vector<crypto::hash> tx_hashes;
+  std::vector<uint64_t> missing;
+  ASSERT_TRUE(cryptonote::get_compact_block_tx_hashes(short_ids, nonce, pool, tx_hashes, missing));
+  ASSERT_EQ(block_txs.size(), tx_hashes.size());
+  ASSERT_EQ(std::vector<uint64_t>{1}, missing);
+  ASSERT_EQ(crypto::null_hash, tx_hashes[1]);
+  for (size_t i: {0, 2, 3, 4})
+    ASSERT_EQ(block_txs[i], tx_hashes[i]);
+}
+
+TEST(compact_block, ambiguous_short_id_is_missing)
+{
+  const crypto::hash txid = crypto::rand<crypto::hash>();
+  const uint64_t nonce = crypto::rand<uint64_t>();
+  const std::string short_ids = cryptonote::get_compact_short_ids({txid}, nonce);
+
+  // the same txid twice in the pool stands in for a short id collision
+  std::vector<crypto::hash> tx_hashes;
+  std::vector<uint64_t> missing;
+  ASSERT_TRUE(cryptonote::get_compact_block_tx_hashes(short_ids, nonce, {txid, txid}, tx_hashes, missing));
+  ASSERT_EQ(std::vector<uint64_t>{0}, missing);
+}
+
+TEST(compact_block, bad_size)
+{
+  std::vector<crypto::hash> tx_hashes;
+  std::vector<uint64_t> missing;
+  ASSERT_FALSE(cryptonote::get_compact_block_tx_hashes(std::string(7, 'x'), 0, {}, tx_hashes, missing));
+}
@@ -100,3 +100,34 @@ TEST(Crypto, verify_32)
     }
   }
 }
+
+TEST(Crypto, batch_key_derivations)
+{
+  crypto::public_key pub;
+  crypto::secret_key view_sec, sec;
+  crypto::generate_keys(pub, view_sec);
+
+  std::vector<crypto::public_key> keys;
+  for (size_t i = 0; i < 9; ++i)
+  {
+    crypto::generate_keys(pub, sec);
+    keys.push_back(pub);
+  }
+  // not a point
+  do keys[4] = crypto::rand<crypto::public_key>(); while (crypto::check_key(keys[4]));
+
+  std::vector<boost::optional<crypto::key_derivation>> derivations;
+  crypto::generate_key_derivations(keys, view_sec, derivations);
+  ASSERT_EQ(derivations.size(), keys.size());
+  for (size_t i = 0; i < keys.size(); ++i)
+  {
+    crypto::key_derivation derivation;
+    const bool r = crypto::generate_key_derivation(keys[i], view_sec, derivation);
+    ASSERT_EQ(r, !!derivations[i]);
+    if (r)
+      ASSERT_EQ(memcmp(&derivation, &*derivations[i], sizeof(derivation)), 0);
+  }
+
+  crypto::generate_key_derivations({}, view_sec, derivations);
+  ASSERT_TRUE(derivations.empty());
+}
@@ -133,3 +133,139 @@ TEST(boosted_tcp_server, worker_threads_are_exception_resistant)
   ASSERT_TRUE(srv.timed_wait_server_stop(5 * 1000));
   ASSERT_TRUE(srv.deinit_server());
 }
+
+namespace
+{
+  const uint32_t test_send_server_port = 5627;
+  const size_t test_send_message_count = 200;
+
+  std::string make_test_message(size_t i)
+  {
+    return std::string(1 + (i * 37) % 3000, char('a' + i % 26));
+  }
+
+  struct test_send_protocol_handler
+  {
+    typedef test_connection_context connection_context;
+    typedef test_protocol_handler_config config_type;
+
+    test_send_protocol_handler(epee::net_utils::i_service_endpoint* psnd_hndlr, config_type& /*config*/, connection_context& /*conn_context*/)
+      : m_psnd_hndlr(psnd_hndlr)
+    {
+    }
+
+    void after_init_connection()
+    {
+      // queue a burst of messages while the first write is still in flight
+      for (size_t i = 0; i < test_send_message_count; ++i)
+        m_psnd_hndlr->do_send(epee::byte_slice{make_test_message(i)});
+    }
+
+    void handle_qued_callback()
+    {
+    }
+
+    bool release_protocol()
+    {
+      return true;
+    }
+
+    bool handle_recv(const void* /*data*/, size_t /*size*/)
+    {
+      return true;
+    }
+
+    epee::net_utils::i_service_endpoint* m_psnd_hndlr;
+  };
+}
+
+TEST(boosted_tcp_server, queued_sends_arrive_in_order)
+{
+  epee::net_utils::boosted_tcp_server<test_send_protocol_handler> srv(epee::net_utils::e_connection_type_RPC);
+  ASSERT_TRUE(srv.init_server(test_send_server_port, test_server_host));
+  ASSERT_TRUE(srv.run_server(2, false));
+
+  std::string expected;
+  for (size_t i = 0; i < test_send_message_count; ++i)
+    expected += make_test_message(i);
+
+  boost::asio::io_service io_service;
+  boost::asio::ip::tcp::socket socket(io_service);
+  socket.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address::from_string(test_server_host), test_send_server_port));
+
+  std::string received(expected.size(), 0);
+  boost::system::error_code ec;
+  const size_t bytes = boost::asio::read(socket, boost::asio::buffer(&received[0], received.size()), ec);
+  ASSERT_FALSE(ec);
+  ASSERT_EQ(expected.size(), bytes);
+  ASSERT_EQ(expected, received);
+
+  socket.close();
+  srv.send_stop_signal();
+  ASSERT_TRUE(srv.timed_wait_server_stop(5 * 1000));
+  ASSERT_TRUE(srv.deinit_server());
+}
+
+TEST(boosted_tcp_server, sharded_connections_send_in_order)
+{
+  epee::net_utils::boosted_tcp_server<test_send_protocol_handler> srv(epee::net_utils::e_connection_type_RPC);
+  srv.set_io_shards(2);
+  ASSERT_TRUE(srv.init_server(test_send_server_port, test_server_host));
+  ASSERT_TRUE(srv.run_server(1, false));
+
+  std::string expected;
+  for (size_t i = 0; i < test_send_message_count; ++i)
+    expected += make_test_message(i);
+
+  boost::asio::io_service io_service;
+  std::vector<std::unique_ptr<boost::asio::ip::tcp::socket>> sockets;
+  for (size_t i = 0; i < 4; ++i)
+  {
+    sockets.emplace_back(new boost::asio::ip::tcp::socket(io_service));
+    sockets.back()->connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address::from_string(test_server_host), test_send_server_port));
+  }
+
+  for (auto &socket: sockets)
+  {
+    std::string received(expected.size(), 0);
+    boost::system::error_code ec;
+    const size_t bytes = boost::asio::read(*socket, boost::asio::buffer(&received[0], received.size()), ec);
+    ASSERT_FALSE(ec);
+    ASSERT_EQ(expected.size(), bytes);
+    ASSERT_EQ(expected, received);
+    socket->close();
+  }
+
+  srv.send_stop_signal();
+  ASSERT_TRUE(srv.timed_wait_server_stop(5 * 1000));
+  ASSERT_TRUE(srv.deinit_server());
+}
+
+TEST(boosted_tcp_server, shards_stop_on_shutdown)
+{
+  // deinit_server joins the shard threads, they can be changed afterwards
+  {
+    epee::net_utils::boosted_tcp_server<test_send_protocol_handler> srv(epee::net_utils::e_connection_type_RPC);
+    srv.set_io_shards(2);
+    ASSERT_TRUE(srv.init_server(test_send_server_port, test_server_host));
+    ASSERT_TRUE(srv.run_server(1, false));
+    ASSERT_THROW(srv.set_io_shards(1), std::exception);
+    srv.send_stop_signal();
+    ASSERT_TRUE(srv.deinit_server());
+    ASSERT_NO_THROW(srv.set_io_shards(1));
+  }
+
+  // so does a waiting run_server once stopped
+  {
+    epee::net_utils::boosted_tcp_server<test_send_protocol_handler> srv(epee::net_utils::e_connection_type_RPC);
+    srv.set_io_shards(2);
+    ASSERT_TRUE(srv.init_server(test_send_server_port, test_server_host));
+    std::atomic<bool> ran(false);
+    boost::thread runner([&](){ ran = srv.run_server(1, true); });
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(100));
+    srv.send_stop_signal();
+    runner.join();
+    ASSERT_TRUE(ran);
+    ASSERT_NO_THROW(srv.set_io_shards(1));
+  }
+}
@@ -33,10 +33,14 @@
 #include <boost/range/algorithm/equal.hpp>
 #include <boost/range/algorithm_ext/iota.hpp>
 #include <cstdint>
+#include <deque>
 #include <gtest/gtest.h>
 #include <iterator>
+#include <limits>
+#include <list>
 #include <string>
 #include <sstream>
+#include <thread>
 #include <vector>
 
 #ifndef _WIN32
@@ -52,10 +56,13 @@
 #include "net/net_utils_base.h"
 #include "net/local_ip.h"
 #include "net/buffer.h"
+#include "net/network_throttle-detail.hpp"
 #include "p2p/net_peerlist_boost_serialization.h"
+#include "serialization/keyvalue_serialization.h"
 #include "span.h"
 #include "string_tools.h"
 #include "storages/parserse_base_utils.h"
+#include "storages/portable_storage_template_helper.h"
 
 namespace
 {
@@ -1719,6 +1726,56 @@ TEST(net_buffer, move)
   ASSERT_TRUE(!memcmp(span.data() + 1, std::string(4000, '0').c_str(), 4000));
 }
 
+TEST(token_bucket, unlimited)
+{
+  epee::net_utils::token_bucket bucket;
+  EXPECT_EQ(0u, bucket.get_rate());
+  EXPECT_EQ(0, bucket.consume(1000000000, 0));
+}
+
+TEST(token_bucket, debt)
+{
+  epee::net_utils::token_bucket bucket;
+  bucket.set_rate(1000);
+  EXPECT_EQ(1000u, bucket.get_rate());
+
+  // a full second of burst, then the debt has to be paid back at the rate
+  const uint64_t now = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  EXPECT_EQ(0, bucket.consume(1000, now));
+  EXPECT_DOUBLE_EQ(0.5, bucket.consume(500, now));
+  EXPECT_DOUBLE_EQ(1.0, bucket.consume(500, now));
+
+  // refilled by the elapsed time, without losing fractions of a token
+  for (uint64_t us = 100; us <= 500000; us += 100)
+    bucket.consume(0, now + us);
+  EXPECT_DOUBLE_EQ(0.5, bucket.consume(0, now + 500000));
+
+  // never more than one second of burst
+  EXPECT_EQ(0, bucket.consume(1000, now + 10000000));
+  EXPECT_DOUBLE_EQ(0.001, bucket.consume(1, now + 10000000));
+}
+
+TEST(network_throttle, concurrent_traffic)
+{
+  epee::net_utils::network_throttle throttle("test", "test", 10);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i)
+    threads.emplace_back([&throttle]{
+      for (int n = 0; n < 10000; ++n)
+        throttle.handle_trafic_exact(100);
+    });
+  for (std::thread &thread: threads)
+    thread.join();
+
+  // counted without a lock, yet nothing is lost
+  uint64_t packets, bytes;
+  throttle.get_stats(packets, bytes);
+  EXPECT_EQ(40000u, packets);
+  EXPECT_EQ(4000000u, bytes);
+  EXPECT_LE(throttle.get_current_speed(), 4000000 / 9.0);
+  EXPECT_GT(throttle.get_current_speed(), 0.0);
+}
+
 TEST(parsing, isspace)
 {
   ASSERT_FALSE(epee::misc_utils::parse::isspace(0));
@@ -1819,3 +1876,143 @@ TEST(parsing, unicode)
   s = "\"foo\\u1234bar\""; si = s.begin(); ASSERT_TRUE(epee::misc_utils::parse::match_string(si, s.end(), bs)); ASSERT_EQ(bs, "fooሴbar");
   s = "\"\\u3042\\u307e\\u3084\\u304b\\u3059\""; si = s.begin(); ASSERT_TRUE(epee::misc_utils::parse::match_string(si, s.end(), bs)); ASSERT_EQ(bs, "あまやかす");
 }
+
+namespace
+{
+  struct json_writer_empty
+  {
+    BEGIN_KV_SERIALIZE_MAP()
+    END_KV_SERIALIZE_MAP()
+  };
+
+  struct json_writer_leaf
+  {
+    std::string name;
+    int8_t small;
+
+    BEGIN_KV_SERIALIZE_MAP()
+      KV_SERIALIZE(name)
+      KV_SERIALIZE(small)
+    END_KV_SERIALIZE_MAP()
+  };
+
+  // keys are declared sorted, so the tree and the writer agree byte for byte
+  struct json_writer_sorted
+  {
+    json_writer_empty empty;
+    std::list<bool> flags;
+    epee::serialization::storage_entry id;
+    json_writer_leaf leaf;
+    std::vector<json_writer_leaf> leaves;
+    std::deque<std::string> names;
+    double ratio;
+    uint64_t total;
+    std::vector<uint32_t> values;
+
+    BEGIN_KV_SERIALIZE_MAP()
+      KV_SERIALIZE(empty)
+      KV_SERIALIZE(flags)
+      KV_SERIALIZE(id)
+      KV_SERIALIZE(leaf)
+      KV_SERIALIZE(leaves)
+      KV_SERIALIZE(names)
+      KV_SERIALIZE(ratio)
+      KV_SERIALIZE(total)
+      KV_SERIALIZE(values)
+    END_KV_SERIALIZE_MAP()
+  };
+
+  struct json_writer_unsorted
+  {
+    uint64_t zeta;
+    std::vector<json_writer_leaf> leaves;
+    json_writer_leaf alpha;
+    std::string blob;
+
+    BEGIN_KV_SERIALIZE_MAP()
+      KV_SERIALIZE(zeta)
+      KV_SERIALIZE(leaves)
+      KV_SERIALIZE(alpha)
+      KV_SERIALIZE(blob)
+    END_KV_SERIALIZE_MAP()
+  };
+
+  json_writer_sorted make_json_writer_sorted()
+  {
+    json_writer_sorted doc{};
+    doc.flags = {true, false, true};
+    doc.id = epee::serialization::storage_entry(uint64_t(7));
+    doc.leaf = {"quote \" slash / tab \t", -5};
+    doc.leaves = {{"a", 1}, {"b\nc", -128}, {"", 127}};
+    doc.names = {"x", "y\\z", std::string("\0\b\f\r\v", 5)};
+    doc.ratio = 0.1234567;
+    doc.total = std::numeric_limits<uint64_t>::max();
+    doc.values = {0, 1, std::numeric_limits<uint32_t>::max()};
+    return doc;
+  }
+
+  template<typename T>
+  std::string json_with_portable_storage(const T& in, size_t indent, bool insert_newlines)
+  {
+    epee::serialization::portable_storage ps;
+    in.store(ps);
+    std::string out;
+    ps.dump_as_json(out, indent, insert_newlines);
+    return out;
+  }
+}
+
+TEST(json_writer, matches_portable_storage)
+{
+  const json_writer_sorted doc = make_json_writer_sorted();
+  for (const bool insert_newlines: {true, false})
+  {
+    for (const size_t indent: {0, 3})
+    {
+      std::string json;
+      ASSERT_TRUE(epee::serialization::store_t_to_json(doc, json, indent, insert_newlines));
+      EXPECT_EQ(json_with_portable_storage(doc, indent, insert_newlines), json);
+    }
+  }
+
+  const json_writer_empty empty{};
+  EXPECT_EQ(json_with_portable_storage(empty, 0, true), epee::serialization::store_t_to_json(empty));
+}
+
+TEST(json_writer, declaration_order)
+{
+  json_writer_unsorted doc{};
+  doc.zeta = 3;
+  doc.leaves = {{"a", 1}, {"b", 2}};
+  doc.alpha = {"c", 3};
+  doc.blob = std::string(100000, '"');
+
+  std::string json;
+  ASSERT_TRUE(epee::serialization::store_t_to_json(doc, json, 0, false));
+  EXPECT_EQ(0u, json.find("{  \"zeta\": 3,  \"leaves\": [{    \"name\": \"a\",    \"small\": 1  },{    \"name\": \"b\",    \"small\": 2  }],  \"alpha\": {"));
+
+  // same document once parsed back
+  json_writer_unsorted loaded{};
+  ASSERT_TRUE(epee::serialization::load_t_from_json(loaded, json));
+  EXPECT_EQ(epee::serialization::store_t_to_binary(doc), epee::serialization::store_t_to_binary(loaded));
+
+  epee::serialization::portable_storage ps;
+  ASSERT_TRUE(ps.load_from_json(json));
+  std::string tree_json;
+  ASSERT_TRUE(ps.dump_as_json(tree_json, 0, false));
+  EXPECT_EQ(json_with_portable_storage(doc, 0, false), tree_json);
+}
+
+TEST(json_writer, closed_sections)
+{
+  std::string json;
+  epee::serialization::json_writer writer(json);
+  epee::serialization::json_writer::hsection first = writer.open_section("first", nullptr, true);
+  ASSERT_NE(nullptr, first);
+  ASSERT_NE(nullptr, writer.open_section("second", nullptr, true));
+  EXPECT_FALSE(writer.set_value("late", uint64_t(1), first));
+  EXPECT_EQ(nullptr, writer.open_section("first", nullptr, false));
+  ASSERT_TRUE(writer.finish());
+  EXPECT_FALSE(writer.set_value("after", uint64_t(1), nullptr));
+  EXPECT_EQ("{\r\n  \"first\": {\r\n  },\r\n  \"second\": {\r\n  }\r\n}", json);
+}
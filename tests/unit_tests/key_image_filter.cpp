@@ -0,0 +1,77 @@
+// Copyright (c) 2019-2021 WAZN Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include "gtest/gtest.h"
+
+#include "blockchain_db/key_image_filter.h"
+
+namespace
+{
+  std::vector<crypto::key_image> make_key_images(size_t n)
+  {
+    std::vector<crypto::key_image> images(n);
+    for (auto &ki: images)
+      ki = crypto::rand<crypto::key_image>();
+    return images;
+  }
+}
+
+TEST(key_image_filter, empty)
+{
+  cryptonote::key_image_filter filter(1000);
+  ASSERT_EQ(filter.size(), 0);
+  ASSERT_FALSE(filter.full());
+  for (const auto &ki: make_key_images(1000))
+    ASSERT_FALSE(filter.may_contain(ki));
+}
+
+TEST(key_image_filter, no_false_negatives)
+{
+  cryptonote::key_image_filter filter(10000);
+  const std::vector<crypto::key_image> images = make_key_images(20000);
+  for (const auto &ki: images)
+    filter.insert(ki);
+  ASSERT_EQ(filter.size(), images.size());
+  ASSERT_TRUE(filter.full());
+  for (const auto &ki: images)
+    ASSERT_TRUE(filter.may_contain(ki));
+}
+
+TEST(key_image_filter, false_positive_rate)
+{
+  cryptonote::key_image_filter filter(100000);
+  for (const auto &ki: make_key_images(100000))
+    filter.insert(ki);
+  ASSERT_TRUE(filter.full());
+
+  size_t false_positives = 0;
+  for (const auto &ki: make_key_images(100000))
+    false_positives += filter.may_contain(ki);
+  ASSERT_LT(false_positives, 4000);
+}
@@ -131,11 +131,16 @@ namespace
             return 0;
         }
 
-        virtual void on_transactions_relayed(epee::span<const cryptonote::blobdata> txes, cryptonote::relay_method relay) override final
+        virtual std::vector<crypto::hash> on_transactions_relayed(epee::span<const cryptonote::blobdata> txes, cryptonote::relay_method relay) override final
         {
             std::vector<cryptonote::blobdata>& cached = relayed_[relay];
+            std::vector<crypto::hash> hashes;
             for (const auto& tx : txes)
+            {
                 cached.push_back(tx);
+                hashes.push_back(crypto::cn_fast_hash(tx.data(), tx.size()));
+            }
+            return hashes;
         }
 
     public:
@@ -172,7 +177,7 @@ namespace
         epee::levin::async_protocol_handler<cryptonote::levin::detail::p2p_context> handler_;
 
     public:
-        test_connection(boost::asio::io_service& io_service, cryptonote::levin::connections& connections, boost::uuids::random_generator& random_generator, const bool is_incoming)
+        test_connection(boost::asio::io_service& io_service, cryptonote::levin::connections& connections, boost::uuids::random_generator& random_generator, const bool is_incoming, const std::uint32_t support_flags = 0)
           : endpoint_(io_service),
             context_(),
             handler_(std::addressof(endpoint_), connections, context_)
@@ -180,6 +185,7 @@ namespace
             using base_type = epee::net_utils::connection_context_base;
             static_cast<base_type&>(context_) = base_type{random_generator(), {}, is_incoming, false};
             context_.m_state = cryptonote::cryptonote_connection_context::state_normal;
+            context_.support_flags = support_flags;
             handler_.after_init_connection();
         }
 
@@ -303,6 +309,13 @@ namespace
             return get_message<T>(notified_);
         }
 
+        int front_notification_command() const
+        {
+            if (notified_.empty())
+                throw std::logic_error{"Queue has no received messges"};
+            return notified_.front().command;
+        }
+
         received_message get_raw_notification()
         {
             return get_raw_message(notified_);
@@ -337,20 +350,20 @@ namespace
 
         cryptonote::levin::connections& get_connections() noexcept { return *connections_; }
 
-        void add_connection(const bool is_incoming)
+        void add_connection(const bool is_incoming, const std::uint32_t support_flags = 0)
         {
-            contexts_.emplace_back(io_service_, *connections_, random_generator_, is_incoming);
+            contexts_.emplace_back(io_service_, *connections_, random_generator_, is_incoming, support_flags);
             EXPECT_TRUE(connection_ids_.emplace(contexts_.back().get_id()).second);
             EXPECT_EQ(connection_ids_.size(), connections_->get_connections_count());
         }
 
-        cryptonote::levin::notify make_notifier(const std::size_t noise_size, bool is_public, bool pad_txs)
+        cryptonote::levin::notify make_notifier(const std::size_t noise_size, bool is_public, bool pad_txs, std::size_t flood_fanout = CRYPTONOTE_TX_RELAY_FLOOD_FANOUT)
         {
             epee::byte_slice noise = nullptr;
             if (noise_size)
                 noise = epee::levin::make_noise_notify(noise_size);
             epee::net_utils::zone zone = is_public ? epee::net_utils::zone::public_ : epee::net_utils::zone::i2p;
-            return cryptonote::levin::notify{io_service_, connections_, std::move(noise), zone, pad_txs, events_};
+            return cryptonote::levin::notify{io_service_, connections_, std::move(noise), zone, pad_txs, events_, flood_fanout};
         }
 
         boost::uuids::random_generator random_generator_;
@@ -2007,6 +2020,101 @@ TEST_F(levin_notify, fluff_multiple)
     }
 }
 
+TEST_F(levin_notify, fluff_inventory)
+{
+    cryptonote::levin::notify notifier = make_notifier(0, true, false, 2);
+
+    for (unsigned count = 0; count < 10; ++count)
+        add_connection(count % 2 == 0, P2P_SUPPORT_FLAG_TX_INVENTORY);
+    add_connection(false); // no inventory support, always flooded
+
+    notifier.new_out_connection();
+    io_service_.poll();
+
+    std::vector<cryptonote::blobdata> txs(2);
+    txs[0].resize(100, 'f');
+    txs[1].resize(200, 'e');
+
+    std::vector<crypto::hash> hashes;
+    for (const auto& tx : txs)
+        hashes.push_back(crypto::cn_fast_hash(tx.data(), tx.size()));
+    std::sort(hashes.begin(), hashes.end(), [] (const crypto::hash& lhs, const crypto::hash& rhs) {
+        return std::memcmp(lhs.data, rhs.data, sizeof(lhs.data)) < 0;
+    });
+
+    ASSERT_EQ(11u, contexts_.size());
+    {
+        auto context = contexts_.begin();
+        EXPECT_TRUE(notifier.send_txs(txs, context->get_id(), cryptonote::relay_method::fluff));
+
+        io_service_.reset();
+        ASSERT_LT(0u, io_service_.poll());
+        notifier.run_fluff();
+        ASSERT_LT(0u, io_service_.poll());
+
+        EXPECT_EQ(txs, events_.take_relayed(cryptonote::relay_method::fluff));
+        std::sort(txs.begin(), txs.end());
+
+        std::set<boost::uuids::uuid> flooded;
+        std::size_t flooded_outgoing = 0;
+        std::size_t announced = 0;
+        EXPECT_EQ(0u, context->process_send_queue());
+        for (++context; context != contexts_.end(); ++context)
+        {
+            EXPECT_EQ(1u, context->process_send_queue());
+            ASSERT_EQ(1u, receiver_.notified_size());
+            if (receiver_.front_notification_command() == cryptonote::NOTIFY_NEW_TRANSACTIONS::ID)
+            {
+                auto notification = receiver_.get_notification<cryptonote::NOTIFY_NEW_TRANSACTIONS>().second;
+                EXPECT_EQ(txs, notification.txs);
+                EXPECT_TRUE(notification.dandelionpp_fluff);
+                EXPECT_FALSE(context->is_incoming());
+                flooded.insert(context->get_id());
+                if (context != std::prev(contexts_.end()))
+                    ++flooded_outgoing;
+            }
+            else
+            {
+                auto notification = receiver_.get_notification<cryptonote::NOTIFY_TX_INVENTORY>().second;
+                EXPECT_EQ(hashes, notification.hashes);
+                ++announced;
+            }
+        }
+
+        EXPECT_EQ(2u, flooded_outgoing);
+        EXPECT_EQ(1u, flooded.count(contexts_.back().get_id()));
+        EXPECT_EQ(7u, announced);
+    }
+}
+
+TEST_F(levin_notify, fluff_inventory_split)
+{
+    cryptonote::levin::notify notifier = make_notifier(0, true, false, 0);
+
+    add_connection(true, P2P_SUPPORT_FLAG_TX_INVENTORY);
+    add_connection(true, P2P_SUPPORT_FLAG_TX_INVENTORY);
+
+    std::vector<cryptonote::blobdata> txs(CRYPTONOTE_TX_INVENTORY_MAX_HASHES + 1);
+    for (std::size_t i = 0; i < txs.size(); ++i)
+        txs[i] = std::to_string(i);
+
+    auto context = contexts_.begin();
+    EXPECT_TRUE(notifier.send_txs(txs, context->get_id(), cryptonote::relay_method::fluff));
+
+    io_service_.reset();
+    ASSERT_LT(0u, io_service_.poll());
+    notifier.run_fluff();
+    ASSERT_LT(0u, io_service_.poll());
+
+    EXPECT_EQ(txs, events_.take_relayed(cryptonote::relay_method::fluff));
+    EXPECT_EQ(0u, context->process_send_queue());
+    EXPECT_EQ(2u, (++context)->process_send_queue());
+
+    ASSERT_EQ(2u, receiver_.notified_size());
+    EXPECT_EQ(CRYPTONOTE_TX_INVENTORY_MAX_HASHES, receiver_.get_notification<cryptonote::NOTIFY_TX_INVENTORY>().second.hashes.size());
+    EXPECT_EQ(1u, receiver_.get_notification<cryptonote::NOTIFY_TX_INVENTORY>().second.hashes.size());
+}
+
 TEST_F(levin_notify, noise)
 {
     for (unsigned count = 0; count < 10; ++count)
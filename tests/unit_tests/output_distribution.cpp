@@ -47,17 +47,26 @@ namespace
 class TestDB: public cryptonote::BaseTestDB
 {
 public:
-  TestDB(size_t bc_height = test_distribution_size): blockchain_height(bc_height) { m_open = true; }
+  TestDB(size_t bc_height = test_distribution_size): blockchain_height(bc_height), fork_height(bc_height), cumulative_rct_outputs_calls(0) { m_open = true; }
   virtual uint64_t height() const override { return blockchain_height; }
 
+  virtual crypto::hash get_block_hash_from_height(const uint64_t& height) const override
+  {
+    crypto::hash hash = crypto::null_hash;
+    *((uint64_t*)&hash) = height;
+    hash.data[31] = height >= fork_height;
+    return hash;
+  }
+
   std::vector<uint64_t> get_block_cumulative_rct_outputs(const std::vector<uint64_t> &heights) const override
   {
+    ++cumulative_rct_outputs_calls;
     std::vector<uint64_t> d;
     for (uint64_t h: heights)
     {
       uint64_t c = 0;
       for (uint64_t i = 0; i <= h; ++i)
-        c += test_distribution[i];
+        c += test_distribution[i % test_distribution_size];
       d.push_back(c);
     }
     return d;
@@ -71,6 +80,8 @@ public:
   }
 
   uint64_t blockchain_height;
+  uint64_t fork_height;
+  mutable std::atomic<size_t> cumulative_rct_outputs_calls;
 };
 
 }
@@ -175,6 +186,117 @@ TEST(output_distribution, part_cumulative)
   ASSERT_EQ(res->distribution, std::vector<uint64_t>({0, 1, 6, 7, 11}));
 }
 
+static bool wait_for_mirror(cryptonote::Blockchain &bc, TestDB &db)
+{
+  // the mirror is loaded in the background after init
+  uint64_t start_height, base;
+  std::vector<uint64_t> distribution;
+  for (int i = 0; i < 1000; ++i)
+  {
+    const size_t calls = db.cumulative_rct_outputs_calls;
+    if (!bc.get_output_distribution(0, 0, 0, start_height, distribution, base))
+      return false;
+    if (db.cumulative_rct_outputs_calls == calls)
+      return true;
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(10));
+  }
+  return false;
+}
+
+TEST(output_distribution, cached)
+{
+  std::unique_ptr<cryptonote::Blockchain> bc;
+  cryptonote::tx_memory_pool txpool(*bc);
+  bc.reset(new cryptonote::Blockchain(txpool));
+  const std::pair<uint8_t, uint64_t> hard_forks[2] = {std::make_pair((uint8_t)1, (uint64_t)0), std::make_pair((uint8_t)0, (uint64_t)0)};
+  const cryptonote::test_options test_options = { hard_forks };
+  TestDB *db = new TestDB(test_distribution_size);
+  ASSERT_TRUE(bc->init(db, cryptonote::FAKECHAIN, true, &test_options, 0, NULL));
+  ASSERT_TRUE(wait_for_mirror(*bc, *db));
+
+  uint64_t start_height, base;
+  std::vector<uint64_t> distribution;
+  const size_t calls = db->cumulative_rct_outputs_calls;
+  ASSERT_TRUE(bc->get_output_distribution(0, 4, 8, start_height, distribution, base));
+  ASSERT_EQ(distribution, std::vector<uint64_t>({0, 1, 6, 7, 11}));
+  ASSERT_TRUE(bc->get_output_distribution(0, 28, 31, start_height, distribution, base));
+  ASSERT_EQ(distribution, std::vector<uint64_t>({55, 55, 57, 60}));
+  ASSERT_EQ(base, 50);
+  ASSERT_EQ(db->cumulative_rct_outputs_calls, calls);
+
+  // popped blocks are hidden without going to the db
+  db->blockchain_height = 30;
+  ASSERT_TRUE(bc->get_output_distribution(0, 26, 29, start_height, distribution, base));
+  ASSERT_EQ(distribution, std::vector<uint64_t>({49, 50, 55, 55}));
+  ASSERT_EQ(db->cumulative_rct_outputs_calls, calls);
+
+  // a reorg to a new chain is picked up from the block hashes, and only
+  // the new blocks are read
+  db->blockchain_height = 32;
+  db->fork_height = 28;
+  ASSERT_TRUE(bc->get_output_distribution(0, 28, 31, start_height, distribution, base));
+  ASSERT_EQ(distribution, std::vector<uint64_t>({55, 55, 57, 60}));
+  ASSERT_EQ(db->cumulative_rct_outputs_calls, calls + 1);
+  ASSERT_TRUE(bc->get_output_distribution(0, 0, 31, start_height, distribution, base));
+  ASSERT_EQ(db->cumulative_rct_outputs_calls, calls + 1);
+}
+
+static std::vector<uint64_t> cumulative_distribution(uint64_t from, uint64_t to)
+{
+  std::vector<uint64_t> d;
+  uint64_t c = 0;
+  for (uint64_t h = 0; h <= to; ++h)
+  {
+    c += test_distribution[h % test_distribution_size];
+    if (h >= from)
+      d.push_back(c);
+  }
+  return d;
+}
+
+TEST(output_distribution, cached_interleaved_txns)
+{
+  // deeper than the mirror's top hashes, so reads below them are tested too
+  const uint64_t chain_height = 1100;
+  std::unique_ptr<cryptonote::Blockchain> bc;
+  cryptonote::tx_memory_pool txpool(*bc);
+  bc.reset(new cryptonote::Blockchain(txpool));
+  const std::pair<uint8_t, uint64_t> hard_forks[2] = {std::make_pair((uint8_t)1, (uint64_t)0), std::make_pair((uint8_t)0, (uint64_t)0)};
+  const cryptonote::test_options test_options = { hard_forks };
+  TestDB *db = new TestDB(chain_height);
+  ASSERT_TRUE(bc->init(db, cryptonote::FAKECHAIN, true, &test_options, 0, NULL));
+  ASSERT_TRUE(wait_for_mirror(*bc, *db));
+
+  // read txns on an older snapshot see a lower top, and alternate with
+  // txns on the latest one without trimming or reloading the mirror
+  uint64_t start_height, base;
+  std::vector<uint64_t> distribution;
+  const size_t calls = db->cumulative_rct_outputs_calls;
+  for (uint64_t old_height: {1090, 50, 1099, 20})
+  {
+    db->blockchain_height = old_height;
+    ASSERT_TRUE(bc->get_output_distribution(0, old_height - 10, old_height - 1, start_height, distribution, base));
+    ASSERT_EQ(distribution, cumulative_distribution(old_height - 10, old_height - 1));
+    db->blockchain_height = chain_height;
+    ASSERT_TRUE(bc->get_output_distribution(0, chain_height - 10, chain_height - 1, start_height, distribution, base));
+    ASSERT_EQ(distribution, cumulative_distribution(chain_height - 10, chain_height - 1));
+  }
+  ASSERT_EQ(db->cumulative_rct_outputs_calls, calls);
+
+  // a reorg seen by the latest snapshot reads only the new blocks, once
+  db->fork_height = chain_height - 5;
+  ASSERT_TRUE(bc->get_output_distribution(0, chain_height - 10, chain_height - 1, start_height, distribution, base));
+  ASSERT_EQ(distribution, cumulative_distribution(chain_height - 10, chain_height - 1));
+  ASSERT_EQ(db->cumulative_rct_outputs_calls, calls + 1);
+  db->blockchain_height = chain_height - 5;
+  ASSERT_TRUE(bc->get_output_distribution(0, 0, chain_height - 6, start_height, distribution, base));
+  ASSERT_EQ(distribution, cumulative_distribution(0, chain_height - 6));
+  db->blockchain_height = chain_height;
+  ASSERT_TRUE(bc->get_output_distribution(0, 0, chain_height - 1, start_height, distribution, base));
+  ASSERT_EQ(distribution, cumulative_distribution(0, chain_height - 1));
+  ASSERT_EQ(db->cumulative_rct_outputs_calls, calls + 1);
+}
+
 TEST(output_distribution, part_noncumulative)
 {
   boost::optional<cryptonote::rpc::output_distribution_data> res;
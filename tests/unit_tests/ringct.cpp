@@ -1269,3 +1269,26 @@ TEST(ringct, aggregated)
 
   ASSERT_TRUE(verRctSemanticsSimple(sp));
 }
+
+TEST(ringct, aggregated_non_semantics)
+{
+  static const size_t N_SIGS = 8;
+  std::vector<rctSig> s(N_SIGS);
+  std::vector<const rctSig*> sp(N_SIGS);
+
+  for (size_t n = 0; n < N_SIGS; ++n)
+  {
+    static const uint64_t inputs[] = {1000, 1000};
+    static const uint64_t outputs[] = {500, 1500};
+    s[n] = make_sample_simple_rct_sig(NELTS(inputs), inputs, NELTS(outputs), outputs, 0);
+    sp[n] = &s[n];
+  }
+
+  ASSERT_TRUE(verRctNonSemanticsSimple(sp));
+
+  // a single bad ring anywhere fails the whole batch
+  s[N_SIGS / 2].mixRing[1][0].dest = pkGen();
+  ASSERT_FALSE(verRctNonSemanticsSimple(sp));
+  ASSERT_TRUE(verRctNonSemanticsSimple(s[0]));
+  ASSERT_FALSE(verRctNonSemanticsSimple(s[N_SIGS / 2]));
+}
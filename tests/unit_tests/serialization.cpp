@@ -46,6 +46,7 @@
 #include "serialization/containers.h"
 #include "serialization/binary_utils.h"
 #include "wallet/wallet2.h"
+#include "wallet/wallet_cache.h"
 #include "gtest/gtest.h"
 #include "unit_tests_utils.h"
 #include "device/device.hpp"
@@ -761,6 +762,91 @@ TEST(Serialization, portability_wallet)
 }
 
 #define OUTPUT_EXPORT_FILE_MAGIC "WAZN output export\003"
+TEST(Serialization, portability_wallet_cache_file)
+{
+  const cryptonote::network_type nettype = cryptonote::TESTNET;
+  const boost::filesystem::path dir = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+  ASSERT_TRUE(boost::filesystem::create_directories(dir));
+  const std::string wallet_file = (dir / "wallet_9svHk1").string();
+  boost::filesystem::copy_file(unit_test::data_dir / "wallet_9svHk1", wallet_file);
+  boost::filesystem::copy_file(unit_test::data_dir / "wallet_9svHk1.keys", wallet_file + ".keys");
+  const string password = "test";
+
+  std::vector<tools::wallet2::transfer_details> transfers;
+  std::string blockchain;
+  {
+    // a cache keeps the old format unless the wallet opts in, and is
+    // migrated on the next store once it does
+    tools::wallet2 w(nettype);
+    ASSERT_NO_THROW(w.load(wallet_file, password));
+    ASSERT_FALSE(w.incremental_cache());
+    ASSERT_NO_THROW(w.store());
+    ASSERT_FALSE(tools::wallet_cache_file::is_cache_file(wallet_file));
+    w.incremental_cache(true);
+    ASSERT_NO_THROW(w.rewrite(wallet_file, password));
+    ASSERT_NO_THROW(w.store());
+    ASSERT_TRUE(tools::wallet_cache_file::is_cache_file(wallet_file));
+    transfers = w.m_transfers;
+    ASSERT_TRUE(::serialization::dump_binary(w.m_blockchain, blockchain));
+  }
+
+  {
+    // it loads from a buffer too
+    std::string keys_buf, cache_buf;
+    ASSERT_TRUE(epee::file_io_utils::load_file_to_string(wallet_file + ".keys", keys_buf));
+    ASSERT_TRUE(epee::file_io_utils::load_file_to_string(wallet_file, cache_buf));
+    tools::wallet2 w(nettype);
+    ASSERT_NO_THROW(w.load("", password, keys_buf, cache_buf));
+    ASSERT_EQ(w.m_transfers.size(), 3);
+    ASSERT_EQ(w.m_key_images.size(), 3);
+    ASSERT_EQ(w.m_tx_notes.size(), 2);
+  }
+
+  tools::wallet2 w(nettype);
+  ASSERT_NO_THROW(w.load(wallet_file, password));
+  ASSERT_TRUE(w.incremental_cache());
+  ASSERT_EQ(w.m_transfers.size(), 3);
+  for (size_t i = 0; i < transfers.size(); ++i)
+  {
+    ASSERT_EQ(w.m_transfers[i].m_block_height, transfers[i].m_block_height);
+    ASSERT_EQ(w.m_transfers[i].m_txid, transfers[i].m_txid);
+    ASSERT_EQ(w.m_transfers[i].m_global_output_index, transfers[i].m_global_output_index);
+    ASSERT_EQ(w.m_transfers[i].m_key_image, transfers[i].m_key_image);
+    ASSERT_EQ(w.m_transfers[i].m_amount, transfers[i].m_amount);
+    ASSERT_EQ(w.m_transfers[i].m_spent, transfers[i].m_spent);
+  }
+  std::string reloaded_blockchain;
+  ASSERT_TRUE(::serialization::dump_binary(w.m_blockchain, reloaded_blockchain));
+  ASSERT_EQ(reloaded_blockchain, blockchain);
+  ASSERT_EQ(w.m_key_images.size(), 3);
+  ASSERT_EQ(w.m_payments.size(), 2);
+  ASSERT_EQ(w.m_tx_keys.size(), 2);
+  ASSERT_EQ(w.m_tx_notes.size(), 2);
+  ASSERT_EQ(w.m_address_book.size(), 1);
+  ASSERT_EQ(w.m_account_public_address.m_spend_public_key, w.m_account.get_keys().m_account_address.m_spend_public_key);
+
+  // storing again appends what changed rather than rewriting the file
+  const uint64_t size = boost::filesystem::file_size(wallet_file);
+  ASSERT_NO_THROW(w.store());
+  ASSERT_LT(w.m_cache_file->last_commit_size(), size);
+  ASSERT_EQ(boost::filesystem::file_size(wallet_file), size + w.m_cache_file->last_commit_size());
+
+  // opting out writes the old format back, for older versions to open
+  w.incremental_cache(false);
+  ASSERT_NO_THROW(w.store());
+  ASSERT_FALSE(tools::wallet_cache_file::is_cache_file(wallet_file));
+  ASSERT_TRUE(w.unlock_keys_file());
+  {
+    tools::wallet2 old(nettype);
+    ASSERT_NO_THROW(old.load(wallet_file, password));
+    ASSERT_EQ(old.m_transfers.size(), 3);
+    ASSERT_EQ(old.m_address_book.size(), 1);
+  }
+
+  boost::system::error_code ec;
+  boost::filesystem::remove_all(dir, ec);
+}
+
 TEST(Serialization, portability_outputs)
 {
   // read file
@@ -73,6 +73,69 @@ TEST(peer_list, peer_list_general)
 }
 
 
+TEST(peer_list, evict_same_host)
+{
+  nodetool::peerlist_manager plm;
+  plm.init(nodetool::peerlist_types{}, false);
+
+  ADD_WHITE_NODE(MAKE_IPV4_ADDRESS(123,43,12,1, 8080), 1, 10);
+  ADD_WHITE_NODE(MAKE_IPV4_ADDRESS(123,43,12,2, 8080), 2, 20);
+  ADD_WHITE_NODE(MAKE_IPV4_ADDRESS(123,43,12,3, 8080), 3, 30);
+  ASSERT_EQ(plm.get_white_peers_count(), 3);
+
+  // same host on another port replaces the old entry
+  ADD_WHITE_NODE(MAKE_IPV4_ADDRESS(123,43,12,2, 18080), 4, 40);
+  ASSERT_EQ(plm.get_white_peers_count(), 3);
+
+  // so does the ipv4-mapped ipv6 address of the same host
+  boost::asio::ip::address_v6::bytes_type bytes{};
+  bytes[10] = bytes[11] = 0xff;
+  bytes[12] = 123; bytes[13] = 43; bytes[14] = 12; bytes[15] = 3;
+  ADD_WHITE_NODE((epee::net_utils::ipv6_network_address{boost::asio::ip::address_v6{bytes}, 8080}), 5, 50);
+  ASSERT_EQ(plm.get_white_peers_count(), 3);
+
+  nodetool::peerlist_entry pe;
+  ASSERT_TRUE(plm.get_white_peer_by_index(pe, 0));
+  ASSERT_EQ(pe.id, 5);
+  ASSERT_TRUE(plm.get_white_peer_by_index(pe, 1));
+  ASSERT_EQ(pe.id, 4);
+  ASSERT_TRUE(plm.get_white_peer_by_index(pe, 2));
+  ASSERT_EQ(pe.id, 1);
+  ASSERT_FALSE(plm.get_white_peer_by_index(pe, 3));
+}
+
+TEST(peer_list, peerlist_head_filter)
+{
+  nodetool::peerlist_manager plm;
+  plm.init(nodetool::peerlist_types{}, false);
+  for (uint8_t i = 1; i <= 100; ++i)
+    ADD_WHITE_NODE(MAKE_IPV4_ADDRESS(123,43,12,i, 8080), i, i);
+
+  std::vector<nodetool::peerlist_entry> bs_head;
+  ASSERT_TRUE(plm.get_peerlist_head(bs_head, true, 10));
+  ASSERT_EQ(bs_head.size(), 10);
+  std::set<uint64_t> ids;
+  for (const auto &e: bs_head)
+  {
+    ASSERT_EQ(e.last_seen, 0);
+    ids.insert(e.id);
+  }
+  ASSERT_EQ(ids.size(), 10);
+
+  bs_head.clear();
+  ASSERT_TRUE(plm.get_peerlist_head(bs_head, true, 250, [](const nodetool::peerlist_entry &pe) { return pe.id % 2 == 0; }));
+  ASSERT_EQ(bs_head.size(), 50);
+  for (const auto &e: bs_head)
+    ASSERT_EQ(e.id % 2, 0);
+
+  bs_head.clear();
+  ASSERT_TRUE(plm.get_peerlist_head(bs_head, false, 3, [](const nodetool::peerlist_entry &pe) { return pe.id != 99; }));
+  ASSERT_EQ(bs_head.size(), 3);
+  ASSERT_EQ(bs_head[0].id, 100);
+  ASSERT_EQ(bs_head[1].id, 98);
+  ASSERT_EQ(bs_head[2].id, 97);
+}
+
 TEST(peer_list, merge_peer_lists)
 {
   //([^ \t]*)\t([^ \t]*):([^ \t]*) \tlast_seen: d(\d+)\.h(\d+)\.m(\d+)\.s(\d+)\n
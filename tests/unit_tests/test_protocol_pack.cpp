@@ -33,8 +33,66 @@
 
 #include "include_base_utils.h"
 #include "cryptonote_protocol/cryptonote_protocol_defs.h"
+#include "net/i2p_address.h"
+#include "net/tor_address.h"
+#include "p2p/p2p_protocol_defs.h"
 #include "storages/portable_storage_template_helper.h"
 
+namespace
+{
+  template<typename t_struct>
+  std::string store_with_portable_storage(const t_struct& s)
+  {
+    epee::serialization::portable_storage ps;
+    std::string blob;
+    EXPECT_TRUE(s.store(ps));
+    EXPECT_TRUE(ps.store_to_binary(blob));
+    return blob;
+  }
+
+  bool loads_with_portable_storage(const std::string& blob)
+  {
+    epee::serialization::portable_storage ps;
+    return ps.load_from_binary(blob);
+  }
+
+  bool loads_with_binary_reader(const std::string& blob)
+  {
+    epee::serialization::binary_reader reader;
+    return reader.load_from_binary(blob);
+  }
+
+  struct peers_t
+  {
+    std::vector<nodetool::peerlist_entry> peers;
+
+    BEGIN_KV_SERIALIZE_MAP()
+      KV_SERIALIZE(peers)
+    END_KV_SERIALIZE_MAP()
+  };
+
+  // a blob of nested sections, the innermost holding one entry of the given type
+  std::string nested_blob(size_t depth, bool in_array, uint8_t leaf_type)
+  {
+    std::string blob("\x01\x11\x01\x01\x01\x01\x02\x01\x01", 9);
+    for (size_t i = 0; i < depth; ++i)
+    {
+      blob += std::string("\x04\x01" "a", 3); // one field named "a"
+      if (in_array)
+        blob += std::string("\x8c\x04", 2); // array of one section
+      else
+        blob += '\x0c';
+    }
+    blob += std::string("\x04\x01" "b", 3);
+    blob += (char)leaf_type;
+    if (leaf_type == SERIALIZE_TYPE_STRING)
+      blob += std::string("\x04" "x", 2);
+    else
+      blob += std::string(8, '\0');
+    return blob;
+  }
+}
+
 TEST(protocol_pack, protocol_pack_command)
 {
   std::string buff;
@@ -55,3 +113,121 @@ TEST(protocol_pack, protocol_pack_command)
     ASSERT_TRUE(r.total_height == 3);
   }
 }
+
+TEST(protocol_pack, block_complete_entry)
+{
+  for (const bool pruned: {false, true})
+  {
+    cryptonote::block_complete_entry e;
+    e.pruned = pruned;
+    e.block = "block";
+    for (size_t i = 0; i < 3; ++i)
+      e.txs.push_back({std::string(100 * (i + 1), 'a' + i), pruned ? crypto::hash{} : crypto::null_hash});
+
+    std::string buff;
+    ASSERT_TRUE(epee::serialization::store_t_to_binary(e, buff));
+
+    cryptonote::block_complete_entry e2;
+    ASSERT_TRUE(epee::serialization::load_t_from_binary(e2, buff));
+    ASSERT_EQ(e2.pruned, pruned);
+    ASSERT_EQ(e2.block, e.block);
+    ASSERT_EQ(e2.txs.size(), e.txs.size());
+    for (size_t i = 0; i < e.txs.size(); ++i)
+      ASSERT_EQ(e2.txs[i].blob, e.txs[i].blob);
+  }
+}
+
+TEST(protocol_pack, direct_store_matches_portable_storage)
+{
+  cryptonote::NOTIFY_RESPONSE_GET_OBJECTS::request objects;
+  objects.current_blockchain_height = 123456;
+  objects.missed_ids.resize(3, crypto::hash{});
+  for (size_t i = 0; i < 4; ++i)
+  {
+    cryptonote::block_complete_entry e;
+    e.pruned = i & 1;
+    e.block = std::string(200 + i, 'b');
+    e.block_weight = e.pruned ? 1000 * i : 0;
+    for (size_t j = 0; j < i; ++j)
+      e.txs.push_back({std::string(100 * (j + 1), 'a' + j), crypto::null_hash});
+    objects.blocks.push_back(std::move(e));
+  }
+  const std::string objects_blob = epee::serialization::store_t_to_binary(objects);
+  ASSERT_EQ(store_with_portable_storage(objects), objects_blob);
+
+  cryptonote::NOTIFY_RESPONSE_CHAIN_ENTRY::request chain;
+  chain.start_height = 1;
+  chain.total_height = 70000;
+  chain.cumulative_difficulty = std::numeric_limits<uint64_t>::max();
+  chain.m_block_ids.resize(100, crypto::hash{});
+  chain.m_block_weights.resize(100, 300000);
+  chain.first_block = "first";
+  ASSERT_EQ(store_with_portable_storage(chain), epee::serialization::store_t_to_binary(chain));
+
+  peers_t peers;
+  peers.peers.resize(4);
+  peers.peers[0].adr = epee::net_utils::ipv4_network_address{0x0100007f, 18080};
+  peers.peers[1].adr = epee::net_utils::ipv6_network_address{boost::asio::ip::address_v6::loopback(), 18080};
+  peers.peers[2].adr = net::tor_address::unknown();
+  peers.peers[3].adr = net::i2p_address::unknown();
+  for (size_t i = 0; i < peers.peers.size(); ++i)
+  {
+    peers.peers[i].id = i;
+    peers.peers[i].last_seen = i * 1000;
+  }
+  const std::string peers_blob = epee::serialization::store_t_to_binary(peers);
+  ASSERT_EQ(store_with_portable_storage(peers), peers_blob);
+
+  // and reading it back field by field gives the same struct
+  cryptonote::NOTIFY_RESPONSE_GET_OBJECTS::request objects2;
+  ASSERT_TRUE(epee::serialization::load_t_from_binary(objects2, objects_blob));
+  ASSERT_EQ(objects_blob, store_with_portable_storage(objects2));
+  ASSERT_EQ(objects2.blocks.size(), objects.blocks.size());
+  ASSERT_EQ(objects2.blocks[3].txs[2].blob, objects.blocks[3].txs[2].blob);
+
+  peers_t peers2;
+  ASSERT_TRUE(epee::serialization::load_t_from_binary(peers2, peers_blob));
+  ASSERT_EQ(peers_blob, store_with_portable_storage(peers2));
+  ASSERT_EQ(peers2.peers[1].adr, peers.peers[1].adr);
+  ASSERT_EQ(peers2.peers[2].adr, peers.peers[2].adr);
+}
+
+TEST(protocol_pack, direct_load_rejects_like_portable_storage)
+{
+  cryptonote::NOTIFY_RESPONSE_GET_OBJECTS::request objects;
+  objects.current_blockchain_height = 1;
+  objects.blocks.resize(2);
+  objects.blocks[1].txs.push_back({std::string(70, 't'), crypto::null_hash});
+  const std::string blob = epee::serialization::store_t_to_binary(objects);
+  for (size_t size = 0; size <= blob.size(); ++size)
+  {
+    const std::string truncated = blob.substr(0, size);
+    ASSERT_EQ(loads_with_portable_storage(truncated), loads_with_binary_reader(truncated)) << "size " << size;
+  }
+
+  // the recursion limit has to hit at the same depth
+  for (const bool in_array: {false, true})
+  {
+    for (const uint8_t leaf_type: {(uint8_t)SERIALIZE_TYPE_UINT64, (uint8_t)SERIALIZE_TYPE_STRING})
+    {
+      bool accepted = true;
+      for (size_t depth = 0; depth < 40; ++depth)
+      {
+        const std::string nested = nested_blob(depth, in_array, leaf_type);
+        const bool ps_loaded = loads_with_portable_storage(nested);
+        ASSERT_EQ(ps_loaded, loads_with_binary_reader(nested)) << "depth " << depth;
+        if (!ps_loaded)
+          accepted = false;
+      }
+      ASSERT_FALSE(accepted);
+    }
+  }
+
+  // duplicate keys
+  std::string duplicate("\x01\x11\x01\x01\x01\x01\x02\x01\x01" "\x0c" "\x01" "b" "\x08" "\x01" "\x01" "a" "\x08" "\x02" "\x01" "b" "\x08" "\x03", 22);
+  ASSERT_FALSE(loads_with_portable_storage(duplicate));
+  ASSERT_FALSE(loads_with_binary_reader(duplicate));
+  duplicate[19] = 'c';
+  ASSERT_TRUE(loads_with_portable_storage(duplicate));
+  ASSERT_TRUE(loads_with_binary_reader(duplicate));
+}
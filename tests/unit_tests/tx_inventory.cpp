@@ -0,0 +1,172 @@
+// Copyright (c) 2019-2021 WAZN Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include <boost/uuid/random_generator.hpp>
+#include "gtest/gtest.h"
+#include "crypto/crypto.h"
+#include "cryptonote_protocol/tx_inventory.h"
+
+TEST(tx_inventory, request_once)
+{
+  boost::uuids::random_generator uuid;
+  const boost::uuids::uuid peer1 = uuid(), peer2 = uuid();
+  const crypto::hash txid = crypto::rand<crypto::hash>();
+  const auto now = std::chrono::steady_clock::now();
+  cryptonote::tx_request_tracker requests(std::chrono::seconds(10), 8);
+
+  ASSERT_TRUE(requests.request(txid, peer1, now));
+  ASSERT_FALSE(requests.request(txid, peer1, now));
+  ASSERT_FALSE(requests.request(txid, peer2, now + std::chrono::seconds(9)));
+  ASSERT_TRUE(requests.request(crypto::rand<crypto::hash>(), peer2, now));
+  ASSERT_EQ(requests.size(), 2);
+
+  // the next peer gets it once the first one timed out
+  ASSERT_TRUE(requests.request(txid, peer2, now + std::chrono::seconds(10)));
+  ASSERT_FALSE(requests.request(txid, peer1, now + std::chrono::seconds(11)));
+}
+
+TEST(tx_inventory, connection_close)
+{
+  boost::uuids::random_generator uuid;
+  const boost::uuids::uuid peer1 = uuid(), peer2 = uuid();
+  const crypto::hash txid1 = crypto::rand<crypto::hash>(), txid2 = crypto::rand<crypto::hash>();
+  const auto now = std::chrono::steady_clock::now();
+  cryptonote::tx_request_tracker requests(std::chrono::seconds(10), 8);
+
+  ASSERT_TRUE(requests.request(txid1, peer1, now));
+  ASSERT_TRUE(requests.request(txid2, peer2, now));
+  requests.on_connection_close(peer1);
+  ASSERT_EQ(requests.size(), 1);
+  ASSERT_TRUE(requests.request(txid1, peer2, now));
+  ASSERT_FALSE(requests.request(txid2, peer1, now));
+}
+
+TEST(tx_inventory, prune)
+{
+  boost::uuids::random_generator uuid;
+  const boost::uuids::uuid peer = uuid();
+  const auto now = std::chrono::steady_clock::now();
+  cryptonote::tx_request_tracker requests(std::chrono::seconds(10), 8);
+
+  ASSERT_TRUE(requests.request(crypto::rand<crypto::hash>(), peer, now));
+  ASSERT_TRUE(requests.request(crypto::rand<crypto::hash>(), peer, now + std::chrono::seconds(5)));
+  requests.prune(now + std::chrono::seconds(9));
+  ASSERT_EQ(requests.size(), 2);
+  requests.prune(now + std::chrono::seconds(10));
+  ASSERT_EQ(requests.size(), 1);
+  requests.prune(now + std::chrono::seconds(15));
+  ASSERT_EQ(requests.size(), 0);
+}
+
+TEST(tx_inventory, next_announcer_on_timeout)
+{
+  boost::uuids::random_generator uuid;
+  const boost::uuids::uuid peer1 = uuid(), peer2 = uuid(), peer3 = uuid();
+  const crypto::hash txid = crypto::rand<crypto::hash>();
+  const auto now = std::chrono::steady_clock::now();
+  cryptonote::tx_request_tracker requests(std::chrono::seconds(10), 8);
+
+  // peer1 announces first and never answers, peer2 announces while the request is in flight
+  ASSERT_TRUE(requests.request(txid, peer1, now));
+  ASSERT_FALSE(requests.request(txid, peer2, now + std::chrono::seconds(3)));
+  ASSERT_FALSE(requests.request(txid, peer2, now + std::chrono::seconds(4)));
+  ASSERT_FALSE(requests.request(txid, peer3, now + std::chrono::seconds(5)));
+  ASSERT_TRUE(requests.prune(now + std::chrono::seconds(9)).empty());
+
+  // peer2 is asked after the timeout, once
+  auto retry = requests.prune(now + std::chrono::seconds(10));
+  ASSERT_EQ(retry.size(), 1);
+  ASSERT_EQ(retry[peer2], std::vector<crypto::hash>{txid});
+  ASSERT_TRUE(requests.prune(now + std::chrono::seconds(19)).empty());
+
+  // then peer3, then it is given up on
+  retry = requests.prune(now + std::chrono::seconds(20));
+  ASSERT_EQ(retry.size(), 1);
+  ASSERT_EQ(retry[peer3], std::vector<crypto::hash>{txid});
+  ASSERT_TRUE(requests.prune(now + std::chrono::seconds(30)).empty());
+  ASSERT_EQ(requests.size(), 0);
+}
+
+TEST(tx_inventory, next_announcer_on_connection_close)
+{
+  boost::uuids::random_generator uuid;
+  const boost::uuids::uuid peer1 = uuid(), peer2 = uuid(), peer3 = uuid();
+  const crypto::hash txid = crypto::rand<crypto::hash>();
+  const auto now = std::chrono::steady_clock::now();
+  cryptonote::tx_request_tracker requests(std::chrono::seconds(10), 8);
+
+  ASSERT_TRUE(requests.request(txid, peer1, now));
+  ASSERT_FALSE(requests.request(txid, peer2, now));
+  ASSERT_FALSE(requests.request(txid, peer3, now));
+
+  // a closed announcer is not asked
+  ASSERT_TRUE(requests.on_connection_close(peer2, now).empty());
+  auto retry = requests.on_connection_close(peer1, now + std::chrono::seconds(1));
+  ASSERT_EQ(retry.size(), 1);
+  ASSERT_EQ(retry[peer3], std::vector<crypto::hash>{txid});
+
+  // the handed over request has a fresh timeout
+  ASSERT_TRUE(requests.prune(now + std::chrono::seconds(10)).empty());
+  ASSERT_EQ(requests.size(), 1);
+
+  requests.on_tx_received(txid);
+  ASSERT_EQ(requests.size(), 0);
+  ASSERT_TRUE(requests.on_connection_close(peer3, now).empty());
+}
+
+TEST(tx_inventory, max_announcers)
+{
+  boost::uuids::random_generator uuid;
+  const crypto::hash txid = crypto::rand<crypto::hash>();
+  const auto now = std::chrono::steady_clock::now();
+  cryptonote::tx_request_tracker requests(std::chrono::seconds(10), 2);
+
+  std::vector<boost::uuids::uuid> peers;
+  for (size_t i = 0; i < 4; ++i)
+  {
+    peers.push_back(uuid());
+    ASSERT_EQ(requests.request(txid, peers.back(), now), i == 0);
+  }
+  ASSERT_EQ(requests.prune(now + std::chrono::seconds(10))[peers[1]], std::vector<crypto::hash>{txid});
+  ASSERT_EQ(requests.prune(now + std::chrono::seconds(20))[peers[2]], std::vector<crypto::hash>{txid});
+  ASSERT_TRUE(requests.prune(now + std::chrono::seconds(30)).empty());
+}
+
+TEST(tx_inventory, split_tx_blobs)
+{
+  ASSERT_TRUE(cryptonote::split_tx_blobs({}, 10).empty());
+
+  const std::vector<cryptonote::blobdata> txs{std::string(4, 'a'), std::string(6, 'b'), std::string(1, 'c'), std::string(25, 'd'), std::string(3, 'e')};
+  const auto parts = cryptonote::split_tx_blobs(txs, 10);
+  ASSERT_EQ(parts.size(), 4);
+  ASSERT_EQ(parts[0], std::vector<cryptonote::blobdata>(txs.begin(), txs.begin() + 2));
+  ASSERT_EQ(parts[1], std::vector<cryptonote::blobdata>{txs[2]});
+  ASSERT_EQ(parts[2], std::vector<cryptonote::blobdata>{txs[3]}); // too large on its own
+  ASSERT_EQ(parts[3], std::vector<cryptonote::blobdata>{txs[4]});
+}
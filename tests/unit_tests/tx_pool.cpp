@@ -0,0 +1,337 @@
+// Copyright (c) 2019-2021 WAZN Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#define IN_UNIT_TESTS
+
+#include "gtest/gtest.h"
+#include "cryptonote_basic/cryptonote_format_utils.h"
+#include "cryptonote_core/blockchain.h"
+#include "cryptonote_core/tx_pool.h"
+#include "cryptonote_core/cryptonote_core.h"
+#include "blockchain_db/testdb.h"
+
+class txpool_accessor_test
+{
+public:
+  // stands in for a ring signature check passing against the given block
+  static void set_inputs_checked(const cryptonote::tx_memory_pool &txpool, const crypto::hash &txid, uint64_t height, const crypto::hash &block_id)
+  {
+    txpool.m_input_cache[txid] = std::make_tuple(true, cryptonote::tx_verification_context{}, height, block_id);
+  }
+  static bool has_template_candidate(const cryptonote::tx_memory_pool &txpool, const crypto::hash &txid)
+  {
+    return txpool.m_template_candidates.find(txid) != txpool.m_template_candidates.end();
+  }
+};
+
+namespace
+{
+
+class TestDB: public cryptonote::BaseTestDB
+{
+public:
+  TestDB() { m_open = true; }
+
+  virtual void add_block( const cryptonote::block& blk
+                        , size_t block_weight
+                        , uint64_t long_term_block_weight
+                        , const cryptonote::difficulty_type& cumulative_difficulty
+                        , const uint64_t& coins_generated
+                        , uint64_t num_rct_outs
+                        , const crypto::hash& blk_hash
+                        ) override {
+    blocks.push_back({});
+  }
+  virtual uint64_t height() const override { return blocks.size(); }
+  virtual size_t get_block_weight(const uint64_t &h) const override { return 0; }
+  virtual uint64_t get_block_long_term_weight(const uint64_t &h) const override { return 0; }
+  virtual std::vector<uint64_t> get_block_weights(uint64_t start_height, size_t count) const override {
+    return std::vector<uint64_t>(std::min<uint64_t>(count, blocks.size() - std::min<uint64_t>(start_height, blocks.size())), 0);
+  }
+  virtual std::vector<uint64_t> get_long_term_block_weights(uint64_t start_height, size_t count) const override {
+    return get_block_weights(start_height, count);
+  }
+  virtual crypto::hash get_block_hash_from_height(const uint64_t &height) const override {
+    // the pool compares these against null_hash, so keep them all non null
+    crypto::hash hash = crypto::null_hash;
+    *(uint64_t*)&hash = height + 1;
+    return hash;
+  }
+  virtual crypto::hash top_block_hash(uint64_t *block_height = NULL) const override {
+    const uint64_t h = height();
+    if (block_height)
+      *block_height = h - 1;
+    return h ? get_block_hash_from_height(h - 1) : crypto::null_hash;
+  }
+  virtual void pop_block(cryptonote::block &blk, std::vector<cryptonote::transaction> &txs) override { blocks.pop_back(); }
+  virtual bool has_key_image(const crypto::key_image& img) const override {
+    for (const auto &b: blocks)
+      if (std::find(b.begin(), b.end(), img) != b.end())
+        return true;
+    return false;
+  }
+
+  virtual void add_txpool_tx(const crypto::hash &txid, const cryptonote::blobdata_ref &blob, const cryptonote::txpool_tx_meta_t& details) override {
+    txpool[txid] = std::make_pair(details, cryptonote::blobdata(blob.data(), blob.size()));
+  }
+  virtual void update_txpool_tx(const crypto::hash &txid, const cryptonote::txpool_tx_meta_t& details) override { txpool[txid].first = details; }
+  virtual uint64_t get_txpool_tx_count(cryptonote::relay_category tx_relay = cryptonote::relay_category::broadcasted) const override { return txpool.size(); }
+  virtual bool txpool_has_tx(const crypto::hash &txid, cryptonote::relay_category tx_category) const override { return txpool.find(txid) != txpool.end(); }
+  virtual void remove_txpool_tx(const crypto::hash& txid) override { txpool.erase(txid); }
+  virtual bool get_txpool_tx_meta(const crypto::hash& txid, cryptonote::txpool_tx_meta_t &meta) const override {
+    const auto i = txpool.find(txid);
+    if (i == txpool.end())
+      return false;
+    meta = i->second.first;
+    return true;
+  }
+  virtual bool get_txpool_tx_blob(const crypto::hash& txid, cryptonote::blobdata &bd, cryptonote::relay_category tx_category) const override {
+    const auto i = txpool.find(txid);
+    if (i == txpool.end())
+      return false;
+    bd = i->second.second;
+    return true;
+  }
+  virtual cryptonote::blobdata get_txpool_tx_blob(const crypto::hash& txid, cryptonote::relay_category tx_category) const override {
+    cryptonote::blobdata bd;
+    get_txpool_tx_blob(txid, bd, tx_category);
+    return bd;
+  }
+
+  // a block, as far as the pool is concerned: the key images it spends
+  void push_test_block(const std::vector<crypto::key_image> &spent) { blocks.push_back(spent); }
+
+private:
+  std::vector<std::vector<crypto::key_image>> blocks;
+  std::unordered_map<crypto::hash, std::pair<cryptonote::txpool_tx_meta_t, cryptonote::blobdata>> txpool;
+};
+
+crypto::key_image make_key_image(uint8_t n)
+{
+  crypto::key_image ki = AUTO_VAL_INIT(ki);
+  ki.data[0] = n;
+  return ki;
+}
+
+// a v1 tx spending a single key image, which only needs to get through the pool's own checks
+cryptonote::transaction make_tx(const crypto::key_image &ki, uint64_t fee)
+{
+  cryptonote::transaction tx;
+  tx.version = 1;
+  tx.unlock_time = 0;
+  cryptonote::txin_to_key in;
+  in.amount = 10 * COIN + fee;
+  in.key_offsets.push_back(0);
+  in.k_image = ki;
+  tx.vin.push_back(in);
+  cryptonote::tx_out out;
+  out.amount = 10 * COIN;
+  out.target = cryptonote::txout_to_key(crypto::null_pkey);
+  tx.vout.push_back(out);
+  tx.signatures.resize(1);
+  tx.signatures[0].resize(1);
+  return tx;
+}
+
+class TxPoolTemplate: public ::testing::Test
+{
+protected:
+  TxPoolTemplate(): txpool(bc), bc(txpool), db(new TestDB()), hard_forks{std::make_pair(1, (uint64_t)0), std::make_pair((uint8_t)0, (uint64_t)0)}, test_options{hard_forks, 5000} {}
+
+  virtual void SetUp() override
+  {
+    ASSERT_TRUE(bc.init(db, cryptonote::FAKECHAIN, true, &test_options, 0, NULL));
+  }
+
+  crypto::hash add_tx(const crypto::key_image &ki, uint64_t fee, cryptonote::relay_method tx_relay = cryptonote::relay_method::fluff, uint64_t inputs_height = 0)
+  {
+    cryptonote::transaction tx = make_tx(ki, fee);
+    const crypto::hash txid = cryptonote::get_transaction_hash(tx);
+    const cryptonote::blobdata blob = cryptonote::tx_to_blob(tx);
+    if (tx_relay != cryptonote::relay_method::block)
+      txpool_accessor_test::set_inputs_checked(txpool, txid, inputs_height, db->get_block_hash_from_height(inputs_height));
+    cryptonote::tx_verification_context tvc{};
+    EXPECT_TRUE(txpool.add_tx(tx, txid, blob, cryptonote::get_transaction_weight(tx, blob.size()), tvc, tx_relay, tx_relay != cryptonote::relay_method::block, 1));
+    EXPECT_TRUE(tvc.m_added_to_pool);
+    return txid;
+  }
+
+  // precheck_tx on the tx, then add_tx on it as it comes from the network
+  std::pair<bool, bool> precheck_and_add_tx(const cryptonote::transaction &tx, size_t tx_weight = 0)
+  {
+    cryptonote::transaction added = tx;
+    const crypto::hash txid = cryptonote::get_transaction_hash(tx);
+    const cryptonote::blobdata blob = cryptonote::tx_to_blob(tx);
+    if (!tx_weight)
+      tx_weight = cryptonote::get_transaction_weight(tx, blob.size());
+    const bool prechecked = txpool.precheck_tx(tx, txid, tx_weight, 1);
+    txpool_accessor_test::set_inputs_checked(txpool, txid, 0, db->get_block_hash_from_height(0));
+    cryptonote::tx_verification_context tvc{};
+    const bool added_to_pool = txpool.add_tx(added, txid, blob, tx_weight, tvc, cryptonote::relay_method::fluff, true, 1) && tvc.m_added_to_pool && txpool.have_tx(txid, cryptonote::relay_category::all);
+    return std::make_pair(prechecked, added_to_pool);
+  }
+
+  bool take_tx(const crypto::hash &txid)
+  {
+    cryptonote::transaction tx;
+    cryptonote::blobdata txblob;
+    size_t tx_weight;
+    uint64_t fee;
+    bool relayed, do_not_relay, double_spend_seen, pruned;
+    return txpool.take_tx(txid, tx, txblob, tx_weight, fee, relayed, do_not_relay, double_spend_seen, pruned);
+  }
+
+  std::vector<crypto::hash> fill()
+  {
+    cryptonote::block bl;
+    size_t total_weight;
+    uint64_t fee, expected_reward;
+    EXPECT_TRUE(txpool.fill_block_template(bl, 300000, 0, total_weight, fee, expected_reward, 1));
+    return bl.tx_hashes;
+  }
+
+  // mines the given pool txes, and any key images spent by txes from elsewhere
+  void add_block(const std::vector<crypto::hash> &txids, const std::vector<crypto::key_image> &spent)
+  {
+    for (const crypto::hash &txid: txids)
+      ASSERT_TRUE(take_tx(txid));
+    db->push_test_block(spent);
+    txpool.on_blockchain_inc(db->height(), db->top_block_hash());
+  }
+
+  void pop_block()
+  {
+    cryptonote::block b;
+    std::vector<cryptonote::transaction> txs;
+    db->pop_block(b, txs);
+    txpool.on_blockchain_dec(db->height(), db->top_block_hash());
+  }
+
+  cryptonote::tx_memory_pool txpool;
+  cryptonote::Blockchain bc;
+  TestDB *db;
+  const std::pair<uint8_t, uint64_t> hard_forks[2];
+  const cryptonote::test_options test_options;
+};
+
+}
+
+TEST_F(TxPoolTemplate, removed_tx_leaves_template)
+{
+  const crypto::hash a = add_tx(make_key_image(1), 4 * COIN);
+  const crypto::hash b = add_tx(make_key_image(2), 5 * COIN);
+  ASSERT_EQ(fill(), std::vector<crypto::hash>({b, a}));
+  ASSERT_TRUE(txpool_accessor_test::has_template_candidate(txpool, a));
+
+  ASSERT_TRUE(take_tx(a));
+  ASSERT_FALSE(txpool_accessor_test::has_template_candidate(txpool, a));
+  ASSERT_EQ(fill(), std::vector<crypto::hash>({b}));
+}
+
+TEST_F(TxPoolTemplate, key_image_spent_by_block)
+{
+  const crypto::hash a = add_tx(make_key_image(1), 4 * COIN);
+  const crypto::hash b = add_tx(make_key_image(2), 5 * COIN);
+  ASSERT_EQ(fill(), std::vector<crypto::hash>({b, a}));
+
+  // a block comes in with another tx spending a's key image
+  const crypto::hash c = add_tx(make_key_image(1), 3 * COIN, cryptonote::relay_method::block);
+  ASSERT_TRUE(take_tx(c));
+  ASSERT_FALSE(txpool_accessor_test::has_template_candidate(txpool, a));
+  ASSERT_TRUE(txpool_accessor_test::has_template_candidate(txpool, b));
+  db->push_test_block({make_key_image(1)});
+  txpool.on_blockchain_inc(db->height(), db->top_block_hash());
+
+  txpool_accessor_test::set_inputs_checked(txpool, a, 0, db->get_block_hash_from_height(0));
+  ASSERT_EQ(fill(), std::vector<crypto::hash>({b}));
+
+  // mining a pool tx leaves the rest of the template alone
+  const crypto::hash d = add_tx(make_key_image(3), 6 * COIN);
+  ASSERT_EQ(fill(), std::vector<crypto::hash>({d, b}));
+  add_block({d}, {make_key_image(3)});
+  txpool_accessor_test::set_inputs_checked(txpool, b, 0, db->get_block_hash_from_height(0));
+  ASSERT_EQ(fill(), std::vector<crypto::hash>({b}));
+}
+
+TEST_F(TxPoolTemplate, reorg)
+{
+  add_block({}, {});
+  const crypto::hash a = add_tx(make_key_image(1), 4 * COIN);
+  // spends an output from the block which is about to be popped
+  const crypto::hash b = add_tx(make_key_image(2), 5 * COIN, cryptonote::relay_method::fluff, 1);
+  ASSERT_EQ(fill(), std::vector<crypto::hash>({b, a}));
+
+  const crypto::hash c = add_tx(make_key_image(1), 3 * COIN, cryptonote::relay_method::block);
+  add_block({c}, {make_key_image(1)});
+  txpool_accessor_test::set_inputs_checked(txpool, a, 0, db->get_block_hash_from_height(0));
+  txpool_accessor_test::set_inputs_checked(txpool, b, 1, db->get_block_hash_from_height(1));
+  ASSERT_EQ(fill(), std::vector<crypto::hash>({b}));
+
+  // both blocks go: c returns to the pool, a's key image is unspent again
+  // and b's inputs are gone
+  pop_block();
+  ASSERT_EQ(c, add_tx(make_key_image(1), 3 * COIN, cryptonote::relay_method::block));
+  pop_block();
+  txpool_accessor_test::set_inputs_checked(txpool, a, 0, db->get_block_hash_from_height(0));
+  ASSERT_EQ(fill(), std::vector<crypto::hash>({a}));
+}
+
+TEST_F(TxPoolTemplate, precheck_matches_add_tx)
+{
+  typedef std::pair<bool, bool> result;
+  const result rejected(false, false);
+
+  cryptonote::transaction tx = make_tx(make_key_image(1), 0);
+  tx.version = 0;
+  EXPECT_EQ(precheck_and_add_tx(tx), rejected);
+
+  tx = make_tx(make_key_image(1), 4 * COIN);
+  tx.vin[0] = cryptonote::txin_gen{0};
+  EXPECT_EQ(precheck_and_add_tx(tx), rejected);
+
+  tx = make_tx(make_key_image(1), 4 * COIN);
+  tx.vout[0].amount = 20 * COIN;
+  EXPECT_EQ(precheck_and_add_tx(tx), rejected);
+
+  EXPECT_EQ(precheck_and_add_tx(make_tx(make_key_image(1), 0)), rejected);
+  EXPECT_EQ(precheck_and_add_tx(make_tx(make_key_image(1), 1)), rejected);
+  EXPECT_EQ(precheck_and_add_tx(make_tx(make_key_image(1), 4 * COIN), 1000000), rejected);
+
+  EXPECT_EQ(precheck_and_add_tx(make_tx(make_key_image(1), 4 * COIN)), result(true, true));
+  EXPECT_EQ(precheck_and_add_tx(make_tx(make_key_image(1), 5 * COIN)), rejected);
+
+  // a full pool: a tx which would be pruned at once is not worth checking
+  txpool.set_txpool_max_weight(txpool.get_txpool_weight());
+  EXPECT_EQ(precheck_and_add_tx(make_tx(make_key_image(2), 3 * COIN)), rejected);
+  EXPECT_EQ(precheck_and_add_tx(make_tx(make_key_image(2), 6 * COIN)), result(true, true));
+
+  // add_tx leaves key images spent on chain to check_tx_inputs
+  db->push_test_block({make_key_image(3)});
+  txpool.on_blockchain_inc(db->height(), db->top_block_hash());
+  EXPECT_FALSE(precheck_and_add_tx(make_tx(make_key_image(3), 4 * COIN)).first);
+}
@@ -0,0 +1,326 @@
+// Copyright (c) 2019-2021 WAZN Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#define IN_UNIT_TESTS
+
+#include "gtest/gtest.h"
+#include "cryptonote_basic/account.h"
+#include "cryptonote_basic/cryptonote_format_utils.h"
+#include "cryptonote_core/blockchain.h"
+#include "cryptonote_core/tx_pool.h"
+#include "cryptonote_core/cryptonote_core.h"
+#include "cryptonote_core/cryptonote_tx_utils.h"
+#include "cryptonote_protocol/cryptonote_protocol_defs.h"
+#include "blockchain_db/testdb.h"
+#include "ringct/rctOps.h"
+
+#define RING_SIZE 4
+#define NUM_TXES 3
+
+namespace
+{
+
+// a chain of bare blocks, and a single amount's outputs to build rings from
+class TestDB: public cryptonote::BaseTestDB
+{
+public:
+  TestDB() { m_open = true; }
+
+  virtual void add_block( const cryptonote::block& blk
+                        , size_t block_weight
+                        , uint64_t long_term_block_weight
+                        , const cryptonote::difficulty_type& cumulative_difficulty
+                        , const uint64_t& coins_generated
+                        , uint64_t num_rct_outs
+                        , const crypto::hash& blk_hash
+                        ) override {
+    blocks.push_back(blk_hash);
+  }
+  virtual uint64_t height() const override { return blocks.size(); }
+  virtual size_t get_block_weight(const uint64_t &h) const override { return 0; }
+  virtual uint64_t get_block_long_term_weight(const uint64_t &h) const override { return 0; }
+  virtual std::vector<uint64_t> get_block_weights(uint64_t start_height, size_t count) const override {
+    return std::vector<uint64_t>(std::min<uint64_t>(count, blocks.size() - std::min<uint64_t>(start_height, blocks.size())), 0);
+  }
+  virtual std::vector<uint64_t> get_long_term_block_weights(uint64_t start_height, size_t count) const override {
+    return get_block_weights(start_height, count);
+  }
+  virtual crypto::hash get_block_hash_from_height(const uint64_t &height) const override {
+    return height < blocks.size() ? blocks[height] : crypto::null_hash;
+  }
+  virtual crypto::hash top_block_hash(uint64_t *block_height = NULL) const override {
+    const uint64_t h = height();
+    if (block_height)
+      *block_height = h - 1;
+    return h ? blocks[h - 1] : crypto::null_hash;
+  }
+
+  virtual uint64_t get_num_outputs(const uint64_t& amount) const override { return amount == output_amount ? outputs.size() : 0; }
+  virtual cryptonote::output_data_t get_output_key(const uint64_t& amount, const uint64_t& index, bool include_commitmemt) const override {
+    if (amount != output_amount || index >= outputs.size())
+      throw cryptonote::OUTPUT_DNE();
+    return outputs[index];
+  }
+  virtual void get_output_key(const epee::span<const uint64_t> &amounts, const std::vector<uint64_t> &offsets, std::vector<cryptonote::output_data_t> &outputs, bool allow_partial = false) const override {
+    outputs.clear();
+    outputs.reserve(offsets.size());
+    for (size_t i = 0; i < offsets.size(); ++i)
+    {
+      const uint64_t amount = amounts.size() == 1 ? amounts[0] : amounts[i];
+      if (amount != output_amount || offsets[i] >= this->outputs.size())
+      {
+        if (allow_partial)
+          return;
+        throw cryptonote::OUTPUT_DNE();
+      }
+      outputs.push_back(this->outputs[offsets[i]]);
+    }
+  }
+
+  void add_output(uint64_t amount, const crypto::public_key &key)
+  {
+    output_amount = amount;
+    cryptonote::output_data_t od;
+    od.pubkey = key;
+    od.unlock_time = 0;
+    od.height = 0;
+    od.commitment = rct::zeroCommit(amount);
+    outputs.push_back(od);
+  }
+  cryptonote::output_data_t &output(size_t n) { return outputs[n]; }
+
+private:
+  std::vector<crypto::hash> blocks;
+  uint64_t output_amount;
+  std::vector<cryptonote::output_data_t> outputs;
+};
+
+class VerifiedTxs: public ::testing::Test
+{
+protected:
+  VerifiedTxs(): txpool(bc), bc(txpool), db(new TestDB()), hard_forks{std::make_pair(1, (uint64_t)0), std::make_pair((uint8_t)0, (uint64_t)0)}, test_options{hard_forks, 5000} {}
+
+  virtual void SetUp() override
+  {
+    ASSERT_TRUE(bc.init(db, cryptonote::FAKECHAIN, true, &test_options, 0, NULL));
+
+    // one miner output per ring member, NUM_TXES rings of RING_SIZE
+    miners.resize(RING_SIZE * NUM_TXES);
+    miner_txes.resize(miners.size());
+    for (size_t n = 0; n < miners.size(); ++n)
+    {
+      miners[n].generate();
+      ASSERT_TRUE(cryptonote::construct_miner_tx(0, 0, 0, 2, 0, miners[n].get_keys().m_account_address, miner_txes[n]));
+      ASSERT_EQ(miner_txes[n].vout[0].amount, miner_txes[0].vout[0].amount);
+      db->add_output(miner_txes[n].vout[0].amount, boost::get<cryptonote::txout_to_key>(miner_txes[n].vout[0].target).key);
+    }
+    alice.generate();
+  }
+
+  // a CLSAG tx spending the second member of ring n, with a single output
+  // so its bulletproof is valid before v8
+  cryptonote::transaction make_tx(size_t n)
+  {
+    const size_t real = 1;
+    const size_t first = n * RING_SIZE;
+    const uint64_t amount = miner_txes[0].vout[0].amount;
+
+    cryptonote::tx_source_entry src;
+    src.amount = amount;
+    src.real_out_tx_key = cryptonote::get_tx_pub_key_from_extra(miner_txes[first + real]);
+    src.real_output_in_tx_index = 0;
+    for (size_t i = 0; i < RING_SIZE; ++i)
+      src.outputs.push_back(std::make_pair(first + i, rct::ctkey({rct::pk2rct(db->output(first + i).pubkey), db->output(first + i).commitment})));
+    src.real_output = real;
+    src.mask = rct::identity();
+    src.rct = false;
+    std::vector<cryptonote::tx_source_entry> sources{src};
+
+    std::vector<cryptonote::tx_destination_entry> destinations;
+    destinations.push_back(cryptonote::tx_destination_entry(amount / 2, alice.get_keys().m_account_address, false));
+
+    const cryptonote::account_keys &keys = miners[first + real].get_keys();
+    std::unordered_map<crypto::public_key, cryptonote::subaddress_index> subaddresses;
+    subaddresses[keys.m_account_address.m_spend_public_key] = {0, 0};
+    cryptonote::transaction tx;
+    crypto::secret_key tx_key;
+    std::vector<crypto::secret_key> additional_tx_keys;
+    EXPECT_TRUE(cryptonote::construct_tx_and_get_tx_key(keys, subaddresses, sources, destinations, cryptonote::account_public_address{}, std::vector<uint8_t>(), tx, 0, tx_key, additional_tx_keys, true, {rct::RangeProofPaddedBulletproof, 3}));
+    EXPECT_EQ(tx.rct_signatures.type, rct::RCTTypeCLSAG);
+    return tx;
+  }
+
+  static void break_signature(cryptonote::transaction &tx)
+  {
+    tx.rct_signatures.p.CLSAGs[0].s[0] = rct::skGen();
+    tx.invalidate_hashes();
+  }
+
+  // blocks on top of the chain, each with its share of the given txes
+  std::vector<cryptonote::block_complete_entry> make_span(const std::vector<std::vector<cryptonote::transaction>> &blocks_txes)
+  {
+    std::vector<cryptonote::block_complete_entry> entries;
+    crypto::hash prev_id = db->top_block_hash();
+    uint64_t height = db->height();
+    for (const auto &txes: blocks_txes)
+    {
+      cryptonote::block b;
+      b.major_version = 1;
+      b.minor_version = 0;
+      b.timestamp = 0;
+      b.nonce = 0;
+      b.prev_id = prev_id;
+      EXPECT_TRUE(cryptonote::construct_miner_tx(height++, 0, 0, 2, 0, alice.get_keys().m_account_address, b.miner_tx));
+      entries.emplace_back();
+      cryptonote::block_complete_entry &entry = entries.back();
+      entry.pruned = false;
+      entry.block_weight = 0;
+      for (const cryptonote::transaction &tx: txes)
+      {
+        b.tx_hashes.push_back(cryptonote::get_transaction_hash(tx));
+        entry.txs.push_back(cryptonote::tx_blob_entry(cryptonote::tx_to_blob(tx)));
+      }
+      entry.block = cryptonote::block_to_blob(b);
+      prev_id = cryptonote::get_block_hash(b);
+    }
+    return entries;
+  }
+
+  bool prepare(const std::vector<cryptonote::block_complete_entry> &entries)
+  {
+    std::vector<cryptonote::block> blocks;
+    return bc.prepare_handle_incoming_blocks(entries, blocks);
+  }
+
+  // what check_tx_inputs makes of the tx as it comes from a blob
+  bool check_tx_inputs(const cryptonote::transaction &tx)
+  {
+    cryptonote::transaction parsed;
+    if (!cryptonote::parse_and_validate_tx_from_blob(cryptonote::tx_to_blob(tx), parsed))
+      return false;
+    cryptonote::tx_verification_context tvc{};
+    return bc.check_tx_inputs(parsed, tvc);
+  }
+
+  cryptonote::tx_memory_pool txpool;
+  cryptonote::Blockchain bc;
+  TestDB *db;
+  const std::pair<uint8_t, uint64_t> hard_forks[2];
+  const cryptonote::test_options test_options;
+  std::vector<cryptonote::account_base> miners;
+  std::vector<cryptonote::transaction> miner_txes;
+  cryptonote::account_base alice;
+};
+
+}
+
+TEST_F(VerifiedTxs, span_with_bad_signature)
+{
+  std::vector<cryptonote::transaction> txes;
+  for (size_t n = 0; n < NUM_TXES; ++n)
+    txes.push_back(make_tx(n));
+  break_signature(txes[1]);
+
+  ASSERT_TRUE(prepare(make_span({{txes[0], txes[1]}, {txes[2]}})));
+  // the batch fails as a whole, so no tx may skip its own check
+  ASSERT_TRUE(bc.m_batch_verified_txs.empty());
+  EXPECT_TRUE(check_tx_inputs(txes[0]));
+  EXPECT_FALSE(check_tx_inputs(txes[1]));
+  EXPECT_TRUE(check_tx_inputs(txes[2]));
+  ASSERT_TRUE(bc.cleanup_handle_incoming_blocks());
+}
+
+TEST_F(VerifiedTxs, span_verified_set_is_cleared)
+{
+  std::vector<cryptonote::transaction> txes;
+  for (size_t n = 0; n < NUM_TXES; ++n)
+    txes.push_back(make_tx(n));
+
+  ASSERT_TRUE(prepare(make_span({{txes[0]}, {txes[1], txes[2]}})));
+  ASSERT_EQ(bc.m_batch_verified_txs.size(), NUM_TXES);
+  for (const cryptonote::transaction &tx: txes)
+  {
+    ASSERT_EQ(bc.m_batch_verified_txs.count(cryptonote::get_transaction_hash(tx)), 1);
+    EXPECT_TRUE(check_tx_inputs(tx));
+  }
+  ASSERT_TRUE(bc.cleanup_handle_incoming_blocks());
+  ASSERT_TRUE(bc.m_batch_verified_txs.empty());
+
+  // the same tx against other rings now gets its signature checked
+  db->output(1).pubkey = rct::rct2pk(rct::pkGen());
+  EXPECT_FALSE(check_tx_inputs(txes[0]));
+
+  // a span the scan table rejects leaves nothing behind either
+  ASSERT_TRUE(prepare(make_span({{txes[1], txes[2]}})));
+  ASSERT_EQ(bc.m_batch_verified_txs.size(), 2);
+  ASSERT_TRUE(bc.cleanup_handle_incoming_blocks());
+  ASSERT_FALSE(prepare(make_span({{txes[1], txes[1]}})));
+  ASSERT_TRUE(bc.m_batch_verified_txs.empty());
+  ASSERT_TRUE(bc.cleanup_handle_incoming_blocks());
+}
+
+TEST_F(VerifiedTxs, preverified_tx_skips_signature_check)
+{
+  cryptonote::transaction tx = make_tx(0);
+  cryptonote::transaction bad = tx;
+  break_signature(bad);
+  const crypto::hash txid = cryptonote::get_transaction_hash(tx);
+  const crypto::hash bad_txid = cryptonote::get_transaction_hash(bad);
+
+  std::vector<cryptonote::transaction> txes{tx, bad};
+  bc.preverify_tx_signatures({&txes[0], &txes[1]});
+  ASSERT_EQ(bc.m_preverified_txs.size(), 1);
+  ASSERT_EQ(bc.m_preverified_txs.count(txid), 1);
+  EXPECT_TRUE(check_tx_inputs(tx));
+  EXPECT_FALSE(check_tx_inputs(bad));
+
+  // remembered against the same rings, the bad signature is not checked again
+  const crypto::hash ring_hash = bc.m_preverified_txs[txid];
+  bc.m_preverified_txs[bad_txid] = ring_hash;
+  EXPECT_TRUE(check_tx_inputs(bad));
+
+  // any other rings get the full check
+  bc.m_preverified_txs[bad_txid] = crypto::null_hash;
+  EXPECT_FALSE(check_tx_inputs(bad));
+  bc.m_preverified_txs[bad_txid] = ring_hash;
+
+  const cryptonote::output_data_t member = db->output(2);
+  db->output(2).pubkey = rct::rct2pk(rct::pkGen());
+  EXPECT_FALSE(check_tx_inputs(bad));
+  db->output(2) = member;
+  db->output(2).commitment = rct::zeroCommit(1);
+  EXPECT_FALSE(check_tx_inputs(bad));
+  db->output(2) = member;
+  EXPECT_TRUE(check_tx_inputs(bad));
+
+  bc.forget_preverified_txs({txid, bad_txid});
+  EXPECT_TRUE(bc.m_preverified_txs.empty());
+  EXPECT_FALSE(check_tx_inputs(bad));
+  EXPECT_TRUE(check_tx_inputs(tx));
+}
@@ -0,0 +1,307 @@
+// Copyright (c) 2019-2021 WAZN Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <boost/filesystem.hpp>
+#include "gtest/gtest.h"
+#include "file_io_utils.h"
+#include "crypto/crypto.h"
+#include "wallet/wallet_cache.h"
+
+namespace
+{
+  crypto::chacha_key make_key()
+  {
+    crypto::chacha_key key;
+    const crypto::hash h = crypto::rand<crypto::hash>();
+    static_assert(sizeof(h) == sizeof(key), "Unexpected key size");
+    memcpy(key.data(), &h, sizeof(h));
+    return key;
+  }
+
+  class wallet_cache: public ::testing::Test
+  {
+  protected:
+    wallet_cache():
+      path((boost::filesystem::temp_directory_path() / boost::filesystem::unique_path()).string()),
+      key(make_key())
+    {
+    }
+
+    ~wallet_cache()
+    {
+      boost::system::error_code ec;
+      boost::filesystem::remove(path, ec);
+      boost::filesystem::remove(path + ".new", ec);
+    }
+
+    std::string read(tools::wallet_cache_file &cache, tools::wallet_cache_file::record_type type, uint64_t id)
+    {
+      std::string data;
+      EXPECT_TRUE(cache.read(type, id, data, key));
+      return data;
+    }
+
+    const std::string path;
+    const crypto::chacha_key key;
+  };
+
+  std::string make_record(char c, size_t size)
+  {
+    return std::string(size, c);
+  }
+}
+
+TEST_F(wallet_cache, round_trip)
+{
+  ASSERT_FALSE(tools::wallet_cache_file::is_cache_file(path));
+
+  tools::wallet_cache_file cache;
+  cache.write(tools::wallet_cache_file::record_state, 0, "state", key);
+  for (uint64_t i = 0; i < 5; ++i)
+    cache.write(tools::wallet_cache_file::record_transfers, i, make_record('a' + i, 1000 + i), key);
+  cache.write(tools::wallet_cache_file::record_blockchain, 7, make_record('z', 64), key);
+  ASSERT_TRUE(cache.commit(path, key));
+  ASSERT_TRUE(tools::wallet_cache_file::is_cache_file(path));
+
+  tools::wallet_cache_file loaded;
+  ASSERT_TRUE(loaded.open(path, key));
+  ASSERT_EQ(loaded.count(tools::wallet_cache_file::record_state), 1);
+  ASSERT_EQ(loaded.count(tools::wallet_cache_file::record_transfers), 5);
+  ASSERT_EQ(loaded.count(tools::wallet_cache_file::record_blockchain), 8);
+  ASSERT_EQ(read(loaded, tools::wallet_cache_file::record_state, 0), "state");
+  for (uint64_t i = 0; i < 5; ++i)
+    ASSERT_EQ(read(loaded, tools::wallet_cache_file::record_transfers, i), make_record('a' + i, 1000 + i));
+  ASSERT_EQ(read(loaded, tools::wallet_cache_file::record_blockchain, 7), make_record('z', 64));
+  std::string data;
+  ASSERT_FALSE(loaded.read(tools::wallet_cache_file::record_blockchain, 6, data, key));
+
+  // records are encrypted
+  std::string file;
+  ASSERT_TRUE(epee::file_io_utils::load_file_to_string(path, file));
+  ASSERT_EQ(file.find("state"), std::string::npos);
+  ASSERT_EQ(file.find(make_record('a', 1000)), std::string::npos);
+}
+
+TEST_F(wallet_cache, wrong_key)
+{
+  tools::wallet_cache_file cache;
+  cache.write(tools::wallet_cache_file::record_state, 0, "state", key);
+  ASSERT_TRUE(cache.commit(path, key));
+
+  tools::wallet_cache_file loaded;
+  ASSERT_FALSE(loaded.open(path, make_key()));
+  ASSERT_TRUE(loaded.open(path, key));
+}
+
+TEST_F(wallet_cache, buffer)
+{
+  tools::wallet_cache_file cache;
+  cache.write(tools::wallet_cache_file::record_state, 0, "state", key);
+  cache.write(tools::wallet_cache_file::record_transfers, 0, make_record('a', 1000), key);
+  ASSERT_TRUE(cache.commit(path, key));
+
+  std::string file;
+  ASSERT_TRUE(epee::file_io_utils::load_file_to_string(path, file));
+  ASSERT_TRUE(tools::wallet_cache_file::is_cache_buffer(file));
+  ASSERT_FALSE(tools::wallet_cache_file::is_cache_buffer(std::string(100, 'a')));
+  ASSERT_FALSE(tools::wallet_cache_file::is_cache_buffer(std::string()));
+
+  tools::wallet_cache_file loaded;
+  ASSERT_FALSE(loaded.open_buffer(file, make_key()));
+  ASSERT_TRUE(loaded.open_buffer(file, key));
+  ASSERT_EQ(read(loaded, tools::wallet_cache_file::record_state, 0), "state");
+  ASSERT_EQ(read(loaded, tools::wallet_cache_file::record_transfers, 0), make_record('a', 1000));
+
+  // no file holds the records, so unchanged ones are written again, and
+  // the commit fails rather than lose any which are not
+  loaded.unmap();
+  ASSERT_TRUE(boost::filesystem::remove(path));
+  loaded.write(tools::wallet_cache_file::record_state, 0, "state", key);
+  ASSERT_FALSE(loaded.commit(path, key));
+  loaded.write(tools::wallet_cache_file::record_transfers, 0, make_record('a', 1000), key);
+  ASSERT_TRUE(loaded.commit(path, key));
+  ASSERT_GT(loaded.last_commit_size(), 1005);
+
+  tools::wallet_cache_file reloaded;
+  ASSERT_TRUE(reloaded.open(path, key));
+  ASSERT_EQ(read(reloaded, tools::wallet_cache_file::record_state, 0), "state");
+  ASSERT_EQ(read(reloaded, tools::wallet_cache_file::record_transfers, 0), make_record('a', 1000));
+}
+
+TEST_F(wallet_cache, change_key)
+{
+  tools::wallet_cache_file cache;
+  cache.write(tools::wallet_cache_file::record_state, 0, "state", key);
+  cache.write(tools::wallet_cache_file::record_transfers, 0, make_record('a', 10000), key);
+  ASSERT_TRUE(cache.commit(path, key));
+
+  // every record has to be written again under the new key
+  const crypto::chacha_key new_key = make_key();
+  cache.write(tools::wallet_cache_file::record_state, 0, "state", new_key);
+  ASSERT_FALSE(cache.commit(path, new_key));
+  cache.write(tools::wallet_cache_file::record_transfers, 0, make_record('a', 10000), new_key);
+  ASSERT_TRUE(cache.commit(path, new_key));
+  ASSERT_GE(cache.last_commit_size(), 10000);
+
+  tools::wallet_cache_file loaded;
+  ASSERT_FALSE(loaded.open(path, key));
+  ASSERT_TRUE(loaded.open(path, new_key));
+  std::string data;
+  ASSERT_TRUE(loaded.read(tools::wallet_cache_file::record_transfers, 0, data, new_key));
+  ASSERT_EQ(data, make_record('a', 10000));
+}
+
+TEST_F(wallet_cache, writes_only_changed_records)
+{
+  tools::wallet_cache_file cache;
+  for (uint64_t i = 0; i < 10; ++i)
+    cache.write(tools::wallet_cache_file::record_transfers, i, make_record('a' + i, 10000), key);
+  ASSERT_TRUE(cache.commit(path, key));
+  ASSERT_GE(cache.last_commit_size(), 100000);
+  const uint64_t size = boost::filesystem::file_size(path);
+
+  // nothing changed: only a new index is appended
+  tools::wallet_cache_file loaded;
+  ASSERT_TRUE(loaded.open(path, key));
+  loaded.unmap();
+  for (uint64_t i = 0; i < 10; ++i)
+    loaded.write(tools::wallet_cache_file::record_transfers, i, make_record('a' + i, 10000), key);
+  ASSERT_TRUE(loaded.commit(path, key));
+  ASSERT_LT(loaded.last_commit_size(), 1000);
+
+  // one record changed and one added
+  for (uint64_t i = 0; i < 10; ++i)
+    loaded.write(tools::wallet_cache_file::record_transfers, i, make_record(i == 4 ? 'X' : 'a' + i, 10000), key);
+  loaded.write(tools::wallet_cache_file::record_transfers, 10, make_record('Y', 5000), key);
+  ASSERT_TRUE(loaded.commit(path, key));
+  ASSERT_GE(loaded.last_commit_size(), 15000);
+  ASSERT_LT(loaded.last_commit_size(), 16000);
+  ASSERT_LT(boost::filesystem::file_size(path), size + 17000);
+
+  tools::wallet_cache_file reloaded;
+  ASSERT_TRUE(reloaded.open(path, key));
+  ASSERT_EQ(reloaded.count(tools::wallet_cache_file::record_transfers), 11);
+  for (uint64_t i = 0; i < 10; ++i)
+    ASSERT_EQ(read(reloaded, tools::wallet_cache_file::record_transfers, i), make_record(i == 4 ? 'X' : 'a' + i, 10000));
+  ASSERT_EQ(read(reloaded, tools::wallet_cache_file::record_transfers, 10), make_record('Y', 5000));
+}
+
+TEST_F(wallet_cache, keep)
+{
+  tools::wallet_cache_file cache;
+  for (uint64_t i = 0; i < 10; ++i)
+  {
+    cache.write(tools::wallet_cache_file::record_transfers, i, make_record('a', 10), key);
+    cache.write(tools::wallet_cache_file::record_blockchain, i, make_record('b', 10), key);
+  }
+  ASSERT_TRUE(cache.commit(path, key));
+  cache.keep(tools::wallet_cache_file::record_transfers, 0, 6);
+  cache.keep(tools::wallet_cache_file::record_blockchain, 3, 8);
+  cache.keep(tools::wallet_cache_file::record_state, 0, 0);
+  ASSERT_TRUE(cache.commit(path, key));
+
+  tools::wallet_cache_file loaded;
+  ASSERT_TRUE(loaded.open(path, key));
+  ASSERT_EQ(loaded.count(tools::wallet_cache_file::record_transfers), 6);
+  ASSERT_EQ(loaded.count(tools::wallet_cache_file::record_blockchain), 8);
+  std::string data;
+  for (uint64_t i = 0; i < 10; ++i)
+    ASSERT_EQ(loaded.read(tools::wallet_cache_file::record_blockchain, i, data, key), i >= 3 && i < 8);
+}
+
+TEST_F(wallet_cache, compaction)
+{
+  tools::wallet_cache_file cache;
+  cache.write(tools::wallet_cache_file::record_state, 0, make_record('s', 1000), key);
+  for (int n = 0; n < 50; ++n)
+  {
+    cache.write(tools::wallet_cache_file::record_transfers, 0, make_record('a' + n % 26, 10000 + n), key);
+    ASSERT_TRUE(cache.commit(path, key));
+    ASSERT_LT(boost::filesystem::file_size(path), 3 * (11000 + n));
+  }
+
+  tools::wallet_cache_file loaded;
+  ASSERT_TRUE(loaded.open(path, key));
+  ASSERT_EQ(read(loaded, tools::wallet_cache_file::record_state, 0), make_record('s', 1000));
+  ASSERT_EQ(read(loaded, tools::wallet_cache_file::record_transfers, 0), make_record('a' + 49 % 26, 10049));
+}
+
+TEST_F(wallet_cache, torn_header)
+{
+  // a large unchanged record, so the second commit appends
+  tools::wallet_cache_file cache;
+  cache.write(tools::wallet_cache_file::record_transfers, 0, make_record('a', 10000), key);
+  cache.write(tools::wallet_cache_file::record_state, 0, "first", key);
+  ASSERT_TRUE(cache.commit(path, key));
+  const uint64_t size = boost::filesystem::file_size(path);
+  cache.write(tools::wallet_cache_file::record_state, 0, "second", key);
+  ASSERT_TRUE(cache.commit(path, key));
+  ASSERT_GT(boost::filesystem::file_size(path), size);
+
+  {
+    tools::wallet_cache_file loaded;
+    ASSERT_TRUE(loaded.open(path, key));
+    ASSERT_EQ(read(loaded, tools::wallet_cache_file::record_state, 0), "second");
+  }
+
+  // damage the newest header, in the first slot, the previous commit is still readable
+  std::string file;
+  ASSERT_TRUE(epee::file_io_utils::load_file_to_string(path, file));
+  file[20] ^= 1;
+  ASSERT_TRUE(epee::file_io_utils::save_string_to_file(path, file));
+
+  tools::wallet_cache_file loaded;
+  ASSERT_TRUE(loaded.open(path, key));
+  ASSERT_EQ(read(loaded, tools::wallet_cache_file::record_state, 0), "first");
+
+  // and appending goes on from there
+  loaded.unmap();
+  loaded.write(tools::wallet_cache_file::record_state, 0, "third", key);
+  ASSERT_TRUE(loaded.commit(path, key));
+  tools::wallet_cache_file reloaded;
+  ASSERT_TRUE(reloaded.open(path, key));
+  ASSERT_EQ(read(reloaded, tools::wallet_cache_file::record_state, 0), "third");
+  ASSERT_EQ(read(reloaded, tools::wallet_cache_file::record_transfers, 0), make_record('a', 10000));
+}
+
+TEST_F(wallet_cache, corrupt_record)
+{
+  tools::wallet_cache_file cache;
+  cache.write(tools::wallet_cache_file::record_state, 0, make_record('s', 100), key);
+  ASSERT_TRUE(cache.commit(path, key));
+
+  std::string file;
+  ASSERT_TRUE(epee::file_io_utils::load_file_to_string(path, file));
+  file[128 + 10] ^= 1;
+  ASSERT_TRUE(epee::file_io_utils::save_string_to_file(path, file));
+
+  tools::wallet_cache_file loaded;
+  ASSERT_TRUE(loaded.open(path, key));
+  std::string data;
+  ASSERT_FALSE(loaded.read(tools::wallet_cache_file::record_state, 0, data, key));
+}
@@ -0,0 +1,185 @@
+// Copyright (c) 2019-2021 WAZN Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "gtest/gtest.h"
+
+#include <set>
+#include "string_tools.h"
+#include "cryptonote_basic/cryptonote_format_utils.h"
+#include "cryptonote_core/cryptonote_tx_utils.h"
+#include "device/device.hpp"
+#include "wallet/wallet2.h"
+
+namespace
+{
+  std::string found_output(const crypto::hash &txid, size_t index, const cryptonote::subaddress_index &subaddr_index)
+  {
+    return epee::string_tools::pod_to_hex(txid) + ":" + std::to_string(index) + ":" + std::to_string(subaddr_index.major) + "/" + std::to_string(subaddr_index.minor);
+  }
+
+  // the scan as it was before chunking: one derivation per tx key, then each output on its own
+  std::set<std::string> scan_per_output(const cryptonote::transaction &tx, const crypto::hash &txid, const crypto::secret_key &view_secret_key, const std::unordered_map<crypto::public_key, cryptonote::subaddress_index> &subaddresses)
+  {
+    hw::device &hwdev = hw::get_device("default");
+    std::set<std::string> found;
+    crypto::key_derivation derivation;
+    if (!hwdev.generate_key_derivation(cryptonote::get_tx_pub_key_from_extra(tx), view_secret_key, derivation))
+      return found;
+    std::vector<crypto::key_derivation> additional_derivations;
+    for (const crypto::public_key &pkey: cryptonote::get_additional_tx_pub_keys_from_extra(tx))
+    {
+      additional_derivations.push_back({});
+      if (!hwdev.generate_key_derivation(pkey, view_secret_key, additional_derivations.back()))
+        return found;
+    }
+    for (size_t k = 0; k < tx.vout.size(); ++k)
+    {
+      const crypto::public_key &key = boost::get<cryptonote::txout_to_key>(tx.vout[k].target).key;
+      const auto received = cryptonote::is_out_to_acc_precomp(subaddresses, key, derivation, additional_derivations, k, hwdev);
+      if (received)
+        found.insert(found_output(txid, k, received->index));
+    }
+    return found;
+  }
+}
+
+TEST(wallet_scan, chunked_matches_per_output)
+{
+  tools::wallet2 w(cryptonote::MAINNET, 1, true);
+  w.generate("", "");
+  // the scan starts from the first block here, not from the estimated chain height
+  w.set_refresh_from_block_height(0);
+  w.add_subaddress_account("");
+  w.add_subaddress(0, "");
+  ASSERT_EQ(w.get_account().get_device().get_type(), hw::device::SOFTWARE);
+  const cryptonote::account_public_address address = w.get_address();
+  const cryptonote::account_public_address subaddress_0_1 = w.get_subaddress({0, 1});
+  const cryptonote::account_public_address subaddress_1_0 = w.get_subaddress({1, 0});
+
+  cryptonote::account_base sender, other;
+  sender.generate();
+  other.generate();
+  const cryptonote::account_public_address other_address = other.get_keys().m_account_address;
+
+  // everything is spent from one output, the wallet does not look at inputs it does not own
+  cryptonote::transaction source_tx;
+  ASSERT_TRUE(cryptonote::construct_miner_tx(0, 0, 0, 0, 0, sender.get_keys().m_account_address, source_tx));
+  size_t source_index = 0;
+  for (size_t k = 1; k < source_tx.vout.size(); ++k)
+    if (source_tx.vout[k].amount > source_tx.vout[source_index].amount)
+      source_index = k;
+  const uint64_t amount = source_tx.vout[source_index].amount / 8;
+  ASSERT_GT(amount, 0);
+  cryptonote::tx_source_entry source{};
+  source.real_output = 0;
+  source.real_out_tx_key = cryptonote::get_tx_pub_key_from_extra(source_tx);
+  source.real_output_in_tx_index = source_index;
+  source.amount = source_tx.vout[source_index].amount;
+  source.rct = false;
+  source.mask = rct::identity();
+  source.push_output(0, boost::get<cryptonote::txout_to_key>(source_tx.vout[source_index].target).key, source.amount);
+  std::unordered_map<crypto::public_key, cryptonote::subaddress_index> sender_subaddresses;
+  sender_subaddresses[sender.get_keys().m_account_address.m_spend_public_key] = {0, 0};
+
+  // a mix of txes to the main address, to one subaddress alone (no
+  // additional tx keys), to subaddresses alongside others (additional tx
+  // keys), and to someone else only, over enough blocks to fill several chunks
+  const std::vector<std::vector<cryptonote::tx_destination_entry>> kinds = {
+    {{amount, address, false}, {amount, other_address, false}},
+    {{amount, subaddress_1_0, true}},
+    {{amount, subaddress_0_1, true}, {amount, other_address, false}, {amount, address, false}},
+    {{amount, other_address, false}},
+  };
+
+  // wallet heights start at its "genesis", which is the first block here
+  w.m_blockchain.clear();
+  std::vector<cryptonote::block_complete_entry> blocks;
+  std::vector<tools::wallet2::parsed_block> parsed_blocks;
+  std::set<std::string> expected;
+  uint64_t global_index = 0;
+  for (size_t height = 0; height < 8; ++height)
+  {
+    tools::wallet2::parsed_block pb;
+    pb.error = false;
+    pb.block.major_version = 1;
+    pb.block.minor_version = 1;
+    pb.block.timestamp = time(NULL);
+    pb.block.prev_id = parsed_blocks.empty() ? crypto::null_hash : parsed_blocks.back().hash;
+    pb.block.nonce = height;
+    ASSERT_TRUE(cryptonote::construct_miner_tx(height, 0, 0, 0, 0, other_address, pb.block.miner_tx));
+    cryptonote::block_complete_entry bce;
+    bce.pruned = false;
+    bce.block_weight = 0;
+    for (size_t n = 0; n < (height ? 12 : 0); ++n)
+    {
+      std::vector<cryptonote::tx_source_entry> sources(1, source);
+      std::vector<cryptonote::tx_destination_entry> destinations = kinds[n % kinds.size()];
+      cryptonote::transaction tx;
+      crypto::secret_key tx_key;
+      std::vector<crypto::secret_key> additional_tx_keys;
+      ASSERT_TRUE(cryptonote::construct_tx_and_get_tx_key(sender.get_keys(), sender_subaddresses, sources, destinations, boost::none, {}, tx, 0, tx_key, additional_tx_keys));
+      const crypto::hash txid = cryptonote::get_transaction_hash(tx);
+      const std::set<std::string> found = scan_per_output(tx, txid, w.get_account().get_keys().m_view_secret_key, w.m_subaddresses);
+      expected.insert(found.begin(), found.end());
+      pb.block.tx_hashes.push_back(txid);
+      bce.txs.push_back(cryptonote::tx_to_blob(tx));
+      pb.txes.push_back(std::move(tx));
+    }
+    std::vector<const cryptonote::transaction*> block_txes(1, &pb.block.miner_tx);
+    for (const cryptonote::transaction &tx: pb.txes)
+      block_txes.push_back(&tx);
+    for (const cryptonote::transaction *tx: block_txes)
+    {
+      pb.o_indices.indices.push_back({});
+      for (size_t k = 0; k < tx->vout.size(); ++k)
+        pb.o_indices.indices.back().indices.push_back(global_index++);
+    }
+    pb.hash = cryptonote::get_block_hash(pb.block);
+    bce.block = cryptonote::block_to_blob(pb.block);
+    if (height == 0)
+      w.m_blockchain.push_back(pb.hash);
+    blocks.push_back(std::move(bce));
+    parsed_blocks.push_back(std::move(pb));
+  }
+
+  // the per-output scan sees each kind as intended
+  std::set<std::string> expected_subaddresses;
+  for (const std::string &e: expected)
+    expected_subaddresses.insert(e.substr(e.rfind(':') + 1));
+  ASSERT_EQ(expected_subaddresses, std::set<std::string>({"0/0", "0/1", "1/0"}));
+  ASSERT_EQ(expected.size(), 7 * (3 + 3 + 3 * 2));
+
+  uint64_t blocks_added;
+  w.process_parsed_blocks(0, blocks, parsed_blocks, blocks_added);
+  ASSERT_EQ(blocks_added, 7);
+
+  std::set<std::string> found;
+  for (const tools::wallet2::transfer_details &td: w.m_transfers)
+    found.insert(found_output(td.m_txid, td.m_internal_output_index, td.m_subaddr_index));
+  ASSERT_EQ(found, expected);
+}